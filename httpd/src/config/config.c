@@ -6,38 +6,181 @@
 
 #include "config.h"
 
+#include <arpa/inet.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../utils/variables/variables.h"
 
+enum section
+{
+    NO_SECTION = 0,
+    GLOBAL,
+    VHOSTS,
+    LOCATIONS
+};
+
+enum value_type
+{
+    STRING = 0,
+    NAME,
+    BOOLEAN,
+    SIZE,
+    MODE,
+    MIME_TYPES,
+    ERROR_PAGES,
+    ALLOW,
+    DENY
+};
+
+/*
+** @brief A key accepted in a section
+**
+** @param name Name of the key
+** @param type How its value is parsed
+** @param offset Offset of the field it fills in its section's structure
+*/
+struct key
+{
+    const char *name;
+    enum value_type type;
+    size_t offset;
+};
+
+static const struct key global_keys[] = {
+    { "pid_file", STRING, offsetof(struct config, pid_file) },
+    { "log_file", STRING, offsetof(struct config, log_file) },
+    { "log", BOOLEAN, offsetof(struct config, log) },
+    { "ip_connection_rate", SIZE, offsetof(struct config, ip_connection_rate) },
+    { "ip_request_rate", SIZE, offsetof(struct config, ip_request_rate) },
+    { "cache_ttl", SIZE, offsetof(struct config, cache_ttl) },
+    { "workers", SIZE, offsetof(struct config, workers) },
+    { "cpu_affinity", BOOLEAN, offsetof(struct config, cpu_affinity) },
+    { "trace_file", STRING, offsetof(struct config, trace_file) },
+    { "trace_sample", SIZE, offsetof(struct config, trace_sample) },
+    { "offload_threads", SIZE, offsetof(struct config, offload_threads) },
+    { "send_quantum", SIZE, offsetof(struct config, send_quantum) },
+    { "send_small_first", BOOLEAN, offsetof(struct config, send_small_first) },
+    { "max_connections", SIZE, offsetof(struct config, max_connections) },
+    { "max_requests", SIZE, offsetof(struct config, max_requests) },
+    { "max_buffer_memory", SIZE,
+      offsetof(struct config, max_buffer_memory) },
+    { "retry_after", SIZE, offsetof(struct config, retry_after) },
+    { "capture_file", STRING, offsetof(struct config, capture_file) },
+    { "capture_sample", SIZE, offsetof(struct config, capture_sample) },
+    { "replay_speed", SIZE, offsetof(struct config, replay_speed) },
+    { "profile_file", STRING, offsetof(struct config, profile_file) },
+    { "profile_frequency", SIZE, offsetof(struct config, profile_frequency) },
+    { NULL, STRING, 0 }
+};
+
+static const struct key vhost_keys[] = {
+    { "server_name", NAME, offsetof(struct server_config, server_name) },
+    { "port", STRING, offsetof(struct server_config, port) },
+    { "ip", STRING, offsetof(struct server_config, ip) },
+    { "unix_socket", STRING, offsetof(struct server_config, unix_socket) },
+    { "unix_mode", MODE, offsetof(struct server_config, unix_mode) },
+    { "root_dir", STRING, offsetof(struct server_config, root_dir) },
+    { "default_file", STRING, offsetof(struct server_config, default_file) },
+    { "autoindex", BOOLEAN, offsetof(struct server_config, autoindex) },
+    { "mime_types", MIME_TYPES, 0 },
+    { "error_pages", ERROR_PAGES, 0 },
+    { "allow", ALLOW, 0 },
+    { "deny", DENY, 0 },
+    { "upload", BOOLEAN, offsetof(struct server_config, upload) },
+    { "upload_max_size", SIZE,
+      offsetof(struct server_config, upload_max_size) },
+    { "proxy_pass", STRING, offsetof(struct server_config, proxy_pass) },
+    { "bundle", STRING, offsetof(struct server_config, bundle) },
+    { "tls_cert", STRING, offsetof(struct server_config, tls_cert) },
+    { "tls_key", STRING, offsetof(struct server_config, tls_key) },
+    { "listen_backlog", SIZE, offsetof(struct server_config, listen_backlog) },
+    { "tcp_defer_accept", SIZE,
+      offsetof(struct server_config, tcp_defer_accept) },
+    { "tcp_fastopen", SIZE, offsetof(struct server_config, tcp_fastopen) },
+    { "tcp_nodelay", BOOLEAN, offsetof(struct server_config, tcp_nodelay) },
+    { "socket_sndbuf", SIZE, offsetof(struct server_config, socket_sndbuf) },
+    { "socket_rcvbuf", SIZE, offsetof(struct server_config, socket_rcvbuf) },
+    { NULL, STRING, 0 }
+};
+
+static const struct key location_keys[] = {
+    { "path", STRING, offsetof(struct location, path) },
+    { "exact", BOOLEAN, offsetof(struct location, exact) },
+    { "root_dir", STRING, offsetof(struct location, root_dir) },
+    { "alias", STRING, offsetof(struct location, alias) },
+    { "cache_control", STRING, offsetof(struct location, cache_control) },
+    { "disabled", BOOLEAN, offsetof(struct location, disabled) },
+    { NULL, STRING, 0 }
+};
+
+/*
+** @brief State of the parser, walking the mapped file once
+**
+** @param path Path of the file, for the error messages
+** @param cur Next byte to read
+** @param end End of the mapped file
+** @param line_start First byte of the current line
+** @param line Current line, starting at 1
+** @param strings Next free byte of the string block of the config
+** @param section Section being parsed
+** @param vhost_line Line of the [[vhosts]] header of the last vhost
+*/
+struct parser
+{
+    const char *path;
+    const char *cur;
+    const char *end;
+    const char *line_start;
+    size_t line;
+    char *strings;
+    enum section section;
+    size_t *vhost_line;
+
+    struct config *config;
+};
+
 static struct config *config_init(void)
 {
-    struct config *res = malloc(sizeof(struct config));
+    struct config *res = calloc(1, sizeof(struct config));
     if (res)
-    {
-        res->pid_file = NULL;
-        res->log_file = NULL;
         res->log = true;
-        res->servers = NULL;
-        res->nb_servers = 0;
-    }
     return res;
 }
 
 void server_print(struct server_config server)
 {
-    if (server.server_name)
-        printf("server_name: %s\n", server.server_name->data);
+    if (server.server_name.data)
+        printf("server_name: %s\n", server.server_name.data);
     if (server.ip)
         printf("ip: %s\n", server.ip);
     if (server.port)
         printf("port: %s\n", server.port);
+    if (server.unix_socket)
+        printf("unix_socket: %s\n", server.unix_socket);
     if (server.root_dir)
         printf("root_dir: %s\n", server.root_dir);
     if (server.default_file)
         printf("default_file: %s\n", server.default_file);
+    if (server.proxy_pass)
+        printf("proxy_pass: %s\n", server.proxy_pass);
+    if (server.bundle)
+        printf("bundle: %s\n", server.bundle);
+    if (server.tls_cert)
+        printf("tls_cert: %s\ntls_key: %s\n", server.tls_cert, server.tls_key);
+    for (size_t i = 0; i < server.nb_mime_types; i++)
+        printf("mime_type: %s %s\n", server.mime_types[i].extension,
+               server.mime_types[i].type);
+    for (size_t i = 0; i < server.nb_error_pages; i++)
+        printf("error_page: %zu %s\n", server.error_pages[i].status,
+               server.error_pages[i].path);
 }
 
 void config_print(struct config *config)
@@ -63,183 +206,643 @@ void config_print(struct config *config)
     }
 }
 
-static size_t string_parse(char **start, char dest[BUFFERSIZE], char delim)
+/*
+** Print "path:line:column: message" for the byte at pos of the current line
+*/
+static int parser_error(struct parser *p, const char *pos, const char *fmt,
+                        ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "%s:%zu:%zu: ", p->path, p->line,
+            (size_t)(pos - p->line_start) + 1);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    return -1;
+}
+
+static void skip_blanks(struct parser *p)
+{
+    while (p->cur < p->end && (*p->cur == ' ' || *p->cur == '\t'))
+        p->cur++;
+}
+
+/*
+** Expect the end of the line, after an optional comment, and move to the
+** next one
+*/
+static int end_of_line(struct parser *p)
+{
+    skip_blanks(p);
+    if (p->cur < p->end && *p->cur == '#')
+        p->cur = memchr(p->cur, '\n', p->end - p->cur);
+    if (!p->cur)
+        p->cur = p->end;
+    if (p->cur < p->end && *p->cur == '\r')
+        p->cur++;
+    if (p->cur < p->end && *p->cur != '\n')
+        return parser_error(p, p->cur, "unexpected character '%c'", *p->cur);
+    if (p->cur < p->end)
+        p->cur++;
+    p->line++;
+    p->line_start = p->cur;
+    return 0;
+}
+
+/*
+** Copy [start, start + len) at the end of the string block of the config.
+** The block is as large as the file, every copied string being followed by
+** at least one byte of the file, so it cannot overflow.
+*/
+static char *store(struct parser *p, const char *start, size_t len)
+{
+    char *res = p->strings;
+    memcpy(res, start, len);
+    res[len] = '\0';
+    p->strings += len + 1;
+    return res;
+}
+
+/*
+** Read the value of a key, quoted or running to the end of the line
+*/
+static int read_value(struct parser *p, const char **start, size_t *len)
+{
+    skip_blanks(p);
+    if (p->cur < p->end && *p->cur == '"')
+    {
+        const char *quote = p->cur;
+        *start = ++p->cur;
+        while (p->cur < p->end && *p->cur != '"' && *p->cur != '\n')
+            p->cur++;
+        if (p->cur == p->end || *p->cur != '"')
+            return parser_error(p, quote, "unterminated string");
+        *len = p->cur++ - *start;
+        return 0;
+    }
+    *start = p->cur;
+    while (p->cur < p->end && *p->cur != '\n'
+           && !(*p->cur == '#' && p->cur[-1] == ' '))
+        p->cur++;
+    const char *last = p->cur;
+    while (last > *start && isspace((unsigned char)last[-1]))
+        last--;
+    *len = last - *start;
+    if (!*len)
+        return parser_error(p, *start, "missing value");
+    return 0;
+}
+
+/*
+** Parse a number of bytes with an optional K, M or G suffix
+*/
+static int parse_size(struct parser *p, size_t *field, const char *start,
+                      size_t len)
 {
-    while (**start == ' ')
-        *start += 1;
-    char *posdelim = strchr(*start, delim);
+    size_t res = 0;
     size_t i = 0;
-    while (*start != posdelim)
+    for (; i < len && isdigit((unsigned char)start[i]); i++)
     {
-        dest[i] = **start;
-        *start += 1;
-        i++;
+        if (res > (SIZE_MAX - 9) / 10)
+            return parser_error(p, start, "size too large");
+        res = res * 10 + (start[i] - '0');
     }
-    dest[i] = '\0';
-    *start += (delim != '\n') ? 1 : 0;
-    return i;
+    int shift = 0;
+    if (i + 1 == len && (start[i] == 'K' || start[i] == 'k'))
+        shift = 10;
+    else if (i + 1 == len && (start[i] == 'M' || start[i] == 'm'))
+        shift = 20;
+    else if (i + 1 == len && (start[i] == 'G' || start[i] == 'g'))
+        shift = 30;
+    else if (i != len || !i)
+        return parser_error(p, start, "expected a size");
+    if (!i || res > (SIZE_MAX >> shift))
+        return parser_error(p, start, "expected a size");
+    *field = res << shift;
+    return 0;
 }
 
-static bool str_to_bool(char *str)
+/*
+** Parse permission bits written in octal, as chmod takes them
+*/
+static int parse_mode(struct parser *p, size_t *field, const char *start,
+                      size_t len)
 {
-    if (!strcmp(str, "true"))
-        return true;
-    else if (!strcmp(str, "false"))
-        return false;
-    else
-        return true;
+    size_t res = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (start[i] < '0' || start[i] > '7' || res > 0777)
+            return parser_error(p, start, "expected an octal mode");
+        res = res * 8 + (start[i] - '0');
+    }
+    if (!len)
+        return parser_error(p, start, "expected an octal mode");
+    *field = res;
+    return 0;
 }
 
-static char *my_strndup(char *str, size_t n)
+/*
+** Parse "ext:type, ext:type" into the MIME type overrides of the vhost
+*/
+static int parse_mime_types(struct parser *p, struct server_config *serv,
+                            const char *start, size_t len)
 {
-    char *res = malloc(n + 1);
-    for (size_t i = 0; i <= n; i++)
-        res[i] = str[i];
-    return res;
+    const char *end = start + len;
+    while (start < end)
+    {
+        const char *comma = memchr(start, ',', end - start);
+        const char *item_end = comma ? comma : end;
+        const char *colon = memchr(start, ':', item_end - start);
+        while (start < item_end && *start == ' ')
+            start++;
+        if (!colon)
+            return parser_error(p, start, "expected \"extension:type\"");
+        const char *ext_end = colon;
+        while (ext_end > start && ext_end[-1] == ' ')
+            ext_end--;
+        const char *type = colon + 1;
+        while (type < item_end && *type == ' ')
+            type++;
+        const char *type_end = item_end;
+        while (type_end > type && type_end[-1] == ' ')
+            type_end--;
+        if (ext_end == start || type == type_end)
+            return parser_error(p, start, "expected \"extension:type\"");
+
+        struct mime_type *types = realloc(
+            serv->mime_types,
+            (serv->nb_mime_types + 1) * sizeof(struct mime_type));
+        if (!types)
+            return parser_error(p, start, "out of memory");
+        serv->mime_types = types;
+        struct mime_type *mime = &types[serv->nb_mime_types++];
+        mime->extension = store(p, start, ext_end - start);
+        mime->type = store(p, type, type_end - type);
+        for (char *c = mime->extension; *c; c++)
+            *c = tolower((unsigned char)*c);
+        start = item_end + 1;
+    }
+    return 0;
 }
 
-static void parse_global(char *lineptr, struct config *config, int *err)
+/*
+** Parse "status:path, status:path", the page of a status replacing the
+** builtin one
+*/
+static int parse_error_pages(struct parser *p, struct server_config *serv,
+                             const char *start, size_t len)
 {
-    char key[BUFFERSIZE];
-    string_parse(&lineptr, key, ' ');
+    const char *end = start + len;
+    while (start < end)
+    {
+        const char *comma = memchr(start, ',', end - start);
+        const char *item_end = comma ? comma : end;
+        while (start < item_end && *start == ' ')
+            start++;
+        size_t status = 0;
+        const char *digit = start;
+        for (; digit < item_end && isdigit((unsigned char)*digit); digit++)
+            status = status * 10 + (*digit - '0');
+        const char *colon = digit;
+        while (colon < item_end && *colon == ' ')
+            colon++;
+        if (digit - start != 3 || colon == item_end || *colon != ':')
+            return parser_error(p, start, "expected \"status:path\"");
+        if (status < 400 || status > 599)
+            return parser_error(p, start, "expected an error status");
+        const char *path = colon + 1;
+        while (path < item_end && *path == ' ')
+            path++;
+        const char *path_end = item_end;
+        while (path_end > path && path_end[-1] == ' ')
+            path_end--;
+        if (path == path_end)
+            return parser_error(p, start, "expected \"status:path\"");
 
-    lineptr = strchr(lineptr, ' ');
+        struct error_page *pages = realloc(
+            serv->error_pages,
+            (serv->nb_error_pages + 1) * sizeof(struct error_page));
+        if (!pages)
+            return parser_error(p, start, "out of memory");
+        serv->error_pages = pages;
+        struct error_page *page = &pages[serv->nb_error_pages++];
+        page->status = status;
+        page->path = store(p, path, path_end - path);
+        start = item_end + 1;
+    }
+    return 0;
+}
 
-    char value[BUFFERSIZE];
-    size_t len = string_parse(&lineptr, value, '\n');
-    if (!strcmp(key, "pid_file"))
-        config->pid_file = my_strndup(value, len);
-    else if (!strcmp(key, "log_file"))
-        config->log_file = my_strndup(value, len);
-    else if (!strcmp(key, "log"))
-        config->log = str_to_bool(value);
-    else
-        *err = 1;
+/*
+** Parse "address/prefix" or "address", an IPv4 block being mapped into
+** ::ffff:0:0/96 and "all" standing for every address
+*/
+static int parse_block(struct access_rule *rule, const char *start,
+                       size_t len)
+{
+    char text[INET6_ADDRSTRLEN + 4];
+    if (len >= sizeof(text))
+        return -1;
+    memcpy(text, start, len);
+    text[len] = '\0';
+    memset(rule->addr, 0, sizeof(rule->addr));
+    if (!strcmp(text, "all"))
+    {
+        rule->prefix = 0;
+        return 0;
+    }
+    char *slash = strchr(text, '/');
+    if (slash)
+        *slash = '\0';
+    size_t max = 128;
+    if (inet_pton(AF_INET, text, rule->addr + 12) == 1)
+    {
+        rule->addr[10] = 0xff;
+        rule->addr[11] = 0xff;
+        max = 32;
+    }
+    else if (inet_pton(AF_INET6, text, rule->addr) != 1)
+        return -1;
+    size_t prefix = max;
+    if (slash)
+    {
+        char *end;
+        prefix = strtoul(slash + 1, &end, 10);
+        if (!isdigit((unsigned char)slash[1]) || *end || prefix > max)
+            return -1;
+    }
+    rule->prefix = prefix + 128 - max;
+    // The bits past the prefix are cleared, "10.1.2.3/8" being 10.0.0.0/8
+    for (size_t bit = rule->prefix; bit < 128; bit++)
+        rule->addr[bit / 8] &= ~(0x80 >> bit % 8);
+    return 0;
 }
 
-static void init_serv(struct server_config *serv)
+/*
+** Parse "block, block" into rules of the vhost, the key being repeatable
+*/
+static int parse_access(struct parser *p, struct server_config *serv,
+                        const char *start, size_t len, bool allow)
 {
-    serv->server_name = NULL;
-    serv->port = NULL;
-    serv->ip = NULL;
-    serv->default_file = NULL;
-    serv->root_dir = NULL;
+    const char *end = start + len;
+    while (start < end)
+    {
+        const char *comma = memchr(start, ',', end - start);
+        const char *item_end = comma ? comma : end;
+        while (start < item_end && *start == ' ')
+            start++;
+        const char *block_end = item_end;
+        while (block_end > start && block_end[-1] == ' ')
+            block_end--;
+
+        size_t nb = serv->nb_access_rules;
+        // Grown to the next power of two, the lists being long
+        if (!(nb & (nb - 1)))
+        {
+            struct access_rule *rules =
+                realloc(serv->access_rules,
+                        (nb ? 2 * nb : 1) * sizeof(struct access_rule));
+            if (!rules)
+                return parser_error(p, start, "out of memory");
+            serv->access_rules = rules;
+        }
+        struct access_rule *rule = &serv->access_rules[nb];
+        if (parse_block(rule, start, block_end - start) < 0)
+            return parser_error(p, start, "expected an address block");
+        rule->allow = allow;
+        serv->nb_access_rules++;
+        start = item_end + 1;
+    }
+    return 0;
 }
 
-static void parse_vhosts(char *lineptr, struct server_config *serv, int *err)
+static int set_value(struct parser *p, const struct key *key, void *base,
+                     const char *start, size_t len)
 {
-    char key[BUFFERSIZE];
-    string_parse(&lineptr, key, ' ');
+    void *field = (char *)base + key->offset;
+    switch (key->type)
+    {
+    case STRING:
+        if (*(char **)field)
+            return parser_error(p, start, "duplicate key \"%s\"", key->name);
+        *(char **)field = store(p, start, len);
+        return 0;
+    case NAME:
+        if (((struct string *)field)->data)
+            return parser_error(p, start, "duplicate key \"%s\"", key->name);
+        ((struct string *)field)->size = len;
+        ((struct string *)field)->data = store(p, start, len);
+        return 0;
+    case BOOLEAN:
+        if (len == 4 && !memcmp(start, "true", 4))
+            *(bool *)field = true;
+        else if (len == 5 && !memcmp(start, "false", 5))
+            *(bool *)field = false;
+        else
+            return parser_error(p, start, "expected true or false");
+        return 0;
+    case SIZE:
+        return parse_size(p, field, start, len);
+    case MODE:
+        return parse_mode(p, field, start, len);
+    case MIME_TYPES:
+        return parse_mime_types(p, base, start, len);
+    case ERROR_PAGES:
+        return parse_error_pages(p, base, start, len);
+    case ALLOW:
+    case DENY:
+        return parse_access(p, base, start, len, key->type == ALLOW);
+    }
+    return -1;
+}
 
-    lineptr = strchr(lineptr, ' ');
+/*
+** Parse a "key = value" line of the current section
+*/
+static int parse_key_value(struct parser *p)
+{
+    const struct key *keys = global_keys;
+    void *base = p->config;
+    if (p->section == VHOSTS)
+    {
+        keys = vhost_keys;
+        base = &p->config->servers[p->config->nb_servers - 1];
+    }
+    else if (p->section == LOCATIONS)
+    {
+        struct server_config *vhost =
+            &p->config->servers[p->config->nb_servers - 1];
+        keys = location_keys;
+        base = &vhost->locations[vhost->nb_locations - 1];
+    }
+    else if (p->section == NO_SECTION)
+        return parser_error(p, p->cur, "key outside of any section");
+
+    const char *name = p->cur;
+    while (p->cur < p->end && (isalnum((unsigned char)*p->cur)
+                               || *p->cur == '_' || *p->cur == '.'))
+        p->cur++;
+    size_t nlen = p->cur - name;
+    skip_blanks(p);
+    if (!nlen || p->cur == p->end || *p->cur != '=')
+        return parser_error(p, p->cur, "expected \"key = value\"");
+    p->cur++;
 
-    char value[BUFFERSIZE];
-    size_t len = string_parse(&lineptr, value, '\n');
-    if (!strcmp(key, "server_name"))
+    while (keys->name
+           && (strlen(keys->name) != nlen || memcmp(keys->name, name, nlen)))
+        keys++;
+    if (!keys->name)
+        return parser_error(p, name, "unknown key \"%.*s\"", (int)nlen, name);
+
+    const char *value;
+    size_t len;
+    if (read_value(p, &value, &len) < 0
+        || set_value(p, keys, base, value, len) < 0)
+        return -1;
+    return end_of_line(p);
+}
+
+static int add_vhost(struct parser *p, size_t *capacity)
+{
+    struct config *config = p->config;
+    if (config->nb_servers == *capacity)
     {
-        struct string *str = string_create(value, len);
-        serv->server_name = str;
+        *capacity = *capacity ? 2 * *capacity : 16;
+        struct server_config *servers =
+            realloc(config->servers, *capacity * sizeof(struct server_config));
+        size_t *lines = realloc(p->vhost_line, *capacity * sizeof(size_t));
+        if (servers)
+            config->servers = servers;
+        if (lines)
+            p->vhost_line = lines;
+        if (!servers || !lines)
+            return parser_error(p, p->cur, "out of memory");
     }
-    else if (!strcmp(key, "port"))
-        serv->port = my_strndup(value, len);
-    else if (!strcmp(key, "ip"))
-        serv->ip = my_strndup(value, len);
-    else if (!strcmp(key, "root_dir"))
-        serv->root_dir = my_strndup(value, len);
-    else if (!strcmp(key, "default_file"))
-        serv->default_file = my_strndup(value, len);
-    else
-        *err = 1;
+    memset(&config->servers[config->nb_servers], 0,
+           sizeof(struct server_config));
+    p->vhost_line[config->nb_servers++] = p->line;
+    return 0;
 }
 
-static void are_servers_valid(struct config *config, int *err)
+/*
+** Add a location to the last vhost
+*/
+static int add_location(struct parser *p)
 {
-    for (size_t i = 0; i < config->nb_servers; i++)
+    if (!p->config->nb_servers)
+        return parser_error(p, p->cur, "location outside of any vhost");
+    struct server_config *vhost =
+        &p->config->servers[p->config->nb_servers - 1];
+    size_t nb = vhost->nb_locations;
+    if (!(nb & (nb - 1)))
+    {
+        struct location *locations = realloc(
+            vhost->locations, (nb ? 2 * nb : 1) * sizeof(struct location));
+        if (!locations)
+            return parser_error(p, p->cur, "out of memory");
+        vhost->locations = locations;
+    }
+    memset(&vhost->locations[nb], 0, sizeof(struct location));
+    vhost->nb_locations++;
+    return 0;
+}
+
+/*
+** Parse a "[global]", "[[vhosts]]" or "[[vhosts.locations]]" header
+*/
+static int parse_section(struct parser *p, size_t *capacity)
+{
+    const char *start = p->cur;
+    const char *end = p->cur;
+    while (end < p->end && *end != ']')
+        end++;
+    while (end < p->end && *end == ']')
+        end++;
+    size_t len = end - start;
+    p->cur = end;
+
+    if (len == 8 && !memcmp(start, "[global]", 8))
+        p->section = GLOBAL;
+    else if (len == 10 && !memcmp(start, "[[vhosts]]", 10))
+    {
+        p->section = VHOSTS;
+        if (add_vhost(p, capacity) < 0)
+            return -1;
+    }
+    else if (len == 20 && !memcmp(start, "[[vhosts.locations]]", 20))
     {
-        struct server_config server = config->servers[i];
-        if (!server.server_name || !server.ip || !server.port
-            || !server.root_dir)
-            *err = 1;
+        p->section = LOCATIONS;
+        if (add_location(p) < 0)
+            return -1;
     }
+    else
+        return parser_error(p, start, "unknown section \"%.*s\"", (int)len,
+                            start);
+    return end_of_line(p);
 }
 
-static void is_config_valid(struct config *config, int *err)
+static int parse_lines(struct parser *p)
 {
-    are_servers_valid(config, err);
-    if (!config->pid_file || !config->servers)
-        *err = 1;
+    size_t capacity = 0;
+    while (p->cur < p->end)
+    {
+        skip_blanks(p);
+        int err = 0;
+        if (p->cur < p->end && *p->cur == '[')
+            err = parse_section(p, &capacity);
+        else if (p->cur < p->end && *p->cur != '#' && *p->cur != '\n'
+                 && *p->cur != '\r')
+            err = parse_key_value(p);
+        else
+            err = end_of_line(p);
+        if (err < 0)
+            return -1;
+    }
+    return 0;
 }
 
-struct config *parse_configuration(const char *path)
+static int is_config_valid(struct parser *p)
 {
-    struct config *res = config_init();
-    FILE *f = fopen(path, "r");
-    if (!res || !f)
-        return NULL;
-    char *lineptr = NULL;
-    size_t n = 0;
-    ssize_t line;
-    int *err = malloc(sizeof(int));
-    *err = 0;
-    while ((line = getline(&lineptr, &n, f)) != -1)
-    {
-        if (!strcmp(lineptr, "[global]\n"))
+    struct config *config = p->config;
+    const char *missing = NULL;
+    for (size_t i = 0; i < config->nb_servers && !missing; i++)
+    {
+        struct server_config *server = &config->servers[i];
+        if (!server->server_name.data)
+            missing = "server_name";
+        else if (!server->unix_socket && !server->ip)
+            missing = "ip";
+        else if (!server->unix_socket && !server->port)
+            missing = "port";
+        else if (!server->root_dir && !server->proxy_pass && !server->bundle)
+            missing = "root_dir";
+        else if (!server->tls_cert != !server->tls_key)
+            missing = server->tls_cert ? "tls_key" : "tls_cert";
+        if (missing)
+            p->line = p->vhost_line[i];
+    }
+    if (missing)
+    {
+        fprintf(stderr, "%s:%zu: vhost without %s\n", p->path, p->line,
+                missing);
+        return -1;
+    }
+    for (size_t i = 0; i < config->nb_servers; i++)
+    {
+        struct server_config *server = &config->servers[i];
+        if (server->unix_socket && (server->ip || server->port))
         {
-            line = getline(&lineptr, &n, f);
-            while (line > 1)
-            {
-                parse_global(lineptr, res, err);
-                line = getline(&lineptr, &n, f);
-            }
+            fprintf(stderr, "%s:%zu: vhost with unix_socket and ip or port\n",
+                    p->path, p->vhost_line[i]);
+            return -1;
         }
-        else if (!strcmp(lineptr, "[[vhosts]]\n"))
+        for (size_t j = 0; j < server->nb_locations; j++)
         {
-            line = getline(&lineptr, &n, f);
-            res->nb_servers += 1;
-            res->servers = realloc(
-                res->servers, res->nb_servers * sizeof(struct server_config));
-            init_serv(&(res->servers[res->nb_servers - 1]));
-            while (line > 1)
+            const struct location *location = &server->locations[j];
+            const char *error = NULL;
+            if (!location->path || location->path[0] != '/')
+                error = "without an absolute path";
+            else if (location->root_dir && location->alias)
+                error = "with root_dir and alias";
+            if (error)
             {
-                parse_vhosts(lineptr, &(res->servers[res->nb_servers - 1]),
-                             err);
-                line = getline(&lineptr, &n, f);
+                fprintf(stderr, "%s:%zu: location %zu of the vhost %s\n",
+                        p->path, p->vhost_line[i], j + 1, error);
+                return -1;
             }
         }
     }
-    is_config_valid(res, err);
-    if (*err)
+    if (!config->pid_file || !config->nb_servers)
     {
-        config_destroy(res);
-        printf("invalid config file\n");
-        res = NULL;
+        fprintf(stderr, "%s: missing %s\n", p->path,
+                config->pid_file ? "[[vhosts]]" : "pid_file");
+        return -1;
     }
-    fclose(f);
-    free(lineptr);
-    free(err);
-    return res;
+    return 0;
 }
 
-static void server_config_destroy(struct server_config serv)
+/*
+** Map the file and allocate the string block of the config, as large as it
+*/
+static const char *map_file(const char *path, struct config *config,
+                            size_t *size)
 {
-    if (serv.server_name)
-        free(serv.server_name->data);
-    free(serv.server_name);
-    free(serv.port);
-    free(serv.ip);
-    free(serv.root_dir);
-    free(serv.default_file);
+    int fd = open(path, O_RDONLY);
+    struct stat statbuf;
+    if (fd < 0 || fstat(fd, &statbuf) < 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    *size = statbuf.st_size;
+    const char *data = "";
+    if (*size)
+        data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    config->strings = malloc(*size + 1);
+    if (data == MAP_FAILED || !config->strings)
+    {
+        perror(path);
+        if (data != MAP_FAILED && *size)
+            munmap((void *)data, *size);
+        return NULL;
+    }
+    return data;
+}
+
+struct config *parse_configuration(const char *path)
+{
+    struct config *res = config_init();
+    if (!res)
+        return NULL;
+    size_t size = 0;
+    res->path = strdup(path);
+    const char *data = res->path ? map_file(path, res, &size) : NULL;
+    if (!data)
+    {
+        config_destroy(res);
+        return NULL;
+    }
+    if (size)
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+
+    struct parser p = { .path = path,
+                        .cur = data,
+                        .end = data + size,
+                        .line_start = data,
+                        .line = 1,
+                        .strings = res->strings,
+                        .section = NO_SECTION,
+                        .vhost_line = NULL,
+                        .config = res };
+    if (parse_lines(&p) < 0 || is_config_valid(&p) < 0)
+    {
+        config_destroy(res);
+        res = NULL;
+    }
+    free(p.vhost_line);
+    if (size)
+        munmap((void *)data, size);
+    return res;
 }
 
 void config_destroy(struct config *config)
 {
     if (config)
     {
-        free(config->pid_file);
-        free(config->log_file);
         for (size_t i = 0; i < config->nb_servers; i++)
-            server_config_destroy(config->servers[i]);
+        {
+            free(config->servers[i].mime_types);
+            free(config->servers[i].error_pages);
+            free(config->servers[i].access_rules);
+            free(config->servers[i].locations);
+        }
         free(config->servers);
+        free(config->strings);
+        free(config->path);
         free(config);
     }
 }
@@ -13,17 +13,149 @@
 ** @param pid_file Path to the pid file
 ** @param log_file Path to the log file
 ** @param log Enable or disable logging
+** @param ip_connection_rate Connections accepted per second from a client
+**        address, 0 for no limit
+** @param ip_request_rate Requests answered per second to a client address,
+**        0 for no limit
+** @param cache_ttl Seconds the file cache trusts an entry while the
+**        document trees are watched for changes, 0 for the default
+** @param workers Worker processes serving the listeners, 0 to serve them
+**        in the server process
+** @param cpu_affinity Pin each worker to a CPU with its memory on the node
+**        of the CPU, the connections being steered to the worker of the
+**        CPU which received them
+** @param trace_file File the timelines of the sampled requests are
+**        appended to, NULL for none
+** @param trace_sample One request of trace_sample is written to the
+**        trace_file, 0 for the default
+** @param offload_threads Threads resolving the targets missing from the
+**        file cache, 0 for the default
+** @param send_quantum Bytes sent to a connection before the next one gets
+**        its turn, the longer responses being sent a turn at a time, 0 for
+**        the default
+** @param send_small_first Serve the responses closest to their end first
+**        in each turn, rather than in turn
+** @param max_connections Client connections open at once across the
+**        workers, the new clients waiting in the accept queues beyond it,
+**        0 for no limit
+** @param max_requests Requests being answered at once across the
+**        workers, the others being answered with a 503, 0 for no limit
+** @param max_buffer_memory Bytes of the receive buffers, of the parked
+**        requests and of the scheduled responses across the workers, the
+**        requests needing more being answered with a 503, 0 for no limit
+** @param retry_after Seconds in the Retry-After of the 503, 0 for the
+**        default
+** @param capture_file File the bytes read from the sampled connections
+**        are appended to, for --replay to send them again, NULL for none
+** @param capture_sample One connection of capture_sample is captured, 0
+**        for the default
+** @param replay_speed How many times faster than captured --replay sends
+**        the capture_file, 0 for the captured speed
+** @param profile_file File the stacks sampled between two SIGUSR1 are
+**        appended to, as collapsed stacks, NULL to ignore SIGUSR1
+** @param profile_frequency Stacks sampled per second of CPU time, 0 for
+**        the default
 ** @param servers Array of vhosts
 ** @param nb_servers Number of vhosts
+** @param strings Block holding every string of the configuration
+** @param path File the configuration was read from, read again for the
+**        locations on SIGUSR2
 */
 struct config
 {
     char *pid_file;
     char *log_file;
     bool log;
+    size_t ip_connection_rate;
+    size_t ip_request_rate;
+    size_t cache_ttl;
+    size_t workers;
+    bool cpu_affinity;
+    char *trace_file;
+    size_t trace_sample;
+    size_t offload_threads;
+    size_t send_quantum;
+    bool send_small_first;
+    size_t max_connections;
+    size_t max_requests;
+    size_t max_buffer_memory;
+    size_t retry_after;
+    char *capture_file;
+    size_t capture_sample;
+    size_t replay_speed;
+    char *profile_file;
+    size_t profile_frequency;
 
     struct server_config *servers;
     size_t nb_servers;
+
+    char *strings;
+    char *path;
+};
+
+/*
+** @brief MIME type given to the files of an extension, overriding the
+**        builtin one
+**
+** @param extension Lowercase extension, without the dot
+** @param type MIME type sent in the Content-Type header
+*/
+struct mime_type
+{
+    char *extension;
+    char *type;
+};
+
+/*
+** @brief Page sent as the body of an error response instead of the builtin
+**        one
+**
+** @param status Status code of the error, from 400 to 599
+** @param path File holding the page, read at startup and at reload
+*/
+struct error_page
+{
+    size_t status;
+    char *path;
+};
+
+/*
+** @brief Block of client addresses allowed or denied on a vhost
+**
+** @param addr Address of the block, the IPv4 ones being mapped into
+**        ::ffff:0:0/96, its bits past prefix cleared
+** @param prefix Leading bits of addr shared by the block, from 0 to 128
+** @param allow The block is allowed rather than denied
+*/
+struct access_rule
+{
+    unsigned char addr[16];
+    size_t prefix;
+    bool allow;
+};
+
+/*
+** @brief Settings of the targets under a path of a vhost, from a
+**        [[vhosts.locations]] section following the vhost
+**
+** @param path Targets the location applies to, the path and those under
+**        it, compared a whole segment at a time
+** @param exact Apply to the path only
+** @param root_dir Directory the targets are looked for in instead of the
+**        root_dir of the vhost, followed by the whole target
+** @param alias Directory standing for path, followed by the rest of the
+**        target
+** @param cache_control Cache-Control header of the files served
+** @param disabled Answer 404 without looking the target up
+*/
+struct location
+{
+    char *path;
+    bool exact;
+    char *root_dir;
+    char *alias;
+    char *cache_control;
+    bool disabled;
 };
 
 /*
@@ -32,22 +164,91 @@ struct config
 ** @param server_name Server name
 ** @param port Port to listen on
 ** @param ip IP address
+** @param unix_socket Path of the Unix stream socket to listen on instead of
+**        ip and port, "@name" for name in the abstract namespace. A socket
+**        left at the path is replaced.
+** @param unix_mode Permissions given to the socket at unix_socket, in
+**        octal, 0 to keep those the umask leaves
 ** @param root_dir Root directory to serve
 ** @param default_file Default file to serve
+** @param autoindex List the directories without a default_file
+** @param mime_types MIME type overrides, from "ext:type, ext:type"
+** @param nb_mime_types Number of MIME type overrides
+** @param error_pages Error page overrides, from "status:path, status:path"
+** @param nb_error_pages Number of error page overrides
+** @param access_rules Blocks of clients from the allow and deny keys,
+**        "address/prefix, address, all", each key taking any number of
+**        them and being repeatable
+** @param nb_access_rules Number of blocks
+** @param locations Settings of the paths, the exact location of a target
+**        then the one of its longest path applying
+** @param nb_locations Number of locations
+** @param upload Accept PUT and POST bodies, stored at their target
+** @param upload_max_size Largest body accepted, 0 for no limit
+** @param proxy_pass Upstream the requests are forwarded to instead of being
+**        served from root_dir, "host:port" or "unix:/path"
+** @param bundle Archive the vhost is served from instead of root_dir, root_dir
+**        being what the packer puts in it
+** @param tls_cert PEM certificate chain, the vhost being served over TLS
+** @param tls_key PEM private key of the certificate
+** @param listen_backlog Length of the accept queue, SOMAXCONN if 0
+** @param tcp_defer_accept Seconds a connection may wait for its first bytes
+**        before being accepted, 0 to accept it on the handshake
+** @param tcp_fastopen Length of the queue of TCP Fast Open connections, 0 to
+**        disable it
+** @param tcp_nodelay Disable Nagle's algorithm on the client sockets
+** @param socket_sndbuf Send buffer of the client sockets, 0 for the default
+** @param socket_rcvbuf Receive buffer of the client sockets, 0 for the
+**        default
+**
+** The socket options of a listener are those of the first vhost of its ip
+** and port.
 */
 struct server_config
 {
-    struct string *server_name;
+    struct string server_name;
     char *port;
     char *ip;
+    char *unix_socket;
+    size_t unix_mode;
     char *root_dir;
     char *default_file;
+    bool autoindex;
+
+    struct mime_type *mime_types;
+    size_t nb_mime_types;
+
+    struct error_page *error_pages;
+    size_t nb_error_pages;
+
+    struct access_rule *access_rules;
+    size_t nb_access_rules;
+
+    struct location *locations;
+    size_t nb_locations;
+
+    bool upload;
+    size_t upload_max_size;
+
+    char *proxy_pass;
+    char *bundle;
+
+    char *tls_cert;
+    char *tls_key;
+
+    size_t listen_backlog;
+    size_t tcp_defer_accept;
+    size_t tcp_fastopen;
+    bool tcp_nodelay;
+    size_t socket_sndbuf;
+    size_t socket_rcvbuf;
 };
 
 /*
 ** @brief Parse the configuration file and return a config struct
 **        The config struct must be freed with config_destroy
-**        If an error occurs, the function returns NULL
+**        If an error occurs, it is reported on stderr with its line and
+**        column and the function returns NULL
 **
 ** @param path The path to the configuration file
 **
@@ -1,8 +1,212 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <criterion/criterion.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../config.h"
 
 TestSuite(config);
 
+static char path[] = "/tmp/config_testXXXXXX";
+
+static struct config *parse_string(const char *content)
+{
+    strcpy(path, "/tmp/config_testXXXXXX");
+    int fd = mkstemp(path);
+    cr_assert(fd >= 0);
+    cr_assert(write(fd, content, strlen(content)) == (ssize_t)strlen(content));
+    close(fd);
+    struct config *config = parse_configuration(path);
+    unlink(path);
+    return config;
+}
+
 Test(config, dummy)
 {
     cr_assert(1);
 }
+
+Test(config, basic)
+{
+    struct config *config = parse_string("[global]\n"
+                                         "log_file = server.log\n"
+                                         "log = false\n"
+                                         "pid_file = /tmp/httpd.pid\n"
+                                         "\n"
+                                         "[[vhosts]]\n"
+                                         "server_name = myserv\n"
+                                         "port = 8000\n"
+                                         "ip = localhost\n"
+                                         "default_file = index.html\n"
+                                         "root_dir = www/\n");
+    cr_assert_not_null(config);
+    cr_assert_str_eq(config->pid_file, "/tmp/httpd.pid");
+    cr_assert_str_eq(config->log_file, "server.log");
+    cr_assert_not(config->log);
+    cr_assert_eq(config->nb_servers, 1);
+    cr_assert_str_eq(config->servers[0].server_name.data, "myserv");
+    cr_assert_eq(config->servers[0].server_name.size, 6);
+    cr_assert_str_eq(config->servers[0].port, "8000");
+    cr_assert_str_eq(config->servers[0].ip, "localhost");
+    cr_assert_str_eq(config->servers[0].default_file, "index.html");
+    cr_assert_str_eq(config->servers[0].root_dir, "www/");
+    config_destroy(config);
+}
+
+Test(config, comments_quotes_and_no_final_newline)
+{
+    struct config *config = parse_string("# httpd\n"
+                                         "[global] # main section\n"
+                                         "pid_file = \"/tmp/a b.pid\"  \r\n"
+                                         "[[vhosts]]\n"
+                                         "server_name=a\n"
+                                         "port = 1 # comment\n"
+                                         "ip = 127.0.0.1\n"
+                                         "root_dir = /srv/www");
+    cr_assert_not_null(config);
+    cr_assert_str_eq(config->pid_file, "/tmp/a b.pid");
+    cr_assert_str_eq(config->servers[0].port, "1");
+    cr_assert_str_eq(config->servers[0].root_dir, "/srv/www");
+    config_destroy(config);
+}
+
+Test(config, mime_types)
+{
+    struct config *config =
+        parse_string("[global]\npid_file = p\n[[vhosts]]\n"
+                     "server_name = a\nport = 1\nip = i\nroot_dir = r\n"
+                     "mime_types = MD:text/markdown, "
+                     "wasm : application/wasm\n");
+    cr_assert_not_null(config);
+    cr_assert_eq(config->servers[0].nb_mime_types, 2);
+    cr_assert_str_eq(config->servers[0].mime_types[0].extension, "md");
+    cr_assert_str_eq(config->servers[0].mime_types[0].type, "text/markdown");
+    cr_assert_str_eq(config->servers[0].mime_types[1].extension, "wasm");
+    cr_assert_str_eq(config->servers[0].mime_types[1].type,
+                     "application/wasm");
+    config_destroy(config);
+}
+
+Test(config, error_pages)
+{
+    struct config *config =
+        parse_string("[global]\npid_file = p\n[[vhosts]]\n"
+                     "server_name = a\nport = 1\nip = i\nroot_dir = r\n"
+                     "error_pages = 404:/srv/404.html, 503 : maintenance\n");
+    cr_assert_not_null(config);
+    cr_assert_eq(config->servers[0].nb_error_pages, 2);
+    cr_assert_eq(config->servers[0].error_pages[0].status, 404);
+    cr_assert_str_eq(config->servers[0].error_pages[0].path, "/srv/404.html");
+    cr_assert_eq(config->servers[0].error_pages[1].status, 503);
+    cr_assert_str_eq(config->servers[0].error_pages[1].path, "maintenance");
+    config_destroy(config);
+    cr_assert_null(parse_string("[global]\npid_file = p\n[[vhosts]]\n"
+                                "server_name = a\nport = 1\nip = i\n"
+                                "root_dir = r\nerror_pages = 200:ok\n"));
+}
+
+Test(config, socket_options)
+{
+    struct config *config =
+        parse_string("[global]\npid_file = p\n[[vhosts]]\n"
+                     "server_name = a\nport = 1\nip = i\nroot_dir = r\n"
+                     "listen_backlog = 4096\ntcp_defer_accept = 5\n"
+                     "tcp_fastopen = 256\ntcp_nodelay = true\n"
+                     "socket_sndbuf = 1M\nsocket_rcvbuf = 256K\n");
+    cr_assert_not_null(config);
+    cr_assert_eq(config->servers[0].listen_backlog, 4096);
+    cr_assert_eq(config->servers[0].tcp_defer_accept, 5);
+    cr_assert_eq(config->servers[0].tcp_fastopen, 256);
+    cr_assert(config->servers[0].tcp_nodelay);
+    cr_assert_eq(config->servers[0].socket_sndbuf, 1 << 20);
+    cr_assert_eq(config->servers[0].socket_rcvbuf, 256 << 10);
+    config_destroy(config);
+}
+
+Test(config, unix_socket)
+{
+    struct config *config =
+        parse_string("[global]\npid_file = p\n[[vhosts]]\n"
+                     "server_name = a\nunix_socket = /run/httpd.sock\n"
+                     "unix_mode = 0660\nroot_dir = r\n");
+    cr_assert_not_null(config);
+    cr_assert_str_eq(config->servers[0].unix_socket, "/run/httpd.sock");
+    cr_assert_eq(config->servers[0].unix_mode, 0660);
+    cr_assert_null(config->servers[0].port);
+    config_destroy(config);
+    cr_assert_null(parse_string("[global]\npid_file = p\n[[vhosts]]\n"
+                                "server_name = a\nunix_socket = @h\n"
+                                "port = 1\nroot_dir = r\n"));
+    cr_assert_null(parse_string("[global]\npid_file = p\n[[vhosts]]\n"
+                                "server_name = a\nunix_socket = @h\n"
+                                "unix_mode = 0689\nroot_dir = r\n"));
+}
+
+Test(config, locations)
+{
+    struct config *config =
+        parse_string("[global]\npid_file = p\n[[vhosts]]\n"
+                     "server_name = a\nport = 1\nip = i\nroot_dir = r\n"
+                     "[[vhosts.locations]]\npath = /static\n"
+                     "alias = /srv/static\ncache_control = max-age=60\n"
+                     "[[vhosts.locations]]\npath = /private\nexact = true\n"
+                     "disabled = true\n");
+    cr_assert_not_null(config);
+    cr_assert_eq(config->servers[0].nb_locations, 2);
+    const struct location *location = &config->servers[0].locations[0];
+    cr_assert_str_eq(location->path, "/static");
+    cr_assert_str_eq(location->alias, "/srv/static");
+    cr_assert_str_eq(location->cache_control, "max-age=60");
+    cr_assert_not(location->exact);
+    cr_assert(config->servers[0].locations[1].exact);
+    cr_assert(config->servers[0].locations[1].disabled);
+    config_destroy(config);
+    cr_assert_null(parse_string("[global]\npid_file = p\n"
+                                "[[vhosts.locations]]\npath = /\n"));
+    cr_assert_null(parse_string("[global]\npid_file = p\n[[vhosts]]\n"
+                                "server_name = a\nport = 1\nip = i\n"
+                                "root_dir = r\n[[vhosts.locations]]\n"
+                                "path = static\n"));
+    cr_assert_null(parse_string("[global]\npid_file = p\n[[vhosts]]\n"
+                                "server_name = a\nport = 1\nip = i\n"
+                                "root_dir = r\n[[vhosts.locations]]\n"
+                                "path = /\nalias = x\nroot_dir = y\n"));
+}
+
+Test(config, invalid)
+{
+    cr_assert_null(parse_string("[global]\npid_file = p\nfoo = bar\n"));
+    cr_assert_null(parse_string("pid_file = p\n"));
+    cr_assert_null(parse_string("[global]\npid_file = p\nlog = maybe\n"));
+    cr_assert_null(parse_string("[global]\npid_file = \"p\n"));
+    cr_assert_null(parse_string("[globals]\npid_file = p\n"));
+    cr_assert_null(parse_string("[global]\npid_file = p\n"));
+    cr_assert_null(parse_string("[global]\npid_file = p\n[[vhosts]]\n"
+                                "server_name = a\nport = 1\nip = i\n"));
+    cr_assert_null(parse_string("[global]\npid_file = p\npid_file = q\n"));
+    cr_assert_null(parse_string(""));
+    cr_assert_null(parse_configuration("/nonexistent/httpd.cfg"));
+}
+
+Test(config, many_vhosts)
+{
+    size_t nb = 5000;
+    char *content = malloc(nb * 100 + 64);
+    size_t len = sprintf(content, "[global]\npid_file = p\n");
+    for (size_t i = 0; i < nb; i++)
+        len += sprintf(content + len,
+                       "[[vhosts]]\nserver_name = s%zu\nport = %zu\n"
+                       "ip = 127.0.0.1\nroot_dir = /srv/%zu\n\n",
+                       i, 10000 + i, i);
+    struct config *config = parse_string(content);
+    free(content);
+    cr_assert_not_null(config);
+    cr_assert_eq(config->nb_servers, nb);
+    cr_assert_str_eq(config->servers[nb - 1].server_name.data, "s4999");
+    cr_assert_str_eq(config->servers[nb - 1].port, "14999");
+    cr_assert_str_eq(config->servers[nb - 1].root_dir, "/srv/4999");
+    config_destroy(config);
+}
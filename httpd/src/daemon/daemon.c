@@ -6,6 +6,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "../utils/variables/variables.h"
+
 /*
  * The signal handler function.
  *
@@ -16,10 +18,10 @@ void handler(int signum)
     switch (signum)
     {
         case SIGUSR1:
-        // do something to make the server understand to SIGINT
+        ask_profile();
         break;
         case SIGUSR2:
-        // RELOAD
+        ask_reload();
         break;
     }
 }
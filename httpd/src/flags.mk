@@ -6,3 +6,5 @@ CFLAGS = -Wall -Wextra -Werror -Wvla -std=c99 -pedantic -g
 
 AR = ar
 ARFLAGS = rcvs
+LDFLAGS = -rdynamic
+LDLIBS = -lssl -lcrypto -lz -lbrotlienc -pthread -ldl
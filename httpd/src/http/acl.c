@@ -0,0 +1,222 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "acl.h"
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NONE 0
+
+enum verdict
+{
+    UNSET = 0,
+    ALLOWED,
+    DENIED
+};
+
+/*
+ * @brief: a node of a trie, standing for the block of its first len bits
+ *
+ * @param key: the address of the block, its bits past len cleared
+ * @param verdict: UNSET for a node only joining its children
+ * @param children: the nodes below, by the bit after len, NONE for none,
+ * the root being the only node at index 0
+ */
+struct node
+{
+    unsigned char key[16];
+    uint8_t len;
+    uint8_t verdict;
+    uint32_t children[2];
+};
+
+/*
+ * @param fallback: the verdict of the clients in no block
+ */
+struct trie
+{
+    struct node *nodes;
+    size_t nb_nodes;
+    enum verdict fallback;
+};
+
+/*
+ * The trie of every vhost, in the order of config->servers
+ */
+static const struct config *loaded = NULL;
+static struct trie *tries = NULL;
+
+static int bit(const unsigned char *key, size_t index)
+{
+    return key[index / 8] >> (7 - index % 8) & 1;
+}
+
+/*
+ * @return whether a and b share their bits from the one at from to the one
+ * before to
+ */
+static bool same_bits(const unsigned char *a, const unsigned char *b,
+                      size_t from, size_t to)
+{
+    for (size_t i = from / 8; i * 8 < to; i++)
+    {
+        unsigned mask = 0xff;
+        if (i == from / 8)
+            mask &= 0xff >> from % 8;
+        if ((i + 1) * 8 > to)
+            mask &= 0xff << ((i + 1) * 8 - to);
+        if ((a[i] ^ b[i]) & mask)
+            return false;
+    }
+    return true;
+}
+
+static size_t common_bits(const unsigned char *a, const unsigned char *b,
+                          size_t max)
+{
+    size_t len = 0;
+    while (len < max && bit(a, len) == bit(b, len))
+        len++;
+    return len;
+}
+
+static uint32_t add_node(struct trie *trie, const unsigned char *key,
+                         size_t len, enum verdict verdict)
+{
+    struct node *node = &trie->nodes[trie->nb_nodes];
+    memset(node, 0, sizeof(*node));
+    memcpy(node->key, key, sizeof(node->key));
+    for (size_t i = len; i < 128; i++)
+        node->key[i / 8] &= ~(0x80 >> i % 8);
+    node->len = len;
+    node->verdict = verdict;
+    return trie->nb_nodes++;
+}
+
+static void set_verdict(struct node *node, enum verdict verdict)
+{
+    if (node->verdict != DENIED)
+        node->verdict = verdict;
+}
+
+/*
+ * @brief: insert a block, splitting the edge it leaves the trie on. Each
+ * block adds two nodes at most.
+ */
+static void insert(struct trie *trie, const struct access_rule *rule)
+{
+    enum verdict verdict = rule->allow ? ALLOWED : DENIED;
+    size_t len = rule->prefix;
+    uint32_t index = 0;
+    while (trie->nodes[index].len < len)
+    {
+        int side = bit(rule->addr, trie->nodes[index].len);
+        uint32_t child = trie->nodes[index].children[side];
+        if (child == NONE)
+        {
+            uint32_t leaf = add_node(trie, rule->addr, len, verdict);
+            trie->nodes[index].children[side] = leaf;
+            return;
+        }
+        const struct node *next = &trie->nodes[child];
+        size_t common = common_bits(rule->addr, next->key,
+                                    len < next->len ? len : next->len);
+        if (common == next->len)
+        {
+            index = child;
+            continue;
+        }
+        // The block parts from the child before its end
+        uint32_t split = add_node(trie, rule->addr, common,
+                                  common == len ? verdict : UNSET);
+        trie->nodes[split].children[bit(next->key, common)] = child;
+        if (common < len)
+            trie->nodes[split].children[bit(rule->addr, common)] =
+                add_node(trie, rule->addr, len, verdict);
+        trie->nodes[index].children[side] = split;
+        return;
+    }
+    set_verdict(&trie->nodes[index], verdict);
+}
+
+static int compile(struct trie *trie, const struct server_config *vhost)
+{
+    trie->nodes = calloc(2 * vhost->nb_access_rules + 1, sizeof(struct node));
+    if (!trie->nodes)
+        return -1;
+    trie->nb_nodes = 0;
+    trie->fallback = ALLOWED;
+    static const unsigned char everything[16] = { 0 };
+    add_node(trie, everything, 0, UNSET);
+    for (size_t i = 0; i < vhost->nb_access_rules; i++)
+    {
+        insert(trie, &vhost->access_rules[i]);
+        if (vhost->access_rules[i].allow)
+            trie->fallback = DENIED;
+    }
+    return 0;
+}
+
+void acl_destroy(void)
+{
+    for (size_t i = 0; tries && i < loaded->nb_servers; i++)
+        free(tries[i].nodes);
+    free(tries);
+    tries = NULL;
+    loaded = NULL;
+}
+
+int acl_init(const struct config *config)
+{
+    tries = calloc(config->nb_servers, sizeof(struct trie));
+    if (!tries)
+        return -1;
+    loaded = config;
+    for (size_t i = 0; i < config->nb_servers; i++)
+    {
+        if (compile(&tries[i], &config->servers[i]) < 0)
+        {
+            acl_destroy();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int acl_allowed(const struct server_config *vhost,
+                const struct sockaddr_storage *peer)
+{
+    if (!tries || vhost < loaded->servers
+        || vhost >= loaded->servers + loaded->nb_servers)
+        return 1;
+    if (!vhost->nb_access_rules)
+        return 1;
+    const struct trie *trie = &tries[vhost - loaded->servers];
+    unsigned char key[16] = { [10] = 0xff, [11] = 0xff };
+    if (peer->ss_family == AF_INET)
+        memcpy(key + 12,
+               &((const struct sockaddr_in *)peer)->sin_addr.s_addr, 4);
+    else if (peer->ss_family == AF_INET6)
+        memcpy(key, ((const struct sockaddr_in6 *)peer)->sin6_addr.s6_addr,
+               16);
+    else
+        return 1;
+    enum verdict verdict = trie->fallback;
+    size_t matched = 0;
+    uint32_t index = 0;
+    do
+    {
+        const struct node *node = &trie->nodes[index];
+        // Only the bits of the edge from the parent are left to compare
+        if (!same_bits(key, node->key, matched, node->len))
+            break;
+        matched = node->len;
+        if (node->verdict != UNSET)
+            verdict = node->verdict;
+        index = matched < 128 ? node->children[bit(key, matched)] : NONE;
+    } while (index != NONE);
+    return verdict == ALLOWED;
+}
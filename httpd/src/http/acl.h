@@ -0,0 +1,33 @@
+#ifndef ACL_H
+#define ACL_H
+
+#include <sys/socket.h>
+
+#include "../config/config.h"
+
+/*
+ * @brief: compile the allow and deny blocks of each vhost into a radix
+ * trie of the IPv6 space, the IPv4 blocks being mapped into it, a node
+ * holding every bit its children share
+ *
+ * @return 0 on success, -1 on error
+ */
+int acl_init(const struct config *config);
+
+/*
+ * @brief: look up a client in the trie of a vhost, walking down its address
+ * once, without allocating. The longest block holding it decides, deny
+ * winning between equal ones. A client in no block is allowed unless the
+ * vhost has allow blocks, and one without an IP address always is.
+ *
+ * @return 1 if the client may reach the vhost, 0 otherwise
+ */
+int acl_allowed(const struct server_config *vhost,
+                const struct sockaddr_storage *peer);
+
+/*
+ * @brief: free the tries
+ */
+void acl_destroy(void);
+
+#endif /*!ACL_H*/
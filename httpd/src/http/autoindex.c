@@ -0,0 +1,414 @@
+#define _GNU_SOURCE
+
+#include "autoindex.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../utils/string/string.h"
+
+/*
+ * Bytes of directory entries read by a single getdents64()
+ */
+#define DIRENT_BUFFER 32768
+
+#define LISTING_FOOTER "</pre>\n</body>\n</html>\n"
+
+/*
+ * @brief: the state of the rendering of a listing
+ *
+ * @param fd: the directory being read
+ * @param base: the HTML-escaped prefix of the links, the last component of
+ * the target and a slash when the target does not end with one
+ * @param entry_max: the most bytes an entry can be rendered into
+ * @param pos: the next entry of buffer to render
+ * @param len: the bytes of entries in buffer
+ */
+struct listing_reader
+{
+    int fd;
+    char *base;
+    size_t base_len;
+    size_t entry_max;
+    size_t pos;
+    size_t len;
+    char buffer[DIRENT_BUFFER];
+};
+
+static struct listing *cache[AUTOINDEX_CACHE_SIZE];
+static size_t nb_cached = 0;
+static size_t cached_bytes = 0;
+static unsigned long tick = 0;
+
+static size_t escape_html(char *out, const char *in, size_t len)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        const char *rep = NULL;
+        switch (in[i])
+        {
+        case '&':
+            rep = "&amp;";
+            break;
+        case '<':
+            rep = "&lt;";
+            break;
+        case '>':
+            rep = "&gt;";
+            break;
+        case '"':
+            rep = "&quot;";
+            break;
+        case '\'':
+            rep = "&#39;";
+            break;
+        default:
+            out[n++] = in[i];
+            continue;
+        }
+        size_t rlen = strlen(rep);
+        memcpy(out + n, rep, rlen);
+        n += rlen;
+    }
+    return n;
+}
+
+/*
+ * @brief: percent-encode a file name, leaving the unreserved characters
+ */
+static size_t escape_url(char *out, const char *name)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t n = 0;
+    for (; *name; name++)
+    {
+        unsigned char c = *name;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+            || (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_'
+            || c == '~')
+            out[n++] = c;
+        else
+        {
+            out[n++] = '%';
+            out[n++] = hex[c >> 4];
+            out[n++] = hex[c & 15];
+        }
+    }
+    return n;
+}
+
+static void listing_destroy(struct listing *listing)
+{
+    while (listing->segments)
+    {
+        struct listing_segment *next = listing->segments->next;
+        free(listing->segments);
+        listing->segments = next;
+    }
+    if (listing->reader)
+    {
+        close(listing->reader->fd);
+        free(listing->reader->base);
+        free(listing->reader);
+    }
+    free(listing->key);
+    free(listing->target);
+    free(listing);
+}
+
+/*
+ * @brief: return room for len bytes at the end of the listing, starting a
+ * new segment when the last one has not enough left
+ */
+static char *reserve(struct listing *listing, size_t len)
+{
+    struct listing_segment *last = listing->last;
+    if (last && last->capacity - last->len >= len)
+        return last->data + last->len;
+    size_t capacity = len > AUTOINDEX_SEGMENT ? len : AUTOINDEX_SEGMENT;
+    struct listing_segment *segment =
+        malloc(sizeof(struct listing_segment) + capacity);
+    if (!segment)
+        return NULL;
+    segment->next = NULL;
+    segment->len = 0;
+    segment->capacity = capacity;
+    if (last)
+        last->next = segment;
+    else
+        listing->segments = segment;
+    listing->last = segment;
+    return segment->data;
+}
+
+static void commit(struct listing *listing, size_t len)
+{
+    listing->last->len += len;
+    listing->size += len;
+}
+
+/*
+ * @brief: render the title and the link to the parent directory
+ */
+static int render_header(struct listing *listing, const char *target,
+                         size_t len)
+{
+    char *out = reserve(listing, 12 * len + 256);
+    if (!out)
+        return -1;
+    size_t n = 0;
+    const char *parts[] = { "<!DOCTYPE html>\n<html>\n<head><title>Index of ",
+                            "</title></head>\n<body>\n<h1>Index of ",
+                            "</h1>\n<pre>\n" };
+    for (size_t i = 0; i < 3; i++)
+    {
+        memcpy(out + n, parts[i], strlen(parts[i]));
+        n += strlen(parts[i]);
+        if (i < 2)
+            n += escape_html(out + n, target, len);
+    }
+    if (len > 1)
+    {
+        const char *parent = listing->reader->base_len
+            ? "<a href=\"./\">../</a>\n"
+            : "<a href=\"../\">../</a>\n";
+        memcpy(out + n, parent, strlen(parent));
+        n += strlen(parent);
+    }
+    commit(listing, n);
+    return 0;
+}
+
+static int is_directory(struct listing_reader *reader,
+                        const struct dirent64 *d)
+{
+    if (d->d_type == DT_DIR)
+        return 1;
+    if (d->d_type != DT_UNKNOWN && d->d_type != DT_LNK)
+        return 0;
+    struct stat statbuf;
+    return !fstatat(reader->fd, d->d_name, &statbuf, 0)
+        && S_ISDIR(statbuf.st_mode);
+}
+
+static int render_entry(struct listing *listing,
+                        const struct dirent64 *d)
+{
+    struct listing_reader *reader = listing->reader;
+    if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+        return 0;
+    char *out = reserve(listing, reader->entry_max);
+    if (!out)
+        return -1;
+    const char *slash = is_directory(reader, d) ? "/" : "";
+    size_t n = 9;
+    memcpy(out, "<a href=\"", n);
+    memcpy(out + n, reader->base, reader->base_len);
+    n += reader->base_len;
+    n += escape_url(out + n, d->d_name);
+    n += sprintf(out + n, "%s\">", slash);
+    n += escape_html(out + n, d->d_name, strlen(d->d_name));
+    n += sprintf(out + n, "%s</a>\n", slash);
+    commit(listing, n);
+    return 0;
+}
+
+static bool same_key(const struct listing *listing, const char *path,
+                     const char *target, size_t len)
+{
+    return !strcmp(listing->key, path) && strlen(listing->target) == len
+        && !memcmp(listing->target, target, len);
+}
+
+static void cache_remove(size_t i)
+{
+    cached_bytes -= cache[i]->size;
+    autoindex_release(cache[i]);
+    cache[i] = cache[--nb_cached];
+}
+
+static void cache_insert(struct listing *listing)
+{
+    if (listing->size > AUTOINDEX_CACHE_MAX)
+        return;
+    for (size_t i = 0; i < nb_cached; i++)
+    {
+        if (same_key(cache[i], listing->key, listing->target,
+                     strlen(listing->target)))
+        {
+            cache_remove(i);
+            break;
+        }
+    }
+    while (nb_cached == AUTOINDEX_CACHE_SIZE
+           || cached_bytes + listing->size > AUTOINDEX_CACHE_MAX)
+    {
+        size_t oldest = 0;
+        for (size_t i = 1; i < nb_cached; i++)
+        {
+            if (cache[i]->used < cache[oldest]->used)
+                oldest = i;
+        }
+        cache_remove(oldest);
+    }
+    listing->refs++;
+    cached_bytes += listing->size;
+    cache[nb_cached++] = listing;
+}
+
+/*
+ * @brief: close the listing once the directory is read, and cache it
+ */
+static int finish(struct listing *listing)
+{
+    char *out = reserve(listing, sizeof(LISTING_FOOTER) - 1);
+    if (!out)
+        return -1;
+    memcpy(out, LISTING_FOOTER, sizeof(LISTING_FOOTER) - 1);
+    commit(listing, sizeof(LISTING_FOOTER) - 1);
+    close(listing->reader->fd);
+    free(listing->reader->base);
+    free(listing->reader);
+    listing->reader = NULL;
+    listing->complete = true;
+    cache_insert(listing);
+    return 1;
+}
+
+/*
+ * @brief: set up the rendering of a directory, fd being kept open to read
+ * it from
+ */
+static struct listing *listing_create(const char *path, int fd,
+                                      const struct stat *statbuf,
+                                      const char *target, size_t len)
+{
+    struct listing *listing = calloc(1, sizeof(struct listing));
+    if (!listing)
+        return NULL;
+    listing->reader = malloc(sizeof(struct listing_reader));
+    listing->key = my_strdup(path);
+    listing->target = strndup(target, len);
+    if (!listing->reader || !listing->key || !listing->target)
+    {
+        free(listing->reader);
+        listing->reader = NULL;
+        close(fd);
+        listing_destroy(listing);
+        return NULL;
+    }
+    struct listing_reader *reader = listing->reader;
+    reader->fd = fd;
+    reader->pos = 0;
+    reader->len = 0;
+
+    const char *component = target + len;
+    while (len && target[len - 1] != '/' && component > target
+           && component[-1] != '/')
+        component--;
+    size_t clen = target + len - component;
+    reader->base = malloc(6 * clen + 2);
+    reader->base_len = 0;
+    if (reader->base && clen)
+    {
+        reader->base_len = escape_html(reader->base, component, clen);
+        reader->base[reader->base_len++] = '/';
+    }
+    reader->entry_max = reader->base_len + 9 * NAME_MAX + 32;
+
+    listing->dev = statbuf->st_dev;
+    listing->ino = statbuf->st_ino;
+    listing->mtime = statbuf->st_mtim;
+    listing->refs = 1;
+    listing->used = ++tick;
+    if (!reader->base || render_header(listing, target, len) < 0)
+    {
+        listing_destroy(listing);
+        return NULL;
+    }
+    return listing;
+}
+
+struct listing *autoindex_lookup(const char *path, const char *target,
+                                 size_t len)
+{
+    const char *query = memchr(target, '?', len);
+    if (query)
+        len = query - target;
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    for (size_t i = 0; i < nb_cached; i++)
+    {
+        struct listing *cached = cache[i];
+        if (same_key(cached, path, target, len)
+            && cached->dev == statbuf.st_dev
+            && cached->ino == statbuf.st_ino
+            && cached->mtime.tv_sec == statbuf.st_mtim.tv_sec
+            && cached->mtime.tv_nsec == statbuf.st_mtim.tv_nsec)
+        {
+            close(fd);
+            cached->refs++;
+            cached->used = ++tick;
+            return cached;
+        }
+    }
+    struct listing *listing = listing_create(path, fd, &statbuf, target, len);
+    if (!listing)
+        errno = ENOMEM;
+    return listing;
+}
+
+int autoindex_render(struct listing *listing)
+{
+    struct listing_reader *reader = listing->reader;
+    if (!reader)
+        return 1;
+    struct listing_segment *filling = listing->last;
+    while (listing->last == filling)
+    {
+        if (reader->pos == reader->len)
+        {
+            ssize_t n =
+                getdents64(reader->fd, reader->buffer, sizeof(reader->buffer));
+            if (n < 0)
+                return -1;
+            if (!n)
+                return finish(listing);
+            reader->pos = 0;
+            reader->len = n;
+        }
+        const struct dirent64 *d =
+            (const void *)(reader->buffer + reader->pos);
+        reader->pos += d->d_reclen;
+        if (render_entry(listing, d) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+void autoindex_release(struct listing *listing)
+{
+    if (listing && !--listing->refs)
+        listing_destroy(listing);
+}
+
+void autoindex_flush(void)
+{
+    while (nb_cached)
+        cache_remove(nb_cached - 1);
+}
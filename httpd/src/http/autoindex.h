@@ -0,0 +1,104 @@
+#ifndef AUTOINDEX_H
+#define AUTOINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * Size of the segments a listing is rendered into. A listing is sent as soon
+ * as its first segment is full, chunked while the rest of the directory is
+ * read.
+ */
+#define AUTOINDEX_SEGMENT 65536
+
+/*
+ * Listings kept in the cache, and the bytes they may take altogether
+ */
+#define AUTOINDEX_CACHE_SIZE 64
+#define AUTOINDEX_CACHE_MAX (64UL << 20)
+
+/*
+ * @brief: a piece of rendered listing
+ */
+struct listing_segment
+{
+    struct listing_segment *next;
+    size_t len;
+    size_t capacity;
+    char data[];
+};
+
+/*
+ * @brief: the HTML listing of a directory, rendered as it is read
+ *
+ * @param key: the path of the directory
+ * @param target: the request target the listing was rendered for, without
+ * its query, as its title and links depend on it
+ * @param dev: the device of the directory
+ * @param ino: the inode of the directory
+ * @param mtime: the modification time of the directory when it was read, the
+ * listing being stale once it changed
+ * @param segments: the rendered segments, the last one being filled
+ * @param size: the bytes rendered so far
+ * @param complete: the whole directory was read
+ * @param reader: the state of the rendering, NULL once complete
+ * @param refs: the holders of the listing, the cache being one of them
+ * @param used: when the listing was last looked up, for the eviction
+ */
+struct listing
+{
+    char *key;
+    char *target;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+
+    struct listing_segment *segments;
+    struct listing_segment *last;
+    size_t size;
+    bool complete;
+    struct listing_reader *reader;
+
+    size_t refs;
+    unsigned long used;
+};
+
+/*
+ * @brief: return the listing of a directory, the cached one if it was
+ * rendered for the same target and the directory did not change since it
+ * was read, a new one to be rendered with autoindex_render() otherwise. The
+ * caller holds a reference on it.
+ *
+ * @param path: the directory
+ * @param target: the request target naming the directory, the links being
+ * relative to it
+ * @param len: the length of the target
+ *
+ * @return the listing, NULL with errno set on error
+ */
+struct listing *autoindex_lookup(const char *path, const char *target,
+                                 size_t len);
+
+/*
+ * @brief: read the directory until a segment of the listing is full or the
+ * directory ends. A completed listing enters the cache, replacing any stale
+ * listing of the same directory and target.
+ *
+ * @return 1 if the listing is complete, 0 if there is more to render, -1 on
+ * error
+ */
+int autoindex_render(struct listing *listing);
+
+/*
+ * @brief: drop a reference on a listing, freeing it with the last one
+ */
+void autoindex_release(struct listing *listing);
+
+/*
+ * @brief: drop every listing of the cache
+ */
+void autoindex_flush(void);
+
+#endif /*!AUTOINDEX_H*/
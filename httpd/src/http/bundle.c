@@ -0,0 +1,867 @@
+#define _GNU_SOURCE
+
+#include "bundle.h"
+
+#include <brotli/encode.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "../utils/string/string.h"
+#include "mime.h"
+
+static const char *const encodings[BUNDLE_ENCODINGS] = { NULL, "gzip", "br" };
+static const char *const etag_suffixes[BUNDLE_ENCODINGS] = { "", "-gz", "-br" };
+
+/*
+ * @brief: FNV-1a hash of a target
+ */
+static uint64_t bundle_hash(const char *target, size_t len)
+{
+    uint64_t hash = 14695981039346656037UL;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)target[i];
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+/*
+ * @brief: the slot of a target hashing to hash, with the displacement of its
+ * bucket
+ */
+static uint64_t bundle_slot(uint64_t hash, uint32_t seed, uint32_t nb_slots)
+{
+    hash ^= (seed + 1) * 0x9e3779b97f4a7c15UL;
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9UL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebUL;
+    hash ^= hash >> 31;
+    return hash % nb_slots;
+}
+
+/*
+ * Packing
+ */
+
+/*
+ * @brief: a growing buffer of strings
+ */
+struct pack_strings
+{
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+/*
+ * @brief: append a string and its NUL to the buffer
+ *
+ * @return the offset of the string in the buffer, (uint64_t)-1 on error
+ */
+static uint64_t add_string(struct pack_strings *strings, const char *str,
+                           size_t len)
+{
+    if (strings->len + len + 1 > strings->capacity)
+    {
+        size_t capacity = strings->capacity ? strings->capacity : 4096;
+        while (capacity < strings->len + len + 1)
+            capacity *= 2;
+        char *bigger = realloc(strings->data, capacity);
+        if (!bigger)
+            return (uint64_t)-1;
+        strings->data = bigger;
+        strings->capacity = capacity;
+    }
+    uint64_t offset = strings->len;
+    memcpy(strings->data + offset, str, len);
+    strings->data[offset + len] = '\0';
+    strings->len += len + 1;
+    return offset;
+}
+
+/*
+ * @brief: a target of the tree, naming a file or, for the directories, the
+ * item of their default_file
+ */
+struct pack_item
+{
+    char *target;
+    char *path;
+    long file;
+};
+
+struct pack
+{
+    const struct server_config *vhost;
+    int fd;
+    uint64_t end;
+    struct pack_item *items;
+    size_t nb_items;
+    size_t capacity;
+    struct pack_strings strings;
+    struct bundle_entry *entries;
+};
+
+static long add_item(struct pack *pack, char *target, char *path, long file)
+{
+    if (pack->nb_items == pack->capacity)
+    {
+        size_t capacity = pack->capacity ? 2 * pack->capacity : 256;
+        struct pack_item *bigger =
+            realloc(pack->items, capacity * sizeof(struct pack_item));
+        if (!bigger)
+        {
+            free(target);
+            free(path);
+            return -1;
+        }
+        pack->items = bigger;
+        pack->capacity = capacity;
+    }
+    if (!target)
+    {
+        free(path);
+        return -1;
+    }
+    pack->items[pack->nb_items] = (struct pack_item){ target, path, file };
+    return pack->nb_items++;
+}
+
+static char *concat(const char *a, const char *b, const char *c)
+{
+    size_t alen = strlen(a);
+    size_t blen = strlen(b);
+    size_t clen = strlen(c);
+    char *res = malloc(alen + blen + clen + 1);
+    if (res)
+    {
+        memcpy(res, a, alen);
+        memcpy(res + alen, b, blen);
+        memcpy(res + alen + blen, c, clen + 1);
+    }
+    return res;
+}
+
+/*
+ * @brief: add the files under the directory path, whose target is target
+ * followed by a slash
+ */
+static int walk(struct pack *pack, const char *path, const char *target)
+{
+    DIR *dir = opendir(path);
+    if (!dir)
+    {
+        perror(path);
+        return -1;
+    }
+    long index = -1;
+    int err = 0;
+    struct dirent *entry;
+    while (!err && (entry = readdir(dir)))
+    {
+        struct stat statbuf;
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")
+            || fstatat(dirfd(dir), entry->d_name, &statbuf, 0) < 0)
+            continue;
+        char *sub_path = concat(path, "/", entry->d_name);
+        char *sub_target = concat(target, "/", entry->d_name);
+        if (!sub_path || !sub_target)
+            err = -1;
+        else if (S_ISDIR(statbuf.st_mode))
+            err = walk(pack, sub_path, sub_target);
+        else if (S_ISREG(statbuf.st_mode))
+        {
+            long item = add_item(pack, sub_target, sub_path, -1);
+            if (item >= 0 && pack->vhost->default_file
+                && !strcmp(entry->d_name, pack->vhost->default_file))
+                index = item;
+            sub_path = sub_target = NULL;
+            err = item < 0 ? -1 : 0;
+        }
+        free(sub_path);
+        free(sub_target);
+    }
+    closedir(dir);
+    if (!err && index >= 0 && *target)
+        err = add_item(pack, my_strdup(target), NULL, index) < 0 ? -1 : 0;
+    if (!err && index >= 0)
+        err = add_item(pack, concat(target, "/", ""), NULL, index) < 0 ? -1
+                                                                        : 0;
+    return err;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * @brief: append data to the bundle, aligned on align
+ *
+ * @return the offset of data, (uint64_t)-1 on error
+ */
+static uint64_t append(struct pack *pack, const void *data, size_t len,
+                       size_t align)
+{
+    static const char zeros[BUNDLE_ALIGN];
+    size_t pad = (align - pack->end % align) % align;
+    if (write_all(pack->fd, zeros, pad) < 0
+        || write_all(pack->fd, data, len) < 0)
+        return (uint64_t)-1;
+    pack->end += pad;
+    uint64_t offset = pack->end;
+    pack->end += len;
+    return offset;
+}
+
+static unsigned char *read_file(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat statbuf;
+    if (fd < 0 || fstat(fd, &statbuf) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    *len = statbuf.st_size;
+    unsigned char *data = malloc(*len ? *len : 1);
+    size_t done = 0;
+    while (data && done < *len)
+    {
+        ssize_t n = read(fd, data + done, *len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            free(data);
+            data = NULL;
+        }
+        else
+            done += n;
+    }
+    close(fd);
+    return data;
+}
+
+/*
+ * @brief: compress data, returning NULL if the result is not worth keeping
+ */
+static unsigned char *compress_file(enum bundle_encoding encoding,
+                                    const unsigned char *data, size_t len,
+                                    size_t *out_len)
+{
+    if (!len || len > UINT_MAX)
+        return NULL;
+    // The gzip header and trailer come on top of the deflate bound
+    size_t bound = encoding == BUNDLE_GZIP
+        ? compressBound(len) + 32
+        : BrotliEncoderMaxCompressedSize(len);
+    unsigned char *out = bound ? malloc(bound) : NULL;
+    if (!out)
+        return NULL;
+    int ok = 0;
+    if (encoding == BUNDLE_GZIP)
+    {
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+                         Z_DEFAULT_STRATEGY)
+            == Z_OK)
+        {
+            z.next_in = (unsigned char *)data;
+            z.avail_in = len;
+            z.next_out = out;
+            z.avail_out = bound;
+            ok = deflate(&z, Z_FINISH) == Z_STREAM_END;
+            *out_len = z.total_out;
+            deflateEnd(&z);
+        }
+    }
+    else
+    {
+        *out_len = bound;
+        ok = BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW,
+                                   BROTLI_MODE_GENERIC, len, data, out_len,
+                                   out);
+    }
+    if (!ok || *out_len * 100 > len * BUNDLE_COMPRESSED_MAX)
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+/*
+ * @brief: write the variants of a file and fill its entry
+ */
+static int pack_file(struct pack *pack, const struct pack_item *item,
+                     struct bundle_entry *entry)
+{
+    size_t len[BUNDLE_ENCODINGS] = { 0 };
+    unsigned char *data[BUNDLE_ENCODINGS] = { NULL };
+    data[BUNDLE_IDENTITY] = read_file(item->path, &len[BUNDLE_IDENTITY]);
+    if (!data[BUNDLE_IDENTITY])
+    {
+        perror(item->path);
+        return -1;
+    }
+    for (int e = BUNDLE_IDENTITY + 1; e < BUNDLE_ENCODINGS; e++)
+    {
+        data[e] = compress_file(e, data[BUNDLE_IDENTITY],
+                                len[BUNDLE_IDENTITY], &len[e]);
+        entry->vary |= data[e] != NULL;
+    }
+    const char *mime = mime_lookup(pack->vhost, item->path);
+    uint64_t hash = bundle_hash((const char *)data[BUNDLE_IDENTITY],
+                                len[BUNDLE_IDENTITY]);
+    entry->mime = add_string(&pack->strings, mime, strlen(mime));
+    int err = entry->mime == (uint64_t)-1 ? -1 : 0;
+    for (int e = BUNDLE_IDENTITY; !err && e < BUNDLE_ENCODINGS; e++)
+    {
+        struct bundle_variant *variant = &entry->variants[e];
+        if (!data[e])
+            continue;
+        char etag[32];
+        int etag_len = sprintf(etag, "\"%016llx%s\"", (unsigned long long)hash,
+                               etag_suffixes[e]);
+        char head[BUNDLE_HEAD_MAX];
+        int head_len = snprintf(
+            head, sizeof(head),
+            "Content-Length: %zu\r\nContent-Type: %s\r\nETag: %s\r\n%s%s%s%s",
+            len[e], mime, etag, encodings[e] ? "Content-Encoding: " : "",
+            encodings[e] ? encodings[e] : "", encodings[e] ? "\r\n" : "",
+            entry->vary ? "Vary: Accept-Encoding\r\n" : "");
+        variant->offset = append(pack, data[e], len[e], BUNDLE_ALIGN);
+        variant->length = len[e];
+        variant->etag = add_string(&pack->strings, etag, etag_len);
+        variant->etag_len = etag_len;
+        variant->head = add_string(&pack->strings, head, head_len);
+        variant->head_len = head_len;
+        if (head_len < 0 || (size_t)head_len >= sizeof(head)
+            || variant->offset == (uint64_t)-1
+            || variant->etag == (uint64_t)-1 || variant->head == (uint64_t)-1)
+            err = -1;
+    }
+    for (int e = BUNDLE_IDENTITY; e < BUNDLE_ENCODINGS; e++)
+        free(data[e]);
+    return err;
+}
+
+struct pack_bucket
+{
+    uint32_t index;
+    size_t first;
+    size_t size;
+};
+
+static int larger_first(const void *a, const void *b)
+{
+    const struct pack_bucket *x = a;
+    const struct pack_bucket *y = b;
+    return (x->size < y->size) - (x->size > y->size);
+}
+
+/*
+ * @brief: give a slot to each target of a bucket, with the first
+ * displacement sending them all to free slots
+ *
+ * @return 0 on success, -1 if there is no such displacement
+ */
+static int place_bucket(const struct pack_bucket *bucket,
+                        const uint64_t *hashes, const size_t *order,
+                        size_t n, char *taken, size_t *slots, uint32_t *seed)
+{
+    size_t end = bucket->first + bucket->size;
+    for (*seed = 0; *seed < BUNDLE_SEED_MAX; (*seed)++)
+    {
+        size_t i = bucket->first;
+        for (; i < end; i++)
+        {
+            uint64_t slot = bundle_slot(hashes[order[i]], *seed, n);
+            if (taken[slot])
+                break;
+            taken[slot] = 1;
+            slots[slot] = order[i];
+        }
+        if (i == end)
+            return 0;
+        while (i-- > bucket->first)
+            taken[bundle_slot(hashes[order[i]], *seed, n)] = 0;
+    }
+    return -1;
+}
+
+/*
+ * @brief: give each entry a slot, filling the displacement of each bucket
+ *
+ * @param slots: filled with the entry of each slot
+ *
+ * @return 0 on success, -1 if some bucket found no displacement
+ */
+static int build_index(const struct pack *pack, uint32_t nb_buckets,
+                       uint32_t *displacements, size_t *slots)
+{
+    size_t n = pack->nb_items;
+    uint64_t *hashes = calloc(n + 1, sizeof(uint64_t));
+    size_t *order = calloc(n + 1, sizeof(size_t));
+    struct pack_bucket *buckets = calloc(nb_buckets, sizeof(*buckets));
+    char *taken = calloc(n + 1, 1);
+    int err = !hashes || !order || !buckets || !taken ? -1 : 0;
+    for (size_t i = 0; !err && i < n; i++)
+    {
+        const char *target = pack->items[i].target;
+        hashes[i] = bundle_hash(target, strlen(target));
+        buckets[hashes[i] % nb_buckets].size++;
+    }
+    // Sort the entries by bucket
+    for (uint32_t b = 0, first = 0; !err && b < nb_buckets; b++)
+    {
+        buckets[b].index = b;
+        buckets[b].first = first;
+        first += buckets[b].size;
+        buckets[b].size = 0;
+    }
+    for (size_t i = 0; !err && i < n; i++)
+    {
+        struct pack_bucket *bucket = &buckets[hashes[i] % nb_buckets];
+        order[bucket->first + bucket->size++] = i;
+    }
+    // The largest buckets first, while most slots are free
+    if (!err)
+        qsort(buckets, nb_buckets, sizeof(*buckets), larger_first);
+    for (uint32_t b = 0; !err && b < nb_buckets; b++)
+        err = place_bucket(&buckets[b], hashes, order, n, taken, slots,
+                           &displacements[buckets[b].index]);
+    free(hashes);
+    free(order);
+    free(buckets);
+    free(taken);
+    return err;
+}
+
+/*
+ * @brief: write the tables after the strings and the header at the start
+ */
+static int write_tables(struct pack *pack)
+{
+    size_t n = pack->nb_items;
+    uint32_t nb_buckets = n / BUNDLE_BUCKET_LOAD + 1;
+    uint32_t *displacements = calloc(nb_buckets, sizeof(uint32_t));
+    size_t *slots = calloc(n ? n : 1, sizeof(size_t));
+    struct bundle_entry *sorted = calloc(n ? n : 1, sizeof(*sorted));
+    int err = !displacements || !slots || !sorted ? -1 : 0;
+    if (!err && build_index(pack, nb_buckets, displacements, slots) < 0)
+    {
+        fprintf(stderr, "%s: no perfect hash of the targets found\n",
+                pack->vhost->bundle);
+        err = -1;
+    }
+    uint64_t base = err ? 0 : append(pack, pack->strings.data,
+                                     pack->strings.len, BUNDLE_ALIGN);
+    for (size_t i = 0; !err && i < n; i++)
+    {
+        sorted[i] = pack->entries[slots[i]];
+        sorted[i].target += base;
+        sorted[i].mime += base;
+        for (int e = 0; e < BUNDLE_ENCODINGS; e++)
+        {
+            struct bundle_variant *variant = &sorted[i].variants[e];
+            if (variant->head_len)
+            {
+                variant->head += base;
+                variant->etag += base;
+            }
+        }
+    }
+    struct bundle_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.nb_entries = n;
+    header.nb_buckets = nb_buckets;
+    if (!err && base == (uint64_t)-1)
+        err = -1;
+    if (!err)
+        header.displacements = append(pack, displacements,
+                                      nb_buckets * sizeof(uint32_t),
+                                      BUNDLE_ALIGN);
+    if (!err)
+        header.entries = append(pack, sorted, n * sizeof(*sorted),
+                                BUNDLE_ALIGN);
+    header.size = pack->end;
+    if (!err
+        && (header.displacements == (uint64_t)-1
+            || header.entries == (uint64_t)-1
+            || pwrite(pack->fd, &header, sizeof(header), 0)
+                != (ssize_t)sizeof(header)))
+        err = -1;
+    free(displacements);
+    free(slots);
+    free(sorted);
+    return err;
+}
+
+static void pack_destroy(struct pack *pack)
+{
+    for (size_t i = 0; i < pack->nb_items; i++)
+    {
+        free(pack->items[i].target);
+        free(pack->items[i].path);
+    }
+    free(pack->items);
+    free(pack->strings.data);
+    free(pack->entries);
+}
+
+int bundle_pack(const struct server_config *vhost)
+{
+    if (!vhost->bundle || !vhost->root_dir)
+        return 0;
+    struct pack pack;
+    memset(&pack, 0, sizeof(pack));
+    pack.vhost = vhost;
+    pack.end = sizeof(struct bundle_header);
+    char *tmp = concat(vhost->bundle, ".XXXXXX", "");
+    pack.fd = tmp ? mkostemp(tmp, O_CLOEXEC) : -1;
+    int err = pack.fd < 0 ? -1 : 0;
+    struct bundle_header header;
+    memset(&header, 0, sizeof(header));
+    if (!err)
+        err = write_all(pack.fd, &header, sizeof(header));
+    if (!err)
+        err = walk(&pack, vhost->root_dir, "");
+    if (!err && pack.nb_items > UINT32_MAX / 2)
+        err = -1;
+    pack.entries = err ? NULL
+                       : calloc(pack.nb_items ? pack.nb_items : 1,
+                                sizeof(struct bundle_entry));
+    err = pack.entries ? err : -1;
+    // The files first, then the directories sharing their entries
+    for (size_t i = 0; !err && i < pack.nb_items; i++)
+    {
+        if (pack.items[i].file < 0)
+            err = pack_file(&pack, &pack.items[i], &pack.entries[i]);
+    }
+    for (size_t i = 0; !err && i < pack.nb_items; i++)
+    {
+        struct pack_item *item = &pack.items[i];
+        if (item->file >= 0)
+            pack.entries[i] = pack.entries[item->file];
+        pack.entries[i].target =
+            add_string(&pack.strings, item->target, strlen(item->target));
+        pack.entries[i].target_len = strlen(item->target);
+        if (pack.entries[i].target == (uint64_t)-1)
+            err = -1;
+    }
+    if (!err)
+        err = write_tables(&pack);
+    if (!err && (fchmod(pack.fd, 0644) < 0 || fsync(pack.fd) < 0
+                 || rename(tmp, vhost->bundle) < 0))
+        err = -1;
+    if (err)
+    {
+        perror(vhost->bundle);
+        if (pack.fd >= 0)
+            unlink(tmp);
+    }
+    if (pack.fd >= 0)
+        close(pack.fd);
+    free(tmp);
+    pack_destroy(&pack);
+    return err;
+}
+
+/*
+ * Serving
+ */
+
+/*
+ * @brief: the mapping of the bundle of a vhost
+ *
+ * @param path: the bundle of the vhost, as its configuration spells it
+ * @param fd: the mapped bundle, -1 if it is not mapped
+ * @param checked: when the path was last checked to still be the bundle
+ */
+struct bundle
+{
+    const char *path;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    const char *data;
+    size_t size;
+    const struct bundle_header *header;
+    const uint32_t *displacements;
+    const struct bundle_entry *entries;
+    time_t checked;
+};
+
+static struct bundle *bundles = NULL;
+static size_t nb_bundles = 0;
+
+static void unmap(struct bundle *bundle)
+{
+    if (bundle->fd >= 0)
+    {
+        munmap((void *)bundle->data, bundle->size);
+        close(bundle->fd);
+    }
+    bundle->fd = -1;
+}
+
+/*
+ * @brief: map the bundle at path in place of the one mapped, if it is valid
+ *
+ * @return 0 on success, -1 on error
+ */
+static int map(struct bundle *bundle)
+{
+    struct bundle mapped = *bundle;
+    struct stat statbuf;
+    mapped.fd = open(bundle->path, O_RDONLY | O_CLOEXEC);
+    if (mapped.fd < 0 || fstat(mapped.fd, &statbuf) < 0)
+    {
+        perror(bundle->path);
+        if (mapped.fd >= 0)
+            close(mapped.fd);
+        return -1;
+    }
+    mapped.dev = statbuf.st_dev;
+    mapped.ino = statbuf.st_ino;
+    mapped.size = statbuf.st_size;
+    mapped.data = MAP_FAILED;
+    if (mapped.size >= sizeof(struct bundle_header))
+        mapped.data = mmap(NULL, mapped.size, PROT_READ, MAP_SHARED,
+                           mapped.fd, 0);
+    const struct bundle_header *header = (const void *)mapped.data;
+    if (mapped.data == MAP_FAILED
+        || memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic))
+        || header->size != mapped.size || !header->nb_buckets
+        || header->displacements % BUNDLE_ALIGN
+        || header->entries % BUNDLE_ALIGN
+        || header->displacements > mapped.size
+        || (mapped.size - header->displacements) / sizeof(uint32_t)
+            < header->nb_buckets
+        || header->entries > mapped.size
+        || (mapped.size - header->entries) / sizeof(struct bundle_entry)
+            < header->nb_entries)
+    {
+        fprintf(stderr, "%s: not a bundle\n", bundle->path);
+        if (mapped.data != MAP_FAILED)
+            munmap((void *)mapped.data, mapped.size);
+        close(mapped.fd);
+        return -1;
+    }
+    mapped.header = header;
+    mapped.displacements = (const void *)(mapped.data + header->displacements);
+    mapped.entries = (const void *)(mapped.data + header->entries);
+    unmap(bundle);
+    *bundle = mapped;
+    return 0;
+}
+
+int bundle_init(const struct config *config)
+{
+    bundles = calloc(config->nb_servers, sizeof(struct bundle));
+    if (!bundles)
+        return -1;
+    for (size_t i = 0; i < config->nb_servers; i++)
+    {
+        const struct server_config *vhost = &config->servers[i];
+        if (!vhost->bundle || vhost->proxy_pass)
+            continue;
+        struct bundle *bundle = &bundles[nb_bundles++];
+        bundle->path = vhost->bundle;
+        bundle->fd = -1;
+        bundle->checked = time(NULL);
+        if (map(bundle) < 0)
+        {
+            bundle_destroy();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * @brief: return the bundle of a vhost, mapping it again if it was replaced
+ * or unmapped. The one mapped is kept when the new one is not valid.
+ */
+static struct bundle *find_bundle(const struct server_config *vhost)
+{
+    struct bundle *bundle = NULL;
+    for (size_t i = 0; i < nb_bundles && !bundle; i++)
+    {
+        if (bundles[i].path == vhost->bundle)
+            bundle = &bundles[i];
+    }
+    time_t now = time(NULL);
+    if (!bundle || (bundle->fd >= 0 && now - bundle->checked < BUNDLE_CHECK))
+        return bundle;
+    bundle->checked = now;
+    struct stat statbuf;
+    if (bundle->fd < 0
+        || (!stat(bundle->path, &statbuf)
+            && (statbuf.st_dev != bundle->dev
+                || statbuf.st_ino != bundle->ino)))
+        map(bundle);
+    return bundle->fd >= 0 ? bundle : NULL;
+}
+
+/*
+ * @brief: return the entry of a target, NULL if it is not in the bundle
+ */
+static const struct bundle_entry *find_entry(const struct bundle *bundle,
+                                             const char *target, size_t len)
+{
+    const struct bundle_header *header = bundle->header;
+    if (!header->nb_entries)
+        return NULL;
+    uint64_t hash = bundle_hash(target, len);
+    uint32_t seed = bundle->displacements[hash % header->nb_buckets];
+    const struct bundle_entry *entry =
+        &bundle->entries[bundle_slot(hash, seed, header->nb_entries)];
+    if (entry->target_len != len || entry->target >= bundle->size
+        || bundle->size - entry->target <= len
+        || memcmp(bundle->data + entry->target, target, len))
+        return NULL;
+    return entry;
+}
+
+/*
+ * @brief: check that a variant lies in the bundle, its strings being NUL
+ * terminated
+ */
+static bool variant_valid(const struct bundle *bundle,
+                          const struct bundle_entry *entry,
+                          const struct bundle_variant *variant)
+{
+    size_t size = bundle->size;
+    return entry->mime < size && memchr(bundle->data + entry->mime, '\0',
+                                        size - entry->mime)
+        && variant->offset <= size && variant->length <= size - variant->offset
+        && variant->head <= size && variant->head_len <= size - variant->head
+        && variant->head_len <= BUNDLE_HEAD_MAX
+        && variant->etag < size && variant->etag_len < size - variant->etag
+        && !bundle->data[variant->etag + variant->etag_len];
+}
+
+/*
+ * @brief: return whether the If-None-Match list of the request holds etag,
+ * compared weakly
+ */
+static bool etag_matches(const struct string *list, const char *etag,
+                         size_t len)
+{
+    for (size_t i = 0; list && i < list->size;)
+    {
+        while (i < list->size && (list->data[i] == ' ' || list->data[i] == ','))
+            i++;
+        size_t start = i;
+        while (i < list->size && list->data[i] != ',')
+            i++;
+        size_t end = i;
+        while (end > start && list->data[end - 1] == ' ')
+            end--;
+        if (end - start >= 2 && !memcmp(list->data + start, "W/", 2))
+            start += 2;
+        if ((end - start == 1 && list->data[start] == '*')
+            || (end - start == len && !memcmp(list->data + start, etag, len)))
+            return true;
+    }
+    return false;
+}
+
+void bundle_respond(const struct request *req,
+                    const struct server_config *vhost, struct response *res)
+{
+    const char *target = req->target->data;
+    size_t len = req->target->size;
+    const char *query = memchr(target, '?', len);
+    if (query)
+        len = query - target;
+    struct bundle *bundle = find_bundle(vhost);
+    const struct bundle_entry *entry =
+        bundle ? find_entry(bundle, target, len) : NULL;
+    if (!entry)
+    {
+        res->status_code = NOT_FOUND;
+        res->phrase = my_strdup("not found");
+        return;
+    }
+    const struct bundle_variant *variant = &entry->variants[BUNDLE_IDENTITY];
+    for (int e = BUNDLE_IDENTITY + 1; e < BUNDLE_ENCODINGS; e++)
+    {
+        const struct bundle_variant *v = &entry->variants[e];
+        if (v->head_len && v->length < variant->length
+            && request_accepts(req, encodings[e]))
+            variant = v;
+    }
+    if (!variant->head_len || !variant_valid(bundle, entry, variant))
+    {
+        res->status_code = ERROR;
+        res->phrase = my_strdup("a general error occured");
+        return;
+    }
+    res->etag = bundle->data + variant->etag;
+    res->vary = entry->vary;
+    if (etag_matches(req->if_none_match, res->etag, variant->etag_len))
+    {
+        res->status_code = NOT_MODIFIED;
+        res->phrase = my_strdup("not modified");
+        return;
+    }
+    res->content_length = malloc(32);
+    res->fd = req->method == GET ? dup(bundle->fd) : -1;
+    if (!res->content_length || (req->method == GET && res->fd < 0))
+    {
+        res->status_code = ERROR;
+        res->phrase = my_strdup("a general error occured");
+        return;
+    }
+    sprintf(res->content_length, "%llu", (unsigned long long)variant->length);
+    res->content_type = bundle->data + entry->mime;
+    res->content_encoding = encodings[variant - entry->variants];
+    res->offset = variant->offset;
+    res->head = bundle->data + variant->head;
+    res->head_len = variant->head_len;
+    res->phrase = my_strdup("ok");
+}
+
+void bundle_unmap(void)
+{
+    for (size_t i = 0; i < nb_bundles; i++)
+        unmap(&bundles[i]);
+}
+
+void bundle_destroy(void)
+{
+    bundle_unmap();
+    free(bundles);
+    bundles = NULL;
+    nb_bundles = 0;
+}
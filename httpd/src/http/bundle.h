@@ -0,0 +1,144 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../config/config.h"
+#include "request.h"
+#include "response.h"
+
+/*
+ * A bundle is the document tree of a vhost packed in a single file, served
+ * from its mapping. Its layout, every offset being from the start of the
+ * file and every number in the byte order of the packer:
+ * - a struct bundle_header
+ * - the bodies of the files, each variant aligned on BUNDLE_ALIGN
+ * - the strings: targets, MIME types, ETags and header blocks
+ * - the displacements of the perfect hash, nb_buckets uint32_t
+ * - the entries, nb_entries struct bundle_entry
+ */
+#define BUNDLE_MAGIC "HTTPDBN1"
+#define BUNDLE_ALIGN 16
+
+/*
+ * The entries are indexed by a two level perfect hash of their target, as
+ * the builtin MIME table is: the hash of the target picks a bucket, whose
+ * displacement seeds the hash picking the slot. The packer puts about
+ * BUNDLE_BUCKET_LOAD targets in a bucket and tries BUNDLE_SEED_MAX
+ * displacements for each before giving up.
+ */
+#define BUNDLE_BUCKET_LOAD 4
+#define BUNDLE_SEED_MAX (1u << 26)
+
+/*
+ * Longest header block of a variant
+ */
+#define BUNDLE_HEAD_MAX 1024
+
+/*
+ * A variant compressed is kept if it is at most this percentage of the file
+ */
+#define BUNDLE_COMPRESSED_MAX 90
+
+/*
+ * Seconds between two checks that the bundle was not replaced
+ */
+#define BUNDLE_CHECK 1
+
+enum bundle_encoding
+{
+    BUNDLE_IDENTITY = 0,
+    BUNDLE_GZIP,
+    BUNDLE_BROTLI,
+    BUNDLE_ENCODINGS
+};
+
+struct bundle_header
+{
+    char magic[8];
+    uint32_t nb_entries;
+    uint32_t nb_buckets;
+    uint64_t displacements;
+    uint64_t entries;
+    uint64_t size;
+};
+
+/*
+ * @brief: an encoding of a file, absent if head_len is 0
+ *
+ * @param offset: the body
+ * @param length: the length of the body
+ * @param head: the header block sent after the Date, each line ending with
+ * CRLF: Content-Length, Content-Type, ETag, Content-Encoding and Vary
+ * @param etag: the quoted ETag, NUL terminated
+ */
+struct bundle_variant
+{
+    uint64_t offset;
+    uint64_t length;
+    uint64_t head;
+    uint64_t etag;
+    uint32_t head_len;
+    uint32_t etag_len;
+};
+
+/*
+ * @brief: a request target, without its query string. A directory with a
+ * default_file gets an entry with and without its final slash, sharing the
+ * variants of its default_file.
+ *
+ * @param target: the target, NUL terminated
+ * @param mime: the MIME type, NUL terminated
+ * @param vary: the file has compressed variants
+ */
+struct bundle_entry
+{
+    uint64_t target;
+    uint64_t mime;
+    uint32_t target_len;
+    uint32_t vary;
+    struct bundle_variant variants[BUNDLE_ENCODINGS];
+};
+
+/*
+ * @brief: pack the root_dir of a vhost in its bundle. The bundle is written
+ * next to its path then renamed over it, so that the servers mapping it get
+ * the whole old one or the whole new one.
+ *
+ * @return 0 on success, -1 on error
+ */
+int bundle_pack(const struct server_config *vhost);
+
+/*
+ * @brief: map the bundle of every vhost having one, the processes forked
+ * afterwards sharing the mappings
+ *
+ * @return 0 on success, -1 on error
+ */
+int bundle_init(const struct config *config);
+
+/*
+ * @brief: answer a request from the bundle of its vhost, with the smallest
+ * variant the client accepts. The response gets a descriptor of the bundle
+ * to send the body from, and its header block. A bundle renamed over the
+ * mapped one is mapped in its place at the next lookup, BUNDLE_CHECK
+ * seconds after the previous check at most.
+ */
+void bundle_respond(const struct request *req,
+                    const struct server_config *vhost, struct response *res);
+
+/*
+ * @brief: unmap the bundles, each one being mapped again at its next lookup.
+ * The master process of the workers does not keep the bundles replaced
+ * since it started from being freed.
+ */
+void bundle_unmap(void);
+
+/*
+ * @brief: unmap the bundles and forget them
+ */
+void bundle_destroy(void);
+
+#endif /*!BUNDLE_H*/
@@ -0,0 +1,332 @@
+#ifndef _POSIX_C_SOURCE
+#    define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../utils/string/string.h"
+#include "../utils/variables/variables.h"
+#include "location.h"
+#include "mime.h"
+
+static struct file_entry *buckets[CACHE_BUCKETS];
+static size_t nb_entries = 0;
+static time_t lifetime = CACHE_TTL;
+static unsigned long generation = 0;
+
+/*
+ * @brief: FNV-1a hash of a NUL terminated string
+ */
+static size_t hash_key(const char *key)
+{
+    size_t hash = 14695981039346656037UL;
+    while (*key)
+    {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+static void entry_destroy(struct file_entry *entry)
+{
+    if (entry)
+    {
+        free(entry->key);
+        free(entry->path);
+        free(entry);
+    }
+}
+
+/*
+ * @brief: open the index of the directory dir_fd, replacing the path of the
+ * entry by the one of the index
+ *
+ * @return the file descriptor of the index, or -1 with errno set
+ */
+static int open_index(struct file_entry *entry, int dir_fd)
+{
+    const char *index = entry->vhost->default_file;
+    if (!index)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+    int fd = openat(dir_fd, index, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    size_t klen = strlen(entry->key);
+    size_t ilen = strlen(index);
+    char *path = malloc(klen + ilen + 2);
+    if (!path)
+    {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(path, entry->key, klen);
+    if (!klen || path[klen - 1] != '/')
+        path[klen++] = '/';
+    memcpy(path + klen, index, ilen + 1);
+    free(entry->path);
+    entry->path = path;
+    return fd;
+}
+
+/*
+ * @brief: check that fd is a regular file and close it
+ *
+ * @return 0 if it is, the errno to report otherwise
+ */
+static int check_regular(int fd, struct stat *statbuf)
+{
+    if (fd < 0)
+        return errno;
+    int err = 0;
+    if (fstat(fd, statbuf) < 0)
+        err = errno;
+    else if (!S_ISREG(statbuf->st_mode))
+        err = ENOENT;
+    close(fd);
+    return err;
+}
+
+/*
+ * @brief: ask the file system what the key of the entry refers to
+ */
+static void resolve(struct file_entry *entry)
+{
+    free(entry->path);
+    entry->path = my_strdup(entry->key);
+    entry->checked = time(NULL);
+
+    entry->directory = false;
+    if (entry->location && entry->location->disabled)
+    {
+        entry->error = ENOENT;
+        return;
+    }
+
+    struct stat statbuf;
+    int fd = open(entry->key, O_RDONLY);
+    if (fd >= 0 && fstat(fd, &statbuf) == 0 && S_ISDIR(statbuf.st_mode))
+    {
+        int index = open_index(entry, fd);
+        if (index < 0 && errno == ENOENT && entry->vhost->autoindex)
+        {
+            close(fd);
+            entry->directory = true;
+            entry->error = 0;
+            entry->size = 0;
+            entry->mtime = statbuf.st_mtime;
+            entry->mime = "text/html";
+            return;
+        }
+        close(fd);
+        fd = index;
+    }
+    entry->error = check_regular(fd, &statbuf);
+    if (!entry->error)
+    {
+        entry->size = statbuf.st_size;
+        entry->mtime = statbuf.st_mtime;
+        entry->mime = mime_lookup(entry->vhost, entry->path);
+    }
+}
+
+/*
+ * @brief: allocate an entry, outside of the cache
+ */
+static struct file_entry *entry_new(const struct server_config *vhost,
+                                    const struct location *location,
+                                    const char *key)
+{
+    struct file_entry *entry = calloc(1, sizeof(struct file_entry));
+    if (!entry)
+        return NULL;
+    entry->vhost = vhost;
+    entry->location = location;
+    entry->key = my_strdup(key);
+    if (!entry->key)
+    {
+        free(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+static void entry_insert(struct file_entry *entry)
+{
+    if (nb_entries >= CACHE_MAX_ENTRIES)
+        cache_flush();
+    size_t bucket = hash_key(entry->key) % CACHE_BUCKETS;
+    entry->next = buckets[bucket];
+    buckets[bucket] = entry;
+    nb_entries++;
+}
+
+static struct file_entry *find(const struct server_config *vhost,
+                               const struct location *location,
+                               const char *key)
+{
+    struct file_entry *entry = buckets[hash_key(key) % CACHE_BUCKETS];
+    while (entry
+           && (entry->vhost != vhost || entry->location != location
+               || strcmp(entry->key, key)))
+        entry = entry->next;
+    return entry;
+}
+
+struct file_entry *cache_lookup(const struct server_config *vhost,
+                                const char *target, size_t len)
+{
+    char key[BUFFERSIZE];
+    const struct location *location = NULL;
+    if (location_path(vhost, target, len, &location, key, BUFFERSIZE) < 0)
+        return NULL;
+
+    struct file_entry *entry = find(vhost, location, key);
+    if (!entry)
+    {
+        entry = entry_new(vhost, location, key);
+        if (!entry)
+            return NULL;
+        entry_insert(entry);
+    }
+    else if (time(NULL) - entry->checked < lifetime)
+        return entry;
+
+    resolve(entry);
+    return entry->path ? entry : NULL;
+}
+
+bool cache_fresh(const struct server_config *vhost, const char *target,
+                 size_t len)
+{
+    char key[BUFFERSIZE];
+    const struct location *location = NULL;
+    if (location_path(vhost, target, len, &location, key, BUFFERSIZE) < 0)
+        return true;
+    struct file_entry *entry = find(vhost, location, key);
+    return entry && time(NULL) - entry->checked < lifetime;
+}
+
+struct file_entry *cache_resolve(const struct server_config *vhost,
+                                 const char *target, size_t len)
+{
+    char key[BUFFERSIZE];
+    const struct location *location = NULL;
+    struct file_entry *entry = NULL;
+    if (location_path(vhost, target, len, &location, key, BUFFERSIZE) < 0
+        || !(entry = entry_new(vhost, location, key)))
+        return NULL;
+    resolve(entry);
+    if (!entry->path)
+    {
+        entry_destroy(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+unsigned long cache_generation(void)
+{
+    return generation;
+}
+
+void cache_insert(struct file_entry *entry, unsigned long since)
+{
+    if (since != generation)
+    {
+        entry_destroy(entry);
+        return;
+    }
+    struct file_entry **old = &buckets[hash_key(entry->key) % CACHE_BUCKETS];
+    while (*old
+           && ((*old)->vhost != entry->vhost
+               || (*old)->location != entry->location
+               || strcmp((*old)->key, entry->key)))
+        old = &(*old)->next;
+    if (*old)
+    {
+        struct file_entry *next = (*old)->next;
+        entry_destroy(*old);
+        *old = next;
+        nb_entries--;
+    }
+    entry_insert(entry);
+}
+
+/*
+ * @brief: drop the entries of a bucket matching pathname
+ *
+ * @param tree: match the entries under pathname too
+ */
+static void invalidate_bucket(size_t bucket, const char *pathname, bool tree)
+{
+    generation++;
+    size_t len = strlen(pathname);
+    struct file_entry **entry = &buckets[bucket];
+    while (*entry)
+    {
+        const char *key = (*entry)->key;
+        const char *path = (*entry)->path;
+        if (!strcmp(key, pathname) || (path && !strcmp(path, pathname))
+            || (tree && !strncmp(key, pathname, len) && key[len] == '/')
+            || (tree && path && !strncmp(path, pathname, len)
+                && path[len] == '/'))
+        {
+            struct file_entry *next = (*entry)->next;
+            entry_destroy(*entry);
+            *entry = next;
+            nb_entries--;
+        }
+        else
+            entry = &(*entry)->next;
+    }
+}
+
+void cache_invalidate(const char *pathname)
+{
+    for (size_t i = 0; i < CACHE_BUCKETS; i++)
+        invalidate_bucket(i, pathname, false);
+}
+
+void cache_invalidate_key(const char *key)
+{
+    invalidate_bucket(hash_key(key) % CACHE_BUCKETS, key, false);
+}
+
+void cache_invalidate_tree(const char *dir)
+{
+    for (size_t i = 0; i < CACHE_BUCKETS; i++)
+        invalidate_bucket(i, dir, true);
+}
+
+void cache_set_ttl(time_t ttl)
+{
+    lifetime = ttl;
+}
+
+void cache_flush(void)
+{
+    generation++;
+    for (size_t i = 0; i < CACHE_BUCKETS; i++)
+    {
+        while (buckets[i])
+        {
+            struct file_entry *next = buckets[i]->next;
+            entry_destroy(buckets[i]);
+            buckets[i] = next;
+        }
+    }
+    nb_entries = 0;
+}
@@ -0,0 +1,122 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "../config/config.h"
+
+/*
+ * Number of seconds an entry is trusted before the file system is asked
+ * again, unless the document trees are watched for changes
+ */
+#define CACHE_TTL 1
+
+#define CACHE_BUCKETS 4096
+#define CACHE_MAX_ENTRIES 16384
+
+/*
+ * @brief: what we know about a request target of a vhost
+ *
+ * @param vhost: the vhost the target was resolved for
+ * @param location: the location of the target, NULL if none applies
+ * @param key: the file the target names, see location_path()
+ * @param path: the file to serve, the default_file when key is a directory
+ * @param directory: key is a directory without default_file to be listed,
+ * path being the directory
+ * @param error: 0 if path can be served, the errno of the lookup otherwise
+ * @param size: size of the file to serve
+ * @param mtime: last modification of the file to serve
+ * @param mime: MIME type of the file to serve
+ * @param checked: when the entry was last validated against the file system
+ */
+struct file_entry
+{
+    const struct server_config *vhost;
+    const struct location *location;
+    char *key;
+    char *path;
+    bool directory;
+    int error;
+    off_t size;
+    time_t mtime;
+    const char *mime;
+    time_t checked;
+
+    struct file_entry *next;
+};
+
+/*
+ * @brief: return the cached entry of a target, resolving it on a miss or
+ * when the entry is older than the cache lifetime. A directory resolves to its
+ * default_file, or to itself when it has none and the vhost has autoindex.
+ * Failed lookups are cached too, with their errno, and a target of a
+ * disabled location fails with ENOENT.
+ *
+ * @param vhost: the vhost serving the target
+ * @param target: the request target
+ * @param len: the length of the target
+ *
+ * @return the entry, or NULL if it could not be allocated
+ */
+struct file_entry *cache_lookup(const struct server_config *vhost,
+                                const char *target, size_t len);
+
+/*
+ * @brief: return whether the entry of a target is cached and still trusted,
+ * cache_lookup() answering without asking the file system
+ */
+bool cache_fresh(const struct server_config *vhost, const char *target,
+                 size_t len);
+
+/*
+ * @brief: resolve a target into an entry outside of the cache, to be given
+ * to cache_insert(). Nothing shared is touched, so that any thread may call
+ * it.
+ *
+ * @return the entry, NULL if it could not be allocated
+ */
+struct file_entry *cache_resolve(const struct server_config *vhost,
+                                 const char *target, size_t len);
+
+/*
+ * @brief: return a number changing each time entries are dropped
+ */
+unsigned long cache_generation(void);
+
+/*
+ * @brief: put an entry from cache_resolve() in the cache, in place of the
+ * one of its target. It is dropped instead if entries were dropped since
+ * the generation it was resolved at, as it may be stale.
+ */
+void cache_insert(struct file_entry *entry, unsigned long since);
+
+/*
+ * @brief: drop every entry whose key or served path is pathname
+ */
+void cache_invalidate(const char *pathname);
+
+/*
+ * @brief: drop the entries of a key, without going through the whole cache
+ */
+void cache_invalidate_key(const char *key);
+
+/*
+ * @brief: drop every entry whose key or served path is dir or is under it
+ */
+void cache_invalidate_tree(const char *dir);
+
+/*
+ * @brief: set the number of seconds an entry is trusted, CACHE_TTL unless
+ * the document trees are watched
+ */
+void cache_set_ttl(time_t ttl);
+
+/*
+ * @brief: drop every entry of the cache
+ */
+void cache_flush(void);
+
+#endif /*!CACHE_H*/
@@ -0,0 +1,279 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "errors.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../utils/trace/trace.h"
+#include "mime.h"
+
+#define NB_STATUSES (sizeof(statuses) / sizeof(*statuses))
+
+static const struct
+{
+    enum my_status_code code;
+    const char *phrase;
+} statuses[] = {
+    { BAD_REQUEST, "Bad Request" },
+    { FORBIDDEN, "Forbidden" },
+    { NOT_FOUND, "Not Found" },
+    { MNA, "Method Not Allowed" },
+    { LENGTH_REQUIRED, "Length Required" },
+    { PAYLOAD_TOO_LARGE, "Content Too Large" },
+    { EXPECTATION_FAILED, "Expectation Failed" },
+    { TOO_MANY_REQUESTS, "Too Many Requests" },
+    { INTERNAL_ERROR, "Internal Server Error" },
+    { NOT_IMPLEMENTED, "Not Implemented" },
+    { BAD_GATEWAY, "Bad Gateway" },
+    { SERVICE_UNAVAILABLE, "Service Unavailable" },
+    { GATEWAY_TIMEOUT, "Gateway Timeout" },
+    { HVNS, "HTTP Version Not Supported" },
+};
+
+/*
+ * @brief: a whole error response, but for its Date
+ *
+ * @param data: the status line, then the other header fields and the page
+ * @param line_len: the length of the status line, the Date following it
+ * @param body_len: the length of the page, at the end of data
+ */
+struct rendered
+{
+    char *data;
+    size_t len;
+    size_t line_len;
+    size_t body_len;
+};
+
+/*
+ * The responses of every vhost, in the order of config->servers, each one
+ * an array of NB_STATUSES
+ */
+static const struct config *loaded = NULL;
+static struct rendered *tables = NULL;
+
+static char date_line[64];
+static time_t date_time = 0;
+
+static int status_index(enum my_status_code status)
+{
+    if (status == ERROR)
+        status = INTERNAL_ERROR;
+    for (size_t i = 0; i < NB_STATUSES; i++)
+    {
+        if (statuses[i].code == status)
+            return i;
+    }
+    return -1;
+}
+
+static char *read_page(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat statbuf;
+    if (fd < 0 || fstat(fd, &statbuf) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    *len = statbuf.st_size;
+    char *data = NULL;
+    if ((size_t)statbuf.st_size <= ERRORS_PAGE_MAX)
+        data = malloc(*len ? *len : 1);
+    else
+        errno = EFBIG;
+    size_t done = 0;
+    while (data && done < *len)
+    {
+        ssize_t n = read(fd, data + done, *len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            // A file cut short is an error, not a page too large
+            errno = n ? errno : EIO;
+            free(data);
+            data = NULL;
+        }
+        else
+            done += n;
+    }
+    close(fd);
+    return data;
+}
+
+/*
+ * @brief: render the response of a status, with the page read from path, or
+ * the builtin one if path is NULL or its page is larger than ERRORS_PAGE_MAX
+ *
+ * @return 0 on success, -1 on error
+ */
+static int render(struct rendered *rendered, size_t index,
+                  const struct server_config *vhost, const char *path)
+{
+    int code = statuses[index].code;
+    const char *phrase = statuses[index].phrase;
+    char builtin[256];
+    char *page = NULL;
+    size_t page_len;
+    const char *type = "text/html";
+    if (path && !(page = read_page(path, &page_len)) && errno != EFBIG)
+    {
+        perror(path);
+        return -1;
+    }
+    if (page)
+        type = mime_lookup(vhost, path);
+    else
+    {
+        if (path)
+            fprintf(stderr, "%s: larger than %lu bytes, builtin page kept\n",
+                    path, ERRORS_PAGE_MAX);
+        page = builtin;
+        page_len = sprintf(builtin,
+                           "<html><head><title>%d %s</title></head>"
+                           "<body><h1>%d %s</h1></body></html>\n",
+                           code, phrase, code, phrase);
+    }
+    // The type may come from the vhost, the head is sized from its parts
+    const char *format = "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n"
+                         "Content-Length: %zu\r\nConnection: close\r\n\r\n";
+    int line_len = snprintf(NULL, 0, "HTTP/1.1 %d %s\r\n", code, phrase);
+    int head_len = snprintf(NULL, 0, format, code, phrase, type, page_len);
+    rendered->data = head_len < 0 ? NULL : malloc(head_len + 1 + page_len);
+    if (rendered->data)
+    {
+        sprintf(rendered->data, format, code, phrase, type, page_len);
+        memcpy(rendered->data + head_len, page, page_len);
+        rendered->len = head_len + page_len;
+        rendered->line_len = line_len;
+        rendered->body_len = page_len;
+    }
+    if (page != builtin)
+        free(page);
+    return rendered->data ? 0 : -1;
+}
+
+static void free_tables(struct rendered *old, size_t nb_vhosts)
+{
+    for (size_t i = 0; old && i < nb_vhosts * NB_STATUSES; i++)
+        free(old[i].data);
+    free(old);
+}
+
+/*
+ * @brief: render the responses of every vhost of the configuration
+ *
+ * @return the tables, NULL on error
+ */
+static struct rendered *render_all(const struct config *config)
+{
+    struct rendered *all =
+        calloc(config->nb_servers * NB_STATUSES, sizeof(struct rendered));
+    for (size_t i = 0; all && i < config->nb_servers; i++)
+    {
+        const struct server_config *vhost = &config->servers[i];
+        for (size_t j = 0; j < NB_STATUSES; j++)
+        {
+            const char *path = NULL;
+            for (size_t k = 0; k < vhost->nb_error_pages; k++)
+            {
+                if (vhost->error_pages[k].status == (size_t)statuses[j].code)
+                    path = vhost->error_pages[k].path;
+            }
+            if (render(&all[i * NB_STATUSES + j], j, vhost, path) < 0)
+            {
+                free_tables(all, config->nb_servers);
+                return NULL;
+            }
+        }
+    }
+    return all;
+}
+
+int errors_init(const struct config *config)
+{
+    for (size_t i = 0; i < config->nb_servers; i++)
+    {
+        const struct server_config *vhost = &config->servers[i];
+        for (size_t j = 0; j < vhost->nb_error_pages; j++)
+        {
+            if (status_index(vhost->error_pages[j].status) < 0)
+                fprintf(stderr, "no error response for %zu, %s ignored\n",
+                        vhost->error_pages[j].status,
+                        vhost->error_pages[j].path);
+        }
+    }
+    tables = render_all(config);
+    if (!tables)
+        return -1;
+    loaded = config;
+    return 0;
+}
+
+int errors_reload(void)
+{
+    if (!loaded)
+        return 0;
+    struct rendered *fresh = render_all(loaded);
+    if (!fresh)
+    {
+        fprintf(stderr, "error pages not reloaded\n");
+        return -1;
+    }
+    free_tables(tables, loaded->nb_servers);
+    tables = fresh;
+    return 0;
+}
+
+static const char *date(void)
+{
+    time_t now = time(NULL);
+    if (now != date_time)
+    {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(date_line, sizeof(date_line),
+                 "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        date_time = now;
+    }
+    return date_line;
+}
+
+int errors_send(struct connection *conn, const struct server_config *vhost,
+                enum my_status_code status, bool head_only)
+{
+    int index = status_index(status);
+    if (!tables || index < 0 || vhost < loaded->servers
+        || vhost >= loaded->servers + loaded->nb_servers)
+        return -1;
+    const struct rendered *rendered =
+        &tables[(vhost - loaded->servers) * NB_STATUSES + index];
+    struct iovec iov[3];
+    iov[0].iov_base = rendered->data;
+    iov[0].iov_len = rendered->line_len;
+    iov[1].iov_base = (char *)date();
+    iov[1].iov_len = strlen(date_line);
+    iov[2].iov_base = rendered->data + rendered->line_len;
+    iov[2].iov_len = rendered->len - rendered->line_len
+        - (head_only ? rendered->body_len : 0);
+    trace_phase(TRACE_HEADERS_SENT, statuses[index].code);
+    connection_sendv(conn, iov, 3);
+    return 0;
+}
+
+void errors_destroy(void)
+{
+    if (loaded)
+        free_tables(tables, loaded->nb_servers);
+    tables = NULL;
+    loaded = NULL;
+}
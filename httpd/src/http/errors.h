@@ -0,0 +1,50 @@
+#ifndef ERRORS_H
+#define ERRORS_H
+
+#include <stdbool.h>
+
+#include "../config/config.h"
+#include "../utils/io/connection.h"
+#include "response.h"
+
+/*
+ * Largest error page read from a file, the builtin page of the status being
+ * sent for a larger one
+ */
+#define ERRORS_PAGE_MAX (64UL << 10)
+
+/*
+ * @brief: render the error responses of every vhost, their page being read
+ * from the file the vhost configured or being the builtin one, which is
+ * also kept for a file larger than ERRORS_PAGE_MAX
+ *
+ * @return 0 on success, -1 if a configured page could not be read
+ */
+int errors_init(const struct config *config);
+
+/*
+ * @brief: read the configured pages again, the previous responses being
+ * kept if one of them could not be read
+ *
+ * @return 0 on success, -1 on error
+ */
+int errors_reload(void);
+
+/*
+ * @brief: send the rendered response of an error status in a single write,
+ * with the Date of the second. ERROR is sent as a 500.
+ *
+ * @param head_only: send the head without the page, for a HEAD
+ *
+ * @return 0 once it is sent, -1 if the status has no rendered response, the
+ * caller answering it itself
+ */
+int errors_send(struct connection *conn, const struct server_config *vhost,
+                enum my_status_code status, bool head_only);
+
+/*
+ * @brief: free the rendered responses
+ */
+void errors_destroy(void);
+
+#endif /*!ERRORS_H*/
@@ -0,0 +1,1076 @@
+#define _GNU_SOURCE
+
+#include "h2.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../utils/io/connection.h"
+#include "acl.h"
+#include "autoindex.h"
+#include "hpack.h"
+#include "ratelimit.h"
+#include "response.h"
+
+#define H2_HEADER_SIZE 9
+#define H2_BUFFER_SIZE (2 * (H2_HEADER_SIZE + H2_FRAME_SIZE))
+#define H2_OUT_SIZE (H2_BUFFER_SIZE + H2_FRAME_SIZE)
+#define H2_WINDOW_MAX 0x7fffffff
+#define H2_FRAME_SIZE_MAX 0xffffff
+#define H2_DEFAULT_WEIGHT 16
+#define H2_SETTINGS_MAX 128
+
+enum h2_frame
+{
+    H2_DATA = 0x0,
+    H2_HEADERS,
+    H2_PRIORITY,
+    H2_RST_STREAM,
+    H2_SETTINGS,
+    H2_PUSH_PROMISE,
+    H2_PING,
+    H2_GOAWAY,
+    H2_WINDOW_UPDATE,
+    H2_CONTINUATION
+};
+
+enum h2_flag
+{
+    H2_END_STREAM = 0x1,
+    H2_ACK = 0x1,
+    H2_END_HEADERS = 0x4,
+    H2_PADDED = 0x8,
+    H2_PRIORITY_FLAG = 0x20
+};
+
+enum h2_error
+{
+    H2_NO_ERROR = 0x0,
+    H2_PROTOCOL_ERROR,
+    H2_INTERNAL_ERROR,
+    H2_FLOW_CONTROL_ERROR,
+    H2_SETTINGS_TIMEOUT,
+    H2_STREAM_CLOSED,
+    H2_FRAME_SIZE_ERROR,
+    H2_REFUSED_STREAM,
+    H2_CANCEL,
+    H2_COMPRESSION_ERROR,
+    H2_ENHANCE_YOUR_CALM = 0xb
+};
+
+enum h2_setting
+{
+    H2_HEADER_TABLE_SIZE = 0x1,
+    H2_ENABLE_PUSH,
+    H2_MAX_CONCURRENT_STREAMS,
+    H2_INITIAL_WINDOW_SIZE,
+    H2_MAX_FRAME_SIZE
+};
+
+/*
+ * @brief: a stream which response body is being sent
+ *
+ * @param id: the stream identifier
+ * @param window: the flow control window of the client for the stream
+ * @param fd: the file the body is read from
+ * @param listing: the directory listing the body is sent from instead, fd
+ * being -1
+ * @param offset: the offset of the next byte to send in the file
+ * @param remaining: the number of bytes left to send
+ * @param weight: the weight of the stream, from 1 to 256
+ * @param pass: the virtual time at which the stream is next served, which
+ * grows with the bytes sent divided by the weight
+ * @param remote_closed: the client ended its side of the stream
+ */
+struct h2_stream
+{
+    uint32_t id;
+    int64_t window;
+    int fd;
+    struct listing *listing;
+    off_t offset;
+    size_t remaining;
+    unsigned weight;
+    uint64_t pass;
+    bool remote_closed;
+};
+
+/*
+ * @brief: the state of an HTTP/2 connection
+ *
+ * @param window: the connection flow control window of the client
+ * @param initial_window: the initial window of the streams, set by the client
+ * @param max_frame: the largest frame the client accepts
+ * @param last_stream: the highest stream opened by the client
+ * @param clock: the pass of the last stream served
+ * @param error: the error sent in GOAWAY when the connection ends, -1 for a
+ * connection closed by the client
+ * @param block_stream: the stream of the header block being received, 0 if
+ * no CONTINUATION is expected
+ * @param started: the client preface was received
+ * @param out: the frames queued for the client, up to out_len, the bytes
+ * before out_sent being sent already
+ * @param sending: the stream whose file follows the last DATA header of out,
+ * for sending_left bytes, NULL if none does
+ */
+struct h2_connection
+{
+    struct connection *conn;
+    struct server_config **vhosts;
+    size_t nb_vhosts;
+    struct h2_stream streams[H2_MAX_STREAMS];
+    size_t nb_streams;
+    int64_t window;
+    int64_t initial_window;
+    uint32_t max_frame;
+    uint32_t last_stream;
+    uint64_t clock;
+    bool goaway;
+    int error;
+    uint32_t block_stream;
+    unsigned char block_flags;
+    unsigned block_weight;
+    size_t block_len;
+    unsigned char block[H2_HEADER_BLOCK_MAX];
+    size_t in_len;
+    unsigned char in[H2_BUFFER_SIZE];
+    bool started;
+    size_t out_len;
+    size_t out_sent;
+    unsigned char out[H2_OUT_SIZE];
+    struct h2_stream *sending;
+    size_t sending_left;
+    struct hpack hpack;
+};
+
+/*
+ * @brief: the request being built from the fields of a header block
+ *
+ * @param malformed: the block breaks the rules of RFC 9113, section 8.2
+ */
+struct h2_request
+{
+    struct request *req;
+    bool has_method;
+    bool regular;
+    bool malformed;
+};
+
+int h2_is_preface(const char *buffer, size_t len)
+{
+    return len >= H2_PREFACE_LINE
+        && !memcmp(buffer, H2_PREFACE, H2_PREFACE_LINE);
+}
+
+int h2_is_upgrade(const struct request *req)
+{
+    return req && req->upgrade && req->http2_settings
+        && req->upgrade->size == 3
+        && !strncasecmp(req->upgrade->data, "h2c", 3)
+        && (req->method == GET || req->method == HEAD)
+        && !req->content_length;
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8
+        | p[3];
+}
+
+static void put_u32(unsigned char *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static int connection_error(struct h2_connection *c, int error)
+{
+    c->error = error;
+    return -1;
+}
+
+static void put_header(unsigned char *p, size_t len, int type, int flags,
+                       uint32_t stream)
+{
+    p[0] = len >> 16;
+    p[1] = len >> 8;
+    p[2] = len;
+    p[3] = type;
+    p[4] = flags;
+    put_u32(p + 5, stream);
+}
+
+/*
+ * @brief: queue a frame for the client, the output being flushed as the
+ * socket takes it
+ */
+static int send_frame(struct h2_connection *c, int type, int flags,
+                      uint32_t stream, const void *payload, size_t len)
+{
+    if (c->out_len + H2_HEADER_SIZE + len > H2_OUT_SIZE)
+        return connection_error(c, H2_INTERNAL_ERROR);
+    put_header(c->out + c->out_len, len, type, flags, stream);
+    if (len)
+        memcpy(c->out + c->out_len + H2_HEADER_SIZE, payload, len);
+    c->out_len += H2_HEADER_SIZE + len;
+    return 0;
+}
+
+static int send_rst(struct h2_connection *c, uint32_t stream, uint32_t error)
+{
+    unsigned char payload[4];
+    put_u32(payload, error);
+    return send_frame(c, H2_RST_STREAM, 0, stream, payload, 4);
+}
+
+static int send_window_update(struct h2_connection *c, uint32_t stream,
+                              uint32_t increment)
+{
+    unsigned char payload[4];
+    put_u32(payload, increment);
+    return send_frame(c, H2_WINDOW_UPDATE, 0, stream, payload, 4);
+}
+
+static struct h2_stream *find_stream(struct h2_connection *c, uint32_t id)
+{
+    for (size_t i = 0; i < c->nb_streams; i++)
+    {
+        if (c->streams[i].id == id)
+            return &c->streams[i];
+    }
+    return NULL;
+}
+
+static void close_stream(struct h2_connection *c, struct h2_stream *s)
+{
+    if (s->fd != -1)
+        close(s->fd);
+    autoindex_release(s->listing);
+    *s = c->streams[--c->nb_streams];
+}
+
+static enum method method_of(const char *name, size_t len)
+{
+    static const char *names[] = { "GET", "HEAD", "PUT", "POST" };
+    for (int i = GET; i < OTHER; i++)
+    {
+        if (strlen(names[i]) == len && !memcmp(names[i], name, len))
+            return i;
+    }
+    return OTHER;
+}
+
+/*
+ * @brief: set a field of the request once, a second value making the
+ * request malformed
+ */
+static void set_field(struct h2_request *r, struct string **field,
+                      const struct hpack_field *f)
+{
+    if (*field)
+        r->malformed = true;
+    else
+        *field = string_create(f->value, f->value_len);
+}
+
+static int field_callback(const struct hpack_field *f, void *data)
+{
+    struct h2_request *r = data;
+    struct request *req = r->req;
+    if (f->name_len && f->name[0] == ':')
+    {
+        r->malformed |= r->regular;
+        if (f->name_len == 7 && !memcmp(f->name, ":method", 7))
+        {
+            r->malformed |= r->has_method;
+            r->has_method = true;
+            req->method = method_of(f->value, f->value_len);
+        }
+        else if (f->name_len == 5 && !memcmp(f->name, ":path", 5))
+            set_field(r, &req->target, f);
+        else if (f->name_len == 10 && !memcmp(f->name, ":authority", 10))
+            set_field(r, &req->host, f);
+        else if (f->name_len != 7 || memcmp(f->name, ":scheme", 7))
+            r->malformed = true;
+        return 0;
+    }
+    r->regular = true;
+    for (size_t i = 0; i < f->name_len; i++)
+        r->malformed |= f->name[i] >= 'A' && f->name[i] <= 'Z';
+    if (f->name_len == 4 && !memcmp(f->name, "host", 4) && !req->host)
+        req->host = string_create(f->value, f->value_len);
+    else if (f->name_len == 14 && !memcmp(f->name, "content-length", 14))
+        set_field(r, &req->content_length, f);
+    else if (f->name_len == 15 && !memcmp(f->name, "accept-encoding", 15)
+             && !req->accept_encoding)
+        req->accept_encoding = string_create(f->value, f->value_len);
+    else if (f->name_len == 13 && !memcmp(f->name, "if-none-match", 13)
+             && !req->if_none_match)
+        req->if_none_match = string_create(f->value, f->value_len);
+    return 0;
+}
+
+static int send_headers(struct h2_connection *c, uint32_t id,
+                        struct response *res, bool end_stream)
+{
+    const char *date = res->date ? res->date : "";
+    const char *length = res->content_length;
+    const char *type = res->content_type;
+    const char *etag = res->etag;
+    const char *encoding = res->content_encoding;
+    const char *cache_control = res->cache_control;
+    size_t size = 96 + strlen(date) + (length ? strlen(length) : 0)
+        + (type ? strlen(type) : 0) + (etag ? strlen(etag) : 0)
+        + (encoding ? strlen(encoding) : 0)
+        + (cache_control ? strlen(cache_control) : 0);
+    unsigned char *block = malloc(size);
+    if (!block)
+        return -1;
+    int status = res->status_code ? (int)res->status_code : INTERNAL_ERROR;
+    size_t len = hpack_encode_status(block, status);
+    if (res->date)
+        len += hpack_encode(block + len, HPACK_DATE, date, strlen(date));
+    if (length)
+        len += hpack_encode(block + len, HPACK_CONTENT_LENGTH, length,
+                            strlen(length));
+    if (type)
+        len += hpack_encode(block + len, HPACK_CONTENT_TYPE, type,
+                            strlen(type));
+    if (etag)
+        len += hpack_encode(block + len, HPACK_ETAG, etag, strlen(etag));
+    if (encoding)
+        len += hpack_encode(block + len, HPACK_CONTENT_ENCODING, encoding,
+                            strlen(encoding));
+    if (res->vary)
+        len += hpack_encode(block + len, HPACK_VARY, "accept-encoding", 15);
+    if (cache_control)
+        len += hpack_encode(block + len, HPACK_CACHE_CONTROL, cache_control,
+                            strlen(cache_control));
+    int ret = send_frame(c, H2_HEADERS,
+                         H2_END_HEADERS | (end_stream ? H2_END_STREAM : 0), id,
+                         block, len);
+    free(block);
+    return ret;
+}
+
+/*
+ * @brief: render the whole listing of the directory a response names, its
+ * length being sent in the headers
+ */
+static struct listing *render_listing(struct response *res,
+                                      const struct request *req)
+{
+    struct listing *listing =
+        autoindex_lookup(res->path, req->target->data, req->target->size);
+    int done = 0;
+    while (listing && !done)
+    {
+        done = autoindex_render(listing);
+        if (done < 0)
+        {
+            autoindex_release(listing);
+            return NULL;
+        }
+    }
+    res->content_length = listing ? malloc(32) : NULL;
+    if (!res->content_length)
+    {
+        autoindex_release(listing);
+        return NULL;
+    }
+    sprintf(res->content_length, "%zu", listing->size);
+    return listing;
+}
+
+/*
+ * @brief: answer a request, sending the headers at once and queuing the
+ * body of the file or of the directory listing for the scheduler. Uploads
+ * and proxied vhosts are not served over HTTP/2 yet.
+ */
+static int serve(struct h2_connection *c, uint32_t id, struct request *req,
+                 bool remote_closed, unsigned weight)
+{
+    struct server_config *vhost = request_vhost(req, c->vhosts, c->nb_vhosts);
+    struct response *res;
+    if (!acl_allowed(vhost, &c->conn->peer))
+    {
+        res = create_response(NULL, vhost);
+        response_set_status(res, FORBIDDEN, "Forbidden");
+    }
+    else if (!ratelimit_request(&c->conn->peer))
+    {
+        res = create_response(NULL, vhost);
+        response_set_status(res, TOO_MANY_REQUESTS, "Too Many Requests");
+    }
+    else if (vhost->proxy_pass || req->method == PUT || req->method == POST)
+    {
+        res = create_response(NULL, vhost);
+        response_set_status(res, NOT_IMPLEMENTED, "Not Implemented");
+    }
+    else
+        res = create_response(req, vhost);
+    if (!res)
+        return connection_error(c, H2_INTERNAL_ERROR);
+
+    int fd = -1;
+    size_t size = 0;
+    struct listing *listing = NULL;
+    if (res->status_code == VALID && req->method == GET && res->listing
+        && (listing = render_listing(res, req)))
+        size = listing->size;
+    else if (res->status_code == VALID && req->method == GET && res->listing)
+    {
+        response_set_status(res, INTERNAL_ERROR, "Internal Server Error");
+        res->content_type = NULL;
+    }
+    else if (res->status_code == VALID && req->method == GET
+             && (size = strtoull(res->content_length, NULL, 10))
+             && (fd = res->fd >= 0 ? res->fd
+                                   : open(res->path, O_RDONLY | O_CLOEXEC))
+                 < 0)
+    {
+        response_set_status(res, INTERNAL_ERROR, "Internal Server Error");
+        free(res->content_length);
+        res->content_length = NULL;
+        res->content_type = NULL;
+    }
+    int ret = send_headers(c, id, res, fd == -1 && !listing);
+    off_t offset = res->offset;
+    if (fd == res->fd)
+        res->fd = -1;
+    response_destroy(res);
+    if (fd == -1 && !listing)
+        return ret < 0 || remote_closed ? ret : send_rst(c, id, H2_NO_ERROR);
+
+    struct h2_stream *s = &c->streams[c->nb_streams++];
+    s->id = id;
+    s->window = c->initial_window;
+    s->fd = fd;
+    s->listing = listing;
+    s->offset = fd != -1 ? offset : 0;
+    s->remaining = size;
+    s->weight = weight;
+    s->pass = c->clock;
+    s->remote_closed = remote_closed;
+    return ret;
+}
+
+/*
+ * @brief: decode the header block received and serve the request it opens
+ */
+static int end_header_block(struct h2_connection *c)
+{
+    uint32_t id = c->block_stream;
+    c->block_stream = 0;
+    struct h2_request r = { calloc(1, sizeof(struct request)), false, false,
+                            false };
+    if (!r.req)
+        return connection_error(c, H2_INTERNAL_ERROR);
+    r.req->method = OTHER;
+    if (hpack_decode(&c->hpack, c->block, c->block_len, field_callback, &r)
+        < 0)
+    {
+        request_destroy(r.req);
+        return connection_error(c, H2_COMPRESSION_ERROR);
+    }
+
+    int ret = 0;
+    bool end_stream = c->block_flags & H2_END_STREAM;
+    struct h2_stream *s = find_stream(c, id);
+    if (id <= c->last_stream)
+    {
+        if (s && end_stream)
+            s->remote_closed = true;
+        request_destroy(r.req);
+        return 0;
+    }
+    c->last_stream = id;
+    if (r.malformed || !r.has_method || !r.req->target)
+        ret = send_rst(c, id, H2_PROTOCOL_ERROR);
+    else if (c->nb_streams == H2_MAX_STREAMS || c->goaway)
+        ret = send_rst(c, id, H2_REFUSED_STREAM);
+    else
+        ret = serve(c, id, r.req, end_stream, c->block_weight);
+    request_destroy(r.req);
+    return ret;
+}
+
+static int append_block(struct h2_connection *c, const unsigned char *p,
+                        size_t len, int flags)
+{
+    if (c->block_len + len > H2_HEADER_BLOCK_MAX)
+        return connection_error(c, H2_ENHANCE_YOUR_CALM);
+    memcpy(c->block + c->block_len, p, len);
+    c->block_len += len;
+    if (flags & H2_END_HEADERS)
+        return end_header_block(c);
+    return 0;
+}
+
+static int on_headers(struct h2_connection *c, int flags, uint32_t id,
+                      const unsigned char *p, size_t len)
+{
+    size_t start = 0;
+    size_t pad = 0;
+    unsigned weight = H2_DEFAULT_WEIGHT;
+    if (!id || !(id & 1))
+        return connection_error(c, H2_PROTOCOL_ERROR);
+    if (flags & H2_PADDED)
+    {
+        if (len < 1)
+            return connection_error(c, H2_FRAME_SIZE_ERROR);
+        pad = p[start++];
+    }
+    if (flags & H2_PRIORITY_FLAG)
+    {
+        if (len < start + 5)
+            return connection_error(c, H2_FRAME_SIZE_ERROR);
+        weight = p[start + 4] + 1;
+        start += 5;
+    }
+    if (start + pad > len)
+        return connection_error(c, H2_PROTOCOL_ERROR);
+    c->block_stream = id;
+    c->block_flags = flags;
+    c->block_weight = weight;
+    c->block_len = 0;
+    return append_block(c, p + start, len - start - pad, flags);
+}
+
+static int apply_settings(struct h2_connection *c, const unsigned char *p,
+                          size_t len)
+{
+    for (size_t i = 0; i + 6 <= len; i += 6)
+    {
+        unsigned id = p[i] << 8 | p[i + 1];
+        uint32_t value = get_u32(p + i + 2);
+        if (id == H2_ENABLE_PUSH && value > 1)
+            return connection_error(c, H2_PROTOCOL_ERROR);
+        if (id == H2_INITIAL_WINDOW_SIZE)
+        {
+            if (value > H2_WINDOW_MAX)
+                return connection_error(c, H2_FLOW_CONTROL_ERROR);
+            for (size_t j = 0; j < c->nb_streams; j++)
+            {
+                c->streams[j].window += (int64_t)value - c->initial_window;
+                if (c->streams[j].window > H2_WINDOW_MAX)
+                    return connection_error(c, H2_FLOW_CONTROL_ERROR);
+            }
+            c->initial_window = value;
+        }
+        else if (id == H2_MAX_FRAME_SIZE)
+        {
+            if (value < H2_FRAME_SIZE || value > H2_FRAME_SIZE_MAX)
+                return connection_error(c, H2_PROTOCOL_ERROR);
+            c->max_frame = value;
+        }
+    }
+    return 0;
+}
+
+static int on_window_update(struct h2_connection *c, uint32_t id,
+                            const unsigned char *p, size_t len)
+{
+    if (len != 4)
+        return connection_error(c, H2_FRAME_SIZE_ERROR);
+    uint32_t increment = get_u32(p) & H2_WINDOW_MAX;
+    if (!id)
+    {
+        c->window += increment;
+        if (!increment || c->window > H2_WINDOW_MAX)
+            return connection_error(c, increment ? H2_FLOW_CONTROL_ERROR
+                                                 : H2_PROTOCOL_ERROR);
+        return 0;
+    }
+    struct h2_stream *s = find_stream(c, id);
+    if (!s)
+        return 0;
+    s->window += increment;
+    if (increment && s->window <= H2_WINDOW_MAX)
+        return 0;
+    close_stream(c, s);
+    return send_rst(c, id, increment ? H2_FLOW_CONTROL_ERROR
+                                     : H2_PROTOCOL_ERROR);
+}
+
+static int on_control(struct h2_connection *c, int type, int flags,
+                      uint32_t id, const unsigned char *p, size_t len)
+{
+    if (id)
+        return connection_error(c, H2_PROTOCOL_ERROR);
+    if (type == H2_SETTINGS)
+    {
+        if ((flags & H2_ACK) ? len != 0 : len % 6 != 0)
+            return connection_error(c, H2_FRAME_SIZE_ERROR);
+        if (flags & H2_ACK)
+            return 0;
+        if (apply_settings(c, p, len) < 0)
+            return -1;
+        return send_frame(c, H2_SETTINGS, H2_ACK, 0, NULL, 0);
+    }
+    if (type == H2_PING)
+    {
+        if (len != 8)
+            return connection_error(c, H2_FRAME_SIZE_ERROR);
+        if (flags & H2_ACK)
+            return 0;
+        return send_frame(c, H2_PING, H2_ACK, 0, p, 8);
+    }
+    c->goaway = true;
+    return 0;
+}
+
+static int handle_frame(struct h2_connection *c, int type, int flags,
+                        uint32_t id, const unsigned char *p, size_t len)
+{
+    struct h2_stream *s;
+    if (c->block_stream && (type != H2_CONTINUATION || id != c->block_stream))
+        return connection_error(c, H2_PROTOCOL_ERROR);
+    switch (type)
+    {
+    case H2_DATA:
+        if (!id || id > c->last_stream)
+            return connection_error(c, H2_PROTOCOL_ERROR);
+        if ((s = find_stream(c, id)) && (flags & H2_END_STREAM))
+            s->remote_closed = true;
+        return len ? send_window_update(c, 0, len) : 0;
+    case H2_HEADERS:
+        return on_headers(c, flags, id, p, len);
+    case H2_CONTINUATION:
+        if (!c->block_stream)
+            return connection_error(c, H2_PROTOCOL_ERROR);
+        return append_block(c, p, len, flags);
+    case H2_PRIORITY:
+        if (!id)
+            return connection_error(c, H2_PROTOCOL_ERROR);
+        if (len == 5 && (s = find_stream(c, id)))
+            s->weight = p[4] + 1;
+        return 0;
+    case H2_RST_STREAM:
+        if (!id || id > c->last_stream)
+            return connection_error(c, H2_PROTOCOL_ERROR);
+        if (len != 4)
+            return connection_error(c, H2_FRAME_SIZE_ERROR);
+        if ((s = find_stream(c, id)))
+            close_stream(c, s);
+        return 0;
+    case H2_SETTINGS:
+    case H2_PING:
+    case H2_GOAWAY:
+        return on_control(c, type, flags, id, p, len);
+    case H2_PUSH_PROMISE:
+        return connection_error(c, H2_PROTOCOL_ERROR);
+    case H2_WINDOW_UPDATE:
+        return on_window_update(c, id, p, len);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * @brief: take the rest of the client preface once it is received
+ *
+ * @return 0 on success, -1 if the client does not speak HTTP/2
+ */
+static int take_preface(struct h2_connection *c)
+{
+    if (c->started || c->in_len < H2_PREFACE_LEN)
+        return 0;
+    if (memcmp(c->in, H2_PREFACE, H2_PREFACE_LEN))
+        return connection_error(c, H2_PROTOCOL_ERROR);
+    c->in_len -= H2_PREFACE_LEN;
+    memmove(c->in, c->in + H2_PREFACE_LEN, c->in_len);
+    c->started = true;
+    return 0;
+}
+
+/*
+ * @brief: handle the complete frames of the input buffer, H2_TURN_FRAMES at
+ * most and as long as the output has room for what they answer
+ *
+ * @return 0 on success, -1 if the connection must end
+ */
+static int process_frames(struct h2_connection *c)
+{
+    if (take_preface(c) < 0)
+        return -1;
+    size_t off = 0;
+    for (int handled = 0; c->started && handled < H2_TURN_FRAMES
+         && c->out_len <= H2_FRAME_SIZE && c->in_len - off >= H2_HEADER_SIZE;
+         handled++)
+    {
+        const unsigned char *h = c->in + off;
+        size_t len = (size_t)h[0] << 16 | h[1] << 8 | h[2];
+        if (len > H2_FRAME_SIZE)
+            return connection_error(c, H2_FRAME_SIZE_ERROR);
+        if (c->in_len - off < H2_HEADER_SIZE + len)
+            break;
+        if (handle_frame(c, h[3], h[4], get_u32(h + 5) & H2_WINDOW_MAX,
+                         h + H2_HEADER_SIZE, len)
+            < 0)
+            return -1;
+        off += H2_HEADER_SIZE + len;
+    }
+    memmove(c->in, c->in + off, c->in_len - off);
+    c->in_len -= off;
+    return 0;
+}
+
+/*
+ * @brief: return whether the input buffer holds the preface or a frame not
+ * handled yet
+ */
+static bool has_frame(const struct h2_connection *c)
+{
+    if (!c->started)
+        return c->in_len >= H2_PREFACE_LEN;
+    if (c->in_len < H2_HEADER_SIZE)
+        return false;
+    size_t len = (size_t)c->in[0] << 16 | c->in[1] << 8 | c->in[2];
+    return len > H2_FRAME_SIZE || c->in_len >= H2_HEADER_SIZE + len;
+}
+
+/*
+ * @brief: read what the client sent, without waiting for it
+ *
+ * @return 0 on success, -1 if the client closed the connection
+ */
+static int read_frames(struct h2_connection *c)
+{
+    ssize_t n = connection_recv(c->conn, c->in + c->in_len,
+                                H2_BUFFER_SIZE - c->in_len);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (n <= 0)
+        return -1;
+    c->in_len += n;
+    return 0;
+}
+
+/*
+ * @brief: return the stream with the smallest pass among those with bytes
+ * to send and room in their window, NULL if none can send
+ */
+static struct h2_stream *next_stream(struct h2_connection *c)
+{
+    struct h2_stream *best = NULL;
+    if (c->window <= 0)
+        return NULL;
+    for (size_t i = 0; i < c->nb_streams; i++)
+    {
+        struct h2_stream *s = &c->streams[i];
+        if (s->window > 0 && (!best || s->pass < best->pass))
+            best = s;
+    }
+    return best;
+}
+
+/*
+ * @brief: close a stream whose body was sent, resetting it unless the
+ * client ended its side
+ */
+static int end_stream(struct h2_connection *c, struct h2_stream *s)
+{
+    uint32_t id = s->id;
+    bool remote_closed = s->remote_closed;
+    close_stream(c, s);
+    return remote_closed ? 0 : send_rst(c, id, H2_NO_ERROR);
+}
+
+/*
+ * @brief: send what the socket takes of the output, then of the file which
+ * follows it, the stream being ended once its last DATA frame is sent
+ *
+ * @return 0 on success, -1 on error
+ */
+static int flush(struct h2_connection *c)
+{
+    struct h2_stream *s = c->sending;
+    size_t head_left = c->out_len - c->out_sent;
+    if (!head_left && !s)
+        return 0;
+    ssize_t n = s
+        ? connection_sendfile_some(c->conn, c->out + c->out_sent, head_left,
+                                   s->fd, &s->offset, c->sending_left)
+        : connection_send_some(c->conn, c->out + c->out_sent, head_left);
+    if (n < 0)
+        return -1;
+    size_t from_head = (size_t)n < head_left ? (size_t)n : head_left;
+    c->out_sent += from_head;
+    if (s)
+        c->sending_left -= n - from_head;
+    if (c->out_sent < c->out_len || (s && c->sending_left))
+        return 0;
+    // The output is only moved once sent, TLS wanting it where it was
+    c->out_len = 0;
+    c->out_sent = 0;
+    c->sending = NULL;
+    return s && !s->remaining ? end_stream(c, s) : 0;
+}
+
+/*
+ * @brief: copy n bytes of a listing from offset to out
+ */
+static void listing_copy(const struct listing *listing, off_t offset,
+                         unsigned char *out, size_t n)
+{
+    const struct listing_segment *segment = listing->segments;
+    while ((size_t)offset >= segment->len)
+    {
+        offset -= segment->len;
+        segment = segment->next;
+    }
+    for (; n; segment = segment->next)
+    {
+        size_t len = segment->len - offset;
+        if (len > n)
+            len = n;
+        memcpy(out, segment->data + offset, len);
+        out += len;
+        n -= len;
+        offset = 0;
+    }
+}
+
+/*
+ * @brief: copy the next n bytes of the body of a stream to the output
+ *
+ * @return 0 on success, -1 on error
+ */
+static int copy_data(struct h2_connection *c, struct h2_stream *s, size_t n)
+{
+    unsigned char *out = c->out + c->out_len;
+    c->out_len += n;
+    if (s->listing)
+    {
+        listing_copy(s->listing, s->offset, out, n);
+        s->offset += n;
+        return 0;
+    }
+    while (n)
+    {
+        ssize_t got = pread(s->fd, out, n, s->offset);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+        out += got;
+        n -= got;
+        s->offset += got;
+    }
+    return 0;
+}
+
+/*
+ * @brief: queue the next DATA frame of the stream, its payload following
+ * from the file with sendfile() unless it is encrypted in user space, or
+ * being copied from the file or from the segments of a listing
+ */
+static int send_data(struct h2_connection *c, struct h2_stream *s)
+{
+    size_t n = s->remaining;
+    if ((int64_t)n > s->window)
+        n = s->window;
+    if ((int64_t)n > c->window)
+        n = c->window;
+    if (n > H2_FRAME_SIZE)
+        n = H2_FRAME_SIZE;
+    bool last = n == s->remaining;
+    put_header(c->out + c->out_len, n, H2_DATA, last ? H2_END_STREAM : 0,
+               s->id);
+    c->out_len += H2_HEADER_SIZE;
+    if (s->fd != -1 && (!c->conn->ssl || c->conn->ktls_send))
+    {
+        c->sending = s;
+        c->sending_left = n;
+    }
+    else if (copy_data(c, s, n) < 0)
+        return -1;
+
+    s->window -= n;
+    s->remaining -= n;
+    c->window -= n;
+    c->clock = s->pass;
+    s->pass += ((uint64_t)n << 8) / s->weight;
+    return last && !c->sending ? end_stream(c, s) : 0;
+}
+
+/*
+ * @brief: decode the base64url payload of the HTTP2-Settings header
+ *
+ * @return the length of the payload, -1 if it is invalid
+ */
+static long base64url_decode(const struct string *in, unsigned char *out)
+{
+    uint32_t bits = 0;
+    int nbits = 0;
+    long len = 0;
+    for (size_t i = 0; i < in->size && in->data[i] != '='; i++)
+    {
+        char ch = in->data[i];
+        int value;
+        if (ch >= 'A' && ch <= 'Z')
+            value = ch - 'A';
+        else if (ch >= 'a' && ch <= 'z')
+            value = ch - 'a' + 26;
+        else if (ch >= '0' && ch <= '9')
+            value = ch - '0' + 52;
+        else if (ch == '-' || ch == '+')
+            value = 62;
+        else if (ch == '_' || ch == '/')
+            value = 63;
+        else
+            return -1;
+        bits = bits << 6 | value;
+        if ((nbits += 6) >= 8)
+        {
+            if (len == H2_SETTINGS_MAX)
+                return -1;
+            nbits -= 8;
+            out[len++] = bits >> nbits;
+        }
+    }
+    return len;
+}
+
+/*
+ * @brief: queue the settings of the server, and serve the request which
+ * upgraded the connection if any
+ */
+static int start(struct h2_connection *c, struct request *upgrade)
+{
+    unsigned char settings[6];
+    settings[0] = 0;
+    settings[1] = H2_MAX_CONCURRENT_STREAMS;
+    put_u32(settings + 2, H2_MAX_STREAMS);
+    if (send_frame(c, H2_SETTINGS, 0, 0, settings, sizeof(settings)) < 0)
+        return -1;
+    if (upgrade)
+    {
+        unsigned char payload[H2_SETTINGS_MAX];
+        long len = base64url_decode(upgrade->http2_settings, payload);
+        if (len < 0 || len % 6 || apply_settings(c, payload, len) < 0)
+            return connection_error(c, H2_PROTOCOL_ERROR);
+        c->last_stream = 1;
+        if (serve(c, 1, upgrade, true, H2_DEFAULT_WEIGHT) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+size_t h2_footprint(void)
+{
+    return sizeof(struct h2_connection);
+}
+
+struct h2_connection *h2_start(struct connection *conn,
+                               struct server_config **vhosts,
+                               size_t nb_vhosts, const char *buffered,
+                               size_t nbuffered, struct request *upgrade)
+{
+    struct h2_connection *c = malloc(sizeof(struct h2_connection));
+    if (!c)
+        return NULL;
+    c->conn = conn;
+    c->vhosts = vhosts;
+    c->nb_vhosts = nb_vhosts;
+    c->nb_streams = 0;
+    c->window = H2_WINDOW;
+    c->initial_window = H2_WINDOW;
+    c->max_frame = H2_FRAME_SIZE;
+    c->last_stream = 0;
+    c->clock = 0;
+    c->goaway = false;
+    c->error = -1;
+    c->block_stream = 0;
+    c->in_len = nbuffered < H2_BUFFER_SIZE ? nbuffered : H2_BUFFER_SIZE;
+    memcpy(c->in, buffered, c->in_len);
+    c->started = false;
+    c->out_len = 0;
+    c->out_sent = 0;
+    c->sending = NULL;
+    c->sending_left = 0;
+    hpack_init(&c->hpack);
+    // Frames are written whole, Nagle would only hold back the last one
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (start(c, upgrade) < 0 && c->error < 0)
+    {
+        h2_end(c, false);
+        return NULL;
+    }
+    return c;
+}
+
+short h2_events(const struct h2_connection *c)
+{
+    short events = c->out_sent < c->out_len || c->sending ? POLLOUT : 0;
+    if (!c->sending && c->out_len <= H2_FRAME_SIZE
+        && c->in_len < H2_BUFFER_SIZE)
+        events |= POLLIN;
+    return events;
+}
+
+bool h2_busy(struct h2_connection *c)
+{
+    if (c->sending || c->out_len > H2_FRAME_SIZE)
+        return false;
+    return has_frame(c) || next_stream(c) || connection_pending(c->conn);
+}
+
+int h2_turn(struct h2_connection *c)
+{
+    if (c->error >= 0 || flush(c) < 0)
+        return -1;
+    if (!c->sending && c->out_len <= H2_FRAME_SIZE)
+    {
+        if (c->in_len < H2_BUFFER_SIZE && read_frames(c) < 0)
+            return -1;
+        if (process_frames(c) < 0)
+            return -1;
+    }
+    struct h2_stream *s;
+    for (int sent = 0; sent < H2_TURN_FRAMES && !c->sending
+         && c->out_len <= H2_FRAME_SIZE && (s = next_stream(c));
+         sent++)
+    {
+        if (send_data(c, s) < 0 || (c->sending && flush(c) < 0))
+            return -1;
+    }
+    if (flush(c) < 0)
+        return -1;
+    return c->error >= 0 || (c->goaway && !c->nb_streams) ? -1 : 0;
+}
+
+void h2_end(struct h2_connection *c, bool closing)
+{
+    if (closing && c->error < 0)
+        c->error = H2_NO_ERROR;
+    // A file being sent leaves no room for the GOAWAY behind its header
+    if (c->error >= 0 && !c->sending)
+    {
+        unsigned char payload[8];
+        put_u32(payload, c->last_stream);
+        put_u32(payload + 4, c->error);
+        if (!send_frame(c, H2_GOAWAY, 0, 0, payload, sizeof(payload)))
+            flush(c);
+    }
+    while (c->nb_streams)
+        close_stream(c, &c->streams[0]);
+    hpack_destroy(&c->hpack);
+    free(c);
+}
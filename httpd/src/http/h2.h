@@ -0,0 +1,110 @@
+#ifndef H2_H
+#define H2_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../config/config.h"
+#include "../utils/io/connection.h"
+#include "request.h"
+
+/*
+ * Connection preface of the client, and the part of it telling an HTTP/2
+ * connection from an HTTP/1.x one
+ */
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+#define H2_PREFACE_LINE 16
+
+/*
+ * Streams served at once, largest frame received, initial flow control
+ * window and largest header block accepted
+ */
+#define H2_MAX_STREAMS 100
+#define H2_FRAME_SIZE 16384
+#define H2_WINDOW 65535
+#define H2_HEADER_BLOCK_MAX 65536
+
+/*
+ * Seconds a connection may stay without anything to read or to send
+ */
+#define H2_IDLE_TIMEOUT 5
+
+/*
+ * Frames received handled, then DATA frames queued, in one turn of a
+ * connection
+ */
+#define H2_TURN_FRAMES 16
+
+struct h2_connection;
+
+/*
+ * @brief: return 1 if the bytes received on a connection start with the
+ * HTTP/2 preface, the client speaking HTTP/2 with prior knowledge
+ */
+int h2_is_preface(const char *buffer, size_t len);
+
+/*
+ * @brief: return 1 if the request asks to upgrade the connection to HTTP/2
+ * over cleartext TCP and can be answered over it
+ */
+int h2_is_upgrade(const struct request *req);
+
+/*
+ * @brief: return the memory a connection holds, besides its HPACK table
+ */
+size_t h2_footprint(void);
+
+/*
+ * @brief: start serving an HTTP/2 connection on a non-blocking socket,
+ * without reading or writing it yet. Requests are multiplexed on streams,
+ * the bodies of the files being sent in DATA frames with sendfile() in the
+ * order of the weights of the streams, within the flow control windows.
+ * Over TLS, the connection is entered with prior knowledge once ALPN
+ * selected "h2".
+ *
+ * @param conn: the client connection, which must outlive the HTTP/2 one
+ * @param vhosts: the vhosts of the listener, the first one being the default
+ * @param nb_vhosts: the number of vhosts
+ * @param buffered: bytes already read from the connection
+ * @param nbuffered: the number of bytes in buffered
+ * @param upgrade: the HTTP/1.1 request which upgraded the connection after
+ * 101 was sent, served on stream 1; NULL with prior knowledge
+ *
+ * @return the connection, NULL on error
+ */
+struct h2_connection *h2_start(struct connection *conn,
+                               struct server_config **vhosts,
+                               size_t nb_vhosts, const char *buffered,
+                               size_t nbuffered, struct request *upgrade);
+
+/*
+ * @brief: return what the socket of the connection is to be polled for
+ */
+short h2_events(const struct h2_connection *c);
+
+/*
+ * @brief: return whether a turn has work to do without the socket being
+ * ready, frames being received or DATA frames able to be queued
+ */
+bool h2_busy(struct h2_connection *c);
+
+/*
+ * @brief: send what the socket takes of the frames queued, handle
+ * H2_TURN_FRAMES frames received at most, then queue as many DATA frames,
+ * never waiting for the socket
+ *
+ * @return 0 on success, -1 once the connection must end
+ */
+int h2_turn(struct h2_connection *c);
+
+/*
+ * @brief: send GOAWAY if the socket takes it and free the connection, the
+ * client connection being left to the caller
+ *
+ * @param closing: the server closes a connection which had no error, for
+ * staying idle H2_IDLE_TIMEOUT seconds or for stopping
+ */
+void h2_end(struct h2_connection *c, bool closing);
+
+#endif /*!H2_H*/
@@ -0,0 +1,372 @@
+#include "hpack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HPACK_HUFFMAN_BITS 30
+#define HPACK_EOS 256
+#define HPACK_ENTRIES (HPACK_TABLE_SIZE / 32)
+
+static const struct hpack_field static_table[HPACK_STATIC_SIZE] = {
+    { ":authority", 10, "", 0 },
+    { ":method", 7, "GET", 3 },
+    { ":method", 7, "POST", 4 },
+    { ":path", 5, "/", 1 },
+    { ":path", 5, "/index.html", 11 },
+    { ":scheme", 7, "http", 4 },
+    { ":scheme", 7, "https", 5 },
+    { ":status", 7, "200", 3 },
+    { ":status", 7, "204", 3 },
+    { ":status", 7, "206", 3 },
+    { ":status", 7, "304", 3 },
+    { ":status", 7, "400", 3 },
+    { ":status", 7, "404", 3 },
+    { ":status", 7, "500", 3 },
+    { "accept-charset", 14, "", 0 },
+    { "accept-encoding", 15, "gzip, deflate", 13 },
+    { "accept-language", 15, "", 0 },
+    { "accept-ranges", 13, "", 0 },
+    { "accept", 6, "", 0 },
+    { "access-control-allow-origin", 27, "", 0 },
+    { "age", 3, "", 0 },
+    { "allow", 5, "", 0 },
+    { "authorization", 13, "", 0 },
+    { "cache-control", 13, "", 0 },
+    { "content-disposition", 19, "", 0 },
+    { "content-encoding", 16, "", 0 },
+    { "content-language", 16, "", 0 },
+    { "content-length", 14, "", 0 },
+    { "content-location", 16, "", 0 },
+    { "content-range", 13, "", 0 },
+    { "content-type", 12, "", 0 },
+    { "cookie", 6, "", 0 },
+    { "date", 4, "", 0 },
+    { "etag", 4, "", 0 },
+    { "expect", 6, "", 0 },
+    { "expires", 7, "", 0 },
+    { "from", 4, "", 0 },
+    { "host", 4, "", 0 },
+    { "if-match", 8, "", 0 },
+    { "if-modified-since", 17, "", 0 },
+    { "if-none-match", 13, "", 0 },
+    { "if-range", 8, "", 0 },
+    { "if-unmodified-since", 19, "", 0 },
+    { "last-modified", 13, "", 0 },
+    { "link", 4, "", 0 },
+    { "location", 8, "", 0 },
+    { "max-forwards", 12, "", 0 },
+    { "proxy-authenticate", 18, "", 0 },
+    { "proxy-authorization", 19, "", 0 },
+    { "range", 5, "", 0 },
+    { "referer", 7, "", 0 },
+    { "refresh", 7, "", 0 },
+    { "retry-after", 11, "", 0 },
+    { "server", 6, "", 0 },
+    { "set-cookie", 10, "", 0 },
+    { "strict-transport-security", 25, "", 0 },
+    { "transfer-encoding", 17, "", 0 },
+    { "user-agent", 10, "", 0 },
+    { "vary", 4, "", 0 },
+    { "via", 3, "", 0 },
+    { "www-authenticate", 16, "", 0 },
+};
+
+/*
+ * The Huffman code of RFC 7541, appendix B, is canonical: it is described by
+ * the number of codes of each length and the symbols sorted by code.
+ */
+static const unsigned char huffman_counts[HPACK_HUFFMAN_BITS + 1] = {
+    0, 0,  0,  0, 0, 10, 26, 32, 6,  0,  5,  3,  2,  6, 2, 3,
+    0, 0,  0,  3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0,  4,
+};
+
+static const uint16_t huffman_symbols[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51, 52,
+    53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109, 110, 112,
+    114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80,
+    81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118, 119, 120, 121, 122, 38,
+    42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62, 0, 36, 64, 91,
+    93, 126, 94, 125, 60, 96, 123, 92, 195, 208, 128, 130, 131, 162, 184, 194,
+    224, 226, 153, 161, 167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230,
+    129, 132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170, 173, 178,
+    181, 185, 186, 187, 189, 190, 196, 198, 228, 232, 233, 1, 135, 137, 138,
+    139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157, 158, 165, 166, 168,
+    174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148,
+    159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193, 200, 201,
+    202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211, 212,
+    214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20, 21, 23, 24, 25,
+    26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22, 256,
+};
+
+void hpack_init(struct hpack *hpack)
+{
+    hpack->head = 0;
+    hpack->count = 0;
+    hpack->size = 0;
+    hpack->max_size = HPACK_TABLE_SIZE;
+}
+
+/*
+ * @brief: decode an integer which first byte keeps prefix bits of it
+ *
+ * @return 0 on success, -1 if the block ends or the integer is too large
+ */
+static int decode_int(const unsigned char **p, const unsigned char *end,
+                      int prefix, size_t *value)
+{
+    size_t max = (1u << prefix) - 1;
+    if (*p >= end)
+        return -1;
+    *value = *(*p)++ & max;
+    if (*value < max)
+        return 0;
+    for (int shift = 0; *p < end && shift < 28; shift += 7)
+    {
+        unsigned char byte = *(*p)++;
+        *value += (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+/*
+ * @brief: decode Huffman coded bytes, one bit at a time against the first
+ * code of each length
+ *
+ * @return the length of the string, -1 on an invalid code or padding
+ */
+static long huffman_decode(const unsigned char *in, size_t len, char *out)
+{
+    size_t nout = 0;
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    int bits = 0;
+    uint32_t raw = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        for (int shift = 7; shift >= 0; shift--)
+        {
+            int bit = (in[i] >> shift) & 1;
+            code |= bit;
+            raw = raw << 1 | bit;
+            int count = huffman_counts[++bits];
+            if (code - first < count)
+            {
+                int symbol = huffman_symbols[index + code - first];
+                if (symbol == HPACK_EOS || nout == HPACK_STRING_MAX)
+                    return -1;
+                out[nout++] = symbol;
+                code = first = index = bits = 0;
+                raw = 0;
+                continue;
+            }
+            if (bits == HPACK_HUFFMAN_BITS)
+                return -1;
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+    }
+    if (bits > 7 || raw != (1u << bits) - 1)
+        return -1;
+    return nout;
+}
+
+/*
+ * @brief: decode a string literal into out
+ *
+ * @return the length of the string, -1 on error
+ */
+static long decode_string(const unsigned char **p, const unsigned char *end,
+                          char *out)
+{
+    size_t len;
+    if (*p >= end)
+        return -1;
+    int huffman = **p & 0x80;
+    if (decode_int(p, end, 7, &len) < 0 || len > (size_t)(end - *p))
+        return -1;
+    const unsigned char *data = *p;
+    *p += len;
+    if (huffman)
+        return huffman_decode(data, len, out);
+    if (len > HPACK_STRING_MAX)
+        return -1;
+    memcpy(out, data, len);
+    return len;
+}
+
+static struct hpack_field *dynamic_entry(struct hpack *hpack, size_t i)
+{
+    return &hpack->entries[(hpack->head + HPACK_ENTRIES - i) % HPACK_ENTRIES];
+}
+
+/*
+ * @brief: return the field of an index of the static and dynamic tables
+ */
+static const struct hpack_field *lookup(struct hpack *hpack, size_t index)
+{
+    if (!index)
+        return NULL;
+    if (index <= HPACK_STATIC_SIZE)
+        return &static_table[index - 1];
+    index -= HPACK_STATIC_SIZE + 1;
+    if (index >= hpack->count)
+        return NULL;
+    return dynamic_entry(hpack, index);
+}
+
+/*
+ * @brief: evict the oldest entries until room bytes fit in the table
+ */
+static void evict(struct hpack *hpack, size_t room)
+{
+    while (hpack->count && hpack->size + room > hpack->max_size)
+    {
+        struct hpack_field *old = dynamic_entry(hpack, --hpack->count);
+        hpack->size -= old->name_len + old->value_len + 32;
+        free((char *)old->name);
+    }
+}
+
+static int insert(struct hpack *hpack, const struct hpack_field *field)
+{
+    size_t size = field->name_len + field->value_len + 32;
+    evict(hpack, size);
+    if (size > hpack->max_size)
+        return 0;
+    char *data = malloc(field->name_len + field->value_len + 1);
+    if (!data)
+        return -1;
+    memcpy(data, field->name, field->name_len);
+    memcpy(data + field->name_len, field->value, field->value_len);
+    hpack->head = (hpack->head + 1) % HPACK_ENTRIES;
+    struct hpack_field *entry = dynamic_entry(hpack, 0);
+    entry->name = data;
+    entry->name_len = field->name_len;
+    entry->value = data + field->name_len;
+    entry->value_len = field->value_len;
+    hpack->count++;
+    hpack->size += size;
+    return 0;
+}
+
+/*
+ * @brief: decode a literal header field, which name is either indexed or a
+ * string literal
+ *
+ * @return 0 on success, -1 on error
+ */
+static int decode_literal(struct hpack *hpack, const unsigned char **p,
+                          const unsigned char *end, int prefix,
+                          struct hpack_field *field)
+{
+    size_t index;
+    long len;
+    if (decode_int(p, end, prefix, &index) < 0)
+        return -1;
+    if (index)
+    {
+        const struct hpack_field *name = lookup(hpack, index);
+        if (!name)
+            return -1;
+        memcpy(hpack->name, name->name, name->name_len);
+        len = name->name_len;
+    }
+    else if ((len = decode_string(p, end, hpack->name)) < 0)
+        return -1;
+    field->name = hpack->name;
+    field->name_len = len;
+    if ((len = decode_string(p, end, hpack->value)) < 0)
+        return -1;
+    field->value = hpack->value;
+    field->value_len = len;
+    return 0;
+}
+
+int hpack_decode(struct hpack *hpack, const unsigned char *block, size_t len,
+                 hpack_callback callback, void *data)
+{
+    const unsigned char *p = block;
+    const unsigned char *end = block + len;
+    while (p < end)
+    {
+        size_t value;
+        struct hpack_field literal;
+        const struct hpack_field *field = &literal;
+        if (*p & 0x80)
+        {
+            if (decode_int(&p, end, 7, &value) < 0
+                || !(field = lookup(hpack, value)))
+                return -1;
+        }
+        else if ((*p & 0xe0) == 0x20)
+        {
+            if (decode_int(&p, end, 5, &value) < 0
+                || value > HPACK_TABLE_SIZE)
+                return -1;
+            hpack->max_size = value;
+            evict(hpack, 0);
+            continue;
+        }
+        else if (*p & 0x40)
+        {
+            if (decode_literal(hpack, &p, end, 6, &literal) < 0
+                || insert(hpack, &literal) < 0)
+                return -1;
+        }
+        else if (decode_literal(hpack, &p, end, 4, &literal) < 0)
+            return -1;
+        if (callback(field, data) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static size_t encode_int(unsigned char *out, unsigned char flags, int prefix,
+                         size_t value)
+{
+    size_t max = (1u << prefix) - 1;
+    if (value < max)
+    {
+        out[0] = flags | value;
+        return 1;
+    }
+    size_t n = 0;
+    out[n++] = flags | max;
+    for (value -= max; value >= 0x80; value >>= 7)
+        out[n++] = 0x80 | (value & 0x7f);
+    out[n++] = value;
+    return n;
+}
+
+size_t hpack_encode(unsigned char *out, size_t index, const char *value,
+                    size_t len)
+{
+    size_t n = encode_int(out, 0x00, 4, index);
+    n += encode_int(out + n, 0x00, 7, len);
+    memcpy(out + n, value, len);
+    return n + len;
+}
+
+size_t hpack_encode_status(unsigned char *out, int status)
+{
+    for (size_t i = HPACK_STATUS; i < HPACK_STATUS + 7; i++)
+    {
+        if (atoi(static_table[i - 1].value) == status)
+            return encode_int(out, 0x80, 7, i);
+    }
+    char value[8];
+    sprintf(value, "%03d", status % 1000);
+    return hpack_encode(out, HPACK_STATUS, value, 3);
+}
+
+void hpack_destroy(struct hpack *hpack)
+{
+    hpack->max_size = 0;
+    evict(hpack, 0);
+}
@@ -0,0 +1,106 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Entries of the static table, size of the dynamic table before any
+ * SETTINGS_HEADER_TABLE_SIZE, and longest header name or value decoded
+ */
+#define HPACK_STATIC_SIZE 61
+#define HPACK_TABLE_SIZE 4096
+#define HPACK_STRING_MAX 8192
+
+/*
+ * Indexes of the static table used by the encoder
+ */
+#define HPACK_STATUS 8
+#define HPACK_CACHE_CONTROL 24
+#define HPACK_CONTENT_ENCODING 26
+#define HPACK_CONTENT_LENGTH 28
+#define HPACK_CONTENT_TYPE 31
+#define HPACK_DATE 33
+#define HPACK_ETAG 34
+#define HPACK_VARY 59
+
+/*
+ * @brief: a header field of a table
+ */
+struct hpack_field
+{
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
+};
+
+/*
+ * @brief: the decoding context of a connection, which dynamic table lives
+ * as long as the connection
+ *
+ * @param entries: ring of the dynamic table entries, newest at head
+ * @param head: index of the newest entry
+ * @param count: number of entries
+ * @param size: size of the table as defined by RFC 7541, section 4.1
+ * @param max_size: size set by the last dynamic table size update
+ * @param name: buffer a decoded header name is stored in
+ * @param value: buffer a decoded header value is stored in
+ */
+struct hpack
+{
+    struct hpack_field entries[HPACK_TABLE_SIZE / 32];
+    size_t head;
+    size_t count;
+    size_t size;
+    size_t max_size;
+    char name[HPACK_STRING_MAX];
+    char value[HPACK_STRING_MAX];
+};
+
+/*
+ * @brief: called on each header field decoded from a block, the field being
+ * valid until the callback returns
+ *
+ * @return 0 to go on, -1 to stop the decoding
+ */
+typedef int (*hpack_callback)(const struct hpack_field *field, void *data);
+
+void hpack_init(struct hpack *hpack);
+
+/*
+ * @brief: decode a complete header block, updating the dynamic table
+ *
+ * @param hpack: the decoding context of the connection
+ * @param block: the header block
+ * @param len: the length of the block
+ * @param callback: called on each header field
+ * @param data: passed to the callback
+ *
+ * @return 0 on success, -1 on a compression error or if the callback failed
+ */
+int hpack_decode(struct hpack *hpack, const unsigned char *block, size_t len,
+                 hpack_callback callback, void *data);
+
+/*
+ * @brief: encode a field as a literal never added to the dynamic table, its
+ * name being the static table entry index
+ *
+ * @param out: the buffer to write to, large enough for value and 12 bytes
+ *
+ * @return the number of bytes written
+ */
+size_t hpack_encode(unsigned char *out, size_t index, const char *value,
+                    size_t len);
+
+/*
+ * @brief: encode the :status pseudo-header, indexed if the static table
+ * has it
+ *
+ * @return the number of bytes written
+ */
+size_t hpack_encode_status(unsigned char *out, int status);
+
+void hpack_destroy(struct hpack *hpack);
+
+#endif /*!HPACK_H*/
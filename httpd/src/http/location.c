@@ -0,0 +1,422 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "location.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * @brief: the way from a node to a child, by one segment of the paths
+ *
+ * @param label: the segment, in the path of a location
+ */
+struct edge
+{
+    const char *label;
+    size_t len;
+    uint32_t child;
+};
+
+/*
+ * @brief: a node of a trie, standing for the path of the segments leading
+ * to it
+ *
+ * @param edges: the children, sorted by label
+ * @param prefix: the location of the path and of those under it, may be
+ * NULL
+ * @param exact: the location of the path only, may be NULL
+ */
+struct node
+{
+    struct edge *edges;
+    size_t nb_edges;
+    const struct location *prefix;
+    const struct location *exact;
+};
+
+/*
+ * @brief: the trie of a vhost, the root being at index 0, NULL nodes for a
+ * vhost without locations
+ */
+struct trie
+{
+    struct node *nodes;
+    size_t nb_nodes;
+};
+
+/*
+ * @brief: the tries of every vhost, in the order of loaded->servers
+ *
+ * @param owned: the configuration the locations were read again from, NULL
+ * for the one given to location_init()
+ * @param config: the configuration holding the locations
+ * @param next: the next table swapped out
+ */
+struct table
+{
+    struct config *owned;
+    const struct config *config;
+    struct trie *tries;
+    struct table *next;
+};
+
+static const struct config *loaded = NULL;
+static struct table *current = NULL;
+static struct table *retired = NULL;
+
+/*
+ * @brief: skip the slashes at *pos
+ *
+ * @return the length of the segment starting there, 0 at the end of s
+ */
+static size_t segment(const char *s, size_t len, size_t *pos)
+{
+    while (*pos < len && s[*pos] == '/')
+        (*pos)++;
+    size_t end = *pos;
+    while (end < len && s[end] != '/')
+        end++;
+    return end - *pos;
+}
+
+static int compare_labels(const char *a, size_t alen, const char *b,
+                          size_t blen)
+{
+    int cmp = memcmp(a, b, alen < blen ? alen : blen);
+    if (cmp)
+        return cmp;
+    return (alen > blen) - (alen < blen);
+}
+
+static int compare_edges(const void *a, const void *b)
+{
+    const struct edge *x = a;
+    const struct edge *y = b;
+    return compare_labels(x->label, x->len, y->label, y->len);
+}
+
+/*
+ * @return the child of node by the segment, 0 if there is none
+ */
+static uint32_t child(const struct node *node, const char *label, size_t len)
+{
+    size_t low = 0;
+    size_t high = node->nb_edges;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        const struct edge *edge = &node->edges[middle];
+        int cmp = compare_labels(label, len, edge->label, edge->len);
+        if (!cmp)
+            return edge->child;
+        if (cmp < 0)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return 0;
+}
+
+/*
+ * @brief: add a child to a node while the trie is built, the edges being
+ * sorted once it is
+ */
+static int add_child(struct trie *trie, uint32_t index, const char *label,
+                     size_t len)
+{
+    struct node *node = &trie->nodes[index];
+    if (!(node->nb_edges & (node->nb_edges - 1)))
+    {
+        size_t size = node->nb_edges ? 2 * node->nb_edges : 1;
+        struct edge *edges = realloc(node->edges, size * sizeof(struct edge));
+        if (!edges)
+            return -1;
+        node->edges = edges;
+    }
+    struct edge *edge = &node->edges[node->nb_edges++];
+    edge->label = label;
+    edge->len = len;
+    edge->child = trie->nb_nodes++;
+    return edge->child;
+}
+
+static int insert(struct trie *trie, const struct server_config *vhost,
+                  const struct location *location)
+{
+    size_t len = strlen(location->path);
+    size_t pos = 0;
+    uint32_t index = 0;
+    size_t slen;
+    while ((slen = segment(location->path, len, &pos)))
+    {
+        const char *label = location->path + pos;
+        pos += slen;
+        const struct node *node = &trie->nodes[index];
+        size_t i = 0;
+        while (i < node->nb_edges
+               && compare_labels(label, slen, node->edges[i].label,
+                                 node->edges[i].len))
+            i++;
+        if (i < node->nb_edges)
+            index = node->edges[i].child;
+        else
+        {
+            int next = add_child(trie, index, label, slen);
+            if (next < 0)
+                return -1;
+            index = next;
+        }
+    }
+    const struct location **slot = location->exact
+        ? &trie->nodes[index].exact
+        : &trie->nodes[index].prefix;
+    if (*slot)
+    {
+        fprintf(stderr, "vhost %s: location %s given twice\n",
+                vhost->server_name.data, location->path);
+        return -1;
+    }
+    *slot = location;
+    return 0;
+}
+
+static void trie_destroy(struct trie *trie)
+{
+    for (size_t i = 0; i < trie->nb_nodes; i++)
+        free(trie->nodes[i].edges);
+    free(trie->nodes);
+}
+
+/*
+ * @brief: build the trie of a vhost, with a node per segment of the paths
+ * at most
+ */
+static int compile(struct trie *trie, const struct server_config *vhost)
+{
+    if (!vhost->nb_locations)
+        return 0;
+    size_t nb_nodes = 1;
+    for (size_t i = 0; i < vhost->nb_locations; i++)
+    {
+        const char *path = vhost->locations[i].path;
+        size_t len = strlen(path);
+        size_t pos = 0;
+        size_t slen;
+        while ((slen = segment(path, len, &pos)))
+        {
+            pos += slen;
+            nb_nodes++;
+        }
+    }
+    trie->nodes = calloc(nb_nodes, sizeof(struct node));
+    if (!trie->nodes)
+        return -1;
+    trie->nb_nodes = 1;
+    for (size_t i = 0; i < vhost->nb_locations; i++)
+        if (insert(trie, vhost, &vhost->locations[i]) < 0)
+            return -1;
+    for (size_t i = 0; i < trie->nb_nodes; i++)
+    {
+        if (trie->nodes[i].nb_edges > 1)
+            qsort(trie->nodes[i].edges, trie->nodes[i].nb_edges,
+                  sizeof(struct edge), compare_edges);
+    }
+    return 0;
+}
+
+static void table_destroy(struct table *table)
+{
+    if (table)
+    {
+        for (size_t i = 0; table->tries && i < table->config->nb_servers; i++)
+            trie_destroy(&table->tries[i]);
+        free(table->tries);
+        if (table->owned)
+            config_destroy(table->owned);
+        free(table);
+    }
+}
+
+static struct table *table_new(const struct config *config)
+{
+    struct table *table = calloc(1, sizeof(struct table));
+    if (!table)
+        return NULL;
+    table->config = config;
+    table->tries = calloc(config->nb_servers, sizeof(struct trie));
+    if (!table->tries)
+    {
+        free(table);
+        return NULL;
+    }
+    for (size_t i = 0; i < config->nb_servers; i++)
+    {
+        if (compile(&table->tries[i], &config->servers[i]) < 0)
+        {
+            table_destroy(table);
+            return NULL;
+        }
+    }
+    return table;
+}
+
+int location_init(const struct config *config)
+{
+    struct table *table = table_new(config);
+    if (!table)
+        return -1;
+    loaded = config;
+    __atomic_store_n(&current, table, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * @return whether config has the vhosts of the loaded one, in its order
+ */
+static bool same_vhosts(const struct config *config)
+{
+    if (config->nb_servers != loaded->nb_servers)
+        return false;
+    for (size_t i = 0; i < config->nb_servers; i++)
+    {
+        const struct string *a = &config->servers[i].server_name;
+        const struct string *b = &loaded->servers[i].server_name;
+        if (a->size != b->size
+            || (a->size && memcmp(a->data, b->data, a->size)))
+            return false;
+    }
+    return true;
+}
+
+int location_reload(void)
+{
+    if (!loaded || !loaded->path)
+        return -1;
+    struct config *config = parse_configuration(loaded->path);
+    if (!config)
+    {
+        fprintf(stderr, "%s: keeping the previous locations\n", loaded->path);
+        return -1;
+    }
+    if (!same_vhosts(config))
+    {
+        fprintf(stderr,
+                "%s: the vhosts changed, keeping the previous locations\n",
+                loaded->path);
+        config_destroy(config);
+        return -1;
+    }
+    struct table *table = table_new(config);
+    if (!table)
+    {
+        fprintf(stderr, "%s: keeping the previous locations\n", loaded->path);
+        config_destroy(config);
+        return -1;
+    }
+    table->owned = config;
+    struct table *old = __atomic_exchange_n(&current, table, __ATOMIC_ACQ_REL);
+    old->next = retired;
+    retired = old;
+    return 0;
+}
+
+void location_release(void)
+{
+    while (retired)
+    {
+        struct table *next = retired->next;
+        table_destroy(retired);
+        retired = next;
+    }
+}
+
+const struct location *location_find(const struct server_config *vhost,
+                                     const char *target, size_t len,
+                                     size_t *matched)
+{
+    const struct table *table = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    if (!table || vhost < loaded->servers
+        || vhost >= loaded->servers + loaded->nb_servers)
+        return NULL;
+    const struct trie *trie = &table->tries[vhost - loaded->servers];
+    if (!trie->nodes)
+        return NULL;
+    const char *query = memchr(target, '?', len);
+    if (query)
+        len = query - target;
+
+    const struct node *node = trie->nodes;
+    const struct location *best = node->prefix;
+    size_t best_end = 0;
+    size_t pos = 0;
+    size_t slen;
+    while ((slen = segment(target, len, &pos)))
+    {
+        uint32_t next = child(node, target + pos, slen);
+        if (!next)
+            break;
+        pos += slen;
+        node = &trie->nodes[next];
+        if (node->prefix)
+        {
+            best = node->prefix;
+            best_end = pos;
+        }
+    }
+    // The whole path was walked when no segment is left
+    if (!slen && node->exact)
+    {
+        best = node->exact;
+        best_end = len;
+    }
+    if (matched)
+        *matched = best_end;
+    return best;
+}
+
+int location_path(const struct server_config *vhost, const char *target,
+                  size_t len, const struct location **location, char *path,
+                  size_t size)
+{
+    const char *query = memchr(target, '?', len);
+    if (query)
+        len = query - target;
+    size_t matched = 0;
+    const struct location *found = location_find(vhost, target, len, &matched);
+    const char *base = vhost->root_dir;
+    if (found && found->alias)
+    {
+        base = found->alias;
+        target += matched;
+        len -= matched;
+    }
+    else if (found && found->root_dir)
+        base = found->root_dir;
+    if (location)
+        *location = found;
+
+    size_t blen = strlen(base);
+    if (blen + len >= size)
+        return -1;
+    memcpy(path, base, blen);
+    memcpy(path + blen, target, len);
+    path[blen + len] = '\0';
+    return 0;
+}
+
+const struct config *location_config(void)
+{
+    const struct table *table = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    return table ? table->config : NULL;
+}
+
+void location_destroy(void)
+{
+    location_release();
+    table_destroy(current);
+    current = NULL;
+    loaded = NULL;
+}
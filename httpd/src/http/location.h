@@ -0,0 +1,69 @@
+#ifndef LOCATION_H
+#define LOCATION_H
+
+#include <stddef.h>
+
+#include "../config/config.h"
+
+/*
+ * @brief: compile the locations of each vhost into a trie of the segments
+ * of their paths, the children of a node being sorted for a binary search
+ *
+ * @return 0 on success, -1 if two locations of a vhost have the same path
+ */
+int location_init(const struct config *config);
+
+/*
+ * @brief: read the locations from the configuration file again, and swap
+ * the tries at once for the new ones. The previous ones are kept until
+ * location_release(), the threads resolving targets meanwhile. The vhosts
+ * must be the same, in the same order.
+ *
+ * @return 0 if the tries were swapped, -1 if the previous ones are kept
+ */
+int location_reload(void);
+
+/*
+ * @brief: free the tries swapped out, once no thread may be walking them
+ */
+void location_release(void);
+
+/*
+ * @brief: find the location of a target in one walk down the trie of its
+ * vhost: the exact location of its path if any, else the location of its
+ * longest path prefix, whole segments being compared. The query string is
+ * ignored. Any thread may call it.
+ *
+ * @param matched: set to the bytes of target the location path matched,
+ * may be NULL
+ *
+ * @return the location, NULL if none applies
+ */
+const struct location *location_find(const struct server_config *vhost,
+                                     const char *target, size_t len,
+                                     size_t *matched);
+
+/*
+ * @brief: write the file a target names in path: the alias of its location
+ * followed by the rest of the target, or the root_dir of the location or of
+ * the vhost followed by the target, without its query string
+ *
+ * @param location: set to the location of the target, NULL if none applies
+ *
+ * @return 0 on success, -1 if it does not fit in size
+ */
+int location_path(const struct server_config *vhost, const char *target,
+                  size_t len, const struct location **location, char *path,
+                  size_t size);
+
+/*
+ * @brief: return the configuration the current locations were read from
+ */
+const struct config *location_config(void);
+
+/*
+ * @brief: free the tries
+ */
+void location_destroy(void);
+
+#endif /*!LOCATION_H*/
@@ -0,0 +1,73 @@
+#include "mime.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+struct mime_slot
+{
+    const char *extension;
+    const char *type;
+};
+
+#include "mime_table.h"
+
+/*
+ * @brief: FNV-1a hash of a NUL terminated string, mixed with a seed
+ */
+static uint32_t mime_hash(const char *str, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+    while (*str)
+    {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * @brief: copy the lowercase extension of the last component of path in ext
+ *
+ * @return 0 on success, -1 if there is no extension or it is too long
+ */
+static int get_extension(const char *path, char ext[MIME_EXT_MAX])
+{
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(slash ? slash : path, '.');
+    if (!dot || !dot[1] || strlen(dot + 1) >= MIME_EXT_MAX)
+        return -1;
+    size_t i = 0;
+    for (dot++; *dot; dot++)
+        ext[i++] = tolower((unsigned char)*dot);
+    ext[i] = '\0';
+    return 0;
+}
+
+static const char *builtin_lookup(const char *ext)
+{
+    unsigned char seed = displacements[mime_hash(ext, 0) % MIME_BUCKETS];
+    if (!seed)
+        return NULL;
+    const struct mime_slot *slot =
+        &builtin_types[mime_hash(ext, seed) % MIME_SLOTS];
+    if (!slot->extension || strcmp(slot->extension, ext))
+        return NULL;
+    return slot->type;
+}
+
+const char *mime_lookup(const struct server_config *vhost, const char *path)
+{
+    char ext[MIME_EXT_MAX];
+    if (get_extension(path, ext) < 0)
+        return MIME_DEFAULT;
+
+    for (size_t i = 0; vhost && i < vhost->nb_mime_types; i++)
+    {
+        if (!strcmp(vhost->mime_types[i].extension, ext))
+            return vhost->mime_types[i].type;
+    }
+
+    const char *type = builtin_lookup(ext);
+    return type ? type : MIME_DEFAULT;
+}
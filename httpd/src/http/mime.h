@@ -0,0 +1,30 @@
+#ifndef MIME_H
+#define MIME_H
+
+#include "../config/config.h"
+
+#define MIME_DEFAULT "application/octet-stream"
+
+/*
+ * The builtin table is indexed by a two level perfect hash of the lowercase
+ * extension: the first hash picks a displacement, the second hash seeded
+ * with that displacement picks the slot. Both tables are generated in
+ * mime_table.h by mime_gen.py from the list of mime.def.
+ */
+#define MIME_SLOTS 128
+#define MIME_BUCKETS 32
+#define MIME_EXT_MAX 16
+
+/*
+ * @brief: return the MIME type of a file from its extension, looking at the
+ * overrides of the vhost first then at the builtin table
+ *
+ * @param vhost: the vhost serving the file, can be NULL
+ * @param path: the path of the file
+ *
+ * @return a string that lives as long as the vhost, MIME_DEFAULT if the
+ * extension is unknown
+ */
+const char *mime_lookup(const struct server_config *vhost, const char *path);
+
+#endif /*!MIME_H*/
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Build the perfect hash of the builtin MIME types of mime.def.
+
+Usage: mime_gen.py [--check] [mime.def] [mime_table.h]
+
+Every extension is first hashed into one of MIME_BUCKETS buckets. The
+buckets, largest first, then get the first displacement that sends all their
+extensions to free slots of the MIME_SLOTS ones, the hash being the FNV-1a of
+mime.c seeded with the displacement. With --check, the table is compared
+with the one on disk instead of written.
+"""
+
+import os
+import re
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+MASK = (1 << 32) - 1
+BANNER = """/*
+ * Generated by mime_gen.py from mime.def, do not edit: every non empty
+ * bucket got the first displacement that sends all its extensions to free
+ * slots. A slot given twice does not compile (-Woverride-init), so the hash
+ * stays perfect.
+ */"""
+
+
+def define(header, name):
+    match = re.search(r"#define %s (\d+)" % name, header)
+    return int(match.group(1))
+
+
+def mime_hash(string, seed):
+    value = (2166136261 ^ (seed * 0x9E3779B9)) & MASK
+    for char in string.encode():
+        value ^= char
+        value = (value * 16777619) & MASK
+    return value
+
+
+def read_types(path):
+    source = re.sub(r"/\*.*?\*/", "", open(path).read(), flags=re.S)
+    types = []
+    pattern = r'MIME_TYPE\(\s*"([^"]*)"\s*,((?:\s*"[^"]*")+)\s*\)'
+    for match in re.finditer(pattern, source):
+        parts = re.findall(r'"([^"]*)"', match.group(2))
+        types.append((match.group(1), "".join(parts)))
+    return types
+
+
+def build(types, nb_slots, nb_buckets, ext_max):
+    buckets = [[] for _ in range(nb_buckets)]
+    for extension, mime in types:
+        if extension != extension.lower() or len(extension) >= ext_max:
+            sys.exit("mime_gen: bad extension %s" % extension)
+        buckets[mime_hash(extension, 0) % nb_buckets].append((extension,
+                                                               mime))
+    displacements = [0] * nb_buckets
+    slots = {}
+    for bucket in sorted(range(nb_buckets), key=lambda b: -len(buckets[b])):
+        if not buckets[bucket]:
+            continue
+        for seed in range(1, 256):
+            taken = [mime_hash(e, seed) % nb_slots for e, _ in buckets[bucket]]
+            if len(set(taken)) == len(taken) and not set(taken) & set(slots):
+                break
+        else:
+            sys.exit("mime_gen: no displacement for bucket %d" % bucket)
+        displacements[bucket] = seed
+        slots.update(zip(taken, buckets[bucket]))
+    return displacements, slots
+
+
+def render(displacements, slots):
+    lines = BANNER.splitlines() + [
+        "static const unsigned char displacements[MIME_BUCKETS] = {",
+    ]
+    for i in range(0, len(displacements), 16):
+        row = ", ".join(str(d) for d in displacements[i:i + 16])
+        last = i + 16 >= len(displacements)
+        lines.append("    " + row + ("" if last else ","))
+    lines += ["};", "",
+              "static const struct mime_slot builtin_types[MIME_SLOTS] = {"]
+    for slot in sorted(slots):
+        extension, mime = slots[slot]
+        line = '    [%d] = { "%s", "%s" },' % (slot, extension, mime)
+        if len(line) <= 80:
+            lines.append(line)
+            continue
+        head = '    [%d] = { ' % slot
+        cut = mime.rfind(".", 0, 80 - len(head) - 3) + 1
+        lines.append(head + '"%s",' % extension)
+        lines.append(" " * len(head) + '"%s"' % mime[:cut])
+        lines.append(" " * len(head) + '"%s" },' % mime[cut:])
+    lines.append("};")
+    return "\n".join(lines) + "\n"
+
+
+def main(argv):
+    check = "--check" in argv
+    paths = [arg for arg in argv if arg != "--check"]
+    source = paths[0] if paths else os.path.join(HERE, "mime.def")
+    target = paths[1] if len(paths) > 1 else os.path.join(HERE,
+                                                          "mime_table.h")
+    header = open(os.path.join(HERE, "mime.h")).read()
+    displacements, slots = build(read_types(source),
+                                 define(header, "MIME_SLOTS"),
+                                 define(header, "MIME_BUCKETS"),
+                                 define(header, "MIME_EXT_MAX"))
+    table = render(displacements, slots)
+    if not check:
+        with open(target, "w") as output:
+            output.write(table)
+        return 0
+    if open(target).read() != table:
+        sys.stderr.write("mime_gen: %s is out of date\n" % target)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
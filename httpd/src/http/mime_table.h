@@ -0,0 +1,97 @@
+/*
+ * Generated by mime_gen.py from mime.def, do not edit: every non empty
+ * bucket got the first displacement that sends all its extensions to free
+ * slots. A slot given twice does not compile (-Woverride-init), so the hash
+ * stays perfect.
+ */
+static const unsigned char displacements[MIME_BUCKETS] = {
+    2, 1, 4, 11, 2, 2, 3, 1, 6, 1, 2, 15, 0, 1, 1, 1,
+    3, 16, 1, 1, 1, 6, 1, 1, 1, 1, 3, 5, 1, 0, 3, 2
+};
+
+static const struct mime_slot builtin_types[MIME_SLOTS] = {
+    [1] = { "map", "application/json" },
+    [2] = { "xz", "application/x-xz" },
+    [3] = { "aac", "audio/aac" },
+    [4] = { "ppt", "application/vnd.ms-powerpoint" },
+    [5] = { "m3u8", "application/vnd.apple.mpegurl" },
+    [10] = { "mkv", "video/x-matroska" },
+    [13] = { "atom", "application/atom+xml" },
+    [14] = { "7z", "application/x-7z-compressed" },
+    [15] = { "avi", "video/x-msvideo" },
+    [18] = { "wav", "audio/wav" },
+    [21] = { "opus", "audio/opus" },
+    [22] = { "woff", "font/woff" },
+    [23] = { "ogg", "audio/ogg" },
+    [24] = { "rss", "application/rss+xml" },
+    [27] = { "png", "image/png" },
+    [29] = { "m4a", "audio/mp4" },
+    [31] = { "xhtml", "application/xhtml+xml" },
+    [32] = { "pptx",
+             "application/vnd.openxmlformats-officedocument.presentationml."
+             "presentation" },
+    [33] = { "gz", "application/gzip" },
+    [34] = { "svg", "image/svg+xml" },
+    [35] = { "toml", "application/toml" },
+    [38] = { "tgz", "application/gzip" },
+    [39] = { "ts", "video/mp2t" },
+    [40] = { "avif", "image/avif" },
+    [42] = { "epub", "application/epub+zip" },
+    [43] = { "tar", "application/x-tar" },
+    [44] = { "woff2", "font/woff2" },
+    [46] = { "txz", "application/x-xz" },
+    [47] = { "htm", "text/html" },
+    [49] = { "csv", "text/csv" },
+    [50] = { "deb", "application/vnd.debian.binary-package" },
+    [51] = { "pdf", "application/pdf" },
+    [52] = { "ogv", "video/ogg" },
+    [54] = { "mov", "video/quicktime" },
+    [57] = { "odt", "application/vnd.oasis.opendocument.text" },
+    [59] = { "xls", "application/vnd.ms-excel" },
+    [60] = { "txt", "text/plain" },
+    [61] = { "yaml", "application/yaml" },
+    [62] = { "docx",
+             "application/vnd.openxmlformats-officedocument.wordprocessingml."
+             "document" },
+    [63] = { "yml", "application/yaml" },
+    [64] = { "flac", "audio/flac" },
+    [65] = { "iso", "application/x-iso9660-image" },
+    [70] = { "ttf", "font/ttf" },
+    [71] = { "ico", "image/vnd.microsoft.icon" },
+    [74] = { "mp4", "video/mp4" },
+    [75] = { "webmanifest", "application/manifest+json" },
+    [76] = { "tiff", "image/tiff" },
+    [77] = { "xml", "application/xml" },
+    [78] = { "eot", "application/vnd.ms-fontobject" },
+    [81] = { "jar", "application/java-archive" },
+    [82] = { "otf", "font/otf" },
+    [85] = { "webm", "video/webm" },
+    [86] = { "ics", "text/calendar" },
+    [87] = { "doc", "application/msword" },
+    [89] = { "rpm", "application/x-rpm" },
+    [91] = { "bin", "application/octet-stream" },
+    [92] = { "wasm", "application/wasm" },
+    [93] = { "sh", "application/x-sh" },
+    [94] = { "webp", "image/webp" },
+    [95] = { "bmp", "image/bmp" },
+    [97] = { "mp3", "audio/mpeg" },
+    [99] = { "zip", "application/zip" },
+    [100] = { "jpeg", "image/jpeg" },
+    [101] = { "md", "text/markdown" },
+    [102] = { "tif", "image/tiff" },
+    [104] = { "zst", "application/zstd" },
+    [105] = { "jpg", "image/jpeg" },
+    [106] = { "css", "text/css" },
+    [109] = { "mjs", "text/javascript" },
+    [112] = { "json", "application/json" },
+    [113] = { "oga", "audio/ogg" },
+    [115] = { "html", "text/html" },
+    [116] = { "rtf", "application/rtf" },
+    [118] = { "bz2", "application/x-bzip2" },
+    [120] = { "rar", "application/vnd.rar" },
+    [121] = { "xlsx",
+              "application/vnd.openxmlformats-officedocument.spreadsheetml."
+              "sheet" },
+    [122] = { "gif", "image/gif" },
+    [124] = { "js", "text/javascript" },
+};
@@ -0,0 +1,929 @@
+#define _GNU_SOURCE
+
+#include "proxy.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../utils/io/io.h"
+#include "../utils/variables/variables.h"
+
+#define PROXY_LINE_MAX 256
+#define PROXY_UNTIL_CLOSE ULLONG_MAX
+
+/*
+ * @brief: an upstream and the idle connections of the worker to it
+ */
+struct upstream
+{
+    const struct server_config *vhost;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int idle[PROXY_POOL_SIZE];
+    size_t nb_idle;
+};
+
+/*
+ * @brief: what the relay needs to know about the head of a response
+ *
+ * @param status: the status code
+ * @param content_length: the length of the body, -1 if not given
+ * @param chunked: the body uses the chunked transfer-encoding
+ * @param close: the upstream closes the connection after the response
+ */
+struct upstream_response
+{
+    int status;
+    long long content_length;
+    int chunked;
+    int close;
+};
+
+enum chunk_state
+{
+    CHUNK_SIZE = 0,
+    CHUNK_DATA,
+    CHUNK_TRAILER,
+    CHUNK_DONE,
+    CHUNK_ERROR
+};
+
+/*
+ * @brief: where a chunked request body is in its framing, as it is relayed
+ *
+ * @param remaining: the bytes of the chunk left, its CRLF included
+ * @param line: the framing line being read
+ */
+struct chunk_parser
+{
+    enum chunk_state state;
+    unsigned long long remaining;
+    char line[PROXY_LINE_MAX];
+    size_t line_len;
+};
+
+enum proxy_state
+{
+    PROXY_CONNECT = 0,
+    PROXY_REQUEST,
+    PROXY_BODY,
+    PROXY_HEAD,
+    PROXY_REPLY,
+    PROXY_RELAY,
+    PROXY_DONE
+};
+
+/*
+ * @brief: a request forwarded to the upstream of its vhost and the response
+ * relayed back, as far as the non-blocking sockets allow at each turn
+ *
+ * @param fd: the upstream socket, -1 once it is closed or pooled
+ * @param reused: fd comes from the pool
+ * @param retried: fd replaces a pooled connection the upstream closed
+ * @param replayable: no byte of the body was taken from the client socket
+ * @param out: the request head and the body bytes read along with it, then
+ * the response head
+ * @param head_len: the length of the request head in out
+ * @param sent: the bytes of out sent
+ * @param chunked: the body being relayed uses the chunked transfer-encoding
+ * @param chunks: the framing of a chunked body
+ * @param left: the bytes of any other body left to receive,
+ * PROXY_UNTIL_CLOSE for one delimited by the end of the connection
+ * @param splice: the body goes through pipefd rather than buf
+ * @param piped: the bytes in pipefd not sent yet
+ * @param buf: bytes received and not sent yet, from start to end
+ * @param extra: the upstream sent bytes past the end of the response
+ */
+struct proxy
+{
+    struct connection *conn;
+    const struct server_config *vhost;
+    struct request *req;
+    struct response *res;
+    enum proxy_state state;
+    int fd;
+    int reused;
+    int retried;
+    int replayable;
+    char *out;
+    size_t out_len;
+    size_t head_len;
+    size_t sent;
+    int chunked;
+    struct chunk_parser chunks;
+    unsigned long long left;
+    int splice;
+    int pipefd[2];
+    size_t piped;
+    struct upstream_response info;
+    char buf[BUFFERSIZE];
+    size_t start;
+    size_t end;
+    int extra;
+};
+
+static struct upstream *upstreams = NULL;
+static size_t nb_upstreams = 0;
+
+static const char *hop_headers[] = { "Connection:", "Keep-Alive:",
+                                     "Proxy-Connection:", NULL };
+
+static int resolve_unix(struct upstream *up, const char *path)
+{
+    struct sockaddr_un *addr = (struct sockaddr_un *)&up->addr;
+    size_t len = strlen(path);
+    if (len >= sizeof(addr->sun_path))
+        return -1;
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, len + 1);
+    up->addrlen = offsetof(struct sockaddr_un, sun_path) + len + 1;
+    return 0;
+}
+
+static int resolve_inet(struct upstream *up, const char *target)
+{
+    const char *colon = strrchr(target, ':');
+    char host[256];
+    if (!colon || (size_t)(colon - target) >= sizeof(host))
+        return -1;
+    size_t len = colon - target;
+    if (len > 1 && target[0] == '[' && target[len - 1] == ']')
+    {
+        target++;
+        len -= 2;
+    }
+    memcpy(host, target, len);
+    host[len] = '\0';
+
+    struct addrinfo hints = { 0 };
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(host, colon + 1, &hints, &res) != 0)
+        return -1;
+    memcpy(&up->addr, res->ai_addr, res->ai_addrlen);
+    up->addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/*
+ * @brief: return the upstream of the vhost, resolving its address the first
+ * time
+ */
+static struct upstream *get_upstream(const struct server_config *vhost)
+{
+    for (size_t i = 0; i < nb_upstreams; i++)
+    {
+        if (upstreams[i].vhost == vhost)
+            return &upstreams[i];
+    }
+    struct upstream *res =
+        realloc(upstreams, (nb_upstreams + 1) * sizeof(struct upstream));
+    if (!res)
+        return NULL;
+    upstreams = res;
+    struct upstream *up = &upstreams[nb_upstreams];
+    memset(up, 0, sizeof(struct upstream));
+    up->vhost = vhost;
+    int err = strncmp(vhost->proxy_pass, "unix:", 5)
+        ? resolve_inet(up, vhost->proxy_pass)
+        : resolve_unix(up, vhost->proxy_pass + 5);
+    if (err < 0)
+    {
+        fprintf(stderr, "could not resolve upstream %s\n", vhost->proxy_pass);
+        return NULL;
+    }
+    nb_upstreams++;
+    return up;
+}
+
+static int upstream_connect(struct upstream *up)
+{
+    int fd = socket(up->addr.ss_family,
+                    SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+    if (up->addr.ss_family != AF_UNIX)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (connect(fd, (struct sockaddr *)&up->addr, up->addrlen) < 0
+        && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * @brief: take an idle connection from the pool, dropping the ones the
+ * upstream closed meanwhile, or start dialing a new one
+ *
+ * @param reused: set to 1 if the connection comes from the pool
+ */
+static int upstream_get(struct upstream *up, int *reused)
+{
+    while (up->nb_idle)
+    {
+        int fd = up->idle[--up->nb_idle];
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, 0) == 0)
+        {
+            *reused = 1;
+            return fd;
+        }
+        close(fd);
+    }
+    *reused = 0;
+    return upstream_connect(up);
+}
+
+static void upstream_put(struct upstream *up, int fd)
+{
+    if (up->nb_idle < PROXY_POOL_SIZE)
+        up->idle[up->nb_idle++] = fd;
+    else
+        close(fd);
+}
+
+static int is_hop_header(const char *line, size_t len)
+{
+    for (size_t i = 0; hop_headers[i]; i++)
+    {
+        size_t hlen = strlen(hop_headers[i]);
+        if (len >= hlen && !strncasecmp(line, hop_headers[i], hlen))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * @brief: copy a message head without its hop-by-hop headers, adding extra
+ * before the empty line, in a buffer with room bytes left after it
+ */
+static char *rewrite_head(const char *head, size_t head_len,
+                          const char *extra, size_t room, size_t *len)
+{
+    size_t elen = strlen(extra);
+    char *res = malloc(head_len + elen + 3 + room);
+    if (!res)
+        return NULL;
+    const char *line = head;
+    const char *end = head + head_len;
+    *len = 0;
+    while (line < end && *line != '\r' && *line != '\n')
+    {
+        const char *eol = memchr(line, '\n', end - line);
+        size_t llen = eol ? (size_t)(eol - line + 1) : (size_t)(end - line);
+        if (!is_hop_header(line, llen))
+        {
+            memcpy(res + *len, line, llen);
+            *len += llen;
+        }
+        line += llen;
+    }
+    memcpy(res + *len, extra, elen);
+    memcpy(res + *len + elen, "\r\n", 2);
+    *len += elen + 2;
+    return res;
+}
+
+/*
+ * @brief: end a framing line of a chunked body, a size line starting a
+ * chunk and an empty trailer line ending the body
+ */
+static void chunk_line(struct chunk_parser *p)
+{
+    p->line[p->line_len] = '\0';
+    p->line_len = 0;
+    if (p->state == CHUNK_TRAILER)
+    {
+        if (p->line[0] == '\r' || p->line[0] == '\n')
+            p->state = CHUNK_DONE;
+        return;
+    }
+    char *end = NULL;
+    unsigned long long size = strtoull(p->line, &end, 16);
+    if (end == p->line || size > SIZE_MAX - 2)
+        p->state = CHUNK_ERROR;
+    else if (!size)
+        p->state = CHUNK_TRAILER;
+    else
+    {
+        p->state = CHUNK_DATA;
+        p->remaining = size + 2;
+    }
+}
+
+/*
+ * @brief: follow the framing of a chunked body through len bytes of it
+ *
+ * @return the bytes belonging to the body, up to its last CRLF
+ */
+static size_t chunk_parse(struct chunk_parser *p, const char *data,
+                          size_t len)
+{
+    size_t used = 0;
+    while (used < len && p->state != CHUNK_DONE && p->state != CHUNK_ERROR)
+    {
+        if (p->state == CHUNK_DATA)
+        {
+            size_t n = len - used;
+            if (n > p->remaining)
+                n = p->remaining;
+            used += n;
+            if (!(p->remaining -= n))
+                p->state = CHUNK_SIZE;
+            continue;
+        }
+        if (p->line_len == sizeof(p->line) - 1)
+        {
+            p->state = CHUNK_ERROR;
+            break;
+        }
+        p->line[p->line_len++] = data[used];
+        if (data[used++] == '\n')
+            chunk_line(p);
+    }
+    return used;
+}
+
+static void parse_response_head(const char *head, size_t len,
+                                struct upstream_response *info)
+{
+    const char *end = head + len;
+    info->status = (len > 12) ? atoi(head + 9) : -1;
+    info->content_length = -1;
+    info->chunked = 0;
+    info->close = !strncmp(head, "HTTP/1.0", 8);
+
+    const char *line = memchr(head, '\n', len);
+    while (line && ++line < end)
+    {
+        size_t llen = end - line;
+        if (llen > 15 && !strncasecmp(line, "Content-Length:", 15))
+            info->content_length = strtoll(line + 15, NULL, 10);
+        else if (llen > 18 && !strncasecmp(line, "Transfer-Encoding:", 18))
+        {
+            const char *eol = memchr(line, '\n', llen);
+            info->chunked = !!memmem(line, eol - line, "chunked", 7);
+        }
+        else if (llen > 11 && !strncasecmp(line, "Connection:", 11))
+        {
+            const char *eol = memchr(line, '\n', llen);
+            info->close = !!memmem(line, eol - line, "close", 5);
+        }
+        line = memchr(line, '\n', end - line);
+    }
+}
+
+static ssize_t client_recv(struct proxy *p, char *buf, size_t len)
+{
+    return connection_recv(p->conn, buf, len);
+}
+
+static ssize_t client_send(struct proxy *p, const char *buf, size_t len)
+{
+    return connection_send_some(p->conn, buf, len);
+}
+
+static ssize_t upstream_recv(struct proxy *p, char *buf, size_t len)
+{
+    ssize_t n;
+    do
+        n = recv(p->fd, buf, len, 0);
+    while (n < 0 && errno == EINTR);
+    return n;
+}
+
+static ssize_t upstream_send(struct proxy *p, const char *buf, size_t len)
+{
+    ssize_t n;
+    do
+        n = send(p->fd, buf, len, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+    return n < 0 && errno == EAGAIN ? 0 : n;
+}
+
+static int body_complete(const struct proxy *p)
+{
+    return p->chunked ? p->chunks.state == CHUNK_DONE : !p->left;
+}
+
+/*
+ * @brief: keep the n bytes received at the end of buf which belong to the
+ * body being relayed, from its framing or its length
+ */
+static void body_received(struct proxy *p, size_t n)
+{
+    size_t used = n;
+    if (p->chunked)
+        used = chunk_parse(&p->chunks, p->buf + p->end, n);
+    else if (p->left != PROXY_UNTIL_CLOSE)
+    {
+        if (used > p->left)
+            used = p->left;
+        p->left -= used;
+    }
+    p->extra = p->extra || used < n;
+    p->end += used;
+}
+
+/*
+ * @brief: send what out takes of the bytes of buf not sent yet
+ *
+ * @return 1 once they are all sent, 0 if out is full, -1 on error
+ */
+static int flush(struct proxy *p,
+                 ssize_t (*out)(struct proxy *, const char *, size_t))
+{
+    while (p->start < p->end)
+    {
+        ssize_t n = out(p, p->buf + p->start, p->end - p->start);
+        if (n <= 0)
+            return n;
+        p->start += n;
+    }
+    return 1;
+}
+
+/*
+ * @brief: relay the body through buf, from in to out, PROXY_TURN_SIZE
+ * bytes at most, without waiting for either socket
+ *
+ * @return 1 once the body is relayed, 0 until then, -1 on error, errno
+ * being EBADMSG if its framing is malformed
+ */
+static int pump_buffer(struct proxy *p,
+                       ssize_t (*in)(struct proxy *, char *, size_t),
+                       ssize_t (*out)(struct proxy *, const char *, size_t))
+{
+    for (size_t moved = 0; moved < PROXY_TURN_SIZE;)
+    {
+        int flushed = flush(p, out);
+        if (flushed <= 0)
+            return flushed;
+        if (body_complete(p))
+            return 1;
+        if (p->chunked && p->chunks.state == CHUNK_ERROR)
+        {
+            errno = EBADMSG;
+            return -1;
+        }
+        size_t want = sizeof(p->buf);
+        if (!p->chunked && p->left < want)
+            want = p->left;
+        p->start = 0;
+        p->end = 0;
+        ssize_t n = in(p, p->buf, want);
+        if (n < 0)
+            return errno == EAGAIN ? 0 : -1;
+        if (!n && !p->chunked && p->left == PROXY_UNTIL_CLOSE)
+        {
+            p->left = 0;
+            return 1;
+        }
+        if (!n)
+        {
+            errno = ECONNRESET;
+            return -1;
+        }
+        body_received(p, n);
+        moved += n;
+    }
+    return 0;
+}
+
+/*
+ * @brief: relay a body delimited by its length or by the end of the
+ * connection through the pipe, from in to out, PROXY_TURN_SIZE bytes at
+ * most, without copying them in user space nor waiting for either socket
+ *
+ * @return 1 once the body is relayed, 0 until then, -1 on error
+ */
+static int pump_pipe(struct proxy *p, int in, int out)
+{
+    for (size_t moved = 0; moved < PROXY_TURN_SIZE;)
+    {
+        ssize_t n;
+        if (!p->piped)
+        {
+            if (!p->left)
+                return 1;
+            size_t want = p->left < IO_PIPE_SIZE ? p->left : IO_PIPE_SIZE;
+            n = splice(in, NULL, p->pipefd[1], NULL, want,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return errno == EAGAIN ? 0 : -1;
+            if (!n && p->left == PROXY_UNTIL_CLOSE)
+            {
+                p->left = 0;
+                return 1;
+            }
+            if (!n)
+            {
+                errno = ECONNRESET;
+                return -1;
+            }
+            p->piped = n;
+            if (p->left != PROXY_UNTIL_CLOSE)
+                p->left -= n;
+            moved += n;
+        }
+        n = splice(p->pipefd[0], NULL, out, NULL, p->piped,
+                   SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return errno == EAGAIN ? 0 : -1;
+        if (!n)
+        {
+            errno = EPIPE;
+            return -1;
+        }
+        p->piped -= n;
+    }
+    return 0;
+}
+
+/*
+ * The steps of a turn return 1 once their state is over, 0 while they wait
+ * for a socket, -1 on error
+ */
+
+static int step_connect(struct proxy *p)
+{
+    struct pollfd pfd = { .fd = p->fd, .events = POLLOUT };
+    if (poll(&pfd, 1, 0) == 0)
+        return 0;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        return -1;
+    if (err)
+    {
+        errno = err;
+        return -1;
+    }
+    p->state = PROXY_REQUEST;
+    return 1;
+}
+
+static int step_request(struct proxy *p)
+{
+    while (p->sent < p->out_len)
+    {
+        ssize_t n = upstream_send(p, p->out + p->sent, p->out_len - p->sent);
+        if (n <= 0)
+            return n;
+        p->sent += n;
+    }
+    p->state = body_complete(p) ? PROXY_HEAD : PROXY_BODY;
+    return 1;
+}
+
+static int step_body(struct proxy *p)
+{
+    p->replayable = 0;
+    int relayed = p->splice ? pump_pipe(p, p->conn->fd, p->fd)
+                            : pump_buffer(p, client_recv, upstream_send);
+    if (relayed > 0)
+    {
+        p->state = PROXY_HEAD;
+        p->start = 0;
+        p->end = 0;
+    }
+    return relayed;
+}
+
+/*
+ * @brief: set the response head of hlen bytes at the start of buf to be
+ * sent to the client, and the framing of its body
+ */
+static int start_reply(struct proxy *p, size_t hlen)
+{
+    free(p->out);
+    p->out = rewrite_head(p->buf, hlen, "Connection: close\r\n", 0,
+                          &p->out_len);
+    if (!p->out)
+        return -1;
+    p->sent = 0;
+    p->chunked = 0;
+    p->left = 0;
+    struct upstream_response *info = &p->info;
+    if (p->req->method != HEAD && info->status != 204 && info->status != 304)
+    {
+        if (info->chunked)
+        {
+            p->chunked = 1;
+            p->chunks = (struct chunk_parser){ .state = CHUNK_SIZE };
+        }
+        else if (info->content_length >= 0)
+            p->left = info->content_length;
+        else
+        {
+            p->left = PROXY_UNTIL_CLOSE;
+            info->close = 1;
+        }
+    }
+    // The body bytes read along with the head are relayed first
+    size_t n = p->end - hlen;
+    memmove(p->buf, p->buf + hlen, n);
+    p->start = 0;
+    p->end = 0;
+    p->extra = 0;
+    body_received(p, n);
+    p->splice = !p->chunked && p->left
+        && (!p->conn->ssl || p->conn->ktls_send)
+        && (p->pipefd[0] >= 0 || io_pipe(p->pipefd) == 0);
+    p->state = PROXY_REPLY;
+    return 1;
+}
+
+/*
+ * @brief: read the head of the response, skipping interim 1xx responses
+ */
+static int step_head(struct proxy *p)
+{
+    while (1)
+    {
+        char *found = memmem(p->buf, p->end, "\r\n\r\n", 4);
+        if (found)
+        {
+            size_t len = found + 4 - p->buf;
+            parse_response_head(p->buf, len, &p->info);
+            if (p->info.status < 100 || p->info.status >= 200
+                || p->info.status == 101)
+                return start_reply(p, len);
+            memmove(p->buf, p->buf + len, p->end - len);
+            p->end -= len;
+            continue;
+        }
+        if (p->end == sizeof(p->buf))
+        {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        ssize_t n = upstream_recv(p, p->buf + p->end,
+                                  sizeof(p->buf) - p->end);
+        if (n < 0)
+            return errno == EAGAIN ? 0 : -1;
+        if (!n)
+        {
+            errno = ECONNRESET;
+            return -1;
+        }
+        p->end += n;
+    }
+}
+
+static int step_reply(struct proxy *p)
+{
+    while (p->sent < p->out_len)
+    {
+        ssize_t n = client_send(p, p->out + p->sent, p->out_len - p->sent);
+        if (n <= 0)
+            return n;
+        p->sent += n;
+    }
+    p->state = PROXY_RELAY;
+    return 1;
+}
+
+/*
+ * @brief: relay the response body, then hand the upstream connection back
+ * to the pool if it is kept alive and holds nothing past the response
+ */
+static int step_relay(struct proxy *p)
+{
+    int relayed = flush(p, client_send);
+    if (relayed > 0)
+        relayed = p->splice ? pump_pipe(p, p->fd, p->conn->fd)
+                            : pump_buffer(p, upstream_recv, client_send);
+    if (relayed <= 0)
+        return relayed;
+    struct upstream *up = get_upstream(p->vhost);
+    if (up && !p->info.close && !p->extra)
+        upstream_put(up, p->fd);
+    else
+        close(p->fd);
+    p->fd = -1;
+    p->state = PROXY_DONE;
+    return 1;
+}
+
+static int (*const steps[])(struct proxy *) = {
+    [PROXY_CONNECT] = step_connect, [PROXY_REQUEST] = step_request,
+    [PROXY_BODY] = step_body,       [PROXY_HEAD] = step_head,
+    [PROXY_REPLY] = step_reply,     [PROXY_RELAY] = step_relay
+};
+
+/*
+ * @brief: close a failed upstream connection, and replace a pooled one the
+ * upstream closed meanwhile once by a newly dialed one, when the request
+ * can be sent again and the upstream cannot have acted on it: the head did
+ * not go through, or the method is safe
+ *
+ * @return 1 if the request is sent again, 0 otherwise
+ */
+static int retry(struct proxy *p, int err)
+{
+    close(p->fd);
+    p->fd = -1;
+    int head_sent = p->sent >= p->head_len;
+    struct upstream *up = get_upstream(p->vhost);
+    if (p->state >= PROXY_REPLY || p->retried || !p->reused
+        || !p->replayable || err == EBADMSG || !up
+        || (head_sent && p->req->method != GET && p->req->method != HEAD))
+        return 0;
+    p->retried = 1;
+    p->reused = 0;
+    p->fd = upstream_connect(up);
+    if (p->fd < 0)
+        return 0;
+    p->state = PROXY_CONNECT;
+    p->sent = 0;
+    p->start = 0;
+    p->end = 0;
+    return 1;
+}
+
+/*
+ * @return 1 if the response was started, the connection being closed
+ * after it, -1 with the status of the response set otherwise
+ */
+static int give_up(struct proxy *p, int err)
+{
+    if (p->state >= PROXY_REPLY)
+        return 1;
+    if (err == EBADMSG)
+        response_set_status(p->res, BAD_REQUEST, "Bad Request");
+    else
+        response_set_status(p->res, BAD_GATEWAY, "Bad Gateway");
+    return -1;
+}
+
+struct proxy *proxy_start(struct connection *conn,
+                          const struct server_config *vhost,
+                          struct request *req, const char *head,
+                          size_t head_len, const char *buffered,
+                          size_t nbuffered, struct response *res)
+{
+    struct upstream *up = get_upstream(vhost);
+    struct proxy *p = up ? calloc(1, sizeof(struct proxy)) : NULL;
+    if (!p)
+    {
+        response_set_status(res, BAD_GATEWAY, "Bad Gateway");
+        return NULL;
+    }
+    p->conn = conn;
+    p->vhost = vhost;
+    p->req = req;
+    p->res = res;
+    p->fd = -1;
+    p->replayable = 1;
+    p->pipefd[0] = -1;
+    p->pipefd[1] = -1;
+    size_t used = nbuffered;
+    if ((p->chunked = request_chunked(req)))
+        used = chunk_parse(&p->chunks, buffered, nbuffered);
+    else
+    {
+        size_t length;
+        request_content_length(req, &length);
+        if (used > length)
+            used = length;
+        p->left = length - used;
+    }
+    p->out = rewrite_head(head, head_len, "", used, &p->head_len);
+    if (p->out)
+        memcpy(p->out + p->head_len, buffered, used);
+    p->out_len = p->head_len + used;
+    p->splice = !p->chunked && p->left && (!conn->ssl || conn->ktls_recv);
+    if (!p->out || p->chunks.state == CHUNK_ERROR
+        || (p->splice && io_pipe(p->pipefd) < 0)
+        || (p->fd = upstream_get(up, &p->reused)) < 0)
+    {
+        if (p->chunks.state == CHUNK_ERROR)
+            response_set_status(res, BAD_REQUEST, "Bad Request");
+        else
+            response_set_status(res, BAD_GATEWAY, "Bad Gateway");
+        proxy_end(p);
+        return NULL;
+    }
+    return p;
+}
+
+void proxy_events(const struct proxy *p, struct pollfd *fd)
+{
+    int pending = p->piped || p->start < p->end;
+    fd->fd = p->fd;
+    fd->events = POLLOUT;
+    if (p->state == PROXY_HEAD || (p->state == PROXY_RELAY && !pending))
+        fd->events = POLLIN;
+    else if (p->state == PROXY_REPLY || p->state == PROXY_RELAY)
+        fd->fd = p->conn->fd;
+    else if (p->state == PROXY_BODY && !pending)
+    {
+        fd->fd = p->conn->fd;
+        fd->events = POLLIN;
+    }
+}
+
+bool proxy_busy(const struct proxy *p)
+{
+    return p->state == PROXY_BODY && !p->piped && p->start == p->end
+        && connection_pending(p->conn);
+}
+
+int proxy_turn(struct proxy *p)
+{
+    while (p->state != PROXY_DONE)
+    {
+        int step = steps[p->state](p);
+        if (!step)
+            return 0;
+        if (step < 0 && !retry(p, errno))
+            return give_up(p, errno);
+    }
+    return 1;
+}
+
+int proxy_expire(struct proxy *p)
+{
+    if (p->state >= PROXY_REPLY)
+        return 1;
+    response_set_status(p->res, GATEWAY_TIMEOUT, "Gateway Timeout");
+    return -1;
+}
+
+void proxy_end(struct proxy *p)
+{
+    if (p->fd >= 0)
+        close(p->fd);
+    if (p->pipefd[0] >= 0)
+    {
+        close(p->pipefd[0]);
+        close(p->pipefd[1]);
+    }
+    free(p->out);
+    free(p);
+}
+
+size_t proxy_footprint(void)
+{
+    return sizeof(struct proxy);
+}
+
+int proxy_forward(struct connection *conn, const struct server_config *vhost,
+                  struct request *req, const char *head, size_t head_len,
+                  const char *buffered, size_t nbuffered,
+                  struct response *res)
+{
+    struct proxy *p = proxy_start(conn, vhost, req, head, head_len, buffered,
+                                  nbuffered, res);
+    if (!p)
+        return -1;
+    int over;
+    while (!(over = proxy_turn(p)))
+    {
+        struct pollfd fd;
+        proxy_events(p, &fd);
+        if (!proxy_busy(p) && poll(&fd, 1, PROXY_TIMEOUT * 1000) <= 0)
+        {
+            over = proxy_expire(p);
+            break;
+        }
+    }
+    proxy_end(p);
+    return over < 0 ? -1 : 0;
+}
+
+void proxy_pool_destroy(void)
+{
+    for (size_t i = 0; i < nb_upstreams; i++)
+    {
+        while (upstreams[i].nb_idle)
+            close(upstreams[i].idle[--upstreams[i].nb_idle]);
+    }
+    free(upstreams);
+    upstreams = NULL;
+    nb_upstreams = 0;
+}
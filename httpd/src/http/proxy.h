@@ -0,0 +1,122 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../config/config.h"
+#include "request.h"
+#include "response.h"
+
+/*
+ * Idle upstream connections kept per vhost, and seconds the sockets of an
+ * exchange may stay idle before it fails
+ */
+#define PROXY_POOL_SIZE 32
+#define PROXY_TIMEOUT 30
+
+/*
+ * Bytes of a body relayed in a turn at most, the other clients being
+ * served before the next one
+ */
+#define PROXY_TURN_SIZE (256UL << 10)
+
+struct proxy;
+
+/*
+ * @brief: start forwarding a request to the upstream of the vhost, the
+ * response being relayed to the client by proxy_turn(). The connection to
+ * the upstream comes from the pool of the worker and goes back to it if the
+ * upstream keeps it alive. The head and the bytes of the body given are
+ * copied.
+ *
+ * @param conn: the client connection, which must outlive the exchange
+ * @param vhost: the vhost, with a proxy_pass
+ * @param req: the parsed request, which must outlive the exchange
+ * @param head: the raw request head, up to the empty line included
+ * @param head_len: the length of head
+ * @param buffered: bytes of the body read along with the request head
+ * @param nbuffered: number of bytes in buffered
+ * @param res: the response, which status is set if nothing could be
+ * relayed, and which must outlive the exchange
+ *
+ * @return the exchange, NULL with the status of res set on error
+ */
+struct proxy *proxy_start(struct connection *conn,
+                          const struct server_config *vhost,
+                          struct request *req, const char *head,
+                          size_t head_len, const char *buffered,
+                          size_t nbuffered, struct response *res);
+
+/*
+ * @brief: fill fd with the socket the exchange waits for, the upstream or
+ * the client, and what for
+ */
+void proxy_events(const struct proxy *p, struct pollfd *fd);
+
+/*
+ * @brief: return whether a turn has work to do without the socket being
+ * ready, bytes of the body being received and decrypted but not read yet
+ */
+bool proxy_busy(const struct proxy *p);
+
+/*
+ * @brief: go on with the exchange as far as the non-blocking sockets allow,
+ * relaying PROXY_TURN_SIZE bytes of a body at most, never waiting for them.
+ * Bodies go from one socket to the other with splice() when the kernel sees
+ * their plaintext and they need no parsing, through user space otherwise.
+ * A pooled connection the upstream closed meanwhile is replaced once by a
+ * newly dialed one, when the request can be sent again and the upstream
+ * cannot have acted on it.
+ *
+ * @return 0 until the exchange is over, 1 once a response was relayed or
+ * started, -1 if the response given to proxy_start() must be sent instead
+ */
+int proxy_turn(struct proxy *p);
+
+/*
+ * @brief: give up on an exchange whose socket stayed idle too long
+ *
+ * @return 1 if a response was started, -1 with the status of the response
+ * set to GATEWAY_TIMEOUT otherwise
+ */
+int proxy_expire(struct proxy *p);
+
+/*
+ * @brief: close the upstream connection unless it went back to the pool,
+ * and free the exchange
+ */
+void proxy_end(struct proxy *p);
+
+/*
+ * @brief: return the memory an exchange holds
+ */
+size_t proxy_footprint(void);
+
+/*
+ * @brief: forward a request and relay its response, waiting PROXY_TIMEOUT
+ * at most for each socket, then end the exchange
+ *
+ * @param conn: the client connection
+ * @param vhost: the vhost, with a proxy_pass
+ * @param req: the parsed request
+ * @param head: the raw request head, up to the empty line included
+ * @param head_len: the length of head
+ * @param buffered: bytes of the body read along with the request head
+ * @param nbuffered: number of bytes in buffered
+ * @param res: the response, which status is set if nothing could be relayed
+ *
+ * @return 0 if a response was relayed, -1 if res must be sent instead
+ */
+int proxy_forward(struct connection *conn, const struct server_config *vhost,
+                  struct request *req, const char *head, size_t head_len,
+                  const char *buffered, size_t nbuffered,
+                  struct response *res);
+
+/*
+ * @brief: close every pooled upstream connection
+ */
+void proxy_pool_destroy(void);
+
+#endif /*!PROXY_H*/
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+
+#include "ratelimit.h"
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define SHARD_SIZE (1UL << RATELIMIT_SLOT_BITS)
+#define TABLE_SIZE (SHARD_SIZE << RATELIMIT_SHARD_BITS)
+
+/*
+ * Tokens are counted in thousandths, refilling by the rate every millisecond
+ */
+#define TOKEN 1000
+
+/*
+ * Largest rate whose bucket fits in the 32 bits of a bucket state
+ */
+#define RATE_MAX (UINT32_MAX / TOKEN)
+
+enum bucket
+{
+    CONNECTIONS = 0,
+    REQUESTS,
+    NB_BUCKETS
+};
+
+/*
+ * @brief: the token buckets of a client, two slots sharing a cache line
+ *
+ * @param key: the client address, 0 for a slot never used
+ * @param buckets: the last refill in milliseconds in the upper 32 bits and
+ * the tokens left in the lower ones, 0 for a full bucket
+ */
+struct slot
+{
+    uint64_t key;
+    uint64_t buckets[NB_BUCKETS];
+    uint64_t pad;
+};
+
+static struct slot *table = NULL;
+static uint64_t rates[NB_BUCKETS];
+
+/*
+ * @brief: the key of a client address, the IPv4 ones being put in the
+ * reserved 0:1::/32 so as not to meet an IPv6 /64
+ *
+ * @return the key, 0 if the address is not an IP one
+ */
+static uint64_t address_key(const struct sockaddr_storage *peer)
+{
+    if (peer->ss_family == AF_INET)
+    {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)peer;
+        return 1ULL << 32 | ntohl(in->sin_addr.s_addr);
+    }
+    if (peer->ss_family != AF_INET6)
+        return 0;
+    const unsigned char *addr =
+        ((const struct sockaddr_in6 *)peer)->sin6_addr.s6_addr;
+    static const unsigned char mapped[12] = { [10] = 0xff, [11] = 0xff };
+    uint64_t key = 0;
+    if (!memcmp(addr, mapped, sizeof(mapped)))
+    {
+        for (size_t i = 12; i < 16; i++)
+            key = key << 8 | addr[i];
+        return 1ULL << 32 | key;
+    }
+    for (size_t i = 0; i < 8; i++)
+        key = key << 8 | addr[i];
+    return key ? key : 1;
+}
+
+static uint32_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * @brief: milliseconds since the last refill of the buckets of a slot,
+ * UINT32_MAX if none of them was ever taken from
+ */
+static uint32_t idle_time(const struct slot *slot, uint32_t now)
+{
+    uint32_t idle = UINT32_MAX;
+    for (size_t i = 0; i < NB_BUCKETS; i++)
+    {
+        uint64_t state = __atomic_load_n(&slot->buckets[i], __ATOMIC_RELAXED);
+        if (state && now - (uint32_t)(state >> 32) < idle)
+            idle = now - (uint32_t)(state >> 32);
+    }
+    return idle;
+}
+
+/*
+ * @brief: return the slot of a client, claiming a free one, else one left
+ * untouched long enough, else the one of the probed slots idle the longest.
+ * Slots are never freed, so a probe stops at the first free one.
+ *
+ * @return the slot, NULL only if another client took the same slot first
+ */
+static struct slot *find_slot(uint64_t key, uint32_t now)
+{
+    uint64_t hash = key * 0x9e3779b97f4a7c15ULL;
+    struct slot *shard =
+        table + (hash >> (64 - RATELIMIT_SHARD_BITS)) * SHARD_SIZE;
+    size_t index = hash >> (64 - RATELIMIT_SHARD_BITS - RATELIMIT_SLOT_BITS);
+    struct slot *victim = NULL;
+    uint32_t victim_idle = 0;
+    for (size_t i = 0; i < RATELIMIT_PROBES; i++)
+    {
+        struct slot *slot = &shard[(index + i) & (SHARD_SIZE - 1)];
+        uint64_t found = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+        if (!found
+            && __atomic_compare_exchange_n(&slot->key, &found, key, false,
+                                           __ATOMIC_ACQ_REL,
+                                           __ATOMIC_ACQUIRE))
+            return slot;
+        if (found == key)
+            return slot;
+        uint32_t idle = idle_time(slot, now);
+        if (!victim || idle > victim_idle)
+        {
+            victim = slot;
+            victim_idle = idle;
+        }
+        if (victim_idle >= RATELIMIT_EXPIRY)
+            break;
+    }
+    // The client takes over the stalest slot, its buckets starting full
+    uint64_t old = __atomic_load_n(&victim->key, __ATOMIC_ACQUIRE);
+    if (idle_time(victim, now) < victim_idle
+        || !__atomic_compare_exchange_n(&victim->key, &old, key, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return NULL;
+    for (size_t i = 0; i < NB_BUCKETS; i++)
+        __atomic_store_n(&victim->buckets[i], 0, __ATOMIC_RELAXED);
+    return victim;
+}
+
+/*
+ * @brief: refill a bucket for the time elapsed since its last refill, then
+ * take a token from it
+ */
+static int take(uint64_t *bucket, uint64_t rate, uint32_t now)
+{
+    uint64_t capacity = rate * TOKEN;
+    uint64_t state = __atomic_load_n(bucket, __ATOMIC_RELAXED);
+    while (1)
+    {
+        uint32_t last = state >> 32;
+        uint64_t tokens = capacity;
+        if (state)
+        {
+            // Another process may have seen the coarse clock tick first
+            if ((int32_t)(now - last) < 0)
+                now = last;
+            tokens = (uint32_t)state + (uint64_t)(now - last) * rate;
+            if (tokens > capacity)
+                tokens = capacity;
+        }
+        if (tokens < TOKEN)
+            return 0;
+        uint64_t next = (uint64_t)now << 32 | (tokens - TOKEN);
+        if (__atomic_compare_exchange_n(bucket, &state, next, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return 1;
+    }
+}
+
+static int limit(const struct sockaddr_storage *peer, enum bucket bucket)
+{
+    if (!table || !rates[bucket])
+        return 1;
+    uint64_t key = address_key(peer);
+    if (!key)
+        return 1;
+    uint32_t now = now_ms();
+    struct slot *slot = find_slot(key, now);
+    // A slot lost to a concurrent claim is let through rather than denied
+    return !slot || take(&slot->buckets[bucket], rates[bucket], now);
+}
+
+int ratelimit_init(size_t connection_rate, size_t request_rate)
+{
+    rates[CONNECTIONS] = connection_rate < RATE_MAX ? connection_rate
+                                                    : RATE_MAX;
+    rates[REQUESTS] = request_rate < RATE_MAX ? request_rate : RATE_MAX;
+    if (!connection_rate && !request_rate)
+        return 0;
+    table = mmap(NULL, TABLE_SIZE * sizeof(struct slot),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED)
+    {
+        table = NULL;
+        perror("mmap");
+        return -1;
+    }
+    return 0;
+}
+
+int ratelimit_connection(const struct sockaddr_storage *peer)
+{
+    return limit(peer, CONNECTIONS);
+}
+
+int ratelimit_request(const struct sockaddr_storage *peer)
+{
+    return limit(peer, REQUESTS);
+}
+
+void ratelimit_destroy(void)
+{
+    if (table)
+        munmap(table, TABLE_SIZE * sizeof(struct slot));
+    table = NULL;
+}
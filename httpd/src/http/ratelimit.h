@@ -0,0 +1,58 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+/*
+ * Layout of the table of the client addresses: shards of slots, a client
+ * being looked for in RATELIMIT_PROBES consecutive slots of its shard
+ */
+#define RATELIMIT_SHARD_BITS 6
+#define RATELIMIT_SLOT_BITS 10
+#define RATELIMIT_PROBES 8
+
+/*
+ * Milliseconds after which an untouched slot may be given to another
+ * client, its buckets being full again by then. When the probed slots are
+ * all touched more recently, a new client still evicts the one idle the
+ * longest rather than go unlimited, so filling the table with distinct
+ * addresses lets no one through: the evicted client merely finds its
+ * buckets full again when it returns.
+ */
+#define RATELIMIT_EXPIRY 1000
+
+/*
+ * @brief: map the table of the token buckets, shared with the processes
+ * forked afterwards. Each client address gets a bucket of connections and
+ * one of requests, refilled at the given rates and holding one second of
+ * them. IPv6 clients are limited per /64, the block a single host is given.
+ *
+ * @param connection_rate: connections per second, 0 for no limit
+ * @param request_rate: requests per second, 0 for no limit
+ *
+ * @return 0 on success, -1 on error
+ */
+int ratelimit_init(size_t connection_rate, size_t request_rate);
+
+/*
+ * @brief: take a token from the connection bucket of a client, without any
+ * lock nor system call
+ *
+ * @return 1 if the client may connect, 0 if it is over its rate
+ */
+int ratelimit_connection(const struct sockaddr_storage *peer);
+
+/*
+ * @brief: take a token from the request bucket of a client
+ *
+ * @return 1 if the request may be answered, 0 if it is over its rate
+ */
+int ratelimit_request(const struct sockaddr_storage *peer);
+
+/*
+ * @brief: unmap the table
+ */
+void ratelimit_destroy(void);
+
+#endif /*!RATELIMIT_H*/
@@ -1,6 +1,15 @@
+#ifndef _POSIX_C_SOURCE
+#    define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "request.h"
 
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../utils/trace/trace.h"
 
 /*
  * Initialisation of the request structure, each field is set to NULL
@@ -15,6 +24,12 @@ static struct request *request_init(void)
         req->version = NULL;
         req->content_length = NULL;
         req->host = NULL;
+        req->expect = NULL;
+        req->upgrade = NULL;
+        req->http2_settings = NULL;
+        req->accept_encoding = NULL;
+        req->if_none_match = NULL;
+        req->transfer_encoding = NULL;
     }
     return req;
 }
@@ -63,6 +78,10 @@ static void __parse_request_line(struct string *token, struct request ***req,
             (**req)->method = GET;
         else if (!string_compare_n_str(token, "HEAD", 4))
             (**req)->method = HEAD;
+        else if (!string_compare_n_str(token, "PUT", 3))
+            (**req)->method = PUT;
+        else if (!string_compare_n_str(token, "POST", 4))
+            (**req)->method = POST;
         else
             (**req)->method = OTHER;
     }
@@ -95,6 +114,24 @@ static void parse_request_line(struct request **req, struct string *line)
     string_destroy(space);
 }
 
+/*
+ * @brief: return the whole value of a header made of a list, its first word
+ * being value and the others being still in saveptr
+ */
+static struct string *list_value(struct string *value, struct string *space,
+                                 struct string **saveptr)
+{
+    struct string *res = string_create(value->data, value->size);
+    struct string *word;
+    while (res && (word = string_tok(NULL, space, saveptr)))
+    {
+        string_concat_str(res, " ", 1);
+        string_concat_str(res, word->data, word->size);
+        string_destroy(word);
+    }
+    return res;
+}
+
 /*
  * Parse the headers particularly
  *
@@ -114,6 +151,21 @@ static void parse_headers(struct request **req, struct string *line)
         (*req)->host = string_create(value->data, value->size);
     else if (key && value && !string_compare_n_str(key, "Content-Length", 14))
         (*req)->content_length = string_create(value->data, value->size);
+    else if (key && value && !string_compare_n_str(key, "Expect", 6))
+        (*req)->expect = string_create(value->data, value->size);
+    else if (key && value && !string_compare_n_str(key, "Upgrade", 7))
+        (*req)->upgrade = string_create(value->data, value->size);
+    else if (key && value && !string_compare_n_str(key, "HTTP2-Settings", 14))
+        (*req)->http2_settings = string_create(value->data, value->size);
+    else if (key && value && !(*req)->accept_encoding
+             && !string_compare_n_str(key, "Accept-Encoding", 15))
+        (*req)->accept_encoding = list_value(value, space, &saveptr);
+    else if (key && value && !(*req)->if_none_match
+             && !string_compare_n_str(key, "If-None-Match", 13))
+        (*req)->if_none_match = list_value(value, space, &saveptr);
+    else if (key && value && !(*req)->transfer_encoding
+             && !string_compare_n_str(key, "Transfer-Encoding", 17))
+        (*req)->transfer_encoding = list_value(value, space, &saveptr);
     else
     {
         while (value)
@@ -174,9 +226,104 @@ struct request *parse_request(char *str, size_t size)
     string_destroy(strequest);
     string_destroy(pattern);
 
+    trace_phase(TRACE_PARSED, res->method);
     return res;
 }
 
+/*
+ * @brief: return whether the parameters of a coding, from its first ';' up
+ * to the comma ending it, set its weight to zero: q=0, q=0. or q=0.000
+ */
+static int weight_is_zero(const char *params, size_t len)
+{
+    for (size_t i = 1; i < len; i++)
+    {
+        if (params[i] != '=' || (params[i - 1] != 'q' && params[i - 1] != 'Q'))
+            continue;
+        size_t j = i + 1;
+        if (j == len || params[j] != '0')
+            return 0;
+        while (++j < len && (params[j] == '0' || params[j] == '.'))
+            continue;
+        return j == len || params[j] == ' ' || params[j] == ';';
+    }
+    return 0;
+}
+
+int request_accepts(const struct request *req, const char *coding)
+{
+    const struct string *list = req->accept_encoding;
+    size_t len = strlen(coding);
+    int any = 0;
+    for (size_t i = 0; list && i < list->size;)
+    {
+        const char *data = list->data;
+        while (i < list->size && (data[i] == ' ' || data[i] == ','))
+            i++;
+        size_t start = i;
+        while (i < list->size && data[i] != ',' && data[i] != ';'
+               && data[i] != ' ')
+            i++;
+        size_t end = i;
+        while (i < list->size && data[i] != ',')
+            i++;
+        int accepted = !weight_is_zero(data + end, i - end);
+        if (end - start == len && !strncasecmp(data + start, coding, len))
+            return accepted;
+        if (end - start == 1 && data[start] == '*')
+            any = accepted;
+    }
+    return any;
+}
+
+int request_chunked(const struct request *req)
+{
+    const struct string *list = req->transfer_encoding;
+    if (!list)
+        return 0;
+    size_t end = list->size;
+    while (end && (list->data[end - 1] == ' ' || list->data[end - 1] == ','))
+        end--;
+    return end >= 7 && !strncasecmp(list->data + end - 7, "chunked", 7)
+        && (end == 7 || list->data[end - 8] == ' '
+            || list->data[end - 8] == ',');
+}
+
+int request_content_length(const struct request *req, size_t *length)
+{
+    struct string *str = req->content_length;
+    *length = 0;
+    for (size_t i = 0; str && i < str->size; i++)
+    {
+        if (str->data[i] < '0' || str->data[i] > '9'
+            || *length > (SIZE_MAX - 9) / 10)
+            return -1;
+        *length = *length * 10 + (str->data[i] - '0');
+    }
+    return 0;
+}
+
+struct server_config *request_vhost(const struct request *req,
+                                    struct server_config **vhosts,
+                                    size_t nb_vhosts)
+{
+    if (nb_vhosts > 1 && req && req->host)
+    {
+        size_t len = req->host->size;
+        const char *colon = memchr(req->host->data, ':', len);
+        if (colon)
+            len = colon - req->host->data;
+        for (size_t i = 0; i < nb_vhosts; i++)
+        {
+            struct string *name = &vhosts[i]->server_name;
+            if (name->size == len
+                && !strncasecmp(name->data, req->host->data, len))
+                return vhosts[i];
+        }
+    }
+    return vhosts[0];
+}
+
 /*
  * Destroy the request structure
  *
@@ -190,6 +337,12 @@ void request_destroy(struct request *request)
         string_destroy(request->version);
         string_destroy(request->host);
         string_destroy(request->content_length);
+        string_destroy(request->expect);
+        string_destroy(request->upgrade);
+        string_destroy(request->http2_settings);
+        string_destroy(request->accept_encoding);
+        string_destroy(request->if_none_match);
+        string_destroy(request->transfer_encoding);
         free(request);
     }
 }
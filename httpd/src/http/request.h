@@ -1,12 +1,15 @@
 #ifndef REQUEST_H
 #define REQUEST_H
 
+#include "../config/config.h"
 #include "../utils/string/string.h"
 
 enum method
 {
     GET = 0,
     HEAD,
+    PUT,
+    POST,
     OTHER
 };
 
@@ -17,6 +20,12 @@ struct request
     struct string *version;
     struct string *content_length;
     struct string *host;
+    struct string *expect;
+    struct string *upgrade;
+    struct string *http2_settings;
+    struct string *accept_encoding;
+    struct string *if_none_match;
+    struct string *transfer_encoding;
 };
 
 /*
@@ -28,4 +37,38 @@ void request_destroy(struct request *request);
 
 struct request *parse_request(char *str, size_t size);
 
+/*
+ * @brief: parse the Content-Length header of the request
+ *
+ * @param req: the request
+ * @param length: set to the length of the body, 0 if there is no such header
+ *
+ * @return 0 on success, -1 if the header is not a number
+ */
+int request_content_length(const struct request *req, size_t *length);
+
+/*
+ * @brief: return whether the body of the request uses the chunked
+ * transfer-encoding, its last coding being chunked
+ */
+int request_chunked(const struct request *req);
+
+/*
+ * @brief: return whether the Accept-Encoding of the request names a coding,
+ * or *, without a weight of zero
+ */
+int request_accepts(const struct request *req, const char *coding);
+
+/*
+ * @brief: return the vhost whose server_name is the Host of the request,
+ * the first one if none matches
+ *
+ * @param req: the request, can be NULL
+ * @param vhosts: the vhosts bound to the address the request came to
+ * @param nb_vhosts: the number of vhosts
+ */
+struct server_config *request_vhost(const struct request *req,
+                                    struct server_config **vhosts,
+                                    size_t nb_vhosts);
+
 #endif /*!REQUEST_H*/
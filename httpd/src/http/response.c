@@ -10,7 +10,12 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "../utils/trace/trace.h"
 #include "../utils/variables/variables.h"
+#include "bundle.h"
+#include "cache.h"
+#include "location.h"
+#include "upload.h"
 
 /*
  * Initialisation of the response structure. Each field is set to default values
@@ -25,7 +30,19 @@ static struct response *response_init(void)
         res->phrase = NULL;
         res->date = NULL;
         res->content_length = NULL;
+        res->content_type = NULL;
         res->connection = my_strdup("close");
+        res->chunked = false;
+        res->path = NULL;
+        res->listing = false;
+        res->fd = -1;
+        res->offset = 0;
+        res->head = NULL;
+        res->head_len = 0;
+        res->etag = NULL;
+        res->content_encoding = NULL;
+        res->vary = false;
+        res->cache_control = NULL;
     }
     return res;
 }
@@ -55,14 +72,25 @@ static char *str_time(void)
     return s;
 }
 
+/*
+ * @brief: return whether the target of a request is in a disabled location
+ */
+static bool disabled(const struct request *req,
+                     const struct server_config *vhost)
+{
+    const struct location *location =
+        location_find(vhost, req->target->data, req->target->size, NULL);
+    return location && location->disabled;
+}
+
 /*
  * @brief: return the response to a valid HTTP request
  *
  * @param req: the request structure to answer
- * @param config: the config file of the server
- * @param client_fd: the client socket
+ * @param vhost: the vhost the request is for
  */
-struct response *create_response(struct request *req, struct config *config)
+struct response *create_response(struct request *req,
+                                 const struct server_config *vhost)
 {
     struct response *res = response_init();
     if (!req)
@@ -70,49 +98,131 @@ struct response *create_response(struct request *req, struct config *config)
 
     res->date = str_time();
     res->version = my_strdup("HTTP/1.1");
-    if (req)
+    if (req && !req->target)
+        res->status_code = BAD_REQUEST;
+    else if (req && (vhost->proxy_pass || vhost->bundle)
+             && disabled(req, vhost))
+        response_set_status(res, NOT_FOUND, "not found");
+    else if (req && vhost->proxy_pass)
+        return res;
+    else if (req && (req->method == PUT || req->method == POST))
+        upload_check(req, vhost, res);
+    else if (req && vhost->bundle)
+        bundle_respond(req, vhost, res);
+    else if (req)
     {
-        char pathname[BUFFERSIZE] = { 0 };
-        char *root_dir = config->servers[0].root_dir;
-        strcat(pathname, root_dir);
-        strcat(pathname, req->target->data);
-
-        int fd;
-        if ((fd = open(pathname, O_RDONLY)) < 0)
+        struct file_entry *file =
+            cache_lookup(vhost, req->target->data, req->target->size);
+        if (!file)
+        {
+            res->status_code = ERROR;
+            res->phrase = my_strdup("a general error occured");
+        }
+        else if (file->error == EACCES)
         {
-            if (errno == EACCES)
-            {
-                res->status_code = FORBIDDEN;
-                res->phrase = my_strdup("access denied");
-            }
-            else if (errno == ENOENT)
-            {
-                res->status_code = NOT_FOUND;
-                res->phrase = my_strdup("not found");
-            }
-            else
-            {
-                res->status_code = ERROR;
-                res->phrase = my_strdup("a general error occured");
-            }
+            res->status_code = FORBIDDEN;
+            res->phrase = my_strdup("access denied");
+        }
+        else if (file->error == ENOENT || file->error == ENOTDIR)
+        {
+            res->status_code = NOT_FOUND;
+            res->phrase = my_strdup("not found");
+        }
+        else if (file->error)
+        {
+            res->status_code = ERROR;
+            res->phrase = my_strdup("a general error occured");
+        }
+        else if (file->directory)
+        {
+            res->content_type = file->mime;
+            res->path = my_strdup(file->path);
+            res->listing = true;
+            res->phrase = my_strdup("ok");
+            if (file->location && file->location->cache_control)
+                res->cache_control = my_strdup(file->location->cache_control);
         }
         else
         {
-            struct stat statbuf;
-            if (fstat(fd, &statbuf) < 0)
-            {
-                res->status_code = ERROR;
-                res->phrase = my_strdup("a general error occured");
-            }
             res->content_length = malloc(32);
-            sprintf(res->content_length, "%ld", statbuf.st_size);
+            sprintf(res->content_length, "%ld", file->size);
+            res->content_type = file->mime;
+            res->path = my_strdup(file->path);
             res->phrase = my_strdup("ok");
-            close(fd);
+            if (file->location && file->location->cache_control)
+                res->cache_control = my_strdup(file->location->cache_control);
         }
     }
+    trace_phase(TRACE_RESOLVED, res->status_code);
     return res;
 }
 
+void response_set_status(struct response *res, enum my_status_code code,
+                         const char *phrase)
+{
+    res->status_code = code;
+    free(res->phrase);
+    res->phrase = my_strdup(phrase);
+}
+
+int response_send_chunk(struct connection *conn, const struct iovec *data,
+                        size_t nb)
+{
+    struct iovec iov[CHUNK_IOV_MAX];
+    char size_line[sizeof(size_t) * 2 + 3];
+    while (nb)
+    {
+        size_t count = nb < CHUNK_IOV_MAX - 2 ? nb : CHUNK_IOV_MAX - 2;
+        size_t size = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            iov[i + 1] = data[i];
+            size += data[i].iov_len;
+        }
+        if (size)
+        {
+            iov[0].iov_base = size_line;
+            iov[0].iov_len = sprintf(size_line, "%zx\r\n", size);
+            iov[count + 1].iov_base = "\r\n";
+            iov[count + 1].iov_len = 2;
+            if (connection_sendv(conn, iov, count + 2) < 0)
+                return -1;
+        }
+        data += count;
+        nb -= count;
+    }
+    return 0;
+}
+
+int response_end_chunks(struct connection *conn,
+                        const struct trailer *trailers, size_t nb)
+{
+    struct iovec iov[CHUNK_IOV_MAX];
+    int count = 1;
+    iov[0].iov_base = "0\r\n";
+    iov[0].iov_len = 3;
+    for (size_t i = 0; i < nb; i++)
+    {
+        if (count + 4 >= CHUNK_IOV_MAX)
+        {
+            if (connection_sendv(conn, iov, count) < 0)
+                return -1;
+            count = 0;
+        }
+        iov[count].iov_base = (char *)trailers[i].name;
+        iov[count++].iov_len = strlen(trailers[i].name);
+        iov[count].iov_base = ": ";
+        iov[count++].iov_len = 2;
+        iov[count].iov_base = (char *)trailers[i].value;
+        iov[count++].iov_len = strlen(trailers[i].value);
+        iov[count].iov_base = "\r\n";
+        iov[count++].iov_len = 2;
+    }
+    iov[count].iov_base = "\r\n";
+    iov[count++].iov_len = 2;
+    return connection_sendv(conn, iov, count);
+}
+
 /*
  * @brief: destroy the response structure
  *
@@ -127,6 +237,10 @@ void response_destroy(struct response *res)
         free(res->date);
         free(res->content_length);
         free(res->connection);
+        free(res->path);
+        free(res->cache_control);
+        if (res->fd >= 0)
+            close(res->fd);
         free(res);
     }
 }
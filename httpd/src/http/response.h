@@ -1,9 +1,13 @@
 #ifndef RESPONSE_H
 #define RESPONSE_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #include "../config/config.h"
+#include "../utils/io/connection.h"
 #include "../utils/string/string.h"
 #include "request.h"
 
@@ -11,15 +15,46 @@ enum my_status_code
 {
     ERROR = 0,
 
+    CONTINUE = 100,
+
     VALID = 200,
+    CREATED,
+    NO_CONTENT = 204,
+
+    NOT_MODIFIED = 304,
 
     BAD_REQUEST = 400,
     FORBIDDEN = 403,
     NOT_FOUND,
     MNA,
-    HVNS = 505
+    LENGTH_REQUIRED = 411,
+    PAYLOAD_TOO_LARGE = 413,
+    EXPECTATION_FAILED = 417,
+    TOO_MANY_REQUESTS = 429,
+    INTERNAL_ERROR = 500,
+    NOT_IMPLEMENTED,
+    BAD_GATEWAY = 502,
+    SERVICE_UNAVAILABLE,
+    GATEWAY_TIMEOUT,
+    HVNS
 };
 
+/*
+ * @brief: the response to a request
+ *
+ * @param path: the file to send, or the directory to list
+ * @param fd: the file to send the body from when it is already open, -1
+ * otherwise, closed with the response
+ * @param offset: where the body starts in fd
+ * @param head: the header block sent after the Date instead of the one
+ * built from the fields, NULL if there is none
+ * @param etag: the ETag, may be NULL
+ * @param content_encoding: the encoding of the body, NULL if it is sent as
+ * it is
+ * @param vary: the body depends on the Accept-Encoding of the request
+ * @param cache_control: the Cache-Control of the location of the file, NULL
+ * if there is none
+ */
 struct response
 {
     char *version;
@@ -27,17 +62,79 @@ struct response
     char *phrase;
     char *date;
     char *content_length;
+    const char *content_type;
     char *connection;
+    bool chunked;
+
+    char *path;
+    bool listing;
+
+    int fd;
+    off_t offset;
+    const char *head;
+    size_t head_len;
+    const char *etag;
+    const char *content_encoding;
+    bool vary;
+    char *cache_control;
 };
 
+/*
+ * @brief: a header sent after the last chunk of a chunked body
+ */
+struct trailer
+{
+    const char *name;
+    const char *value;
+};
+
+/*
+ * Buffers gathered in a single write by response_send_chunk(), the chunk
+ * size line and the final CRLF included
+ */
+#define CHUNK_IOV_MAX 64
+
 /*
  * @brief: return the response to a valid HTTP request
  *
  * @param req: the request structure to answer
- * @param config: the config file of the server
- * @param client_fd: the client socket
+ * @param vhost: the vhost the request is for
+ */
+struct response *create_response(struct request *req,
+                                 const struct server_config *vhost);
+
+/*
+ * @brief: replace the status and the phrase of the response
+ */
+void response_set_status(struct response *res, enum my_status_code code,
+                         const char *phrase);
+
+/*
+ * @brief: send the buffers as one chunk of a chunked body, its size line and
+ * the data going out in a single gathered write without being copied. A
+ * chunk spanning more than CHUNK_IOV_MAX - 2 buffers is split in several.
+ * Empty chunks are not sent, as they would end the body.
+ *
+ * @param conn: the client connection
+ * @param data: the buffers of the chunk
+ * @param nb: the number of buffers
+ *
+ * @return 0 on success, -1 on error
+ */
+int response_send_chunk(struct connection *conn, const struct iovec *data,
+                        size_t nb);
+
+/*
+ * @brief: end a chunked body with the last chunk and the trailers
+ *
+ * @param conn: the client connection
+ * @param trailers: the trailers, may be NULL
+ * @param nb: the number of trailers
+ *
+ * @return 0 on success, -1 on error
  */
-struct response *create_response(struct request *req, struct config *config);
+int response_end_chunks(struct connection *conn,
+                        const struct trailer *trailers, size_t nb);
 
 /*
  * @brief: destroy the response structure
@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <arpa/inet.h>
+#include <criterion/criterion.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../acl.h"
+
+TestSuite(acl);
+
+static struct config *parse_rules(const char *rules)
+{
+    char path[] = "/tmp/acl_testXXXXXX";
+    int fd = mkstemp(path);
+    cr_assert(fd >= 0);
+    dprintf(fd, "[global]\npid_file = p\n[[vhosts]]\nserver_name = a\n"
+                "port = 1\nip = i\nroot_dir = r\n%s", rules);
+    close(fd);
+    struct config *config = parse_configuration(path);
+    unlink(path);
+    cr_assert_not_null(config);
+    cr_assert_eq(acl_init(config), 0);
+    return config;
+}
+
+static int allowed(const struct config *config, const char *ip)
+{
+    struct sockaddr_storage peer;
+    memset(&peer, 0, sizeof(peer));
+    if (strchr(ip, ':'))
+    {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&peer;
+        in6->sin6_family = AF_INET6;
+        cr_assert_eq(inet_pton(AF_INET6, ip, &in6->sin6_addr), 1);
+    }
+    else
+    {
+        struct sockaddr_in *in = (struct sockaddr_in *)&peer;
+        in->sin_family = AF_INET;
+        cr_assert_eq(inet_pton(AF_INET, ip, &in->sin_addr), 1);
+    }
+    return acl_allowed(&config->servers[0], &peer);
+}
+
+Test(acl, longest_block_decides)
+{
+    struct config *config =
+        parse_rules("allow = 10.0.0.0/8, 2001:db8::/32\n"
+                    "deny = 10.1.0.0/16\nallow = 10.1.2.0/24\n"
+                    "deny = 10.1.2.3, 10.1.2.0/24\n");
+    cr_assert(allowed(config, "10.200.0.1"));
+    cr_assert_not(allowed(config, "10.1.0.1"));
+    cr_assert_not(allowed(config, "10.1.2.0"));
+    cr_assert_not(allowed(config, "10.1.2.3"));
+    cr_assert_not(allowed(config, "11.0.0.1"));
+    cr_assert(allowed(config, "::ffff:10.2.0.1"));
+    cr_assert(allowed(config, "2001:db8:ffff::1"));
+    cr_assert_not(allowed(config, "2001:db9::1"));
+    acl_destroy();
+    config_destroy(config);
+}
+
+Test(acl, deny_only)
+{
+    struct config *config = parse_rules("deny = 192.168.0.0/16, ::1\n");
+    cr_assert_not(allowed(config, "192.168.3.4"));
+    cr_assert_not(allowed(config, "::1"));
+    cr_assert(allowed(config, "192.169.0.1"));
+    cr_assert(allowed(config, "::2"));
+    acl_destroy();
+    config_destroy(config);
+    config = parse_rules("deny = all\nallow = 127.0.0.1\n");
+    cr_assert(allowed(config, "127.0.0.1"));
+    cr_assert_not(allowed(config, "127.0.0.2"));
+    cr_assert_not(allowed(config, "fe80::1"));
+    acl_destroy();
+    config_destroy(config);
+}
+
+Test(acl, many_blocks)
+{
+    char *rules = calloc(4096, 24);
+    cr_assert_not_null(rules);
+    size_t len = 0;
+    for (int i = 0; i < 4096; i++)
+        len += sprintf(rules + len, "allow = 10.%d.%d.0/24\n", i >> 8 & 0xff,
+                       i & 0xff);
+    struct config *config = parse_rules(rules);
+    free(rules);
+    cr_assert_eq(config->servers[0].nb_access_rules, 4096);
+    cr_assert(allowed(config, "10.0.0.1"));
+    cr_assert(allowed(config, "10.15.255.254"));
+    cr_assert_not(allowed(config, "10.16.0.1"));
+    cr_assert(allowed(config, "::ffff:10.7.128.9"));
+    cr_assert_not(allowed(config, "9.255.255.255"));
+    acl_destroy();
+    config_destroy(config);
+}
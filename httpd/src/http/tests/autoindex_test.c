@@ -0,0 +1,146 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../autoindex.h"
+
+TestSuite(autoindex);
+
+static char dir[] = "/tmp/autoindex_testXXXXXX";
+
+static void create(const char *name)
+{
+    char path[256];
+    sprintf(path, "%s/%s", dir, name);
+    int fd = open(path, O_CREAT | O_WRONLY, 0644);
+    cr_assert(fd >= 0);
+    close(fd);
+}
+
+static void delete(const char *name)
+{
+    char path[256];
+    sprintf(path, "%s/%s", dir, name);
+    unlink(path);
+}
+
+/*
+ * Render the whole listing and return it as a string
+ */
+static char *render(struct listing *listing)
+{
+    int done;
+    while (!(done = autoindex_render(listing)))
+        continue;
+    cr_assert_eq(done, 1);
+    char *out = malloc(listing->size + 1);
+    size_t len = 0;
+    for (struct listing_segment *s = listing->segments; s; s = s->next)
+    {
+        memcpy(out + len, s->data, s->len);
+        len += s->len;
+    }
+    cr_assert_eq(len, listing->size);
+    out[len] = '\0';
+    return out;
+}
+
+Test(autoindex, escaped_links)
+{
+    strcpy(dir, "/tmp/autoindex_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    create("a b&.txt");
+    char sub[64];
+    sprintf(sub, "%s/sub", dir);
+    cr_assert(mkdir(sub, 0755) == 0);
+
+    struct listing *listing = autoindex_lookup(dir, "/pub?x=1", 8);
+    cr_assert_not_null(listing);
+    char *out = render(listing);
+    cr_assert_not_null(strstr(out, "<title>Index of /pub</title>"));
+    cr_assert_not_null(strstr(out, "<a href=\"./\">../</a>\n"));
+    cr_assert_not_null(
+        strstr(out, "<a href=\"pub/a%20b%26.txt\">a b&amp;.txt</a>\n"));
+    cr_assert_not_null(strstr(out, "<a href=\"pub/sub/\">sub/</a>\n"));
+    free(out);
+    autoindex_release(listing);
+    autoindex_flush();
+    delete("a b&.txt");
+    rmdir(sub);
+    rmdir(dir);
+}
+
+Test(autoindex, cached_until_modified)
+{
+    strcpy(dir, "/tmp/autoindex_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    char name[128];
+    for (int i = 0; i < 2000; i++)
+    {
+        sprintf(name, "%0100d", i);
+        create(name);
+    }
+    struct listing *first = autoindex_lookup(dir, "/", 1);
+    cr_assert_eq(autoindex_render(first), 0);
+    free(render(first));
+    cr_assert_not_null(first->segments->next);
+    autoindex_release(first);
+
+    struct listing *again = autoindex_lookup(dir, "/", 1);
+    cr_assert_eq(again, first);
+    cr_assert(again->complete);
+    autoindex_release(again);
+
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { 1, 0 } };
+    cr_assert(utimensat(AT_FDCWD, dir, times, 0) == 0);
+    struct listing *fresh = autoindex_lookup(dir, "/", 1);
+    cr_assert_neq(fresh, first);
+    cr_assert_not(fresh->complete);
+    autoindex_release(fresh);
+    autoindex_flush();
+    for (int i = 0; i < 2000; i++)
+    {
+        sprintf(name, "%0100d", i);
+        delete(name);
+    }
+    rmdir(dir);
+}
+
+Test(autoindex, cached_per_target)
+{
+    strcpy(dir, "/tmp/autoindex_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    create("file.txt");
+    struct listing *bare = autoindex_lookup(dir, "/d", 2);
+    char *out = render(bare);
+    cr_assert_not_null(strstr(out, "<a href=\"./\">../</a>\n"));
+    cr_assert_not_null(strstr(out, "<a href=\"d/file.txt\">"));
+    free(out);
+    autoindex_release(bare);
+
+    // The same directory named with a trailing slash links relative to it
+    struct listing *slash = autoindex_lookup(dir, "/d/?x", 5);
+    cr_assert_neq(slash, bare);
+    out = render(slash);
+    cr_assert_not_null(strstr(out, "<title>Index of /d/</title>"));
+    cr_assert_not_null(strstr(out, "<a href=\"../\">../</a>\n"));
+    cr_assert_not_null(strstr(out, "<a href=\"file.txt\">"));
+    cr_assert_null(strstr(out, "d/file.txt"));
+    free(out);
+    autoindex_release(slash);
+
+    cr_assert_eq(autoindex_lookup(dir, "/d", 2), bare);
+    cr_assert_eq(autoindex_lookup(dir, "/d/", 3), slash);
+    autoindex_release(bare);
+    autoindex_release(slash);
+    autoindex_flush();
+    delete("file.txt");
+    rmdir(dir);
+}
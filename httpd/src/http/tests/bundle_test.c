@@ -0,0 +1,147 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../server/server.h"
+#include "../bundle.h"
+
+TestSuite(bundle);
+
+static char dir[] = "/tmp/bundle_testXXXXXX";
+
+static void create(const char *name, const char *content, size_t times)
+{
+    char path[256];
+    sprintf(path, "%s/%s", dir, name);
+    FILE *file = fopen(path, "w");
+    cr_assert_not_null(file);
+    for (size_t i = 0; i < times; i++)
+        fputs(content, file);
+    fclose(file);
+}
+
+static struct response *get(const struct server_config *vhost,
+                            const char *head)
+{
+    struct request *req = parse_request((char *)head, strlen(head));
+    cr_assert_not_null(req);
+    struct response *res = create_response(req, vhost);
+    request_destroy(req);
+    return res;
+}
+
+Test(bundle, pack_and_serve)
+{
+    strcpy(dir, "/tmp/bundle_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    char sub[256];
+    sprintf(sub, "%s/sub", dir);
+    cr_assert_eq(mkdir(sub, 0755), 0);
+    create("index.html", "<p>hello</p>", 1000);
+    create("sub/index.html", "x", 1);
+    char bundle[256];
+    sprintf(bundle, "%s.bundle", dir);
+
+    struct server_config vhost;
+    memset(&vhost, 0, sizeof(vhost));
+    vhost.root_dir = dir;
+    vhost.default_file = "index.html";
+    vhost.bundle = bundle;
+    struct config config;
+    memset(&config, 0, sizeof(config));
+    config.servers = &vhost;
+    config.nb_servers = 1;
+    cr_assert_eq(bundle_pack(&vhost), 0);
+    cr_assert_eq(bundle_init(&config), 0);
+
+    struct response *res = get(&vhost, "GET /sub HTTP/1.1\r\n\r\n");
+    cr_assert_eq(res->status_code, VALID);
+    cr_assert_str_eq(res->content_length, "1");
+    cr_assert_str_eq(res->content_type, "text/html");
+    cr_assert_null(res->content_encoding);
+    cr_assert(res->fd >= 0);
+    char byte;
+    cr_assert_eq(pread(res->fd, &byte, 1, res->offset), 1);
+    cr_assert_eq(byte, 'x');
+    response_destroy(res);
+
+    res = get(&vhost,
+              "GET /?q HTTP/1.1\r\nAccept-Encoding: gzip, br;q=0\r\n\r\n");
+    cr_assert_eq(res->status_code, VALID);
+    cr_assert_str_eq(res->content_encoding, "gzip");
+    cr_assert(res->vary);
+    cr_assert_not_null(strstr(res->head, "Content-Encoding: gzip\r\n"));
+    char etag[64];
+    strcpy(etag, res->etag);
+    response_destroy(res);
+
+    char head[256];
+    sprintf(head, "HEAD / HTTP/1.1\r\nAccept-Encoding: gzip\r\n"
+                  "If-None-Match: \"other\", %s\r\n\r\n", etag);
+    res = get(&vhost, head);
+    cr_assert_eq(res->status_code, NOT_MODIFIED);
+    cr_assert_eq(res->fd, -1);
+    response_destroy(res);
+
+    res = get(&vhost, "GET /missing HTTP/1.1\r\n\r\n");
+    cr_assert_eq(res->status_code, NOT_FOUND);
+    response_destroy(res);
+
+    bundle_destroy();
+    unlink(bundle);
+    char path[512];
+    sprintf(path, "%s/index.html", sub);
+    unlink(path);
+    rmdir(sub);
+    sprintf(path, "%s/index.html", dir);
+    unlink(path);
+    rmdir(dir);
+}
+
+Test(bundle, pack_from_arguments)
+{
+    strcpy(dir, "/tmp/bundle_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    create("index.html", "packed", 1);
+    char path[256];
+    sprintf(path, "%s.cfg", dir);
+    FILE *file = fopen(path, "w");
+    cr_assert_not_null(file);
+    fprintf(file, "[global]\npid_file = p\n[[vhosts]]\nserver_name = a\n"
+                  "port = 1\nip = i\nroot_dir = %s\nbundle = %s.bundle\n",
+            dir, dir);
+    fclose(file);
+    struct config *config = parse_configuration(path);
+    cr_assert_not_null(config);
+
+    char *serve[] = { "httpd", path };
+    struct args *args = parse_arguments(2, serve);
+    cr_assert(args->valid);
+    cr_assert_eq(tool_launch(args, config), 1);
+    args_destroy(args);
+    char bundle[256];
+    sprintf(bundle, "%s.bundle", dir);
+    cr_assert_neq(access(bundle, F_OK), 0);
+
+    char *pack[] = { "httpd", "--pack", path };
+    args = parse_arguments(3, pack);
+    cr_assert(args->valid);
+    cr_assert_eq(tool_launch(args, config), 0);
+    args_destroy(args);
+    struct stat statbuf;
+    cr_assert_eq(stat(bundle, &statbuf), 0);
+    cr_assert_gt(statbuf.st_size, 0);
+
+    config_destroy(config);
+    unlink(bundle);
+    unlink(path);
+    sprintf(path, "%s/index.html", dir);
+    unlink(path);
+    rmdir(dir);
+}
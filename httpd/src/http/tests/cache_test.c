@@ -0,0 +1,133 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../cache.h"
+
+TestSuite(cache);
+
+static char dir[] = "/tmp/cache_testXXXXXX";
+
+static void write_file(const char *name, const char *content)
+{
+    char path[256];
+    sprintf(path, "%s/%s", dir, name);
+    int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    cr_assert(fd >= 0);
+    cr_assert_eq(write(fd, content, strlen(content)), (ssize_t)strlen(content));
+    close(fd);
+}
+
+static struct config *setup(bool autoindex)
+{
+    strcpy(dir, "/tmp/cache_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    char path[256];
+    sprintf(path, "%s/d", dir);
+    cr_assert_eq(mkdir(path, 0755), 0);
+    sprintf(path, "%s/empty", dir);
+    cr_assert_eq(mkdir(path, 0755), 0);
+    write_file("a.txt", "hello");
+    write_file("d/index.html", "<p>index</p>");
+
+    sprintf(path, "%s/httpd.cfg", dir);
+    FILE *file = fopen(path, "w");
+    cr_assert_not_null(file);
+    fprintf(file, "[global]\npid_file = p\n[[vhosts]]\nserver_name = a\n"
+                  "port = 1\nip = i\nroot_dir = %s\n"
+                  "default_file = index.html\nautoindex = %s\n",
+            dir, autoindex ? "true" : "false");
+    fclose(file);
+    struct config *config = parse_configuration(path);
+    cr_assert_not_null(config);
+    cache_set_ttl(60);
+    return config;
+}
+
+static struct file_entry *lookup(const struct config *config,
+                                 const char *target)
+{
+    return cache_lookup(&config->servers[0], target, strlen(target));
+}
+
+static void teardown(struct config *config)
+{
+    cache_flush();
+    config_destroy(config);
+    char command[128];
+    sprintf(command, "rm -rf %s", dir);
+    cr_assert_eq(system(command), 0);
+}
+
+Test(cache, hit)
+{
+    struct config *config = setup(false);
+    struct file_entry *entry = lookup(config, "/a.txt?v=1");
+    cr_assert_not_null(entry);
+    cr_assert_eq(entry->error, 0);
+    cr_assert_eq(entry->size, 5);
+    cr_assert_str_eq(entry->mime, "text/plain");
+    cr_assert(cache_fresh(&config->servers[0], "/a.txt", 6));
+    // The query string is not part of the key
+    cr_assert_eq(lookup(config, "/a.txt"), entry);
+    teardown(config);
+}
+
+Test(cache, miss)
+{
+    struct config *config = setup(false);
+    cr_assert_not(cache_fresh(&config->servers[0], "/missing", 8));
+    struct file_entry *entry = lookup(config, "/missing");
+    cr_assert_not_null(entry);
+    cr_assert_eq(entry->error, ENOENT);
+    // The failure is cached too, until the file shows up and it expires
+    write_file("missing", "late");
+    cr_assert_eq(lookup(config, "/missing"), entry);
+    cr_assert_eq(entry->error, ENOENT);
+    cr_assert_eq(lookup(config, "/a.txt/x")->error, ENOTDIR);
+    teardown(config);
+}
+
+Test(cache, ttl_expiry)
+{
+    struct config *config = setup(false);
+    struct file_entry *entry = lookup(config, "/a.txt");
+    cr_assert_eq(entry->size, 5);
+    write_file("a.txt", "hello, world");
+    cr_assert_eq(lookup(config, "/a.txt")->size, 5);
+    cache_set_ttl(0);
+    cr_assert_not(cache_fresh(&config->servers[0], "/a.txt", 6));
+    entry = lookup(config, "/a.txt");
+    cr_assert_eq(entry->size, 12);
+    cache_set_ttl(CACHE_TTL);
+    teardown(config);
+}
+
+Test(cache, directory_default_file)
+{
+    struct config *config = setup(false);
+    char index[256];
+    sprintf(index, "%s/d/index.html", dir);
+    struct file_entry *entry = lookup(config, "/d");
+    cr_assert_eq(entry->error, 0);
+    cr_assert_not(entry->directory);
+    cr_assert_str_eq(entry->path, index);
+    cr_assert_str_eq(entry->mime, "text/html");
+    cr_assert_eq(entry->size, 12);
+    cr_assert_str_eq(lookup(config, "/d/")->path, index);
+    // Without default_file nor autoindex, a directory is not found
+    cr_assert_eq(lookup(config, "/empty")->error, ENOENT);
+    teardown(config);
+
+    config = setup(true);
+    entry = lookup(config, "/empty/");
+    cr_assert_eq(entry->error, 0);
+    cr_assert(entry->directory);
+    teardown(config);
+}
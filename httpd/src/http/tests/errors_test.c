@@ -0,0 +1,108 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../errors.h"
+
+TestSuite(errors);
+
+static char dir[] = "/tmp/errors_testXXXXXX";
+
+/*
+ * Load a vhost whose 404 page is a file of page_size bytes with the
+ * extension "long", given type
+ */
+static struct config *setup(const char *type, size_t page_size)
+{
+    strcpy(dir, "/tmp/errors_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    char path[256];
+    sprintf(path, "%s/404.long", dir);
+    FILE *file = fopen(path, "w");
+    cr_assert_not_null(file);
+    for (size_t i = 0; i < page_size; i++)
+        fputc('p', file);
+    fclose(file);
+
+    sprintf(path, "%s/httpd.cfg", dir);
+    file = fopen(path, "w");
+    cr_assert_not_null(file);
+    fprintf(file, "[global]\npid_file = p\n[[vhosts]]\nserver_name = a\n"
+                  "port = 1\nip = i\nroot_dir = %s\nmime_types = long:%s\n"
+                  "error_pages = 404:%s/404.long\n",
+            dir, type, dir);
+    fclose(file);
+    struct config *config = parse_configuration(path);
+    cr_assert_not_null(config);
+    return config;
+}
+
+static void teardown(struct config *config)
+{
+    errors_destroy();
+    config_destroy(config);
+    char command[128];
+    sprintf(command, "rm -rf %s", dir);
+    cr_assert_eq(system(command), 0);
+}
+
+/*
+ * Send the 404 of the vhost on a socket pair and return what was sent
+ */
+static char *send_404(const struct config *config)
+{
+    int fds[2];
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    struct connection conn;
+    connection_init(&conn, fds[0]);
+    cr_assert_eq(errors_send(&conn, &config->servers[0], NOT_FOUND, false),
+                 0);
+    close(fds[0]);
+    size_t size = 256 << 10;
+    char *out = malloc(size);
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fds[1], out + len, size - 1 - len)) > 0)
+        len += n;
+    out[len] = '\0';
+    close(fds[1]);
+    return out;
+}
+
+Test(errors, long_content_type)
+{
+    char type[4096];
+    memset(type, 't', sizeof(type) - 1);
+    type[sizeof(type) - 1] = '\0';
+    struct config *config = setup(type, 10);
+    cr_assert_eq(errors_init(config), 0);
+
+    char *out = send_404(config);
+    cr_assert_eq(strncmp(out, "HTTP/1.1 404 Not Found\r\nDate: ", 30), 0);
+    char *field = strstr(out, "Content-Type: ");
+    cr_assert_not_null(field);
+    field += 14;
+    cr_assert_eq(strncmp(field, type, sizeof(type) - 1), 0);
+    cr_assert_eq(strncmp(field + sizeof(type) - 1, "\r\n", 2), 0);
+    cr_assert_not_null(strstr(out, "\r\n\r\npppppppppp"));
+    free(out);
+    teardown(config);
+}
+
+Test(errors, page_too_large)
+{
+    struct config *config = setup("text/plain", ERRORS_PAGE_MAX + 1);
+    cr_assert_eq(errors_init(config), 0);
+
+    char *out = send_404(config);
+    cr_assert_not_null(strstr(out, "Content-Type: text/html\r\n"));
+    cr_assert_not_null(strstr(out, "<h1>404 Not Found</h1>"));
+    cr_assert_null(strstr(out, "ppp"));
+    free(out);
+    teardown(config);
+}
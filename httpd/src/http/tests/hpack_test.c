@@ -0,0 +1,88 @@
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../hpack.h"
+
+TestSuite(hpack);
+
+static int concat(const struct hpack_field *field, void *data)
+{
+    char *out = data;
+    size_t len = strlen(out);
+    sprintf(out + len, "%.*s: %.*s\n", (int)field->name_len, field->name,
+            (int)field->value_len, field->value);
+    return 0;
+}
+
+static char *decode(struct hpack *hpack, const unsigned char *block,
+                    size_t len)
+{
+    static char out[1024];
+    out[0] = '\0';
+    cr_assert_eq(hpack_decode(hpack, block, len, concat, out), 0);
+    return out;
+}
+
+/*
+ * RFC 7541, appendix C.4: requests with Huffman coding sharing a table
+ */
+Test(hpack, rfc_huffman_requests)
+{
+    static struct hpack hpack;
+    hpack_init(&hpack);
+    const unsigned char first[] = { 0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1,
+                                    0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b,
+                                    0xa0, 0xab, 0x90, 0xf4, 0xff };
+    cr_assert_str_eq(decode(&hpack, first, sizeof(first)),
+                     ":method: GET\n:scheme: http\n:path: /\n"
+                     ":authority: www.example.com\n");
+    cr_assert_eq(hpack.size, 57);
+
+    const unsigned char second[] = { 0x82, 0x86, 0x84, 0xbe, 0x58, 0x86, 0xa8,
+                                     0xeb, 0x10, 0x64, 0x9c, 0xbf };
+    cr_assert_str_eq(decode(&hpack, second, sizeof(second)),
+                     ":method: GET\n:scheme: http\n:path: /\n"
+                     ":authority: www.example.com\n"
+                     "cache-control: no-cache\n");
+    cr_assert_eq(hpack.size, 110);
+
+    const unsigned char third[] = { 0x82, 0x87, 0x85, 0xbf, 0x40, 0x88, 0x25,
+                                    0xa8, 0x49, 0xe9, 0x5b, 0xa9, 0x7d, 0x7f,
+                                    0x89, 0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xb8,
+                                    0xe8, 0xb4, 0xbf };
+    cr_assert_str_eq(decode(&hpack, third, sizeof(third)),
+                     ":method: GET\n:scheme: https\n:path: /index.html\n"
+                     ":authority: www.example.com\n"
+                     "custom-key: custom-value\n");
+    cr_assert_eq(hpack.size, 164);
+    hpack_destroy(&hpack);
+}
+
+Test(hpack, errors)
+{
+    static struct hpack hpack;
+    hpack_init(&hpack);
+    char out[1024];
+    const unsigned char bad_index[] = { 0xbe };
+    cr_assert_eq(hpack_decode(&hpack, bad_index, 1, concat, out), -1);
+    const unsigned char bad_padding[] = { 0x00, 0x01, 'a', 0x81, 0x00 };
+    cr_assert_eq(hpack_decode(&hpack, bad_padding, 5, concat, out), -1);
+    const unsigned char too_large[] = { 0x3f, 0xe2, 0x1f };
+    cr_assert_eq(hpack_decode(&hpack, too_large, 3, concat, out), -1);
+    hpack_destroy(&hpack);
+}
+
+Test(hpack, status_and_literals)
+{
+    static struct hpack hpack;
+    unsigned char block[64];
+    size_t len = hpack_encode_status(block, 404);
+    len += hpack_encode_status(block + len, 413);
+    len += hpack_encode(block + len, HPACK_CONTENT_LENGTH, "1234", 4);
+    hpack_init(&hpack);
+    cr_assert_str_eq(decode(&hpack, block, len),
+                     ":status: 404\n:status: 413\ncontent-length: 1234\n");
+    cr_assert_eq(block[0], 0x8d);
+    hpack_destroy(&hpack);
+}
@@ -0,0 +1,84 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../location.h"
+
+TestSuite(location);
+
+static struct config *parse_locations(const char *locations)
+{
+    char path[] = "/tmp/location_testXXXXXX";
+    int fd = mkstemp(path);
+    cr_assert(fd >= 0);
+    dprintf(fd, "[global]\npid_file = p\n[[vhosts]]\nserver_name = a\n"
+                "port = 1\nip = i\nroot_dir = /srv\n%s", locations);
+    close(fd);
+    struct config *config = parse_configuration(path);
+    unlink(path);
+    cr_assert_not_null(config);
+    return config;
+}
+
+static const char *resolve(const struct config *config, const char *target)
+{
+    static char path[256];
+    cr_assert_eq(location_path(&config->servers[0], target, strlen(target),
+                               NULL, path, sizeof(path)),
+                 0);
+    return path;
+}
+
+Test(location, longest_prefix_then_exact)
+{
+    struct config *config = parse_locations(
+        "[[vhosts.locations]]\npath = /\ncache_control = no-cache\n"
+        "[[vhosts.locations]]\npath = /img\nalias = /data/images\n"
+        "[[vhosts.locations]]\npath = /img/raw/\nroot_dir = /raw\n"
+        "[[vhosts.locations]]\npath = /img/logo\nexact = true\n"
+        "alias = /data/logo.png\n"
+        "[[vhosts.locations]]\npath = /img/tmp\ndisabled = true\n");
+    cr_assert_eq(location_init(config), 0);
+    cr_assert_str_eq(resolve(config, "/index.html"), "/srv/index.html");
+    cr_assert_str_eq(resolve(config, "/img/a.png?v=2"), "/data/images/a.png");
+    cr_assert_str_eq(resolve(config, "/img"), "/data/images");
+    cr_assert_str_eq(resolve(config, "/imgs/a.png"), "/srv/imgs/a.png");
+    cr_assert_str_eq(resolve(config, "/img/raw/b.tif"), "/raw/img/raw/b.tif");
+    cr_assert_str_eq(resolve(config, "/img/logo"), "/data/logo.png");
+    cr_assert_str_eq(resolve(config, "/img/logo/x"), "/data/images/logo/x");
+
+    const struct server_config *vhost = &config->servers[0];
+    size_t matched = 0;
+    const struct location *location =
+        location_find(vhost, "/img/tmp/f", 10, &matched);
+    cr_assert(location->disabled);
+    cr_assert_eq(matched, 8);
+    location = location_find(vhost, "/other", 6, &matched);
+    cr_assert_str_eq(location->cache_control, "no-cache");
+    cr_assert_eq(matched, 0);
+    location_destroy();
+    config_destroy(config);
+}
+
+Test(location, without_locations)
+{
+    struct config *config = parse_locations("");
+    cr_assert_eq(location_init(config), 0);
+    cr_assert_null(location_find(&config->servers[0], "/a", 2, NULL));
+    cr_assert_str_eq(resolve(config, "/a/b?c"), "/srv/a/b");
+    location_destroy();
+    config_destroy(config);
+}
+
+Test(location, duplicate)
+{
+    struct config *config = parse_locations(
+        "[[vhosts.locations]]\npath = /a/b\n"
+        "[[vhosts.locations]]\npath = //a/b/\nexact = true\n"
+        "[[vhosts.locations]]\npath = /a//b\n");
+    cr_assert_eq(location_init(config), -1);
+    config_destroy(config);
+}
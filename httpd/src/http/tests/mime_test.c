@@ -0,0 +1,48 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <ctype.h>
+#include <stdio.h>
+
+#include "../mime.h"
+
+TestSuite(mime);
+
+/*
+ * Every extension of mime.def, which must resolve through the displacements
+ * of mime_table.h whatever slot it was given: an entry added without running
+ * mime_gen.py is not found
+ */
+static const struct
+{
+    const char *extension;
+    const char *type;
+} builtin[] = {
+#define MIME_TYPE(extension, type) { extension, type },
+#include "../mime.def"
+#undef MIME_TYPE
+};
+
+Test(mime, every_builtin_extension)
+{
+    for (size_t i = 0; i < sizeof(builtin) / sizeof(*builtin); i++)
+    {
+        char path[64];
+        sprintf(path, "/srv/dir.d/file.%s", builtin[i].extension);
+        cr_assert_str_eq(mime_lookup(NULL, path), builtin[i].type, "%s",
+                         path);
+        // Extensions are compared in lowercase
+        for (char *c = path; *c; c++)
+            *c = toupper((unsigned char)*c);
+        cr_assert_str_eq(mime_lookup(NULL, path), builtin[i].type, "%s",
+                         path);
+    }
+}
+
+Test(mime, unknown_extension)
+{
+    cr_assert_str_eq(mime_lookup(NULL, "/srv/file.unknownext"), MIME_DEFAULT);
+    cr_assert_str_eq(mime_lookup(NULL, "/srv/file.tx"), MIME_DEFAULT);
+    cr_assert_str_eq(mime_lookup(NULL, "/srv/file."), MIME_DEFAULT);
+    cr_assert_str_eq(mime_lookup(NULL, "/srv/dir.txt/file"), MIME_DEFAULT);
+}
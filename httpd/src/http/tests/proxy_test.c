@@ -0,0 +1,293 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../proxy.h"
+#include "../request.h"
+#include "../response.h"
+
+TestSuite(proxy);
+
+static char socket_path[sizeof("/tmp/proxy_testXXXXXX/s")];
+static char proxy_pass[sizeof("unix:") + sizeof(socket_path)];
+
+/*
+ * Answer the requests of one connection: "/count" gets the number of
+ * connections accepted so far, "/chunked" a chunked body with a trailer,
+ * "/echo" the chunked body it was sent and "/close" no answer at all
+ */
+static void backend_serve(int fd, int accepted)
+{
+    char buf[4096];
+    size_t len = 0;
+    ssize_t n;
+    while ((n = recv(fd, buf + len, sizeof(buf) - len - 1, 0)) > 0)
+    {
+        len += n;
+        buf[len] = '\0';
+        char *end = strstr(buf, "\r\n\r\n");
+        if (!end)
+            continue;
+        if (strstr(buf, " /close "))
+            break;
+        char out[512];
+        int olen;
+        if (strstr(buf, " /echo "))
+        {
+            char *body = end + 4;
+            char *last = strstr(body, "0\r\n\r\n");
+            if (!last)
+                continue;
+            end = last + 1;
+            int blen = end + 4 - body;
+            olen = sprintf(out, "HTTP/1.1 200 OK\r\nContent-Length: %d"
+                                "\r\n\r\n%.*s",
+                           blen, blen, body);
+        }
+        else if (!strncmp(buf, "GET /chunked ", 13))
+            olen = sprintf(out, "HTTP/1.1 200 OK\r\n"
+                                "Transfer-Encoding: chunked\r\n\r\n"
+                                "5\r\nhello\r\n7\r\n world!\r\n"
+                                "0\r\nX-Trailer: 1\r\n\r\n");
+        else
+            olen = sprintf(out,
+                           "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n"
+                           "Connection: keep-alive\r\n\r\naccepts=%03d",
+                           accepted);
+        send(fd, out, olen, MSG_NOSIGNAL);
+        len -= end + 4 - buf;
+        memmove(buf, end + 4, len);
+    }
+    close(fd);
+}
+
+static pid_t backend_start(void)
+{
+    strcpy(socket_path, "/tmp/proxy_testXXXXXX");
+    cr_assert_not_null(mkdtemp(socket_path));
+    strcat(socket_path, "/s");
+    sprintf(proxy_pass, "unix:%s", socket_path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, socket_path);
+    cr_assert(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    cr_assert(listen(sock, 8) == 0);
+    pid_t pid = fork();
+    if (!pid)
+    {
+        int accepted = 0;
+        int fd;
+        while ((fd = accept(sock, NULL, NULL)) >= 0)
+            backend_serve(fd, ++accepted);
+        _exit(0);
+    }
+    close(sock);
+    return pid;
+}
+
+static void backend_stop(pid_t pid)
+{
+    proxy_pool_destroy();
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    unlink(socket_path);
+    *strrchr(socket_path, '/') = '\0';
+    rmdir(socket_path);
+}
+
+/*
+ * Forward a request through the proxy and return what the client received,
+ * the body being partly read with the head and the rest sent after it
+ */
+static char *forward_body(struct server_config *vhost, const char *head,
+                          const char *buffered, const char *rest, int *ret)
+{
+    int client[2];
+    cr_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, client) == 0);
+    cr_assert_eq(write(client[1], rest, strlen(rest)), (ssize_t)strlen(rest));
+    char *raw = strdup(head);
+    struct request *req = parse_request(raw, strlen(raw));
+    struct response *res = create_response(req, vhost);
+    struct connection conn;
+    connection_init(&conn, client[0]);
+    *ret = proxy_forward(&conn, vhost, req, raw, strlen(raw), buffered,
+                         strlen(buffered), res);
+    connection_close(&conn);
+
+    char *out = calloc(4096, 1);
+    size_t len = 0;
+    ssize_t n;
+    while ((n = recv(client[1], out + len, 4095 - len, 0)) > 0)
+        len += n;
+    close(client[1]);
+    if (*ret)
+        sprintf(out, "%d", res->status_code);
+    request_destroy(req);
+    response_destroy(res);
+    free(raw);
+    return out;
+}
+
+static char *forward(struct server_config *vhost, const char *head, int *ret)
+{
+    return forward_body(vhost, head, "", "", ret);
+}
+
+Test(proxy, content_length_and_reuse)
+{
+    pid_t pid = backend_start();
+    struct server_config vhost = { .proxy_pass = proxy_pass };
+    const char *head = "GET /count HTTP/1.1\r\nHost: app\r\n"
+                       "Connection: close\r\n\r\n";
+    int ret;
+    for (int i = 0; i < 3; i++)
+    {
+        char *out = forward(&vhost, head, &ret);
+        cr_assert_eq(ret, 0);
+        cr_assert_not_null(strstr(out, "Connection: close\r\n"));
+        cr_assert_null(strstr(out, "keep-alive"));
+        cr_assert_not_null(strstr(out, "\r\n\r\naccepts=001"));
+        free(out);
+    }
+    backend_stop(pid);
+}
+
+Test(proxy, chunked)
+{
+    pid_t pid = backend_start();
+    struct server_config vhost = { .proxy_pass = proxy_pass };
+    int ret;
+    char *out = forward(&vhost, "GET /chunked HTTP/1.1\r\nHost: a\r\n\r\n",
+                        &ret);
+    cr_assert_eq(ret, 0);
+    cr_assert_not_null(strstr(out, "\r\n\r\n5\r\nhello\r\n7\r\n world!\r\n"
+                                   "0\r\nX-Trailer: 1\r\n\r\n"));
+    free(out);
+    out = forward(&vhost, "GET /count HTTP/1.1\r\nHost: a\r\n\r\n", &ret);
+    cr_assert_not_null(strstr(out, "accepts=001"));
+    free(out);
+    backend_stop(pid);
+}
+
+Test(proxy, chunked_request_body)
+{
+    pid_t pid = backend_start();
+    struct server_config vhost = { .proxy_pass = proxy_pass };
+    const char *head = "POST /echo HTTP/1.1\r\nHost: a\r\n"
+                       "Transfer-Encoding: chunked\r\n\r\n";
+    int ret;
+    char *out = forward_body(&vhost, head, "5\r\nhel",
+                             "lo\r\n0\r\n\r\nGET /next HTTP/1.1\r\n", &ret);
+    cr_assert_eq(ret, 0);
+    // The body ends at its last chunk, the next request is not forwarded
+    cr_assert_not_null(strstr(out, "Content-Length: 15\r\n"));
+    cr_assert_not_null(strstr(out, "\r\n\r\n5\r\nhello\r\n0\r\n\r\n"));
+    free(out);
+
+    out = forward_body(&vhost, head, "zz\r\n", "", &ret);
+    cr_assert_eq(ret, -1);
+    cr_assert_str_eq(out, "400");
+    free(out);
+    backend_stop(pid);
+}
+
+/*
+ * A pooled connection closed by the upstream is dialed again once for a
+ * GET, never for a POST whose head went through
+ */
+Test(proxy, retry)
+{
+    pid_t pid = backend_start();
+    struct server_config vhost = { .proxy_pass = proxy_pass };
+    const char *count = "GET /count HTTP/1.1\r\nHost: a\r\n\r\n";
+    int ret;
+    char *out = forward(&vhost, count, &ret);
+    cr_assert_not_null(strstr(out, "accepts=001"));
+    free(out);
+    out = forward(&vhost, "POST /close HTTP/1.1\r\nHost: a\r\n"
+                          "Content-Length: 0\r\n\r\n",
+                  &ret);
+    cr_assert_str_eq(out, "502");
+    free(out);
+    out = forward(&vhost, count, &ret);
+    cr_assert_not_null(strstr(out, "accepts=002"));
+    free(out);
+
+    out = forward(&vhost, "GET /close HTTP/1.1\r\nHost: a\r\n\r\n", &ret);
+    cr_assert_str_eq(out, "502");
+    free(out);
+    out = forward(&vhost, count, &ret);
+    cr_assert_not_null(strstr(out, "accepts=004"));
+    free(out);
+    backend_stop(pid);
+}
+
+Test(proxy, bad_gateway)
+{
+    struct server_config vhost = { .proxy_pass = "unix:/nonexistent/s" };
+    int ret;
+    char *out = forward(&vhost, "GET / HTTP/1.1\r\nHost: a\r\n\r\n", &ret);
+    cr_assert_eq(ret, -1);
+    cr_assert_str_eq(out, "502");
+    free(out);
+    proxy_pool_destroy();
+}
+
+/*
+ * An upstream which never accepts leaves the turns waiting, the exchange
+ * timing out without a response
+ */
+Test(proxy, expired)
+{
+    strcpy(socket_path, "/tmp/proxy_testXXXXXX");
+    cr_assert_not_null(mkdtemp(socket_path));
+    strcat(socket_path, "/s");
+    sprintf(proxy_pass, "unix:%s", socket_path);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, socket_path);
+    cr_assert(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    cr_assert(listen(sock, 8) == 0);
+
+    struct server_config vhost = { .proxy_pass = proxy_pass };
+    char *raw = strdup("GET / HTTP/1.1\r\nHost: a\r\n\r\n");
+    struct request *req = parse_request(raw, strlen(raw));
+    struct response *res = create_response(req, &vhost);
+    int client[2];
+    cr_assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, client)
+              == 0);
+    struct connection conn;
+    connection_init(&conn, client[0]);
+    struct proxy *p = proxy_start(&conn, &vhost, req, raw, strlen(raw), "",
+                                  0, res);
+    cr_assert_not_null(p);
+    cr_assert_eq(proxy_turn(p), 0);
+    cr_assert_eq(proxy_turn(p), 0);
+    struct pollfd fd;
+    proxy_events(p, &fd);
+    cr_assert_eq(fd.events, POLLIN);
+    cr_assert_neq(fd.fd, client[0]);
+    cr_assert_eq(proxy_expire(p), -1);
+    cr_assert_eq(res->status_code, GATEWAY_TIMEOUT);
+    proxy_end(p);
+
+    connection_close(&conn);
+    close(client[1]);
+    request_destroy(req);
+    response_destroy(res);
+    free(raw);
+    close(sock);
+    proxy_pool_destroy();
+    unlink(socket_path);
+    *strrchr(socket_path, '/') = '\0';
+    rmdir(socket_path);
+}
@@ -0,0 +1,79 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <arpa/inet.h>
+#include <criterion/criterion.h>
+#include <netinet/in.h>
+#include <string.h>
+
+#include "../ratelimit.h"
+
+TestSuite(ratelimit);
+
+static struct sockaddr_storage address(const char *ip)
+{
+    struct sockaddr_storage peer;
+    memset(&peer, 0, sizeof(peer));
+    if (strchr(ip, ':'))
+    {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&peer;
+        in6->sin6_family = AF_INET6;
+        cr_assert_eq(inet_pton(AF_INET6, ip, &in6->sin6_addr), 1);
+    }
+    else
+    {
+        struct sockaddr_in *in = (struct sockaddr_in *)&peer;
+        in->sin_family = AF_INET;
+        cr_assert_eq(inet_pton(AF_INET, ip, &in->sin_addr), 1);
+    }
+    return peer;
+}
+
+Test(ratelimit, burst_per_client)
+{
+    cr_assert_eq(ratelimit_init(0, 3), 0);
+    struct sockaddr_storage a = address("10.0.0.1");
+    struct sockaddr_storage b = address("10.0.0.2");
+    for (int i = 0; i < 3; i++)
+        cr_assert(ratelimit_request(&a));
+    cr_assert_not(ratelimit_request(&a));
+    cr_assert(ratelimit_request(&b));
+    for (int i = 0; i < 10; i++)
+        cr_assert(ratelimit_connection(&a));
+    ratelimit_destroy();
+}
+
+Test(ratelimit, ipv6_per_block)
+{
+    cr_assert_eq(ratelimit_init(2, 0), 0);
+    struct sockaddr_storage a = address("2001:db8:1:2::1");
+    struct sockaddr_storage b = address("2001:db8:1:2::ffff");
+    struct sockaddr_storage c = address("2001:db8:1:3::1");
+    struct sockaddr_storage mapped = address("::ffff:10.0.0.1");
+    struct sockaddr_storage v4 = address("10.0.0.1");
+    cr_assert(ratelimit_connection(&a));
+    cr_assert(ratelimit_connection(&b));
+    cr_assert_not(ratelimit_connection(&a));
+    cr_assert(ratelimit_connection(&c));
+    cr_assert(ratelimit_connection(&mapped));
+    cr_assert(ratelimit_connection(&v4));
+    cr_assert_not(ratelimit_connection(&mapped));
+    ratelimit_destroy();
+}
+
+Test(ratelimit, full_table_still_limits)
+{
+    cr_assert_eq(ratelimit_init(1, 0), 0);
+    struct sockaddr_storage peer = address("10.0.0.1");
+    struct sockaddr_in *in = (struct sockaddr_in *)&peer;
+    // Four times as many clients as slots leave no probe window free
+    for (uint32_t i = 0; i < 4U << (RATELIMIT_SHARD_BITS + RATELIMIT_SLOT_BITS);
+         i++)
+    {
+        in->sin_addr.s_addr = htonl(0x0b000000 + i);
+        ratelimit_connection(&peer);
+    }
+    struct sockaddr_storage late = address("10.0.0.1");
+    cr_assert(ratelimit_connection(&late));
+    cr_assert_not(ratelimit_connection(&late));
+    ratelimit_destroy();
+}
@@ -0,0 +1,66 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../response.h"
+
+TestSuite(response);
+
+/*
+ * Close the writing end and return everything sent on it
+ */
+static char *drain(struct connection *conn, int sv[2])
+{
+    connection_close(conn);
+    char *out = calloc(8192, 1);
+    size_t len = 0;
+    ssize_t n;
+    while ((n = recv(sv[1], out + len, 8191 - len, 0)) > 0)
+        len += n;
+    close(sv[1]);
+    return out;
+}
+
+Test(response, chunks_and_trailers)
+{
+    int sv[2];
+    cr_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    struct iovec data[] = { { "hello", 5 }, { "", 0 }, { " world!", 7 } };
+    struct trailer trailers[] = { { "X-Checksum", "42" },
+                                  { "X-Count", "2" } };
+    struct connection conn;
+    connection_init(&conn, sv[0]);
+    cr_assert_eq(response_send_chunk(&conn, data, 3), 0);
+    cr_assert_eq(response_send_chunk(&conn, data + 1, 1), 0);
+    cr_assert_eq(response_send_chunk(&conn, data, 1), 0);
+    cr_assert_eq(response_end_chunks(&conn, trailers, 2), 0);
+    char *out = drain(&conn, sv);
+    cr_assert_str_eq(out, "c\r\nhello world!\r\n5\r\nhello\r\n0\r\n"
+                          "X-Checksum: 42\r\nX-Count: 2\r\n\r\n");
+    free(out);
+}
+
+Test(response, split_chunks)
+{
+    int sv[2];
+    cr_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    struct iovec data[100];
+    for (size_t i = 0; i < 100; i++)
+        data[i] = (struct iovec){ "abcdefghijklmnop", 16 };
+    struct connection conn;
+    connection_init(&conn, sv[0]);
+    cr_assert_eq(response_send_chunk(&conn, data, 100), 0);
+    cr_assert_eq(response_end_chunks(&conn, NULL, 0), 0);
+    char *out = drain(&conn, sv);
+    size_t first = (CHUNK_IOV_MAX - 2) * 16;
+    char *body = strstr(out, "\r\n") + 2;
+    cr_assert_eq(strtoul(out, NULL, 16), first);
+    char *second = body + first + 2;
+    cr_assert_eq(strtoul(second, NULL, 16), 100 * 16 - first);
+    cr_assert_str_eq(out + strlen(out) - 5, "0\r\n\r\n");
+    free(out);
+}
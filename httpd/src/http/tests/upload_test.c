@@ -0,0 +1,233 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../upload.h"
+
+TestSuite(upload);
+
+static char dir[] = "/tmp/upload_testXXXXXX";
+
+/*
+ * The first vhost takes uploads of 10 bytes at most, the second none
+ */
+static struct config *setup(void)
+{
+    strcpy(dir, "/tmp/upload_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    char path[256];
+    sprintf(path, "%s/httpd.cfg", dir);
+    FILE *file = fopen(path, "w");
+    cr_assert_not_null(file);
+    fprintf(file, "[global]\npid_file = p\n[[vhosts]]\nserver_name = a\n"
+                  "port = 1\nip = i\nroot_dir = %s\nupload = true\n"
+                  "upload_max_size = 10\n[[vhosts]]\nserver_name = b\n"
+                  "port = 2\nip = i\nroot_dir = %s\n",
+            dir, dir);
+    fclose(file);
+    struct config *config = parse_configuration(path);
+    unlink(path);
+    cr_assert_not_null(config);
+    return config;
+}
+
+static void teardown(struct config *config)
+{
+    config_destroy(config);
+    char command[128];
+    sprintf(command, "rm -rf %s", dir);
+    cr_assert_eq(system(command), 0);
+}
+
+/*
+ * Check the request head against a vhost, the request being kept in *req
+ * when it is given
+ */
+static struct response *check(const struct server_config *vhost,
+                              const char *head, struct request **req)
+{
+    char *raw = strdup(head);
+    struct request *request = parse_request(raw, strlen(raw));
+    cr_assert_not_null(request);
+    struct response *res = create_response(request, vhost);
+    if (req)
+        *req = request;
+    else
+        request_destroy(request);
+    free(raw);
+    return res;
+}
+
+static enum my_status_code status_of(const struct server_config *vhost,
+                                     const char *head)
+{
+    struct response *res = check(vhost, head, NULL);
+    enum my_status_code status = res->status_code;
+    response_destroy(res);
+    return status;
+}
+
+Test(upload, refused)
+{
+    struct config *config = setup();
+    const struct server_config *vhost = &config->servers[0];
+    cr_assert_eq(status_of(&config->servers[1],
+                           "PUT /f HTTP/1.1\r\nHost: b\r\n"
+                           "Content-Length: 1\r\n\r\n"),
+                 MNA);
+    cr_assert_eq(status_of(vhost, "PUT /f HTTP/1.1\r\nHost: a\r\n"
+                                  "Expect: 200-ok\r\n"
+                                  "Content-Length: 1\r\n\r\n"),
+                 EXPECTATION_FAILED);
+    cr_assert_eq(status_of(vhost, "PUT /f HTTP/1.1\r\nHost: a\r\n\r\n"),
+                 LENGTH_REQUIRED);
+    cr_assert_eq(status_of(vhost, "PUT /f HTTP/1.1\r\nHost: a\r\n"
+                                  "Content-Length: 1x\r\n\r\n"),
+                 BAD_REQUEST);
+    cr_assert_eq(status_of(vhost, "POST /f HTTP/1.1\r\nHost: a\r\n"
+                                  "Content-Length: 11\r\n\r\n"),
+                 PAYLOAD_TOO_LARGE);
+    cr_assert_eq(status_of(vhost, "PUT /../f HTTP/1.1\r\nHost: a\r\n"
+                                  "Content-Length: 1\r\n\r\n"),
+                 FORBIDDEN);
+    cr_assert_eq(status_of(vhost, "PUT /d/ HTTP/1.1\r\nHost: a\r\n"
+                                  "Content-Length: 1\r\n\r\n"),
+                 FORBIDDEN);
+    teardown(config);
+}
+
+/*
+ * Store a body whose first bytes came with the head, the rest being sent
+ * on the connection before it is closed
+ */
+static struct response *store(const struct server_config *vhost,
+                              const char *head, const char *buffered,
+                              const char *rest)
+{
+    struct request *req;
+    struct response *res = check(vhost, head, &req);
+    cr_assert_eq(res->status_code, VALID);
+    int sv[2];
+    cr_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    cr_assert_eq(write(sv[1], rest, strlen(rest)), (ssize_t)strlen(rest));
+    close(sv[1]);
+    struct connection conn;
+    connection_init(&conn, sv[0]);
+    upload_receive(&conn, req, res, buffered, strlen(buffered));
+    connection_close(&conn);
+    request_destroy(req);
+    return res;
+}
+
+static void assert_content(const char *name, const char *expected)
+{
+    char path[256];
+    sprintf(path, "%s/%s", dir, name);
+    char content[64] = { 0 };
+    int fd = open(path, O_RDONLY);
+    cr_assert(fd >= 0);
+    cr_assert_geq(read(fd, content, sizeof(content) - 1), 0);
+    close(fd);
+    cr_assert_str_eq(content, expected);
+}
+
+Test(upload, created_then_replaced)
+{
+    struct config *config = setup();
+    const struct server_config *vhost = &config->servers[0];
+    struct response *res = store(vhost,
+                                 "PUT /f.txt?x HTTP/1.1\r\nHost: a\r\n"
+                                 "Content-Length: 10\r\n\r\n",
+                                 "hell", "o body");
+    cr_assert_eq(res->status_code, CREATED);
+    cr_assert_str_eq(res->content_length, "0");
+    response_destroy(res);
+    assert_content("f.txt", "hello body");
+
+    res = store(vhost,
+                "POST /f.txt HTTP/1.1\r\nHost: a\r\nContent-Length: 3\r\n\r\n",
+                "", "new");
+    cr_assert_eq(res->status_code, NO_CONTENT);
+    response_destroy(res);
+    assert_content("f.txt", "new");
+    teardown(config);
+}
+
+Test(upload, truncated_body)
+{
+    struct config *config = setup();
+    struct response *res = store(&config->servers[0],
+                                 "PUT /g HTTP/1.1\r\nHost: a\r\n"
+                                 "Content-Length: 8\r\n\r\n",
+                                 "ab", "cd");
+    cr_assert_eq(res->status_code, BAD_REQUEST);
+    response_destroy(res);
+    char path[256];
+    sprintf(path, "%s/g", dir);
+    cr_assert_neq(access(path, F_OK), 0);
+    teardown(config);
+}
+
+Test(upload, turns_without_waiting)
+{
+    struct config *config = setup();
+    struct request *req;
+    struct response *res = check(&config->servers[0],
+                                 "PUT /h HTTP/1.1\r\nHost: a\r\n"
+                                 "Content-Length: 6\r\n\r\n",
+                                 &req);
+    int sv[2];
+    cr_assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+    struct connection conn;
+    connection_init(&conn, sv[0]);
+    struct upload *up = upload_start(&conn, req, res, "ab", 2);
+    cr_assert_not_null(up);
+    cr_assert_eq(upload_turn(up), 0);
+    cr_assert_eq(write(sv[1], "cd", 2), 2);
+    cr_assert_eq(upload_turn(up), 0);
+    char path[256];
+    sprintf(path, "%s/h", dir);
+    cr_assert_neq(access(path, F_OK), 0);
+    cr_assert_eq(write(sv[1], "ef", 2), 2);
+    cr_assert_eq(upload_turn(up), 1);
+    cr_assert_eq(res->status_code, CREATED);
+    upload_end(up);
+    assert_content("h", "abcdef");
+    close(sv[1]);
+    connection_close(&conn);
+    request_destroy(req);
+    response_destroy(res);
+    teardown(config);
+}
+
+Test(upload, ended_before_complete)
+{
+    struct config *config = setup();
+    struct request *req;
+    struct response *res = check(&config->servers[0],
+                                 "PUT /i HTTP/1.1\r\nHost: a\r\n"
+                                 "Content-Length: 6\r\n\r\n",
+                                 &req);
+    int sv[2];
+    cr_assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+    struct connection conn;
+    connection_init(&conn, sv[0]);
+    struct upload *up = upload_start(&conn, req, res, "ab", 2);
+    cr_assert_not_null(up);
+    cr_assert_eq(upload_turn(up), 0);
+    upload_end(up);
+    char command[128];
+    sprintf(command, "test -z \"$(ls %s)\"", dir);
+    cr_assert_eq(system(command), 0);
+    close(sv[1]);
+    connection_close(&conn);
+    request_destroy(req);
+    response_destroy(res);
+    teardown(config);
+}
@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../cache.h"
+#include "../watch.h"
+
+TestSuite(watch);
+
+static char dir[] = "/tmp/watch_testXXXXXX";
+
+static void write_file(const char *name, const char *content)
+{
+    char path[256];
+    sprintf(path, "%s/%s", dir, name);
+    int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    cr_assert(fd >= 0);
+    cr_assert_eq(write(fd, content, strlen(content)), (ssize_t)strlen(content));
+    close(fd);
+}
+
+/*
+ * Watch a root_dir holding a.txt and d/b.txt, its entries trusted for a
+ * minute
+ */
+static struct config *setup(int *fd)
+{
+    strcpy(dir, "/tmp/watch_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    char path[256];
+    sprintf(path, "%s/d", dir);
+    cr_assert_eq(mkdir(path, 0755), 0);
+    write_file("a.txt", "hello");
+    write_file("d/b.txt", "b");
+
+    sprintf(path, "%s/httpd.cfg", dir);
+    FILE *file = fopen(path, "w");
+    cr_assert_not_null(file);
+    fprintf(file, "[global]\npid_file = p\ncache_ttl = 60\n[[vhosts]]\n"
+                  "server_name = a\nport = 1\nip = i\nroot_dir = %s\n",
+            dir);
+    fclose(file);
+    struct config *config = parse_configuration(path);
+    cr_assert_not_null(config);
+    *fd = watch_init(config);
+    cr_assert_geq(*fd, 0);
+    return config;
+}
+
+static void teardown(struct config *config)
+{
+    watch_destroy();
+    cache_flush();
+    config_destroy(config);
+    char command[128];
+    sprintf(command, "rm -rf %s", dir);
+    cr_assert_eq(system(command), 0);
+}
+
+static struct file_entry *lookup(const struct config *config,
+                                 const char *target)
+{
+    return cache_lookup(&config->servers[0], target, strlen(target));
+}
+
+/*
+ * Read the events as the event loop does once the descriptor is readable
+ */
+static void process(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    cr_assert_eq(poll(&pfd, 1, 2000), 1, "no inotify event");
+    watch_process();
+}
+
+Test(watch, modified_file)
+{
+    int fd;
+    struct config *config = setup(&fd);
+    cr_assert_eq(lookup(config, "/a.txt")->size, 5);
+    cr_assert_eq(lookup(config, "/d/b.txt")->size, 1);
+    write_file("a.txt", "hello, world");
+    // Still trusted until the event is read, then looked up again
+    cr_assert(cache_fresh(&config->servers[0], "/a.txt", 6));
+    process(fd);
+    cr_assert_not(cache_fresh(&config->servers[0], "/a.txt", 6));
+    cr_assert_eq(lookup(config, "/a.txt")->size, 12);
+    cr_assert(cache_fresh(&config->servers[0], "/d/b.txt", 8));
+
+    write_file("d/b.txt", "bb");
+    process(fd);
+    cr_assert_eq(lookup(config, "/d/b.txt")->size, 2);
+    teardown(config);
+}
+
+Test(watch, removed_file)
+{
+    int fd;
+    struct config *config = setup(&fd);
+    cr_assert_eq(lookup(config, "/a.txt")->error, 0);
+    char path[256];
+    sprintf(path, "%s/a.txt", dir);
+    cr_assert_eq(unlink(path), 0);
+    process(fd);
+    cr_assert_eq(lookup(config, "/a.txt")->error, ENOENT);
+    teardown(config);
+}
+
+Test(watch, created_directory)
+{
+    int fd;
+    struct config *config = setup(&fd);
+    cr_assert_eq(lookup(config, "/e/c.txt")->error, ENOENT);
+    char path[256];
+    sprintf(path, "%s/e", dir);
+    cr_assert_eq(mkdir(path, 0755), 0);
+    process(fd);
+    write_file("e/c.txt", "c");
+    process(fd);
+    cr_assert_eq(lookup(config, "/e/c.txt")->size, 1);
+
+    // The new directory is watched as well
+    write_file("e/c.txt", "cc");
+    process(fd);
+    cr_assert_eq(lookup(config, "/e/c.txt")->size, 2);
+    teardown(config);
+}
@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+
+#include "upload.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../utils/io/connection.h"
+#include "../utils/io/io.h"
+#include "../utils/string/string.h"
+#include "../utils/variables/variables.h"
+#include "cache.h"
+#include "location.h"
+
+static enum my_status_code errno_status(int err)
+{
+    if (err == EACCES || err == EPERM || err == EISDIR)
+        return FORBIDDEN;
+    if (err == ENOENT || err == ENOTDIR)
+        return NOT_FOUND;
+    return INTERNAL_ERROR;
+}
+
+static const char *errno_phrase(int err)
+{
+    switch (errno_status(err))
+    {
+    case FORBIDDEN:
+        return "Forbidden";
+    case NOT_FOUND:
+        return "Not Found";
+    default:
+        return "Internal Server Error";
+    }
+}
+
+/*
+ * @brief: return 1 if the target has a ".." segment or names a directory
+ */
+static int is_unsafe_target(const char *target, size_t len)
+{
+    if (!len || target[0] != '/' || target[len - 1] == '/')
+        return 1;
+    for (size_t i = 0; i + 1 < len; i++)
+    {
+        if (target[i] == '/' && target[i + 1] == '.' && i + 2 < len
+            && target[i + 2] == '.' && (i + 3 == len || target[i + 3] == '/'))
+            return 1;
+    }
+    return 0;
+}
+
+void upload_check(struct request *req, const struct server_config *vhost,
+                  struct response *res)
+{
+    size_t length;
+    size_t tlen = req->target->size;
+    const char *query = memchr(req->target->data, '?', tlen);
+    if (query)
+        tlen = query - req->target->data;
+    const struct location *location = NULL;
+    char path[BUFFERSIZE];
+    int fits = location_path(vhost, req->target->data, tlen, &location, path,
+                             BUFFERSIZE);
+
+    if (location && location->disabled)
+        response_set_status(res, NOT_FOUND, "Not Found");
+    else if (!vhost->upload)
+        response_set_status(res, MNA, "Method Not Allowed");
+    else if (req->expect
+             && (req->expect->size != 12
+                 || strncasecmp(req->expect->data, "100-continue", 12)))
+        response_set_status(res, EXPECTATION_FAILED, "Expectation Failed");
+    else if (!req->content_length)
+        response_set_status(res, LENGTH_REQUIRED, "Length Required");
+    else if (request_content_length(req, &length) < 0)
+        response_set_status(res, BAD_REQUEST, "Bad Request");
+    else if (vhost->upload_max_size && length > vhost->upload_max_size)
+        response_set_status(res, PAYLOAD_TOO_LARGE, "Payload Too Large");
+    else if (is_unsafe_target(req->target->data, tlen))
+        response_set_status(res, FORBIDDEN, "Forbidden");
+    else if (fits < 0 || !(res->path = my_strdup(path)))
+        response_set_status(res, INTERNAL_ERROR, "Internal Server Error");
+}
+
+/*
+ * @brief: a body stored a turn at a time
+ *
+ * @param tmp: the temporary file next to the path of res, NULL once it is
+ * renamed or removed
+ * @param fd: the temporary file, -1 once it is closed
+ * @param pipefd: the pipe the body is spliced through, -1 when it is
+ * decrypted in user space
+ * @param remaining: the bytes of the body left to receive
+ */
+struct upload
+{
+    struct connection *conn;
+    struct response *res;
+    char *tmp;
+    int fd;
+    int pipefd[2];
+    size_t remaining;
+};
+
+void upload_end(struct upload *up)
+{
+    if (up->fd >= 0)
+        close(up->fd);
+    if (up->tmp)
+        unlink(up->tmp);
+    if (up->pipefd[0] >= 0)
+    {
+        close(up->pipefd[0]);
+        close(up->pipefd[1]);
+    }
+    free(up->tmp);
+    free(up);
+}
+
+/*
+ * @brief: create the temporary file next to the path of res, answering
+ * 100-continue once it is created if the client expects it
+ *
+ * @return 0 on success, -1 with the status of res set
+ */
+static int create_tmp(struct upload *up, struct request *req, size_t length)
+{
+    struct response *res = up->res;
+    up->tmp = malloc(strlen(res->path) + sizeof(".XXXXXX"));
+    if (!up->tmp)
+    {
+        response_set_status(res, INTERNAL_ERROR, "Internal Server Error");
+        return -1;
+    }
+    sprintf(up->tmp, "%s.XXXXXX", res->path);
+    up->fd = mkstemp(up->tmp);
+    if (up->fd < 0)
+    {
+        response_set_status(res, errno_status(errno), errno_phrase(errno));
+        free(up->tmp);
+        up->tmp = NULL;
+        return -1;
+    }
+    fchmod(up->fd, 0644);
+    if (req->expect)
+        connection_send(up->conn, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+    if (length && fallocate(up->fd, 0, 0, length) < 0 && errno != EOPNOTSUPP)
+    {
+        response_set_status(res, INTERNAL_ERROR, "Internal Server Error");
+        return -1;
+    }
+    return 0;
+}
+
+struct upload *upload_start(struct connection *conn, struct request *req,
+                            struct response *res, const char *buffered,
+                            size_t nbuffered)
+{
+    size_t length;
+    request_content_length(req, &length);
+    struct upload *up = malloc(sizeof(struct upload));
+    if (!up)
+    {
+        response_set_status(res, INTERNAL_ERROR, "Internal Server Error");
+        return NULL;
+    }
+    *up = (struct upload){ conn, res, NULL, -1, { -1, -1 }, 0 };
+    if (nbuffered > length)
+        nbuffered = length;
+    up->remaining = length - nbuffered;
+    if (create_tmp(up, req, length) < 0
+        || write_all(up->fd, buffered, nbuffered) < 0
+        || (up->remaining && (!conn->ssl || conn->ktls_recv)
+            && io_pipe(up->pipefd) < 0))
+    {
+        if (up->tmp)
+            response_set_status(res, INTERNAL_ERROR, "Internal Server Error");
+        upload_end(up);
+        return NULL;
+    }
+    return up;
+}
+
+/*
+ * @brief: close the complete body or remove an incomplete one, and set the
+ * status of the response
+ *
+ * @param status: 0 if the body is complete, the status to answer otherwise
+ *
+ * @return 1, the upload being over
+ */
+static int finish(struct upload *up, enum my_status_code status)
+{
+    struct response *res = up->res;
+    if (close(up->fd) < 0 && !status)
+        status = INTERNAL_ERROR;
+    up->fd = -1;
+    if (status)
+    {
+        response_set_status(res, status,
+                            status == BAD_REQUEST ? "Bad Request"
+                                                  : "Internal Server Error");
+        return 1;
+    }
+    int existed = !access(res->path, F_OK);
+    if (rename(up->tmp, res->path) < 0)
+    {
+        response_set_status(res, errno_status(errno), errno_phrase(errno));
+        return 1;
+    }
+    free(up->tmp);
+    up->tmp = NULL;
+    cache_invalidate(res->path);
+    if (existed)
+        response_set_status(res, NO_CONTENT, "No Content");
+    else
+    {
+        response_set_status(res, CREATED, "Created");
+        res->content_length = my_strdup("0");
+    }
+    return 1;
+}
+
+short upload_events(const struct upload *up)
+{
+    (void)up;
+    return POLLIN;
+}
+
+bool upload_busy(const struct upload *up)
+{
+    return up->remaining && connection_pending(up->conn);
+}
+
+int upload_turn(struct upload *up)
+{
+    size_t turn = up->remaining;
+    if (turn > UPLOAD_TURN_SIZE)
+        turn = UPLOAD_TURN_SIZE;
+    while (turn)
+    {
+        ssize_t n =
+            connection_splice_in_some(up->conn, up->fd, up->pipefd, turn);
+        if (n < 0 && errno == EAGAIN)
+            return 0;
+        if (n <= 0)
+            return finish(up, n ? INTERNAL_ERROR : BAD_REQUEST);
+        turn -= n;
+        up->remaining -= n;
+    }
+    return up->remaining ? 0 : finish(up, 0);
+}
+
+void upload_receive(struct connection *conn, struct request *req,
+                    struct response *res, const char *buffered,
+                    size_t nbuffered)
+{
+    struct upload *up = upload_start(conn, req, res, buffered, nbuffered);
+    if (!up)
+        return;
+    struct pollfd fd = { .fd = conn->fd, .events = POLLIN };
+    while (!upload_turn(up))
+    {
+        if (!upload_busy(up) && poll(&fd, 1, UPLOAD_TIMEOUT * 1000) <= 0)
+        {
+            response_set_status(res, BAD_REQUEST, "Bad Request");
+            break;
+        }
+    }
+    upload_end(up);
+}
@@ -0,0 +1,98 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../config/config.h"
+#include "request.h"
+#include "response.h"
+
+/*
+ * Bytes of the body received in a turn at most, the other clients being
+ * served before the next one
+ */
+#define UPLOAD_TURN_SIZE (256UL << 10)
+
+/*
+ * Seconds the client may leave the socket idle before the body is complete
+ */
+#define UPLOAD_TIMEOUT 30
+
+struct upload;
+
+/*
+ * @brief: check a PUT or POST request before reading its body. When the
+ * upload can proceed, the status of the response stays VALID and its path
+ * is set to the file the body will be stored in.
+ *
+ * @param req: the request
+ * @param vhost: the vhost receiving the request
+ * @param res: the response to fill
+ */
+void upload_check(struct request *req, const struct server_config *vhost,
+                  struct response *res);
+
+/*
+ * @brief: start receiving the body of a checked upload, to be stored in the
+ * path of the response. The bytes of the body read along with the head are
+ * written to a temporary file next to it, after 100-continue is answered if
+ * the client expects it and the file could be created.
+ *
+ * @param conn: the client connection, which must outlive the upload
+ * @param req: the request
+ * @param res: the response checked by upload_check(), which must outlive
+ * the upload
+ * @param buffered: bytes of the body read along with the request head
+ * @param nbuffered: number of bytes in buffered
+ *
+ * @return the upload, NULL with the status of the response set on error
+ */
+struct upload *upload_start(struct connection *conn, struct request *req,
+                            struct response *res, const char *buffered,
+                            size_t nbuffered);
+
+/*
+ * @brief: return what the socket of the client is to be polled for
+ */
+short upload_events(const struct upload *up);
+
+/*
+ * @brief: return whether a turn has work to do without the socket being
+ * ready, bytes being received and decrypted but not read yet
+ */
+bool upload_busy(const struct upload *up);
+
+/*
+ * @brief: move what the socket has of the next UPLOAD_TURN_SIZE bytes of
+ * the body to the temporary file, never waiting for it. The body goes from
+ * the socket to the file through a pipe with splice(), unless it is
+ * decrypted in user space, and is renamed over the path once complete.
+ *
+ * @return 1 once the upload is over, the status of the response being set
+ * to CREATED, NO_CONTENT or an error, 0 until then
+ */
+int upload_turn(struct upload *up);
+
+/*
+ * @brief: remove the temporary file of an upload that is not over, and free
+ * the upload
+ */
+void upload_end(struct upload *up);
+
+/*
+ * @brief: receive the whole body of a checked upload, waiting
+ * UPLOAD_TIMEOUT at most for each part of it, and end the upload. The
+ * status of the response is set to CREATED, NO_CONTENT or an error.
+ *
+ * @param conn: the client connection
+ * @param req: the request
+ * @param res: the response checked by upload_check()
+ * @param buffered: bytes of the body read along with the request head
+ * @param nbuffered: number of bytes in buffered
+ */
+void upload_receive(struct connection *conn, struct request *req,
+                    struct response *res, const char *buffered,
+                    size_t nbuffered);
+
+#endif /*!UPLOAD_H*/
@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+
+#include "watch.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../utils/string/string.h"
+#include "cache.h"
+#include "location.h"
+
+#define WATCH_MASK                                                             \
+    (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE            \
+     | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF             \
+     | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+static int inotify_fd = -1;
+static const struct config *watched = NULL;
+
+/*
+ * The path of the directory of each watch descriptor, spelled as the keys
+ * of the cache are: the root_dir of its vhost followed by the target
+ */
+static char **dirs = NULL;
+static size_t nb_dirs = 0;
+
+static time_t ttl = CACHE_TTL;
+static bool complete = false;
+
+/*
+ * @brief: return dir followed by a slash and name
+ */
+static char *join(const char *dir, const char *name)
+{
+    size_t dlen = strlen(dir);
+    size_t nlen = strlen(name);
+    char *path = malloc(dlen + nlen + 2);
+    if (path)
+    {
+        memcpy(path, dir, dlen);
+        path[dlen] = '/';
+        memcpy(path + dlen + 1, name, nlen + 1);
+    }
+    return path;
+}
+
+static void set_dir(int wd, const char *path)
+{
+    if ((size_t)wd >= nb_dirs)
+    {
+        size_t size = nb_dirs ? nb_dirs : 64;
+        while (size <= (size_t)wd)
+            size *= 2;
+        char **bigger = realloc(dirs, size * sizeof(char *));
+        if (!bigger)
+            return;
+        memset(bigger + nb_dirs, 0, (size - nb_dirs) * sizeof(char *));
+        dirs = bigger;
+        nb_dirs = size;
+    }
+    free(dirs[wd]);
+    dirs[wd] = my_strdup(path);
+}
+
+/*
+ * @brief: stop trusting the cache entries for long, a change being able to
+ * go unnoticed
+ */
+static void incomplete(const char *path)
+{
+    if (complete)
+        fprintf(stderr, "%s: %s, cache entries trusted for %d s\n", path,
+                strerror(errno), CACHE_TTL);
+    complete = false;
+    cache_set_ttl(CACHE_TTL);
+}
+
+/*
+ * @brief: watch a directory, then the directories under it. A directory
+ * created while they are listed shows either in the listing or as an event.
+ */
+static void watch_tree(const char *path)
+{
+    int wd = inotify_add_watch(inotify_fd, path, WATCH_MASK);
+    if (wd < 0)
+    {
+        if (errno == ENOSPC || errno == ENOMEM)
+            incomplete(path);
+        return;
+    }
+    set_dir(wd, path);
+    DIR *dir = opendir(path);
+    if (!dir)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        struct stat statbuf;
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")
+            || (entry->d_type != DT_DIR
+                && (entry->d_type != DT_UNKNOWN
+                    || fstatat(dirfd(dir), entry->d_name, &statbuf,
+                               AT_SYMLINK_NOFOLLOW)
+                    || !S_ISDIR(statbuf.st_mode))))
+            continue;
+        char *sub = join(path, entry->d_name);
+        if (sub)
+            watch_tree(sub);
+        free(sub);
+    }
+    closedir(dir);
+}
+
+/*
+ * @brief: walk the tree of a location, whose alias may name a file in no
+ * watched directory
+ */
+static void watch_location(const char *path)
+{
+    struct stat statbuf;
+    if (!stat(path, &statbuf) && !S_ISDIR(statbuf.st_mode))
+    {
+        errno = ENOTDIR;
+        incomplete(path);
+    }
+    else
+        watch_tree(path);
+}
+
+/*
+ * @brief: walk the document trees of every vhost and of its locations
+ */
+static void watch_all(void)
+{
+    complete = true;
+    const struct config *locations = location_config();
+    for (size_t i = 0; i < watched->nb_servers; i++)
+    {
+        const struct server_config *vhost = &watched->servers[i];
+        if (!vhost->root_dir || vhost->proxy_pass || vhost->bundle)
+            continue;
+        watch_tree(vhost->root_dir);
+        for (size_t j = 0; locations && j < locations->servers[i].nb_locations;
+             j++)
+        {
+            const struct location *location =
+                &locations->servers[i].locations[j];
+            if (location->root_dir)
+                watch_location(location->root_dir);
+            if (location->alias)
+                watch_location(location->alias);
+        }
+    }
+    cache_set_ttl(complete ? ttl : CACHE_TTL);
+}
+
+int watch_init(const struct config *config)
+{
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0)
+    {
+        perror("inotify_init1");
+        return -1;
+    }
+    watched = config;
+    ttl = config->cache_ttl ? (time_t)config->cache_ttl : WATCH_DEFAULT_TTL;
+    watch_all();
+    return inotify_fd;
+}
+
+/*
+ * @brief: drop the cache entries an event on name, in the directory dir,
+ * makes stale: those of name, and those of dir as it may resolve to name
+ */
+static void invalidate(const char *dir, const struct inotify_event *event)
+{
+    if (!event->len)
+    {
+        cache_invalidate_tree(dir);
+        return;
+    }
+    char *path = join(dir, event->name);
+    char *index = join(dir, "");
+    if (!path || !index)
+        cache_flush();
+    else if (event->mask & IN_ISDIR)
+    {
+        cache_invalidate_tree(path);
+        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+            watch_tree(path);
+    }
+    else
+        cache_invalidate_key(path);
+    cache_invalidate_key(dir);
+    if (index)
+        cache_invalidate_key(index);
+    free(path);
+    free(index);
+}
+
+void watch_process(void)
+{
+    union
+    {
+        struct inotify_event event;
+        char bytes[WATCH_BUFFER];
+    } buffer;
+    bool overflow = false;
+    ssize_t len;
+    while ((len = read(inotify_fd, buffer.bytes, sizeof(buffer))) > 0)
+    {
+        for (ssize_t i = 0; i < len;)
+        {
+            const struct inotify_event *event =
+                (const void *)(buffer.bytes + i);
+            i += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW)
+                overflow = true;
+            else if (event->wd < 0 || (size_t)event->wd >= nb_dirs
+                     || !dirs[event->wd])
+                continue;
+            else if (event->mask & IN_IGNORED)
+            {
+                free(dirs[event->wd]);
+                dirs[event->wd] = NULL;
+            }
+            else
+                invalidate(dirs[event->wd], event);
+        }
+    }
+    if (overflow)
+    {
+        fprintf(stderr, "inotify queue overflow, dropping the file cache\n");
+        cache_flush();
+        watch_all();
+    }
+}
+
+void watch_reload(void)
+{
+    if (inotify_fd >= 0)
+        watch_all();
+}
+
+void watch_destroy(void)
+{
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+    inotify_fd = -1;
+    for (size_t i = 0; i < nb_dirs; i++)
+        free(dirs[i]);
+    free(dirs);
+    dirs = NULL;
+    nb_dirs = 0;
+    watched = NULL;
+    cache_set_ttl(CACHE_TTL);
+}
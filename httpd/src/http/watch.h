@@ -0,0 +1,49 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "../config/config.h"
+
+/*
+ * Seconds the file cache trusts an entry while the document trees are
+ * watched and the configuration sets no cache_ttl. Changes made where
+ * inotify does not see them, on a network file system for instance, are
+ * picked up after it.
+ */
+#define WATCH_DEFAULT_TTL 60
+
+/*
+ * Bytes of events read at once
+ */
+#define WATCH_BUFFER 65536
+
+/*
+ * @brief: watch every directory under the root_dir of the vhosts, and
+ * under the root_dir or alias of their locations, with inotify, then let the
+ * file cache trust its entries for the cache_ttl of the configuration. If a
+ * tree cannot be watched whole, the watches being exhausted or an alias
+ * naming a file for instance, the cache goes back to CACHE_TTL.
+ *
+ * @return the inotify file descriptor to poll for events, -1 if nothing is
+ * watched
+ */
+int watch_init(const struct config *config);
+
+/*
+ * @brief: read the pending events, dropping the cache entries of what
+ * changed and watching the directories created. When events were lost, the
+ * whole cache is dropped and the trees walked again.
+ */
+void watch_process(void);
+
+/*
+ * @brief: walk the trees again once the locations were reloaded, those
+ * they added being watched too
+ */
+void watch_reload(void);
+
+/*
+ * @brief: stop watching, the cache going back to CACHE_TTL
+ */
+void watch_destroy(void);
+
+#endif /*!WATCH_H*/
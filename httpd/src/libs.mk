@@ -6,7 +6,10 @@ utils/libutils.a:
 	$(MAKE) -C $(SRC_DIR)utils
 server/libserver.a:
 	$(MAKE) -C $(SRC_DIR)server
-http/libhttp.a:
+http/libhttp.a: $(SRC_DIR)http/mime_table.h
 	$(MAKE) -C $(SRC_DIR)http
 daemon/libdaemon.a:
 	$(MAKE) -C $(SRC_DIR)daemon
+
+$(SRC_DIR)http/mime_table.h: $(SRC_DIR)http/mime.def $(SRC_DIR)http/mime_gen.py
+	$(SRC_DIR)http/mime_gen.py $< $@
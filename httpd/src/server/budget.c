@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+
+#include "budget.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "../http/response.h"
+#include "../utils/trace/trace.h"
+
+/*
+ * Bytes read from a shed client before the 503 is sent
+ */
+#define DRAIN_SIZE 1024
+
+struct slot
+{
+    size_t held[BUDGET_KINDS];
+};
+
+static size_t limits[BUDGET_KINDS];
+
+/*
+ * The totals first, then the slot of each worker, or a single one when the
+ * server has no workers
+ */
+static struct slot *slots = NULL;
+static size_t nb_slots = 0;
+static struct slot *own = NULL;
+
+static char reply[128];
+static size_t reply_len = 0;
+
+int budget_init(const struct config *config)
+{
+    limits[BUDGET_CONNECTIONS] = config->max_connections;
+    limits[BUDGET_REQUESTS] = config->max_requests;
+    limits[BUDGET_MEMORY] = config->max_buffer_memory;
+    size_t retry_after = config->retry_after ? config->retry_after
+                                             : BUDGET_DEFAULT_RETRY_AFTER;
+    reply_len = snprintf(reply, sizeof(reply),
+                         "HTTP/1.1 503 Service Unavailable\r\n"
+                         "Retry-After: %zu\r\nContent-Length: 0\r\n"
+                         "Connection: close\r\n\r\n",
+                         retry_after);
+    if (!config->max_connections && !config->max_requests
+        && !config->max_buffer_memory)
+        return 0;
+    nb_slots = 1 + (config->workers ? config->workers : 1);
+    slots = mmap(NULL, nb_slots * sizeof(struct slot), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED)
+    {
+        slots = NULL;
+        perror("mmap");
+        return -1;
+    }
+    own = &slots[1];
+    return 0;
+}
+
+void budget_worker(size_t index)
+{
+    if (slots)
+        own = &slots[1 + index];
+}
+
+void budget_reclaim(size_t index)
+{
+    if (!slots)
+        return;
+    struct slot *dead = &slots[1 + index];
+    for (size_t i = 0; i < BUDGET_KINDS; i++)
+    {
+        __atomic_sub_fetch(&slots[0].held[i], dead->held[i],
+                           __ATOMIC_RELAXED);
+        dead->held[i] = 0;
+    }
+}
+
+bool budget_take(enum budget_kind kind, size_t amount)
+{
+    if (!slots)
+        return true;
+    size_t total =
+        __atomic_add_fetch(&slots[0].held[kind], amount, __ATOMIC_RELAXED);
+    if (limits[kind] && total > limits[kind])
+    {
+        __atomic_sub_fetch(&slots[0].held[kind], amount, __ATOMIC_RELAXED);
+        return false;
+    }
+    // Only this process writes its slot, the master reading it once it died
+    own->held[kind] += amount;
+    return true;
+}
+
+void budget_give(enum budget_kind kind, size_t amount)
+{
+    if (!slots)
+        return;
+    __atomic_sub_fetch(&slots[0].held[kind], amount, __ATOMIC_RELAXED);
+    own->held[kind] -= amount;
+}
+
+bool budget_full(enum budget_kind kind)
+{
+    return slots && limits[kind]
+        && __atomic_load_n(&slots[0].held[kind], __ATOMIC_RELAXED)
+        >= limits[kind];
+}
+
+void budget_shed(struct connection *conn, bool received)
+{
+    char drain[DRAIN_SIZE];
+    // A shed client must not hold the process: only what already arrived
+    // is read, from the socket under TLS too as the 503 is only written
+    if (!received)
+        recv(conn->fd, drain, sizeof(drain), MSG_DONTWAIT);
+    connection_send(conn, reply, reply_len);
+    trace_phase(TRACE_BODY_SENT, SERVICE_UNAVAILABLE);
+}
+
+void budget_destroy(void)
+{
+    if (slots)
+        munmap(slots, nb_slots * sizeof(struct slot));
+    slots = NULL;
+    own = NULL;
+}
@@ -0,0 +1,89 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../config/config.h"
+#include "../utils/io/connection.h"
+
+/*
+ * Seconds sent in the Retry-After of the 503 when the configuration sets no
+ * retry_after
+ */
+#define BUDGET_DEFAULT_RETRY_AFTER 1
+
+/*
+ * Milliseconds between two looks at the connections, while the listeners
+ * are not polled because the server is full
+ */
+#define BUDGET_RECHECK 100
+
+/*
+ * @brief: the resources shared by every process of the server
+ *
+ * - BUDGET_CONNECTIONS: the client connections open
+ * - BUDGET_REQUESTS: the requests received and not answered yet, parked or
+ *   being sent included
+ * - BUDGET_MEMORY: the bytes of the receive buffers, of the parked requests,
+ *   of the transfers of the scheduler and of the HTTP/2 connections
+ */
+enum budget_kind
+{
+    BUDGET_CONNECTIONS = 0,
+    BUDGET_REQUESTS,
+    BUDGET_MEMORY,
+    BUDGET_KINDS
+};
+
+/*
+ * @brief: map the counters of the budgets, shared with the worker processes
+ * forked afterwards, and render the 503 sent when a budget is spent
+ *
+ * @return 0 on success, -1 on error
+ */
+int budget_init(const struct config *config);
+
+/*
+ * @brief: make the calling worker account for what it takes in its own
+ * slot, so that it can be given back if the worker dies
+ */
+void budget_worker(size_t index);
+
+/*
+ * @brief: give back what a dead worker held
+ */
+void budget_reclaim(size_t index);
+
+/*
+ * @brief: take from a budget, with a single atomic addition
+ *
+ * @return true if it was taken, false if the budget is spent
+ */
+bool budget_take(enum budget_kind kind, size_t amount);
+
+/*
+ * @brief: give back what budget_take() took
+ */
+void budget_give(enum budget_kind kind, size_t amount);
+
+/*
+ * @brief: return whether a budget is spent
+ */
+bool budget_full(enum budget_kind kind);
+
+/*
+ * @brief: answer a client with the pre-rendered 503
+ *
+ * @param received: the request was read, what the client already sent
+ * being read first otherwise without waiting for more, for the kernel not
+ * to reset the connection on unread data
+ */
+void budget_shed(struct connection *conn, bool received);
+
+/*
+ * @brief: unmap the counters
+ */
+void budget_destroy(void);
+
+#endif /*!BUDGET_H*/
@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+
+#include "exchange.h"
+
+#include <time.h>
+
+static struct exchange *exchanges[EXCHANGE_MAX];
+static size_t nb_exchanges = 0;
+
+/*
+ * The exchanges filled by the last exchange_poll(), and their number of
+ * entries, those added since having none
+ */
+static size_t nb_polled = 0;
+static size_t polled[EXCHANGE_MAX];
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void finish(struct exchange *ex, enum exchange_turn result)
+{
+    trace_resume(&ex->trace);
+    ex->end(ex, result);
+}
+
+/*
+ * @brief: give a turn to an exchange, ending it once it is over
+ *
+ * @return whether the exchange ended
+ */
+static bool take_turn(struct exchange *ex, uint64_t current)
+{
+    trace_resume(&ex->trace);
+    enum exchange_turn result = ex->turn(ex);
+    if (result == EXCHANGE_DONE || result == EXCHANGE_ERROR)
+    {
+        ex->end(ex, result);
+        return true;
+    }
+    ex->again = result == EXCHANGE_AGAIN;
+    ex->deadline = current + (uint64_t)ex->timeout * 1000;
+    trace_suspend(&ex->trace);
+    return false;
+}
+
+bool exchange_full(void)
+{
+    return nb_exchanges == EXCHANGE_MAX;
+}
+
+int exchange_add(struct exchange *ex)
+{
+    if (nb_exchanges == EXCHANGE_MAX)
+        return -1;
+    trace_suspend(&ex->trace);
+    if (!take_turn(ex, now()))
+        exchanges[nb_exchanges++] = ex;
+    return 0;
+}
+
+size_t exchange_poll(struct pollfd *fds)
+{
+    size_t nb = 0;
+    for (size_t i = 0; i < nb_exchanges; i++)
+    {
+        polled[i] = exchanges[i]->events(exchanges[i], fds + nb);
+        for (size_t j = 0; j < polled[i]; j++)
+            fds[nb + j].revents = 0;
+        nb += polled[i];
+    }
+    nb_polled = nb_exchanges;
+    return nb;
+}
+
+int exchange_timeout(void)
+{
+    if (!nb_exchanges)
+        return -1;
+    uint64_t first = UINT64_MAX;
+    for (size_t i = 0; i < nb_exchanges; i++)
+    {
+        if (exchanges[i]->again)
+            return 0;
+        if (exchanges[i]->deadline < first)
+            first = exchanges[i]->deadline;
+    }
+    uint64_t current = now();
+    return first > current ? first - current : 0;
+}
+
+void exchange_run(const struct pollfd *fds, size_t nb)
+{
+    uint64_t current = now();
+    size_t at = 0;
+    for (size_t i = 0; i < nb_polled && at <= nb; i++)
+    {
+        struct exchange *ex = exchanges[i];
+        bool ready = ex->again;
+        for (size_t j = 0; j < polled[i] && at + j < nb; j++)
+            ready = ready || fds[at + j].revents;
+        at += polled[i];
+        if (ready)
+        {
+            if (take_turn(ex, current))
+                exchanges[i] = NULL;
+        }
+        else if (ex->deadline <= current)
+        {
+            finish(ex, EXCHANGE_WAIT);
+            exchanges[i] = NULL;
+        }
+    }
+    nb_polled = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < nb_exchanges; i++)
+    {
+        if (exchanges[i])
+            exchanges[kept++] = exchanges[i];
+    }
+    nb_exchanges = kept;
+}
+
+void exchange_destroy(void)
+{
+    for (size_t i = 0; i < nb_exchanges; i++)
+        finish(exchanges[i], EXCHANGE_WAIT);
+    nb_exchanges = 0;
+    nb_polled = 0;
+}
@@ -0,0 +1,104 @@
+#ifndef EXCHANGE_H
+#define EXCHANGE_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../utils/trace/trace.h"
+
+/*
+ * Exchanges in progress, beyond which the requests are answered on a
+ * blocking socket
+ */
+#define EXCHANGE_MAX 1024
+
+/*
+ * Sockets an exchange is polled on at most: its client and an upstream
+ */
+#define EXCHANGE_FDS 2
+
+/*
+ * @brief: what a turn of an exchange came to
+ */
+enum exchange_turn
+{
+    EXCHANGE_ERROR = -1,
+    EXCHANGE_WAIT,
+    EXCHANGE_AGAIN,
+    EXCHANGE_DONE
+};
+
+/*
+ * @brief: a request whose body, or the response to it, is moved by the
+ * poll loop as far as its non-blocking sockets allow. It is usually the
+ * first member of the structure holding its state.
+ *
+ * @param events: fill fds with the sockets to poll and what for, returning
+ * how many, EXCHANGE_FDS at most
+ * @param turn: move what the sockets take without waiting for them,
+ * returning EXCHANGE_WAIT until they are ready again, EXCHANGE_AGAIN if it
+ * has more to do at once, then EXCHANGE_DONE or EXCHANGE_ERROR
+ * @param end: answer the client if it is still to be, close the connection
+ * and free the exchange. result is the last turn, EXCHANGE_WAIT when the
+ * exchange ran out of time or the server stops.
+ * @param timeout: seconds the sockets may stay idle
+ * @param deadline: CLOCK_MONOTONIC millisecond after which the exchange
+ * ends for staying idle
+ * @param again: the last turn asked for another one at once
+ * @param trace: the timeline of the request, set aside meanwhile
+ */
+struct exchange
+{
+    size_t (*events)(struct exchange *ex, struct pollfd *fds);
+    enum exchange_turn (*turn)(struct exchange *ex);
+    void (*end)(struct exchange *ex, enum exchange_turn result);
+    int timeout;
+    uint64_t deadline;
+    int again;
+    struct trace_timeline trace;
+};
+
+/*
+ * @brief: return whether there is no room for another exchange
+ */
+bool exchange_full(void);
+
+/*
+ * @brief: take over an exchange whose callbacks and timeout are set, its
+ * sockets being non-blocking. It is given a first turn at once, and the
+ * current trace is set aside until it ends.
+ *
+ * @return 0 if the exchange is taken over or already ended, -1 if there is
+ * no room for it, the caller keeping it then
+ */
+int exchange_add(struct exchange *ex);
+
+/*
+ * @brief: fill fds with the sockets of the exchanges
+ *
+ * @return the number of entries filled, at most EXCHANGE_MAX * EXCHANGE_FDS
+ */
+size_t exchange_poll(struct pollfd *fds);
+
+/*
+ * @brief: return the milliseconds until the first exchange runs out of time,
+ * 0 if one has work to do at once, -1 if there is no exchange
+ */
+int exchange_timeout(void);
+
+/*
+ * @brief: give a turn to each exchange whose sockets are ready or which has
+ * work to do, ending the exchanges done, failed or idle for too long
+ *
+ * @param fds: the entries filled by exchange_poll(), after poll()
+ */
+void exchange_run(const struct pollfd *fds, size_t nb);
+
+/*
+ * @brief: end the exchanges in progress
+ */
+void exchange_destroy(void);
+
+#endif /*!EXCHANGE_H*/
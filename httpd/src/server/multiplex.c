@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+
+#include "multiplex.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../http/h2.h"
+#include "../utils/trace/trace.h"
+#include "budget.h"
+
+/*
+ * @brief: an HTTP/2 connection served a turn at a time
+ *
+ * @param h2: the state of the connection, pointing to conn
+ * @param deadline: CLOCK_MONOTONIC millisecond after which the connection
+ * ends for staying idle
+ * @param trace: the timeline of the connection, set aside meanwhile
+ */
+struct multiplexed
+{
+    struct connection conn;
+    struct h2_connection *h2;
+    uint64_t deadline;
+    struct trace_timeline trace;
+};
+
+static struct multiplexed *connections[MULTIPLEX_MAX];
+static size_t nb_connections = 0;
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int multiplex_add(struct connection *conn, struct listener *listener,
+                  const char *buffered, size_t nbuffered,
+                  struct request *upgrade)
+{
+    size_t size = sizeof(struct multiplexed) + h2_footprint();
+    if (nb_connections == MULTIPLEX_MAX || !budget_take(BUDGET_MEMORY, size))
+        return -1;
+    struct multiplexed *m = malloc(sizeof(struct multiplexed));
+    int flags = fcntl(conn->fd, F_GETFL);
+    if (!m || flags < 0 || fcntl(conn->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        free(m);
+        budget_give(BUDGET_MEMORY, size);
+        return -1;
+    }
+    m->conn = *conn;
+    m->h2 = h2_start(&m->conn, listener->vhosts, listener->nb_vhosts,
+                     buffered, nbuffered, upgrade);
+    if (!m->h2)
+    {
+        free(m);
+        budget_give(BUDGET_MEMORY, size);
+        return -1;
+    }
+    m->deadline = now() + H2_IDLE_TIMEOUT * 1000;
+    trace_suspend(&m->trace);
+    connections[nb_connections++] = m;
+    return 0;
+}
+
+size_t multiplex_poll(struct pollfd *fds)
+{
+    for (size_t i = 0; i < nb_connections; i++)
+    {
+        fds[i].fd = connections[i]->conn.fd;
+        fds[i].events = h2_events(connections[i]->h2);
+        fds[i].revents = 0;
+    }
+    return nb_connections;
+}
+
+int multiplex_timeout(void)
+{
+    if (!nb_connections)
+        return -1;
+    uint64_t first = UINT64_MAX;
+    for (size_t i = 0; i < nb_connections; i++)
+    {
+        if (h2_busy(connections[i]->h2))
+            return 0;
+        if (connections[i]->deadline < first)
+            first = connections[i]->deadline;
+    }
+    uint64_t current = now();
+    return first > current ? first - current : 0;
+}
+
+static void end_connection(struct multiplexed *m, bool closing)
+{
+    trace_resume(&m->trace);
+    h2_end(m->h2, closing);
+    connection_close(&m->conn);
+    trace_end();
+    fprintf(stderr, "client disconnected\n");
+    budget_give(BUDGET_MEMORY, sizeof(struct multiplexed) + h2_footprint());
+    budget_give(BUDGET_REQUESTS, 1);
+    budget_give(BUDGET_CONNECTIONS, 1);
+    free(m);
+}
+
+void multiplex_run(const struct pollfd *fds, size_t nb)
+{
+    uint64_t current = now();
+    for (size_t i = 0; i < nb; i++)
+    {
+        struct multiplexed *m = connections[i];
+        if (fds[i].revents || h2_busy(m->h2))
+            m->deadline = current + H2_IDLE_TIMEOUT * 1000;
+        else if (m->deadline > current)
+            continue;
+        else
+        {
+            end_connection(m, true);
+            connections[i] = NULL;
+            continue;
+        }
+        trace_resume(&m->trace);
+        int state = h2_turn(m->h2);
+        trace_suspend(&m->trace);
+        if (state < 0)
+        {
+            end_connection(m, false);
+            connections[i] = NULL;
+        }
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < nb_connections; i++)
+    {
+        if (connections[i])
+            connections[kept++] = connections[i];
+    }
+    nb_connections = kept;
+}
+
+void multiplex_destroy(void)
+{
+    for (size_t i = 0; i < nb_connections; i++)
+        end_connection(connections[i], true);
+    nb_connections = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef MULTIPLEX_H
+#define MULTIPLEX_H
+
+#include <poll.h>
+#include <stddef.h>
+
+#include "../http/request.h"
+#include "../utils/io/connection.h"
+#include "server.h"
+
+/*
+ * HTTP/2 connections served at once, beyond which the clients asking for
+ * one are closed
+ */
+#define MULTIPLEX_MAX 1024
+
+/*
+ * @brief: take over a client speaking HTTP/2, the socket being made
+ * non-blocking. The current trace is set aside until the connection ends,
+ * which gives back the connection and the request to their budgets.
+ *
+ * @param buffered: bytes already read from the connection
+ * @param nbuffered: the number of bytes in buffered
+ * @param upgrade: the HTTP/1.1 request which upgraded the connection, NULL
+ * with prior knowledge
+ *
+ * @return 0 if the multiplexer owns the connection, -1 if the caller keeps it
+ */
+int multiplex_add(struct connection *conn, struct listener *listener,
+                  const char *buffered, size_t nbuffered,
+                  struct request *upgrade);
+
+/*
+ * @brief: fill fds with the sockets of the HTTP/2 connections
+ *
+ * @return the number of entries filled, at most MULTIPLEX_MAX
+ */
+size_t multiplex_poll(struct pollfd *fds);
+
+/*
+ * @brief: return the milliseconds until the first connection stays idle for
+ * too long, 0 if one has work to do at once, -1 if there is no connection
+ */
+int multiplex_timeout(void);
+
+/*
+ * @brief: give a turn to each connection whose socket is ready or which has
+ * work to do, ending the connections done or idle
+ *
+ * @param fds: the entries filled by multiplex_poll(), after poll()
+ */
+void multiplex_run(const struct pollfd *fds, size_t nb);
+
+/*
+ * @brief: end the HTTP/2 connections with GOAWAY and close them
+ */
+void multiplex_destroy(void);
+
+#endif /*!MULTIPLEX_H*/
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+
+#include "offload.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static pthread_t threads[OFFLOAD_THREADS_MAX];
+static size_t nb_threads = 0;
+static int event_fd = -1;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static struct offload_job *head = NULL;
+static struct offload_job *tail = NULL;
+static struct offload_job *completed = NULL;
+static bool stopping = false;
+
+/*
+ * Jobs submitted and not completed, only touched by the event loop
+ */
+static size_t pending = 0;
+
+static void *run(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    while (head || !stopping)
+    {
+        if (!head)
+        {
+            pthread_cond_wait(&queued, &lock);
+            continue;
+        }
+        struct offload_job *job = head;
+        head = job->next;
+        if (!head)
+            tail = NULL;
+        pthread_mutex_unlock(&lock);
+
+        job->work(job);
+
+        pthread_mutex_lock(&lock);
+        job->next = completed;
+        completed = job;
+        uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) < 0)
+            perror("eventfd");
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int offload_init(size_t threads_wanted)
+{
+    if (!threads_wanted)
+        threads_wanted = OFFLOAD_DEFAULT_THREADS;
+    if (threads_wanted > OFFLOAD_THREADS_MAX)
+        threads_wanted = OFFLOAD_THREADS_MAX;
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0)
+    {
+        perror("eventfd");
+        return -1;
+    }
+    stopping = false;
+    // The signals are for the event loop, the threads inherit a full mask
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (; nb_threads < threads_wanted; nb_threads++)
+    {
+        int err = pthread_create(&threads[nb_threads], NULL, run, NULL);
+        if (err)
+        {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!nb_threads)
+    {
+        close(event_fd);
+        event_fd = -1;
+    }
+    return event_fd;
+}
+
+int offload_submit(struct offload_job *job)
+{
+    if (!nb_threads || pending >= OFFLOAD_QUEUE)
+        return -1;
+    job->next = NULL;
+    pthread_mutex_lock(&lock);
+    if (tail)
+        tail->next = job;
+    else
+        head = job;
+    tail = job;
+    pthread_cond_signal(&queued);
+    pthread_mutex_unlock(&lock);
+    pending++;
+    return 0;
+}
+
+void offload_process(void)
+{
+    uint64_t count;
+    if (event_fd >= 0 && read(event_fd, &count, sizeof(count)) < 0
+        && errno != EAGAIN)
+        perror("eventfd");
+    pthread_mutex_lock(&lock);
+    struct offload_job *jobs = completed;
+    completed = NULL;
+    pthread_mutex_unlock(&lock);
+    // Completed last first, reversed to complete them in order
+    struct offload_job *ordered = NULL;
+    while (jobs)
+    {
+        struct offload_job *next = jobs->next;
+        jobs->next = ordered;
+        ordered = jobs;
+        jobs = next;
+    }
+    while (ordered)
+    {
+        struct offload_job *job = ordered;
+        ordered = job->next;
+        pending--;
+        job->done(job);
+    }
+}
+
+size_t offload_pending(void)
+{
+    return pending;
+}
+
+void offload_destroy(void)
+{
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&queued);
+    pthread_mutex_unlock(&lock);
+    for (size_t i = 0; i < nb_threads; i++)
+        pthread_join(threads[i], NULL);
+    nb_threads = 0;
+    offload_process();
+    if (event_fd >= 0)
+        close(event_fd);
+    event_fd = -1;
+}
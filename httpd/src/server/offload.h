@@ -0,0 +1,74 @@
+#ifndef OFFLOAD_H
+#define OFFLOAD_H
+
+#include <stddef.h>
+
+/*
+ * Threads of the pool when the configuration sets no offload_threads, and
+ * the most it may set
+ */
+#define OFFLOAD_DEFAULT_THREADS 4
+#define OFFLOAD_THREADS_MAX 64
+
+/*
+ * Jobs submitted and not completed yet, beyond which the caller does the
+ * work itself
+ */
+#define OFFLOAD_QUEUE 256
+
+/*
+ * Bytes of a cold file read ahead by the pool before it is sent
+ */
+#define OFFLOAD_READAHEAD (1UL << 20)
+
+/*
+ * @brief: a blocking operation run by a thread of the pool, then completed
+ * by the event loop. It is usually the first member of the structure
+ * holding its state.
+ *
+ * @param work: run by a thread of the pool, it must not touch what the
+ * event loop uses
+ * @param done: run by the event loop once work returned
+ */
+struct offload_job
+{
+    void (*work)(struct offload_job *job);
+    void (*done)(struct offload_job *job);
+    struct offload_job *next;
+};
+
+/*
+ * @brief: start the threads of the pool, which block every signal
+ *
+ * @param nb_threads: 0 for OFFLOAD_DEFAULT_THREADS
+ *
+ * @return the eventfd to poll for completions, -1 on error, the jobs being
+ * refused then
+ */
+int offload_init(size_t nb_threads);
+
+/*
+ * @brief: queue a job for the pool
+ *
+ * @return 0 on success, -1 if the pool is full or not started
+ */
+int offload_submit(struct offload_job *job);
+
+/*
+ * @brief: run the done callback of the completed jobs, when the eventfd is
+ * readable
+ */
+void offload_process(void);
+
+/*
+ * @brief: return the jobs submitted whose done callback has not run yet
+ */
+size_t offload_pending(void);
+
+/*
+ * @brief: stop the threads once the queued jobs are run, then complete
+ * them
+ */
+void offload_destroy(void);
+
+#endif /*!OFFLOAD_H*/
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+
+#include "reception.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "budget.h"
+
+static struct reception *clients[RECEPTION_MAX];
+static size_t nb_clients = 0;
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int reception_add(struct connection *conn, struct listener *listener,
+                  bool admitted)
+{
+    if (nb_clients == RECEPTION_MAX
+        || !budget_take(BUDGET_MEMORY, sizeof(struct reception)))
+        return -1;
+    struct reception *client = calloc(1, sizeof(struct reception));
+    if (!client)
+    {
+        budget_give(BUDGET_MEMORY, sizeof(struct reception));
+        return -1;
+    }
+    client->conn = *conn;
+    client->listener = listener;
+    client->events = POLLIN;
+    client->handshake = conn->ssl != NULL;
+    client->admitted = admitted;
+    client->deadline = now() + RECEPTION_TIMEOUT * 1000;
+    trace_suspend(&client->trace);
+    capture_suspend(&client->capture);
+    clients[nb_clients++] = client;
+    return 0;
+}
+
+bool reception_full(void)
+{
+    return nb_clients == RECEPTION_MAX;
+}
+
+size_t reception_poll(struct pollfd *fds)
+{
+    for (size_t i = 0; i < nb_clients; i++)
+    {
+        fds[i].fd = clients[i]->conn.fd;
+        fds[i].events = clients[i]->events;
+        fds[i].revents = 0;
+    }
+    return nb_clients;
+}
+
+int reception_timeout(void)
+{
+    if (!nb_clients)
+        return -1;
+    uint64_t first = clients[0]->deadline;
+    for (size_t i = 1; i < nb_clients; i++)
+    {
+        if (clients[i]->deadline < first)
+            first = clients[i]->deadline;
+    }
+    uint64_t current = now();
+    return first > current ? first - current : 0;
+}
+
+void reception_free(struct reception *client)
+{
+    pool_give(client->chain);
+    budget_give(BUDGET_MEMORY, client->nb_buffers * POOL_BUFFER_SIZE
+                    + sizeof(struct reception));
+    free(client);
+}
+
+/*
+ * @brief: close the connection of a client and end its trace, giving back
+ * what it holds
+ */
+static void drop(struct reception *client)
+{
+    connection_close(&client->conn);
+    trace_end();
+    if (client->requested)
+        budget_give(BUDGET_REQUESTS, 1);
+    if (client->admitted)
+        budget_give(BUDGET_CONNECTIONS, 1);
+    fprintf(stderr, "client disconnected\n");
+    reception_free(client);
+}
+
+/*
+ * @brief: take a request of the budget and the first buffer of the head,
+ * the client being sent a 503 if the server has no room for it
+ *
+ * @return 0 on success, -1 if the client must be dropped
+ */
+static int admit(struct reception *client)
+{
+    if (!client->admitted || !budget_take(BUDGET_REQUESTS, 1))
+    {
+        budget_shed(&client->conn, false);
+        return -1;
+    }
+    client->requested = true;
+    if (!budget_take(BUDGET_MEMORY, POOL_BUFFER_SIZE))
+    {
+        budget_shed(&client->conn, false);
+        return -1;
+    }
+    client->nb_buffers = 1;
+    client->chain = pool_take();
+    client->last = client->chain;
+    return client->chain ? 0 : -1;
+}
+
+/*
+ * @brief: read what the client sent, chaining one more buffer each time the
+ * last one is full, up to the empty line ending the head
+ *
+ * @return 1 once the head is received, or cut, 0 if more is to come, -1 if
+ * the client left without sending anything
+ */
+static int receive(struct reception *client)
+{
+    while (client->matched < 4)
+    {
+        struct pool_buffer *last = client->last;
+        if (last->len == POOL_BUFFER_SIZE)
+        {
+            if (client->nb_buffers == POOL_CHAIN_MAX)
+                return 1;
+            if (!budget_take(BUDGET_MEMORY, POOL_BUFFER_SIZE))
+            {
+                client->spent = true;
+                return 1;
+            }
+            client->nb_buffers++;
+            if (!(last->next = pool_take()))
+                return 1;
+            last = last->next;
+            client->last = last;
+        }
+        char *data = last->data + last->len;
+        ssize_t n = connection_recv(&client->conn, data,
+                                    POOL_BUFFER_SIZE - last->len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n <= 0)
+            return client->chain->len ? 1 : -1;
+        capture_data(data, n);
+        if (!client->chain->len)
+            trace_phase(TRACE_FIRST_BYTE, n);
+        for (ssize_t i = 0; i < n && client->matched < 4; i++)
+        {
+            if (data[i] == "\r\n\r\n"[client->matched])
+                client->matched++;
+            else
+                client->matched = data[i] == '\r';
+        }
+        last->len += n;
+    }
+    return 1;
+}
+
+/*
+ * @brief: make the socket blocking again, a read or a write waiting
+ * RECEPTION_TIMEOUT at most. A slow client can still hold the loop that
+ * long on what is answered on the blocking socket.
+ */
+static int settle(int fd)
+{
+    struct timeval timeout = { RECEPTION_TIMEOUT, 0 };
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0
+        || setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout))
+        || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)))
+    {
+        perror("client socket");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * @brief: go on with a client as far as its socket allows
+ *
+ * @return 1 once its head is received, 0 if it waits, -1 if it was dropped
+ */
+static int turn(struct reception *client)
+{
+    if (client->handshake)
+    {
+        int wait = connection_handshake(&client->conn);
+        if (wait)
+        {
+            if (wait < 0)
+                fprintf(stderr, "TLS handshake failed\n");
+            client->events = wait;
+            return wait < 0 ? -1 : 0;
+        }
+        client->handshake = false;
+        client->events = POLLIN;
+    }
+    if (!client->chain && admit(client) < 0)
+        return -1;
+    int received = receive(client);
+    if (received > 0 && settle(client->conn.fd) < 0)
+        return -1;
+    return received;
+}
+
+size_t reception_run(const struct pollfd *fds, size_t nb,
+                     struct reception **ready)
+{
+    size_t nb_ready = 0;
+    uint64_t current = now();
+    for (size_t i = 0; i < nb; i++)
+    {
+        struct reception *client = clients[i];
+        bool expired = client->deadline <= current;
+        if (!fds[i].revents && !expired)
+            continue;
+        trace_resume(&client->trace);
+        capture_resume(&client->capture);
+        // A client trickling its head runs out of time all the same
+        int state = expired ? -1 : turn(client);
+        if (state < 0)
+        {
+            drop(client);
+            clients[i] = NULL;
+            continue;
+        }
+        trace_suspend(&client->trace);
+        capture_suspend(&client->capture);
+        if (state)
+        {
+            ready[nb_ready++] = client;
+            clients[i] = NULL;
+        }
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < nb_clients; i++)
+    {
+        if (clients[i])
+            clients[kept++] = clients[i];
+    }
+    nb_clients = kept;
+    return nb_ready;
+}
+
+void reception_destroy(void)
+{
+    for (size_t i = 0; i < nb_clients; i++)
+    {
+        trace_resume(&clients[i]->trace);
+        drop(clients[i]);
+    }
+    nb_clients = 0;
+}
@@ -0,0 +1,127 @@
+#ifndef RECEPTION_H
+#define RECEPTION_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../utils/capture/capture.h"
+#include "../utils/io/connection.h"
+#include "../utils/pool/pool.h"
+#include "../utils/trace/trace.h"
+#include "server.h"
+
+/*
+ * Clients whose request head is being received, beyond which the new
+ * clients are left in the accept queues
+ */
+#define RECEPTION_MAX 1024
+
+/*
+ * Seconds a client has to finish its TLS handshake and send its request
+ * head, then that a single read or write of its request may wait
+ */
+#define RECEPTION_TIMEOUT 30
+
+/*
+ * @brief: a client whose request head is being received
+ *
+ * @param listener: the listener the client connected to
+ * @param chain: the buffers of the pool holding what the client sent, each
+ * one taken from the memory budget
+ * @param last: the buffer of the chain being filled
+ * @param matched: the bytes of the empty line ending what was received so
+ * far
+ * @param events: what the socket is polled for, POLLOUT while the TLS
+ * handshake waits to write
+ * @param handshake: the TLS handshake is not done yet
+ * @param admitted: the client holds a connection of the budget
+ * @param requested: the client holds a request of the budget
+ * @param spent: the head was cut by the memory budget
+ * @param deadline: CLOCK_MONOTONIC millisecond after which the client is
+ * dropped
+ * @param trace: the timeline of the request, set aside meanwhile
+ * @param capture: the connection for the capture, set aside meanwhile
+ */
+struct reception
+{
+    struct connection conn;
+    struct listener *listener;
+    struct pool_buffer *chain;
+    struct pool_buffer *last;
+    size_t nb_buffers;
+    size_t matched;
+    short events;
+    bool handshake;
+    bool admitted;
+    bool requested;
+    bool spent;
+    uint64_t deadline;
+    struct trace_timeline trace;
+    struct capture_state capture;
+};
+
+/*
+ * @brief: take over a client accepted on a listener, on a non-blocking
+ * socket, running the TLS handshake on a TLS listener. The current trace and
+ * capture are set aside until the head is received.
+ *
+ * @param admitted: the client holds a connection of the budget, a 503
+ * being sent to it as soon as it can be otherwise
+ *
+ * @return 0 if the reception owns the connection, -1 if the caller keeps it
+ */
+int reception_add(struct connection *conn, struct listener *listener,
+                  bool admitted);
+
+/*
+ * @brief: return whether RECEPTION_MAX clients are being received
+ */
+bool reception_full(void);
+
+/*
+ * @brief: fill fds with the sockets of the clients being received
+ *
+ * @return the number of entries filled, at most RECEPTION_MAX
+ */
+size_t reception_poll(struct pollfd *fds);
+
+/*
+ * @brief: return the milliseconds until the first client runs out of time,
+ * -1 if no client is being received
+ */
+int reception_timeout(void);
+
+/*
+ * @brief: go on with the handshake of each client whose socket is ready and
+ * read what it sent, without blocking, dropping the clients out of time.
+ * The clients whose head is complete are handed over in ready, on a
+ * blocking socket whose reads and writes wait RECEPTION_TIMEOUT at most,
+ * holding a connection and a request of the budget.
+ * Only upload bodies, proxied exchanges, long responses and HTTP/2 go back
+ * to non-blocking sockets in the poll loop. The rest is sent on the
+ * blocking socket from the loop: responses up to the send quantum, files
+ * over TLS without kernel TLS, listings, error pages, 100-continue, and
+ * uploads or proxied requests when the exchange table is full.
+ *
+ * @param fds: the entries filled by reception_poll(), after poll()
+ * @param ready: room for nb clients
+ *
+ * @return the number of clients handed over
+ */
+size_t reception_run(const struct pollfd *fds, size_t nb,
+                     struct reception **ready);
+
+/*
+ * @brief: free a client handed over, giving back its buffers to the pool
+ * and to the memory budget, the connection being left to the caller
+ */
+void reception_free(struct reception *client);
+
+/*
+ * @brief: close the connections of the clients being received
+ */
+void reception_destroy(void);
+
+#endif /*!RECEPTION_H*/
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+
+#include "scheduler.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../http/response.h"
+#include "../utils/trace/trace.h"
+#include "budget.h"
+
+/*
+ * @brief: a response sent a quantum at a time
+ *
+ * @param head: the head of the response, sent before the body
+ * @param sent: the bytes of head already sent
+ * @param fd: the file holding the body
+ * @param offset: where the rest of the body starts in fd
+ * @param remaining: the bytes of the body left to send
+ * @param trace: the timeline of the request, set aside meanwhile
+ */
+struct transfer
+{
+    struct connection conn;
+    char *head;
+    size_t head_len;
+    size_t sent;
+    int fd;
+    off_t offset;
+    size_t remaining;
+    struct trace_timeline trace;
+};
+
+static struct transfer *transfers[SCHEDULER_MAX];
+static size_t nb_transfers = 0;
+static size_t quantum = SCHEDULER_DEFAULT_QUANTUM;
+static bool small_first = false;
+
+/*
+ * The transfer served first in the next turn, when they are served in turn
+ */
+static size_t next = 0;
+
+void scheduler_init(size_t send_quantum, bool send_small_first)
+{
+    quantum = send_quantum ? send_quantum : SCHEDULER_DEFAULT_QUANTUM;
+    small_first = send_small_first;
+}
+
+int scheduler_add(struct connection *conn, const char *head, size_t head_len,
+                  int fd, off_t offset, size_t len)
+{
+    if (len <= quantum || nb_transfers >= SCHEDULER_MAX
+        || (conn->ssl && !conn->ktls_send)
+        || !budget_take(BUDGET_MEMORY, sizeof(struct transfer) + head_len))
+        return -1;
+    struct transfer *transfer = malloc(sizeof(struct transfer));
+    if (!transfer)
+    {
+        budget_give(BUDGET_MEMORY, sizeof(struct transfer) + head_len);
+        return -1;
+    }
+    transfer->head = malloc(head_len);
+    transfer->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    int flags = fcntl(conn->fd, F_GETFL);
+    if (!transfer->head || transfer->fd < 0 || flags < 0
+        || fcntl(conn->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        if (transfer->fd >= 0)
+            close(transfer->fd);
+        free(transfer->head);
+        free(transfer);
+        budget_give(BUDGET_MEMORY, sizeof(struct transfer) + head_len);
+        return -1;
+    }
+    transfer->conn = *conn;
+    memcpy(transfer->head, head, head_len);
+    transfer->head_len = head_len;
+    transfer->sent = 0;
+    transfer->offset = offset;
+    transfer->remaining = len;
+    trace_suspend(&transfer->trace);
+    transfers[nb_transfers++] = transfer;
+    return 0;
+}
+
+size_t scheduler_poll(struct pollfd *fds)
+{
+    for (size_t i = 0; i < nb_transfers; i++)
+    {
+        fds[i].fd = transfers[i]->conn.fd;
+        fds[i].events = POLLOUT;
+        fds[i].revents = 0;
+    }
+    return nb_transfers;
+}
+
+static size_t left(const struct transfer *transfer)
+{
+    return transfer->head_len - transfer->sent + transfer->remaining;
+}
+
+static int closest_to_end(const void *a, const void *b)
+{
+    size_t left_a = left(transfers[*(const size_t *)a]);
+    size_t left_b = left(transfers[*(const size_t *)b]);
+    return (left_a > left_b) - (left_a < left_b);
+}
+
+/*
+ * @brief: send what the socket takes of the next quantum of a transfer
+ *
+ * @return 1 once the response is sent, 0 if it is not yet, -1 on error
+ */
+static int send_quantum(struct transfer *transfer)
+{
+    size_t head_left = transfer->head_len - transfer->sent;
+    size_t len = quantum > head_left ? quantum - head_left : 0;
+    if (len > transfer->remaining)
+        len = transfer->remaining;
+    ssize_t n = connection_sendfile_some(&transfer->conn,
+                                         transfer->head + transfer->sent,
+                                         head_left, transfer->fd,
+                                         &transfer->offset, len);
+    if (n < 0)
+        return -1;
+    size_t from_head = (size_t)n < head_left ? (size_t)n : head_left;
+    transfer->sent += from_head;
+    transfer->remaining -= n - from_head;
+    return !left(transfer);
+}
+
+static void end_transfer(struct transfer *transfer, bool sent)
+{
+    trace_resume(&transfer->trace);
+    if (sent)
+        trace_phase(TRACE_BODY_SENT, VALID);
+    connection_close(&transfer->conn);
+    trace_end();
+    fprintf(stderr, "client disconnected\n");
+    close(transfer->fd);
+    budget_give(BUDGET_MEMORY, sizeof(struct transfer) + transfer->head_len);
+    budget_give(BUDGET_REQUESTS, 1);
+    budget_give(BUDGET_CONNECTIONS, 1);
+    free(transfer->head);
+    free(transfer);
+}
+
+void scheduler_run(const struct pollfd *fds, size_t nb)
+{
+    size_t ready[SCHEDULER_MAX];
+    size_t nb_ready = 0;
+    for (size_t i = 0; i < nb; i++)
+    {
+        size_t index = small_first ? i : (next + i) % nb;
+        if (fds[index].revents)
+            ready[nb_ready++] = index;
+    }
+    if (nb)
+        next = (next + 1) % nb;
+    if (small_first)
+        qsort(ready, nb_ready, sizeof(size_t), closest_to_end);
+    for (size_t i = 0; i < nb_ready; i++)
+    {
+        int sent = send_quantum(transfers[ready[i]]);
+        if (sent < 0)
+            perror("sendfile");
+        if (sent)
+        {
+            end_transfer(transfers[ready[i]], sent > 0);
+            transfers[ready[i]] = NULL;
+        }
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < nb_transfers; i++)
+    {
+        if (transfers[i])
+            transfers[kept++] = transfers[i];
+    }
+    nb_transfers = kept;
+}
+
+void scheduler_destroy(void)
+{
+    for (size_t i = 0; i < nb_transfers; i++)
+        end_transfer(transfers[i], false);
+    nb_transfers = 0;
+    next = 0;
+}
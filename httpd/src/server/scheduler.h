@@ -0,0 +1,63 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "../utils/io/connection.h"
+
+/*
+ * Bytes sent to a connection in one turn when the configuration sets no
+ * send_quantum, the responses not longer than it being sent at once
+ */
+#define SCHEDULER_DEFAULT_QUANTUM (256UL << 10)
+
+/*
+ * Transfers in progress, beyond which the responses are sent at once
+ */
+#define SCHEDULER_MAX 1024
+
+/*
+ * @brief: set how the transfers share the server
+ *
+ * @param quantum: 0 for SCHEDULER_DEFAULT_QUANTUM
+ * @param small_first: serve the transfers closest to their end first in
+ * each turn, rather than in turn
+ */
+void scheduler_init(size_t quantum, bool small_first);
+
+/*
+ * @brief: take over the sending of a response whose body is longer than the
+ * quantum, the socket being made non-blocking. The file is duplicated, and
+ * the current trace is set aside until the transfer ends, which gives back
+ * the connection and the request to their budgets.
+ *
+ * @return 0 if the scheduler owns the connection, -1 if the caller must send
+ * the response itself
+ */
+int scheduler_add(struct connection *conn, const char *head, size_t head_len,
+                  int fd, off_t offset, size_t len);
+
+/*
+ * @brief: fill fds with the sockets of the transfers, to poll for POLLOUT
+ *
+ * @return the number of entries filled, at most SCHEDULER_MAX
+ */
+size_t scheduler_poll(struct pollfd *fds);
+
+/*
+ * @brief: send a quantum to each transfer whose socket is writable, the
+ * finished ones closing their connection
+ *
+ * @param fds: the entries filled by scheduler_poll(), after poll()
+ */
+void scheduler_run(const struct pollfd *fds, size_t nb);
+
+/*
+ * @brief: close the connections of the transfers in progress
+ */
+void scheduler_destroy(void);
+
+#endif /*!SCHEDULER_H*/
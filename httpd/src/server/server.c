@@ -1,140 +1,1133 @@
+#define _GNU_SOURCE
+
 #include "server.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/sendfile.h>
+#include <strings.h>
+#include <sys/prctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "../daemon/daemon.h"
+#include "../http/acl.h"
+#include "../http/autoindex.h"
+#include "../http/bundle.h"
+#include "../http/cache.h"
+#include "../http/errors.h"
+#include "../http/h2.h"
+#include "../http/location.h"
+#include "../http/proxy.h"
+#include "../http/ratelimit.h"
 #include "../http/request.h"
 #include "../http/response.h"
+#include "../http/upload.h"
+#include "../http/watch.h"
+#include "../utils/capture/capture.h"
+#include "../utils/io/connection.h"
+#include "../utils/pool/pool.h"
+#include "../utils/profile/profile.h"
+#include "../utils/trace/trace.h"
 #include "../utils/variables/variables.h"
+#include "budget.h"
+#include "exchange.h"
+#include "multiplex.h"
+#include "offload.h"
+#include "reception.h"
+#include "scheduler.h"
+#include "tls.h"
+#include "worker.h"
+
+#define SWITCHING_TO_H2C                                                       \
+    "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\n"              \
+    "Upgrade: h2c\r\n\r\n"
+
+/*
+ * Bytes of a response head besides the values of its fields: the names,
+ * the separators and the status code
+ */
+#define HEAD_OVERHEAD 160
+
+static size_t value_len(const char *value)
+{
+    return value ? strlen(value) : 0;
+}
 
 /*
  * @brief: build the response by concatenating it to the version field of
- * the struct response (for example here)
+ * the struct response (for example here), in a buffer sized from the values
+ * of its fields, some of which come from the configuration
  */
 static char *__respond(struct response *response)
 {
     ssize_t nwrite = 0;
-    char *buffer = malloc(BUFFERSIZE);
-    nwrite += sprintf(buffer + nwrite, "%s %d %s\nDate: %s\n", response->version, response->status_code, response->phrase, response->date);
-    if (response->status_code == VALID)
-        nwrite += sprintf(buffer + nwrite, "Content_length: %s\n",
-                response->content_length);
-    sprintf(buffer + nwrite, "Connection: %s\n", response->connection);
+    size_t size = HEAD_OVERHEAD + value_len(response->version)
+        + value_len(response->phrase) + value_len(response->date)
+        + (response->head ? response->head_len : 0)
+        + value_len(response->content_length)
+        + value_len(response->content_type) + value_len(response->etag)
+        + value_len(response->cache_control)
+        + value_len(response->connection);
+    char *buffer = malloc(size);
+    nwrite += sprintf(buffer + nwrite, "%s %d %s\r\nDate: %s\r\n",
+                      response->version, response->status_code,
+                      response->phrase, response->date);
+    if (response->head)
+    {
+        memcpy(buffer + nwrite, response->head, response->head_len);
+        nwrite += response->head_len;
+    }
+    else
+    {
+        if (response->chunked)
+            nwrite +=
+                sprintf(buffer + nwrite, "Transfer-Encoding: chunked\r\n");
+        else if (response->content_length)
+            nwrite += sprintf(buffer + nwrite, "Content-Length: %s\r\n",
+                              response->content_length);
+        if (response->content_type)
+            nwrite += sprintf(buffer + nwrite, "Content-Type: %s\r\n",
+                              response->content_type);
+        if (response->etag)
+            nwrite += sprintf(buffer + nwrite, "ETag: %s\r\n", response->etag);
+        if (response->cache_control)
+            nwrite += sprintf(buffer + nwrite, "Cache-Control: %s\r\n",
+                              response->cache_control);
+    }
+    sprintf(buffer + nwrite, "Connection: %s\r\n\r\n", response->connection);
 
+    trace_phase(TRACE_HEADERS_SENT, response->status_code);
     return buffer;
 }
 
 /*
- * @brief: parse the request emmited by the client, and send him the ressources
- * asked if this was a GET request
+ * @brief: return the length of the request head, up to the empty line
+ * included, or bytes if the empty line is not in the buffer
+ */
+static size_t head_length(const char *buffer, size_t bytes)
+{
+    for (size_t i = 0; i + 3 < bytes; i++)
+    {
+        if (!memcmp(buffer + i, "\r\n\r\n", 4))
+            return i + 4;
+    }
+    return bytes;
+}
+
+/*
+ * @brief: send the head of the response then the file it names, or the one
+ * it holds open, the long ones being handed to the scheduler
  *
- * @param client_fd: the client file descriptor
- * @param buffer: the request as a string
- * @param bytes: the length of the request
- * @param config: the config of the actual server
+ * @return true if the scheduler took the connection over
  */
-static void respond(int client_fd, char *buffer, size_t bytes,
-                    struct config *config)
+static bool send_file(struct connection *conn, struct response *response,
+                      const char *head)
 {
-    struct request *request = parse_request(buffer, bytes);
-    struct response *response = create_response(request, config);
+    off_t offset = response->offset;
+    int fd = response->fd >= 0 ? response->fd : open(response->path, O_RDONLY);
+    size_t len = strtoull(response->content_length, NULL, 10);
+    bool scheduled =
+        fd >= 0 && !scheduler_add(conn, head, strlen(head), fd, offset, len);
+    if (!scheduled
+        && (fd < 0
+            || connection_sendfile(conn, head, strlen(head), fd, &offset, len)
+                < 0))
+        perror(NULL);
+    if (fd >= 0 && fd != response->fd)
+        close(fd);
+    return scheduled;
+}
+
+/*
+ * @brief: send the segments of a listing from first up to end excluded, as
+ * chunks of a chunked body or after head otherwise
+ */
+static int send_segments(struct connection *conn, const char *head,
+                         struct listing_segment *first,
+                         struct listing_segment *end, bool chunked)
+{
+    struct iovec iov[CHUNK_IOV_MAX - 2];
+    int count = 0;
+    if (head && !chunked)
+        iov[count++] = (struct iovec){ (char *)head, strlen(head) };
+    else if (head && connection_send(conn, head, strlen(head)) < 0)
+        return -1;
+    while (first != end || count)
+    {
+        for (; first != end && count < CHUNK_IOV_MAX - 2; first = first->next)
+            iov[count++] = (struct iovec){ first->data, first->len };
+        if ((chunked ? response_send_chunk(conn, iov, count)
+                     : connection_sendv(conn, iov, count))
+            < 0)
+            return -1;
+        count = 0;
+    }
+    return 0;
+}
+
+/*
+ * @brief: send the listing of a directory, with a Content-Length if it is
+ * cached or fits in a segment, chunked while the directory is read otherwise
+ */
+static void send_listing(struct connection *conn, struct response *response,
+                         struct request *request)
+{
+    struct listing *listing = autoindex_lookup(
+        response->path, request->target->data, request->target->size);
+    int done = listing ? autoindex_render(listing) : -1;
+    if (done < 0)
+    {
+        perror(response->path);
+        response_set_status(response, INTERNAL_ERROR,
+                            "Internal Server Error");
+        response->content_type = NULL;
+    }
+    else if (done)
+    {
+        response->content_length = malloc(32);
+        if (response->content_length)
+            sprintf(response->content_length, "%zu", listing->size);
+    }
+    response->chunked = !done;
     char *rep = __respond(response);
-    send(client_fd, rep, strlen(rep), MSG_NOSIGNAL);
+    if (done < 0 || request->method != GET)
+        connection_send(conn, rep, strlen(rep));
+    else if (done)
+        send_segments(conn, rep, listing->segments, NULL, false);
+    else
+    {
+        struct listing_segment *sent = listing->segments;
+        int err = send_segments(conn, rep, sent, listing->last, true);
+        while (!err && !done)
+        {
+            sent = listing->last;
+            done = autoindex_render(listing);
+            err = done < 0
+                || send_segments(conn, NULL, sent, done ? NULL : listing->last,
+                                 true);
+        }
+        if (!err)
+            response_end_chunks(conn, NULL, 0);
+    }
     free(rep);
+    autoindex_release(listing);
+}
 
+/*
+ * @brief: a request waiting for the offload pool to resolve its target, the
+ * next clients being served meanwhile
+ *
+ * @param entry: the entry resolved by the pool, NULL if it failed
+ * @param generation: the generation of the file cache at the submission
+ * @param trace: the timeline of the request, set aside while it waits
+ */
+struct parked
+{
+    struct offload_job job;
+    struct connection conn;
+    struct request *request;
+    struct server_config *vhost;
+    struct file_entry *entry;
+    unsigned long generation;
+    struct trace_timeline trace;
+};
+
+/*
+ * @brief: send the response to a request, which is destroyed with it
+ *
+ * @return true if the scheduler took the connection over
+ */
+static bool reply(struct connection *conn, struct request *request,
+                  struct response *response, struct server_config *vhost)
+{
+    if (response->status_code == VALID && response->listing)
+    {
+        send_listing(conn, response, request);
+        trace_phase(TRACE_BODY_SENT, response->status_code);
+        request_destroy(request);
+        response_destroy(response);
+        return false;
+    }
+    if (response->status_code >= BAD_REQUEST || response->status_code == ERROR)
+    {
+        bool head_only = request && request->method == HEAD;
+        if (!errors_send(conn, vhost, response->status_code, head_only))
+        {
+            trace_phase(TRACE_BODY_SENT, response->status_code);
+            request_destroy(request);
+            response_destroy(response);
+            return false;
+        }
+    }
+    char *rep = __respond(response);
+    bool scheduled = false;
     if (response->status_code == VALID && request->method == GET)
+        scheduled = send_file(conn, response, rep);
+    else
+        connection_send(conn, rep, strlen(rep));
+    if (!scheduled)
+        trace_phase(TRACE_BODY_SENT, response->status_code);
+    free(rep);
+    request_destroy(request);
+    response_destroy(response);
+    return scheduled;
+}
+
+/*
+ * @brief: an upload whose body is received by the poll loop, the request
+ * being answered once it is stored
+ */
+struct receiving
+{
+    struct exchange ex;
+    struct connection conn;
+    struct request *request;
+    struct response *response;
+    struct server_config *vhost;
+    struct upload *upload;
+};
+
+static size_t receiving_events(struct exchange *ex, struct pollfd *fds)
+{
+    struct receiving *receiving = (struct receiving *)ex;
+    fds[0].fd = receiving->conn.fd;
+    fds[0].events = upload_events(receiving->upload);
+    return 1;
+}
+
+static enum exchange_turn receiving_turn(struct exchange *ex)
+{
+    struct receiving *receiving = (struct receiving *)ex;
+    if (upload_turn(receiving->upload))
+        return EXCHANGE_DONE;
+    return upload_busy(receiving->upload) ? EXCHANGE_AGAIN : EXCHANGE_WAIT;
+}
+
+/*
+ * @brief: answer a stored upload on the socket made blocking again, or
+ * close the connection of one which ran out of time
+ */
+static void receiving_end(struct exchange *ex, enum exchange_turn result)
+{
+    struct receiving *receiving = (struct receiving *)ex;
+    struct connection *conn = &receiving->conn;
+    upload_end(receiving->upload);
+    int flags = fcntl(conn->fd, F_GETFL);
+    bool scheduled = false;
+    if (result == EXCHANGE_DONE && flags >= 0
+        && fcntl(conn->fd, F_SETFL, flags & ~O_NONBLOCK) == 0)
+        scheduled = reply(conn, receiving->request, receiving->response,
+                          receiving->vhost);
+    else
+    {
+        request_destroy(receiving->request);
+        response_destroy(receiving->response);
+    }
+    if (!scheduled)
+    {
+        connection_close(conn);
+        trace_end();
+        budget_give(BUDGET_REQUESTS, 1);
+        budget_give(BUDGET_CONNECTIONS, 1);
+        fprintf(stderr, "client disconnected\n");
+    }
+    free(receiving);
+    budget_give(BUDGET_MEMORY, sizeof(struct receiving));
+}
+
+/*
+ * @brief: hand the body of a checked upload to the poll loop, the other
+ * clients being served while it is received. When there is no room for it,
+ * the body is received on the blocking socket.
+ *
+ * @return true if the poll loop took the connection, the request and the
+ * response over, false with the status of the response set otherwise
+ */
+static bool receive(struct connection *conn, struct request *request,
+                    struct response *response, struct server_config *vhost,
+                    const char *buffered, size_t nbuffered)
+{
+    int flags = fcntl(conn->fd, F_GETFL);
+    if (exchange_full() || flags < 0
+        || !budget_take(BUDGET_MEMORY, sizeof(struct receiving)))
+    {
+        upload_receive(conn, request, response, buffered, nbuffered);
+        return false;
+    }
+    struct receiving *receiving = malloc(sizeof(struct receiving));
+    if (!receiving || fcntl(conn->fd, F_SETFL, flags | O_NONBLOCK) < 0)
     {
-        send(client_fd, "\n", 1, MSG_NOSIGNAL);
+        free(receiving);
+        budget_give(BUDGET_MEMORY, sizeof(struct receiving));
+        upload_receive(conn, request, response, buffered, nbuffered);
+        return false;
+    }
+    receiving->conn = *conn;
+    receiving->upload = upload_start(&receiving->conn, request, response,
+                                     buffered, nbuffered);
+    if (!receiving->upload)
+    {
+        fcntl(conn->fd, F_SETFL, flags);
+        free(receiving);
+        budget_give(BUDGET_MEMORY, sizeof(struct receiving));
+        return false;
+    }
+    receiving->ex.events = receiving_events;
+    receiving->ex.turn = receiving_turn;
+    receiving->ex.end = receiving_end;
+    receiving->ex.timeout = UPLOAD_TIMEOUT;
+    receiving->request = request;
+    receiving->response = response;
+    receiving->vhost = vhost;
+    exchange_add(&receiving->ex);
+    return true;
+}
 
-        char pathname[BUFFERSIZE] = { 0 };
-        char *root_dir = config->servers[0].root_dir;
-        strcat(pathname, root_dir);
-        strcat(pathname, request->target->data);
+/*
+ * @brief: a request forwarded to the upstream of its vhost by the poll
+ * loop, the response being relayed back as the sockets allow
+ */
+struct forwarding
+{
+    struct exchange ex;
+    struct connection conn;
+    struct request *request;
+    struct response *response;
+    struct server_config *vhost;
+    struct proxy *proxy;
+};
+
+static size_t forwarding_events(struct exchange *ex, struct pollfd *fds)
+{
+    proxy_events(((struct forwarding *)ex)->proxy, fds);
+    return 1;
+}
+
+static enum exchange_turn forwarding_turn(struct exchange *ex)
+{
+    struct forwarding *forwarding = (struct forwarding *)ex;
+    int over = proxy_turn(forwarding->proxy);
+    if (over)
+        return over > 0 ? EXCHANGE_DONE : EXCHANGE_ERROR;
+    return proxy_busy(forwarding->proxy) ? EXCHANGE_AGAIN : EXCHANGE_WAIT;
+}
 
-        int fd = open(pathname, O_RDONLY);
-        ssize_t nsent;
-        int total = 0;
-        while (total != atoi(response->content_length))
+/*
+ * @brief: close the connection once the response is relayed, or send the
+ * response set by the proxy on the socket made blocking again
+ */
+static void forwarding_end(struct exchange *ex, enum exchange_turn result)
+{
+    struct forwarding *forwarding = (struct forwarding *)ex;
+    struct connection *conn = &forwarding->conn;
+    struct response *response = forwarding->response;
+    if (result == EXCHANGE_WAIT && proxy_expire(forwarding->proxy) < 0)
+        result = EXCHANGE_ERROR;
+    proxy_end(forwarding->proxy);
+    int flags = fcntl(conn->fd, F_GETFL);
+    bool scheduled = false;
+    if (result == EXCHANGE_ERROR && flags >= 0
+        && fcntl(conn->fd, F_SETFL, flags & ~O_NONBLOCK) == 0)
+        scheduled = reply(conn, forwarding->request, response,
+                          forwarding->vhost);
+    else
+    {
+        trace_phase(TRACE_BODY_SENT, response->status_code);
+        request_destroy(forwarding->request);
+        response_destroy(response);
+    }
+    if (!scheduled)
+    {
+        connection_close(conn);
+        trace_end();
+        budget_give(BUDGET_REQUESTS, 1);
+        budget_give(BUDGET_CONNECTIONS, 1);
+        fprintf(stderr, "client disconnected\n");
+    }
+    free(forwarding);
+    budget_give(BUDGET_MEMORY, sizeof(struct forwarding) + proxy_footprint());
+}
+
+/*
+ * @brief: hand a request to the poll loop, to be forwarded to the upstream
+ * of its vhost while the other clients are served. When there is no room
+ * for it, the request is forwarded on the blocking socket.
+ *
+ * @return 1 if the poll loop took the connection, the request and the
+ * response over, 0 if the response was relayed, -1 if the response must be
+ * sent instead
+ */
+static int forward(struct connection *conn, struct request *request,
+                   struct response *response, struct server_config *vhost,
+                   const char *buffer, size_t head, size_t bytes)
+{
+    size_t size = sizeof(struct forwarding) + proxy_footprint();
+    int flags = fcntl(conn->fd, F_GETFL);
+    struct forwarding *forwarding = NULL;
+    if (!exchange_full() && flags >= 0 && budget_take(BUDGET_MEMORY, size))
+    {
+        forwarding = malloc(sizeof(struct forwarding));
+        if (!forwarding || fcntl(conn->fd, F_SETFL, flags | O_NONBLOCK) < 0)
         {
-            nsent = sendfile(client_fd, fd, NULL, 512);
-            if (nsent < 0)
-            {
-                perror(NULL);
-                close(fd);
-                request_destroy(request);
-                response_destroy(response);
-                return;
-            }
-            total += nsent;
+            free(forwarding);
+            forwarding = NULL;
+            budget_give(BUDGET_MEMORY, size);
         }
-        close(fd);
     }
-    request_destroy(request);
-    response_destroy(response);
+    if (!forwarding)
+        return proxy_forward(conn, vhost, request, buffer, head,
+                             buffer + head, bytes - head, response);
+    forwarding->conn = *conn;
+    forwarding->proxy =
+        proxy_start(&forwarding->conn, vhost, request, buffer, head,
+                    buffer + head, bytes - head, response);
+    if (!forwarding->proxy)
+    {
+        fcntl(conn->fd, F_SETFL, flags);
+        free(forwarding);
+        budget_give(BUDGET_MEMORY, size);
+        return -1;
+    }
+    forwarding->ex.events = forwarding_events;
+    forwarding->ex.turn = forwarding_turn;
+    forwarding->ex.end = forwarding_end;
+    forwarding->ex.timeout = PROXY_TIMEOUT;
+    forwarding->request = request;
+    forwarding->response = response;
+    forwarding->vhost = vhost;
+    exchange_add(&forwarding->ex);
+    return 1;
+}
+
+/*
+ * @brief: create the response to a request and send it, the request head
+ * being the first head bytes of buffer
+ *
+ * @return true if the scheduler or the poll loop took the connection over
+ */
+static bool answer(struct connection *conn, char *buffer, size_t bytes,
+                   size_t head, struct request *request,
+                   struct server_config *vhost)
+{
+    struct response *response = create_response(request, vhost);
+    int forwarded = response->status_code == VALID && vhost->proxy_pass
+        ? forward(conn, request, response, vhost, buffer, head, bytes)
+        : -1;
+    if (forwarded > 0)
+        return true;
+    if (!forwarded)
+    {
+        trace_phase(TRACE_BODY_SENT, response->status_code);
+        request_destroy(request);
+        response_destroy(response);
+        return false;
+    }
+    if (response->status_code == VALID
+        && (request->method == PUT || request->method == POST)
+        && receive(conn, request, response, vhost, buffer + head,
+                   bytes - head))
+        return true;
+    return reply(conn, request, response, vhost);
 }
 
-static void communicate(int client_fd, struct config *config)
+/*
+ * @brief: run by the offload pool, resolve the target of a parked request
+ * and start reading the file it names
+ */
+static void resolve_target(struct offload_job *job)
 {
-    char buffer[BUFFERSIZE];
+    struct parked *parked = (struct parked *)job;
+    struct string *target = parked->request->target;
+    parked->entry = cache_resolve(parked->vhost, target->data, target->size);
+    struct file_entry *entry = parked->entry;
+    if (!entry || entry->error || entry->directory
+        || parked->request->method != GET)
+        return;
+    int fd = open(entry->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    size_t ahead = entry->size;
+    if (ahead > OFFLOAD_READAHEAD)
+        ahead = OFFLOAD_READAHEAD;
+    readahead(fd, 0, ahead);
+    close(fd);
+}
+
+/*
+ * @brief: answer a parked request once its target is resolved, the entry
+ * being served from the cache
+ */
+static void resume(struct offload_job *job)
+{
+    struct parked *parked = (struct parked *)job;
+    if (parked->entry)
+        cache_insert(parked->entry, parked->generation);
+    trace_resume(&parked->trace);
+    // Neither proxied nor uploaded, the request has no body to look at
+    if (!answer(&parked->conn, NULL, 0, 0, parked->request, parked->vhost))
+    {
+        connection_close(&parked->conn);
+        trace_end();
+        budget_give(BUDGET_REQUESTS, 1);
+        budget_give(BUDGET_CONNECTIONS, 1);
+        fprintf(stderr, "client disconnected\n");
+    }
+    free(parked);
+    budget_give(BUDGET_MEMORY, sizeof(struct parked));
+}
+
+/*
+ * @brief: hand a GET or HEAD whose target is not in the file cache to the
+ * offload pool, rather than blocking the other clients on the file system
+ *
+ * @return true if the request was parked, the connection and the request
+ * being owned by the pool then
+ */
+static bool park(struct connection *conn, struct request *request,
+                 struct server_config *vhost)
+{
+    if (!request || !request->target
+        || (request->method != GET && request->method != HEAD)
+        || vhost->proxy_pass || vhost->bundle
+        || cache_fresh(vhost, request->target->data, request->target->size)
+        || !budget_take(BUDGET_MEMORY, sizeof(struct parked)))
+        return false;
+    struct parked *parked = malloc(sizeof(struct parked));
+    if (!parked)
+    {
+        budget_give(BUDGET_MEMORY, sizeof(struct parked));
+        return false;
+    }
+    parked->job.work = resolve_target;
+    parked->job.done = resume;
+    parked->conn = *conn;
+    parked->request = request;
+    parked->vhost = vhost;
+    parked->entry = NULL;
+    parked->generation = cache_generation();
+    if (offload_submit(&parked->job) < 0)
+    {
+        free(parked);
+        budget_give(BUDGET_MEMORY, sizeof(struct parked));
+        return false;
+    }
+    trace_suspend(&parked->trace);
+    return true;
+}
+
+/*
+ * @brief: answer a request the client may not make with an error, without
+ * looking at its target
+ */
+static void refuse(struct connection *conn, struct server_config *vhost,
+                   enum my_status_code status, const char *phrase)
+{
+    if (errors_send(conn, vhost, status, false) < 0)
+    {
+        struct response *response = create_response(NULL, vhost);
+        response_set_status(response, status, phrase);
+        char *rep = __respond(response);
+        connection_send(conn, rep, strlen(rep));
+        free(rep);
+        response_destroy(response);
+    }
+    trace_phase(TRACE_BODY_SENT, status);
+}
+
+/*
+ * @brief: parse the request emmited by the client, and send him the ressources
+ * asked if this was a GET request, or store the body it sent if this was an
+ * upload
+ *
+ * @param conn: the client connection
+ * @param buffer: the request as a string
+ * @param bytes: the length of the request
+ * @param listener: the listener the client connected to
+ *
+ * @return true if the request was parked, its body received by the poll
+ * loop, its response scheduled or the connection multiplexed over HTTP/2,
+ * the connection being closed once done
+ */
+static bool respond(struct connection *conn, char *buffer, size_t bytes,
+                    struct listener *listener)
+{
+    if (h2_is_preface(buffer, bytes))
+        return !multiplex_add(conn, listener, buffer, bytes, NULL);
+    size_t head = head_length(buffer, bytes);
+    struct request *request = parse_request(buffer, head);
+    struct server_config *vhost =
+        request_vhost(request, listener->vhosts, listener->nb_vhosts);
+    if (!acl_allowed(vhost, &conn->peer))
+    {
+        refuse(conn, vhost, FORBIDDEN, "Forbidden");
+        request_destroy(request);
+        return false;
+    }
+    if (!ratelimit_request(&conn->peer))
+    {
+        refuse(conn, vhost, TOO_MANY_REQUESTS, "Too Many Requests");
+        request_destroy(request);
+        return false;
+    }
+    if (h2_is_upgrade(request) && !vhost->proxy_pass && !conn->ssl)
+    {
+        bool kept = !connection_send(conn, SWITCHING_TO_H2C,
+                                     strlen(SWITCHING_TO_H2C))
+            && !multiplex_add(conn, listener, buffer + head, bytes - head,
+                              request);
+        request_destroy(request);
+        return kept;
+    }
+    if (park(conn, request, vhost))
+        return true;
+    return answer(conn, buffer, bytes, head, request, vhost);
+}
+
+/*
+ * @brief: answer the request of a client whose head was received, or a 503
+ * if its head was cut by the memory budget
+ *
+ * @return true if the request was parked, its body received by the poll
+ * loop, its response scheduled or the connection multiplexed
+ */
+static bool communicate(struct reception *client)
+{
+    struct connection *conn = &client->conn;
+    if (client->spent)
+    {
+        budget_shed(conn, true);
+        return false;
+    }
+    struct pool_buffer *chain = client->chain;
     size_t bytes = 0;
-    bytes = recv(client_fd, buffer, BUFFERSIZE, 0);
-    respond(client_fd, buffer, bytes, config);
+    for (struct pool_buffer *b = chain; b; b = b->next)
+        bytes += b->len;
+    char *buffer = chain->data;
+    if (chain->next)
+    {
+        // A head longer than a buffer is joined once, when it is complete
+        buffer = malloc(bytes);
+        size_t joined = 0;
+        for (struct pool_buffer *b = chain; buffer && b; b = b->next)
+        {
+            memcpy(buffer + joined, b->data, b->len);
+            joined += b->len;
+        }
+        pool_give(chain);
+        client->chain = NULL;
+    }
+    // The request is parsed then, a parked request keeping no buffer
+    bool kept = buffer && respond(conn, buffer, bytes, client->listener);
+    if (!client->chain)
+        free(buffer);
+    return kept;
 }
 
-static void start_server(int server_socket, struct config *config)
+/*
+ * @brief: answer a client handed over by the reception, closing its
+ * connection unless the request was parked, its response scheduled or the
+ * connection multiplexed
+ */
+static void serve_received(struct reception *client)
 {
-    if (listen(server_socket, SOMAXCONN) == -1)
+    trace_resume(&client->trace);
+    capture_resume(&client->capture);
+    if (!communicate(client))
+    {
+        budget_give(BUDGET_REQUESTS, 1);
+        connection_close(&client->conn);
+        trace_end();
+        budget_give(BUDGET_CONNECTIONS, 1);
+        fprintf(stderr, "client disconnected\n");
+    }
+    reception_free(client);
+}
+
+/*
+ * @return whether a vhost of the listener allows the client, the vhost it
+ * asks for being known with its request only
+ */
+static bool reaches_listener(const struct listener *listener,
+                             const struct sockaddr_storage *peer)
+{
+    for (size_t i = 0; i < listener->nb_vhosts; i++)
+    {
+        if (acl_allowed(listener->vhosts[i], peer))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * @brief: hand a new client to the reception, which receives its request
+ * head without blocking the other clients
+ */
+static void serve_client(struct listener *listener, int client_fd,
+                         const struct sockaddr_storage *peer)
+{
+    struct connection conn;
+    trace_phase(TRACE_ACCEPT, client_fd);
+    const char *port = listener->vhosts[0]->port;
+    capture_connection(port ? strtoul(port, NULL, 10) : 0);
+    if (!reaches_listener(listener, peer) || !ratelimit_connection(peer))
+    {
+        close(client_fd);
+        trace_end();
         return;
+    }
+    fprintf(stderr, "client connected\n");
+    // Another worker may have taken the last connection since the poll
+    bool admitted = budget_take(BUDGET_CONNECTIONS, 1);
+    if (!listener->tls)
+        connection_init(&conn, client_fd);
+    if (listener->tls
+        && connection_start_tls(&conn, client_fd, listener->tls[0]) < 0)
+        fprintf(stderr, "TLS handshake failed\n");
+    else
+    {
+        conn.peer = *peer;
+        if (!reception_add(&conn, listener, admitted))
+            return;
+        // Only a plaintext client can be answered before its handshake
+        if (!listener->tls)
+            budget_shed(&conn, false);
+    }
+    connection_close(&conn);
+    trace_end();
+    if (admitted)
+        budget_give(BUDGET_CONNECTIONS, 1);
+    fprintf(stderr, "client disconnected\n");
+}
+
+/*
+ * @brief: take the clients waiting on the non-blocking listener until its
+ * accept queue is empty, rather than going back to poll() for each, or
+ * until the connection budget or the reception is full
+ */
+static void accept_clients(struct listener *listener)
+{
+    while (return_run() && !budget_full(BUDGET_CONNECTIONS)
+           && !reception_full())
+    {
+        struct sockaddr_storage peer;
+        socklen_t peer_len = sizeof(peer);
+        int client_fd = accept4(listener->fd, (struct sockaddr *)&peer,
+                                &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd >= 0)
+            serve_client(listener, client_fd, &peer);
+        else if (errno != EINTR && errno != ECONNABORTED)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept4");
+            return;
+        }
+    }
+}
+
+/*
+ * @brief: accept the clients of the listeners, receive their request heads,
+ * and process the changes of the document trees, the completed offload
+ * jobs, the scheduled transfers and the HTTP/2 connections between them
+ *
+ * @param watch_fd: the inotify file descriptor of the trees, -1 if they are
+ * not watched
+ * @param offload_fd: the eventfd of the offload pool, -1 if it is not
+ * started
+ */
+static void start_server(struct listener *listeners, size_t nb_listeners,
+                         int watch_fd, int offload_fd)
+{
+    size_t nb_fds = nb_listeners + 2;
+    struct pollfd *fds =
+        calloc(nb_fds + RECEPTION_MAX + SCHEDULER_MAX + MULTIPLEX_MAX
+                   + EXCHANGE_MAX * EXCHANGE_FDS,
+               sizeof(struct pollfd));
+    struct reception **ready = calloc(RECEPTION_MAX,
+                                      sizeof(struct reception *));
+    if (!fds || !ready)
+    {
+        free(fds);
+        free(ready);
+        return;
+    }
+    // A client going away shows as EPIPE, SSL_write() having no MSG_NOSIGNAL
+    signal(SIGPIPE, SIG_IGN);
+    for (size_t i = 0; i < nb_listeners; i++)
+    {
+        fds[i].fd = listeners[i].fd;
+        fds[i].events = POLLIN;
+    }
+    fds[nb_listeners].fd = watch_fd;
+    fds[nb_listeners].events = POLLIN;
+    fds[nb_listeners + 1].fd = offload_fd;
+    fds[nb_listeners + 1].events = POLLIN;
     while (return_run())
     {
-        int client_fd = accept(server_socket, NULL, NULL);
-        if (client_fd != -1)
+        if (take_reload())
+        {
+            errors_reload();
+            // The entries point into the locations swapped out
+            if (!location_reload())
+            {
+                cache_flush();
+                watch_reload();
+            }
+        }
+        if (take_profile())
+            profile_toggle();
+        // Full, the server leaves the new clients in the accept queues
+        bool accepting = !budget_full(BUDGET_CONNECTIONS) && !reception_full();
+        for (size_t i = 0; i < nb_listeners; i++)
+            fds[i].fd = accepting ? listeners[i].fd : -1;
+        size_t nb_received = reception_poll(fds + nb_fds);
+        struct pollfd *transfer_fds = fds + nb_fds + nb_received;
+        size_t nb_transfers = scheduler_poll(transfer_fds);
+        struct pollfd *h2_fds = transfer_fds + nb_transfers;
+        size_t nb_h2 = multiplex_poll(h2_fds);
+        struct pollfd *exchange_fds = h2_fds + nb_h2;
+        size_t nb_exchanged = exchange_poll(exchange_fds);
+        int timeout = reception_timeout();
+        int h2_timeout = multiplex_timeout();
+        int ex_timeout = exchange_timeout();
+        if (h2_timeout >= 0 && (timeout < 0 || h2_timeout < timeout))
+            timeout = h2_timeout;
+        if (ex_timeout >= 0
+            && (timeout < 0 || ex_timeout < timeout))
+            timeout = ex_timeout;
+        if (!accepting && (timeout < 0 || timeout > BUDGET_RECHECK))
+            timeout = BUDGET_RECHECK;
+        if (poll(fds, nb_fds + nb_received + nb_transfers + nb_h2
+                     + nb_exchanged,
+                 timeout)
+            < 0)
+            continue;
+        scheduler_run(transfer_fds, nb_transfers);
+        multiplex_run(h2_fds, nb_h2);
+        exchange_run(exchange_fds, nb_exchanged);
+        size_t nb_ready = reception_run(fds + nb_fds, nb_received, ready);
+        for (size_t i = 0; i < nb_ready; i++)
+            serve_received(ready[i]);
+        if (fds[nb_listeners].revents & POLLIN)
+            watch_process();
+        if (fds[nb_listeners + 1].revents & POLLIN)
+            offload_process();
+        // No thread of the pool walks the locations swapped out anymore
+        if (!offload_pending())
+            location_release();
+        for (size_t i = 0; i < nb_listeners; i++)
         {
-            fprintf(stderr, "client connected\n");
-            communicate(client_fd, config);
-            close(client_fd);
-            fprintf(stderr, "client disconnected\n");
+            if (fds[i].revents & POLLIN)
+                accept_clients(&listeners[i]);
         }
     }
+    free(fds);
+    free(ready);
+    offload_destroy();
+    reception_destroy();
+    exchange_destroy();
+    multiplex_destroy();
+    scheduler_destroy();
+    pool_destroy();
+    watch_destroy();
+    proxy_pool_destroy();
+    autoindex_flush();
+    ratelimit_destroy();
+    bundle_destroy();
+    errors_destroy();
+    acl_destroy();
+    location_destroy();
+    budget_destroy();
+    capture_destroy();
+    profile_destroy();
+    trace_destroy();
     fprintf(stderr, "Have you freed all the ressources ?\n");
 }
 
-static int create_and_bind(const char *node, const char *service)
+/*
+ * @param reuseport: let other sockets bind the same address, for workers
+ */
+static int create_and_bind(const char *node, const char *service,
+                           bool reuseport)
 {
     struct addrinfo hints = { 0 };
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_protocol = IPPROTO_TCP;
     struct addrinfo *res = NULL;
-    if (getaddrinfo(node, service, &hints, &res) == -1)
+    int err = getaddrinfo(node, service, &hints, &res);
+    if (err)
     {
-        fprintf(stderr, "couldn't find a struct addrinfo with such hints\n");
+        fprintf(stderr, "%s:%s: %s\n", node, service, gai_strerror(err));
         return -1;
     }
     int sock = -1;
     for (struct addrinfo *p = res; p; p = p->ai_next)
     {
-        sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        sock = socket(p->ai_family,
+                      p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                      p->ai_protocol);
         if (sock == -1)
             continue;
+        // Restarting must not wait for the connections left in TIME_WAIT
+        int one = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (reuseport
+            && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)))
+        {
+            close(sock);
+            sock = -1;
+            continue;
+        }
         if (bind(sock, p->ai_addr, p->ai_addrlen) != -1)
             break;
         close(sock);
         sock = -1;
     }
-    free(res);
+    freeaddrinfo(res);
+    return sock;
+}
+
+/*
+ * @brief: bind a Unix stream socket at path, "@name" binding name in the
+ * abstract namespace. A socket file nobody listens on any more is replaced.
+ *
+ * @param mode: the permissions of the socket file, set before listen() so
+ * that no client connects meanwhile, 0 to keep those the umask leaves
+ */
+static int create_unix(const char *path, size_t mode)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    size_t len = strlen(path);
+    if (len >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "%s: path too long for a socket\n", path);
+        return -1;
+    }
+    memcpy(addr.sun_path, path, len);
+    bool abstract = path[0] == '@';
+    // The name of an abstract socket is its bytes after a null one
+    if (abstract)
+        addr.sun_path[0] = '\0';
+    socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + len;
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        return -1;
+    struct stat st;
+    if (!abstract && !lstat(path, &st) && S_ISSOCK(st.st_mode)
+        && connect(sock, (struct sockaddr *)&addr, addr_len) == -1
+        && errno == ECONNREFUSED)
+        unlink(path);
+    if (bind(sock, (struct sockaddr *)&addr, addr_len) == -1
+        || (!abstract && mode && chmod(path, mode) == -1))
+    {
+        perror(path);
+        close(sock);
+        return -1;
+    }
     return sock;
 }
 
+static int set_option(int sock, int level, int name, size_t value,
+                      const char *option)
+{
+    int val = value > INT_MAX ? INT_MAX : value;
+    if (setsockopt(sock, level, name, &val, sizeof(val)) < 0)
+    {
+        perror(option);
+        return -1;
+    }
+    return 0;
+}
+
+static int set_tcp_options(int sock, const struct server_config *vhost)
+{
+    if (vhost->tcp_defer_accept
+        && set_option(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                      vhost->tcp_defer_accept, "TCP_DEFER_ACCEPT")
+            < 0)
+        return -1;
+    if (vhost->tcp_fastopen
+        && set_option(sock, IPPROTO_TCP, TCP_FASTOPEN, vhost->tcp_fastopen,
+                      "TCP_FASTOPEN")
+            < 0)
+        return -1;
+    if (vhost->tcp_nodelay
+        && set_option(sock, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY") < 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * @brief: set the socket options of the vhost on a listening socket, before
+ * listen(). The accepted sockets inherit TCP_NODELAY and the buffer sizes,
+ * the TCP options being left out on a Unix socket.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int set_listener_options(int sock, const struct server_config *vhost)
+{
+    if (!vhost->unix_socket && set_tcp_options(sock, vhost) < 0)
+        return -1;
+    if (vhost->socket_sndbuf
+        && set_option(sock, SOL_SOCKET, SO_SNDBUF, vhost->socket_sndbuf,
+                      "SO_SNDBUF")
+            < 0)
+        return -1;
+    if (vhost->socket_rcvbuf
+        && set_option(sock, SOL_SOCKET, SO_RCVBUF, vhost->socket_rcvbuf,
+                      "SO_RCVBUF")
+            < 0)
+        return -1;
+    return 0;
+}
+
+static struct listener *find_listener(struct listener *listeners,
+                                      size_t nb_listeners,
+                                      const struct server_config *vhost)
+{
+    for (size_t i = 0; i < nb_listeners; i++)
+    {
+        const struct server_config *first = listeners[i].vhosts[0];
+        if (first->unix_socket || vhost->unix_socket)
+        {
+            if (first->unix_socket && vhost->unix_socket
+                && !strcmp(first->unix_socket, vhost->unix_socket))
+                return &listeners[i];
+        }
+        else if (!strcmp(first->ip, vhost->ip)
+                 && !strcmp(first->port, vhost->port))
+            return &listeners[i];
+    }
+    return NULL;
+}
+
+static void destroy_listeners(struct listener *listeners, size_t nb_listeners)
+{
+    for (size_t i = 0; i < nb_listeners; i++)
+    {
+        if (listeners[i].fd != -1)
+            close(listeners[i].fd);
+        tls_listener_destroy(&listeners[i]);
+        free(listeners[i].vhosts);
+    }
+    free(listeners);
+}
+
 /*
  * The signal handler function for the basic launch
  *
@@ -148,20 +1141,239 @@ void bhandler(int signum)
         // STOP
         unset();
         break;
+    case SIGUSR1:
+        ask_profile();
+        break;
+    case SIGUSR2:
+        ask_reload();
+        break;
     default:
         break;
     }
 }
 
-int basic_launch(struct config *config)
+/*
+ * @brief: bind a listening socket for every distinct ip and port or
+ * unix_socket of the vhosts, the vhosts sharing one being told apart by
+ * their server_name
+ *
+ * @param nb_listeners: set to the number of listeners created
+ * @param reuseport: bind the sockets with SO_REUSEPORT, a set of listeners
+ * being created for each worker
+ * @param shared: the first set of listeners, whose Unix sockets the other
+ * sets share, Unix sockets having no SO_REUSEPORT; NULL for the first set
+ *
+ * @return the listeners, NULL on error
+ */
+static struct listener *create_listeners(struct config *config,
+                                         size_t *nb_listeners, bool reuseport,
+                                         const struct listener *shared)
 {
-    int server_socket =
-        create_and_bind(config->servers[0].ip, config->servers[0].port);
-    if (server_socket == -1)
+    struct listener *listeners =
+        calloc(config->nb_servers, sizeof(struct listener));
+    *nb_listeners = 0;
+    for (size_t i = 0; listeners && i < config->nb_servers; i++)
     {
-        fprintf(stderr, "could not create the server socket\n");
-        return -1;
+        struct server_config *vhost = &config->servers[i];
+        struct listener *listener = find_listener(listeners, *nb_listeners,
+                                                  vhost);
+        if (!listener)
+        {
+            listener = &listeners[(*nb_listeners)++];
+            if (!vhost->unix_socket)
+                listener->fd = create_and_bind(vhost->ip, vhost->port,
+                                               reuseport);
+            else if (shared)
+                listener->fd = fcntl(shared[*nb_listeners - 1].fd,
+                                     F_DUPFD_CLOEXEC, 0);
+            else
+                listener->fd = create_unix(vhost->unix_socket,
+                                           vhost->unix_mode);
+            listener->vhosts = calloc(config->nb_servers,
+                                      sizeof(struct server_config *));
+            size_t backlog = vhost->listen_backlog ? vhost->listen_backlog
+                                                   : SOMAXCONN;
+            if (listener->fd == -1 || !listener->vhosts
+                || set_listener_options(listener->fd, vhost) < 0
+                || listen(listener->fd, backlog > INT_MAX ? INT_MAX : backlog)
+                    == -1)
+            {
+                fprintf(stderr, "could not create the server socket\n");
+                destroy_listeners(listeners, *nb_listeners);
+                return NULL;
+            }
+        }
+        listener->vhosts[listener->nb_vhosts++] = vhost;
+    }
+    for (size_t i = 0; listeners && i < *nb_listeners; i++)
+    {
+        if (tls_listener_init(&listeners[i]) < 0)
+        {
+            destroy_listeners(listeners, *nb_listeners);
+            return NULL;
+        }
+    }
+    return listeners;
+}
+
+/*
+ * @brief: run a worker on its set of listeners, pinned to its CPU
+ *
+ * @return the pid of the worker, -1 on error
+ */
+static pid_t start_worker(struct config *config, struct listener **sets,
+                          size_t nb_listeners, size_t index, const int *cpus)
+{
+    pid_t pid = fork();
+    if (pid)
+        return pid;
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    budget_worker(index);
+    for (size_t i = 0; i < config->workers; i++)
+    {
+        if (i != index)
+            destroy_listeners(sets[i], nb_listeners);
+    }
+    int err = 0;
+    if (config->cpu_affinity)
+    {
+        err = worker_pin(cpus[index]);
+        // The Unix sockets are shared, the first accept taking the client
+        for (size_t i = 0; !err && i < nb_listeners; i++)
+        {
+            if (!sets[index][i].vhosts[0]->unix_socket)
+                err = worker_incoming_cpu(sets[index][i].fd, cpus[index]);
+        }
+    }
+    if (!err)
+        start_server(sets[index], nb_listeners, watch_init(config),
+                     offload_init(config->offload_threads));
+    destroy_listeners(sets[index], nb_listeners);
+    exit(err ? 1 : 0);
+}
+
+/*
+ * @brief: serve the listeners with config->workers worker processes, each
+ * on its own set of sockets bound with SO_REUSEPORT. The sockets stay open
+ * here, so that a worker killed by a signal is started again on them, at
+ * the same place in the reuseport groups.
+ */
+static int run_workers(struct config *config)
+{
+    size_t nb = config->workers;
+    int *cpus = calloc(nb, sizeof(int));
+    pid_t *pids = calloc(nb, sizeof(pid_t));
+    struct listener **sets = calloc(nb, sizeof(struct listener *));
+    size_t nb_listeners = 0;
+    int err = !cpus || !pids || !sets ? -1 : 0;
+    if (!err && config->cpu_affinity)
+        err = worker_cpus(cpus, nb);
+    for (size_t i = 0; !err && i < nb; i++)
+    {
+        sets[i] = create_listeners(config, &nb_listeners, true,
+                                   i ? sets[0] : NULL);
+        err = sets[i] ? 0 : -1;
+    }
+    for (size_t i = 0; !err && config->cpu_affinity && i < nb_listeners; i++)
+    {
+        if (!sets[0][i].vhosts[0]->unix_socket)
+            err = worker_steer(sets[0][i].fd, cpus, nb);
+    }
+    for (size_t i = 0; !err && i < nb; i++)
+        pids[i] = start_worker(config, sets, nb_listeners, i, cpus);
+    bundle_unmap();
+    while (!err && return_run())
+    {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0 && errno != EINTR)
+            break;
+        if (take_reload())
+        {
+            // The workers started again later get the new pages too
+            errors_reload();
+            if (!location_reload())
+                location_release();
+            for (size_t i = 0; i < nb; i++)
+            {
+                if (pids[i] > 0)
+                    kill(pids[i], SIGUSR2);
+            }
+        }
+        if (take_profile())
+        {
+            // Each worker profiles itself, appending to the same file
+            for (size_t i = 0; i < nb; i++)
+            {
+                if (pids[i] > 0)
+                    kill(pids[i], SIGUSR1);
+            }
+        }
+        for (size_t i = 0; pid > 0 && i < nb; i++)
+        {
+            if (pids[i] != pid)
+                continue;
+            pids[i] = -1;
+            budget_reclaim(i);
+            if (WIFSIGNALED(status) && WTERMSIG(status) != SIGINT
+                && return_run())
+            {
+                fprintf(stderr, "worker %zu killed by signal %d\n", i,
+                        WTERMSIG(status));
+                pids[i] = start_worker(config, sets, nb_listeners, i, cpus);
+            }
+        }
     }
+    for (size_t i = 0; pids && i < nb; i++)
+    {
+        if (pids[i] > 0)
+        {
+            kill(pids[i], SIGINT);
+            waitpid(pids[i], NULL, 0);
+        }
+    }
+    for (size_t i = 0; sets && i < nb; i++)
+    {
+        if (sets[i])
+            destroy_listeners(sets[i], nb_listeners);
+    }
+    free(sets);
+    free(pids);
+    free(cpus);
+    return err;
+}
+
+/*
+ * @brief: serve the vhosts of the configuration, in this process or in
+ * worker processes
+ */
+static int launch(struct config *config)
+{
+    if (ratelimit_init(config->ip_connection_rate, config->ip_request_rate)
+        < 0
+        || trace_init(config->trace_file, config->trace_sample) < 0
+        || bundle_init(config) < 0 || budget_init(config) < 0
+        || errors_init(config) < 0 || acl_init(config) < 0
+        || location_init(config) < 0
+        || capture_init(config->capture_file, config->capture_sample) < 0
+        || profile_init(config->profile_file, config->profile_frequency) < 0)
+        return -1;
+    scheduler_init(config->send_quantum, config->send_small_first);
+    if (config->workers)
+        return run_workers(config);
+    size_t nb_listeners;
+    struct listener *listeners = create_listeners(config, &nb_listeners,
+                                                  false, NULL);
+    if (!listeners)
+        return -1;
+    start_server(listeners, nb_listeners, watch_init(config),
+                 offload_init(config->offload_threads));
+    destroy_listeners(listeners, nb_listeners);
+    return 0;
+}
+
+int basic_launch(struct config *config)
+{
     struct sigaction bsa;
     bsa.sa_flags = 0;
     bsa.sa_handler = bhandler;
@@ -170,37 +1382,46 @@ int basic_launch(struct config *config)
         fprintf(stderr, "error of the signal catcher\n");
         return -1;
     }
-    if (sigaction(SIGINT, &bsa, NULL) < 0)
+    if (sigaction(SIGINT, &bsa, NULL) < 0
+        || sigaction(SIGUSR1, &bsa, NULL) < 0
+        || sigaction(SIGUSR2, &bsa, NULL) < 0)
     {
         fprintf(stderr, "error of the signal catcher\n");
         return -1;
     }
 
-    start_server(server_socket, config);
-
-    close(server_socket);
-
-    return 0;
+    return launch(config);
 }
 
-int daemonize_launch(struct config *config)
+int tool_launch(const struct args *args, const struct config *config)
 {
-    int cpid = daemonize();
-    if (!cpid) // We are in the daemon
+    if (args->pack > 0)
     {
-        int server_socket =
-            create_and_bind(config->servers[0].ip, config->servers[0].port);
-        if (server_socket == -1)
+        int err = 0;
+        for (size_t i = 0; i < config->nb_servers; i++)
         {
-            fprintf(stderr, "could not create the server socket\n");
+            if (bundle_pack(&config->servers[i]) < 0)
+                err = -1;
+        }
+        return err;
+    }
+    if (args->replay > 0)
+    {
+        if (!config->capture_file)
+        {
+            fprintf(stderr, "--replay: no capture_file to replay\n");
             return -1;
         }
-
-        start_server(server_socket, config);
-        close(server_socket);
-
-        return 0;
+        return capture_replay(config->capture_file, config->replay_speed);
     }
+    return 1;
+}
+
+int daemonize_launch(struct config *config)
+{
+    int cpid = daemonize();
+    if (!cpid) // We are in the daemon
+        return launch(config);
     else
         return cpid;
 }
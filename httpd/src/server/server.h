@@ -5,9 +5,40 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <openssl/ssl.h>
+#include <stddef.h>
+
 #include "../config/config.h"
+#include "../utils/arguments/arguments.h"
+
+/*
+ * @brief: a listening socket and the vhosts bound to its ip and port, or
+ * to its unix_socket
+ *
+ * @param fd: the listening socket
+ * @param vhosts: the vhosts, the first one being the default
+ * @param nb_vhosts: the number of vhosts
+ * @param tls: the TLS context of each vhost, NULL for a plaintext listener
+ */
+struct listener
+{
+    int fd;
+    struct server_config **vhosts;
+    size_t nb_vhosts;
+    SSL_CTX **tls;
+};
 
 int daemonize_launch(struct config *config);
 int basic_launch(struct config *config);
 
+/*
+ * @brief: run the tool asked for by the arguments instead of the server:
+ * --pack packs the root_dir of every vhost having a bundle, --replay sends
+ * the capture_file to the server at replay_speed
+ *
+ * @return 0 on success, -1 on error, 1 if the arguments ask for no tool,
+ * the server being left to launch
+ */
+int tool_launch(const struct args *args, const struct config *config);
+
 #endif /*!SERVER_H*/
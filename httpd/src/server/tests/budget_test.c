@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../budget.h"
+
+TestSuite(budget);
+
+static struct config *setup(size_t connections, size_t requests,
+                            size_t workers)
+{
+    struct config *config = calloc(1, sizeof(struct config));
+    cr_assert_not_null(config);
+    config->max_connections = connections;
+    config->max_requests = requests;
+    config->workers = workers;
+    config->retry_after = 7;
+    cr_assert_eq(budget_init(config), 0);
+    return config;
+}
+
+static void teardown(struct config *config)
+{
+    budget_destroy();
+    free(config);
+}
+
+Test(budget, take_and_give)
+{
+    struct config *config = setup(2, 0, 0);
+    cr_assert(budget_take(BUDGET_CONNECTIONS, 1));
+    cr_assert_not(budget_full(BUDGET_CONNECTIONS));
+    cr_assert(budget_take(BUDGET_CONNECTIONS, 1));
+    cr_assert(budget_full(BUDGET_CONNECTIONS));
+    cr_assert_not(budget_take(BUDGET_CONNECTIONS, 1));
+
+    // A budget without a limit is never spent
+    for (int i = 0; i < 1000; i++)
+        cr_assert(budget_take(BUDGET_REQUESTS, 1));
+    cr_assert_not(budget_full(BUDGET_REQUESTS));
+
+    budget_give(BUDGET_CONNECTIONS, 1);
+    cr_assert_not(budget_full(BUDGET_CONNECTIONS));
+    cr_assert(budget_take(BUDGET_CONNECTIONS, 1));
+    cr_assert_not(budget_take(BUDGET_CONNECTIONS, 1));
+    teardown(config);
+}
+
+Test(budget, no_limits)
+{
+    struct config *config = setup(0, 0, 0);
+    for (int i = 0; i < 1000; i++)
+        cr_assert(budget_take(BUDGET_MEMORY, 1UL << 30));
+    cr_assert_not(budget_full(BUDGET_MEMORY));
+    teardown(config);
+}
+
+Test(budget, shared_with_workers)
+{
+    struct config *config = setup(0, 4, 2);
+    budget_worker(1);
+    cr_assert(budget_take(BUDGET_REQUESTS, 3));
+    pid_t pid = fork();
+    if (!pid)
+    {
+        // The other worker sees what the first one took
+        budget_worker(0);
+        bool last = budget_take(BUDGET_REQUESTS, 1);
+        _exit(last && !budget_take(BUDGET_REQUESTS, 1) ? 0 : 1);
+    }
+    int status;
+    cr_assert_eq(waitpid(pid, &status, 0), pid);
+    cr_assert(WIFEXITED(status) && !WEXITSTATUS(status));
+    cr_assert(budget_full(BUDGET_REQUESTS));
+
+    // The dead worker gives back its request, the live one keeps its own
+    budget_reclaim(0);
+    cr_assert_not(budget_full(BUDGET_REQUESTS));
+    cr_assert(budget_take(BUDGET_REQUESTS, 1));
+    cr_assert_not(budget_take(BUDGET_REQUESTS, 1));
+    teardown(config);
+}
+
+/*
+ * Shed a client on a socket pair, what it sent being left unread if any
+ *
+ * @return what the client received, until the server side was closed
+ */
+static char *shed(const char *sent, bool received)
+{
+    int fds[2];
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    if (sent)
+        cr_assert_eq(write(fds[1], sent, strlen(sent)), (ssize_t)strlen(sent));
+    struct connection conn;
+    connection_init(&conn, fds[0]);
+    budget_shed(&conn, received);
+    connection_close(&conn);
+    static char out[512];
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fds[1], out + len, sizeof(out) - 1 - len)) > 0)
+        len += n;
+    out[len] = '\0';
+    close(fds[1]);
+    return out;
+}
+
+Test(budget, shed_with_retry_after)
+{
+    struct config *config = setup(1, 0, 0);
+    const char *expected = "HTTP/1.1 503 Service Unavailable\r\n"
+                           "Retry-After: 7\r\nContent-Length: 0\r\n"
+                           "Connection: close\r\n\r\n";
+    cr_assert_str_eq(shed("GET / HTTP/1.1\r\n\r\n", false), expected);
+    // Nothing to drain, the shed must not wait for the client
+    cr_assert_str_eq(shed(NULL, false), expected);
+    cr_assert_str_eq(shed(NULL, true), expected);
+    teardown(config);
+
+    config = calloc(1, sizeof(struct config));
+    cr_assert_eq(budget_init(config), 0);
+    cr_assert_not_null(strstr(shed(NULL, true), "Retry-After: 1\r\n"));
+    teardown(config);
+}
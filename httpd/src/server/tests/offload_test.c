@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+
+#include <criterion/criterion.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../offload.h"
+
+TestSuite(offload);
+
+/*
+ * @brief: a job recording the order it was worked then done in
+ */
+struct test_job
+{
+    struct offload_job job;
+    size_t index;
+};
+
+static struct test_job jobs[OFFLOAD_QUEUE];
+static size_t worked[OFFLOAD_QUEUE];
+static size_t nb_worked = 0;
+static size_t done[OFFLOAD_QUEUE];
+static size_t nb_done = 0;
+
+/*
+ * The first job holds the thread until the gate opens
+ */
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static bool gate_open = true;
+
+static void work(struct offload_job *job)
+{
+    struct test_job *test = (struct test_job *)job;
+    pthread_mutex_lock(&gate_lock);
+    while (!gate_open)
+        pthread_cond_wait(&gate_cond, &gate_lock);
+    worked[nb_worked++] = test->index;
+    pthread_mutex_unlock(&gate_lock);
+    // Jobs pile up in the completed list meanwhile
+    usleep(1000);
+}
+
+static void complete(struct offload_job *job)
+{
+    done[nb_done++] = ((struct test_job *)job)->index;
+}
+
+static void set_gate(bool open)
+{
+    pthread_mutex_lock(&gate_lock);
+    gate_open = open;
+    pthread_cond_broadcast(&gate_cond);
+    pthread_mutex_unlock(&gate_lock);
+}
+
+static int submit(size_t index)
+{
+    jobs[index].job.work = work;
+    jobs[index].job.done = complete;
+    jobs[index].index = index;
+    return offload_submit(&jobs[index].job);
+}
+
+/*
+ * Complete the jobs as the event loop does, until none is pending
+ */
+static void wait_pending(int fd)
+{
+    while (offload_pending())
+    {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        cr_assert_eq(poll(&pfd, 1, 2000), 1, "a job never completed");
+        offload_process();
+    }
+}
+
+Test(offload, refused_when_not_started)
+{
+    cr_assert_eq(submit(0), -1);
+    cr_assert_eq(offload_pending(), 0);
+}
+
+Test(offload, completed_in_order)
+{
+    int fd = offload_init(1);
+    cr_assert_geq(fd, 0);
+    set_gate(false);
+    for (size_t i = 0; i < 32; i++)
+        cr_assert_eq(submit(i), 0);
+    cr_assert_eq(offload_pending(), 32);
+    set_gate(true);
+    // Let several jobs complete before the first offload_process()
+    usleep(10000);
+    wait_pending(fd);
+
+    cr_assert_eq(nb_worked, 32);
+    cr_assert_eq(nb_done, 32);
+    for (size_t i = 0; i < 32; i++)
+    {
+        cr_assert_eq(worked[i], i);
+        cr_assert_eq(done[i], i);
+    }
+    offload_destroy();
+}
+
+Test(offload, full_queue_refused)
+{
+    int fd = offload_init(2);
+    cr_assert_geq(fd, 0);
+    set_gate(false);
+    for (size_t i = 0; i < OFFLOAD_QUEUE; i++)
+        cr_assert_eq(submit(i), 0);
+    // The caller does the work itself beyond OFFLOAD_QUEUE jobs
+    struct test_job extra = { .job = { work, complete, NULL }, .index = 0 };
+    cr_assert_eq(offload_submit(&extra.job), -1);
+    cr_assert_eq(offload_pending(), OFFLOAD_QUEUE);
+
+    set_gate(true);
+    wait_pending(fd);
+    cr_assert_eq(nb_done, OFFLOAD_QUEUE);
+    cr_assert_eq(offload_submit(&extra.job), 0);
+    wait_pending(fd);
+    offload_destroy();
+}
+
+Test(offload, destroy_drains)
+{
+    cr_assert_geq(offload_init(1), 0);
+    set_gate(false);
+    for (size_t i = 0; i < 16; i++)
+        cr_assert_eq(submit(i), 0);
+    set_gate(true);
+
+    // The queued jobs are worked and done before the pool stops
+    offload_destroy();
+    cr_assert_eq(nb_worked, 16);
+    cr_assert_eq(nb_done, 16);
+    cr_assert_eq(offload_pending(), 0);
+    for (size_t i = 0; i < 16; i++)
+        cr_assert_eq(done[i], i);
+    cr_assert_eq(submit(0), -1);
+}
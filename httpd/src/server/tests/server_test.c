@@ -0,0 +1,454 @@
+#define _GNU_SOURCE
+
+#include <criterion/criterion.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../utils/pool/pool.h"
+#include "../server.h"
+
+TestSuite(server);
+
+#define BIG_SIZE (16UL << 20)
+
+/*
+ * Idle clients of the soak, fewer than RECEPTION_MAX
+ */
+#define SOAK_CLIENTS 1000
+
+static char dir[] = "/tmp/server_testXXXXXX";
+static char socket_path[sizeof(dir) + 2];
+
+/*
+ * Serve a directory holding big.bin and small.txt on a Unix socket, from a
+ * child process, extra ending the configuration of the vhost
+ */
+static pid_t server_start(const char *extra)
+{
+    strcpy(dir, "/tmp/server_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    char path[256];
+    sprintf(path, "%s/big.bin", dir);
+    int fd = open(path, O_CREAT | O_WRONLY, 0644);
+    cr_assert(fd >= 0);
+    cr_assert_eq(ftruncate(fd, BIG_SIZE), 0);
+    close(fd);
+    sprintf(path, "%s/small.txt", dir);
+    FILE *file = fopen(path, "w");
+    cr_assert_not_null(file);
+    fputs("small", file);
+    fclose(file);
+    sprintf(socket_path, "%s/s", dir);
+
+    sprintf(path, "%s/httpd.cfg", dir);
+    file = fopen(path, "w");
+    cr_assert_not_null(file);
+    fprintf(file, "[global]\npid_file = %s/pid\n[[vhosts]]\n"
+                  "server_name = a\nunix_socket = %s\nroot_dir = %s\n%s",
+            dir, socket_path, dir, extra);
+    fclose(file);
+    pid_t pid = fork();
+    if (!pid)
+    {
+        // A failed test leaves no server behind
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        struct config *config = parse_configuration(path);
+        int err = config ? basic_launch(config) : -1;
+        config_destroy(config);
+        _exit(err ? 1 : 0);
+    }
+    return pid;
+}
+
+static void server_stop(pid_t pid)
+{
+    kill(pid, SIGINT);
+    int status;
+    cr_assert_eq(waitpid(pid, &status, 0), pid);
+    cr_assert(WIFEXITED(status));
+    char command[128];
+    sprintf(command, "rm -rf %s", dir);
+    cr_assert_eq(system(command), 0);
+}
+
+/*
+ * Connect to the server, its reads giving up after two seconds
+ */
+static int client(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    cr_assert(fd >= 0);
+    for (int i = 0; connect(fd, (struct sockaddr *)&addr, sizeof(addr)); i++)
+    {
+        cr_assert_lt(i, 100, "the server does not listen");
+        usleep(20000);
+    }
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+static void send_str(int fd, const char *str)
+{
+    cr_assert_eq(send(fd, str, strlen(str), MSG_NOSIGNAL),
+                 (ssize_t)strlen(str));
+}
+
+/*
+ * Read a response until the server closes the connection
+ *
+ * @return the bytes read, the first ones being copied to head
+ */
+static size_t receive(int fd, char *head, size_t size)
+{
+    char buf[65536];
+    size_t total = 0;
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+    {
+        if (total < size - 1)
+            memcpy(head + total, buf,
+                   (size_t)n < size - 1 - total ? (size_t)n : size - 1 - total);
+        total += n;
+    }
+    head[total < size - 1 ? total : size - 1] = '\0';
+    cr_assert_eq(n, 0, "the response did not end in time");
+    return total;
+}
+
+Test(server, small_while_large_in_flight)
+{
+    pid_t pid = server_start("");
+    // A large response left unread, a client silent and one sending its
+    // head a piece at a time
+    int large = client();
+    send_str(large, "GET /big.bin HTTP/1.1\r\nHost: a\r\n\r\n");
+    int silent = client();
+    int slow = client();
+    send_str(slow, "GET /small.txt HT");
+
+    for (int i = 0; i < 3; i++)
+    {
+        int small = client();
+        send_str(small, "GET /small.txt HTTP/1.1\r\nHost: a\r\n\r\n");
+        char head[256];
+        receive(small, head, sizeof(head));
+        cr_assert_not_null(strstr(head, "HTTP/1.1 200"));
+        cr_assert_not_null(strstr(head, "\r\n\r\nsmall"));
+        close(small);
+    }
+
+    send_str(slow, "TP/1.1\r\nHost: a\r\n\r\n");
+    char head[256];
+    receive(slow, head, sizeof(head));
+    cr_assert_not_null(strstr(head, "\r\n\r\nsmall"));
+    size_t total = receive(large, head, sizeof(head));
+    cr_assert_not_null(strstr(head, "HTTP/1.1 200"));
+    cr_assert_eq(total - (strstr(head, "\r\n\r\n") + 4 - head), BIG_SIZE);
+    close(large);
+    close(silent);
+    close(slow);
+    server_stop(pid);
+}
+
+/*
+ * Append an HTTP/2 frame to buf
+ *
+ * @return the length of the frame
+ */
+static size_t h2_frame(char *buf, int type, int flags, unsigned stream,
+                       const char *payload, size_t len)
+{
+    unsigned char header[9] = { len >> 16, len >> 8, len,          type,
+                                flags,     stream >> 24, stream >> 16,
+                                stream >> 8, stream };
+    memcpy(buf, header, sizeof(header));
+    memcpy(buf + sizeof(header), payload, len);
+    return sizeof(header) + len;
+}
+
+/*
+ * Send the client preface with settings opening the windows, then a GET of
+ * path on stream 1, its fields being literals
+ */
+static void h2_get(int fd, const char *path)
+{
+    char block[128] = "\x82\x86\x00\x05:path";
+    size_t len = 9;
+    block[len++] = strlen(path);
+    len += sprintf(block + len, "%s", path);
+    char buf[512];
+    size_t n = sprintf(buf, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+    n += h2_frame(buf + n, 0x4, 0, 0, "\x00\x04\x7f\xff\xff\xff", 6);
+    n += h2_frame(buf + n, 0x8, 0, 0, "\x7f\xff\x00\x00", 4);
+    n += h2_frame(buf + n, 0x1, 0x5, 1, block, len);
+    cr_assert_eq(send(fd, buf, n, MSG_NOSIGNAL), (ssize_t)n);
+}
+
+/*
+ * Read HTTP/2 frames until stream 1 ends
+ *
+ * @return the bytes of its DATA frames
+ */
+static size_t h2_body(int fd, char *body, size_t size)
+{
+    size_t total = 0;
+    for (;;)
+    {
+        unsigned char header[9];
+        cr_assert_eq(recv(fd, header, sizeof(header), MSG_WAITALL), 9,
+                     "the response did not end in time");
+        size_t len = header[0] << 16 | header[1] << 8 | header[2];
+        char payload[16384];
+        cr_assert_leq(len, sizeof(payload));
+        cr_assert_eq(recv(fd, payload, len, MSG_WAITALL), (ssize_t)len);
+        unsigned stream = (unsigned)header[5] << 24 | header[6] << 16
+            | header[7] << 8 | header[8];
+        if (stream != 1)
+            continue;
+        if (header[3] == 0x0 && total + len <= size)
+            memcpy(body + total, payload, len);
+        if (header[3] == 0x0)
+            total += len;
+        if ((header[3] <= 0x1 && header[4] & 0x1) || header[3] == 0x3)
+            return total;
+    }
+}
+
+Test(server, small_while_h2_stalls)
+{
+    pid_t pid = server_start("");
+    // An HTTP/2 client sending its preface only, and one asking for a large
+    // body it never reads
+    int silent = client();
+    send_str(silent, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+    int large = client();
+    h2_get(large, "/big.bin");
+
+    for (int i = 0; i < 3; i++)
+    {
+        int small = client();
+        send_str(small, "GET /small.txt HTTP/1.1\r\nHost: a\r\n\r\n");
+        char head[256];
+        receive(small, head, sizeof(head));
+        cr_assert_not_null(strstr(head, "\r\n\r\nsmall"));
+        close(small);
+
+        small = client();
+        h2_get(small, "/small.txt");
+        char body[16];
+        cr_assert_eq(h2_body(small, body, sizeof(body)), 5);
+        cr_assert_eq(memcmp(body, "small", 5), 0);
+        close(small);
+    }
+
+    cr_assert_eq(h2_body(large, NULL, 0), BIG_SIZE);
+    close(large);
+    close(silent);
+    server_stop(pid);
+}
+
+Test(server, small_while_upload_stalls)
+{
+    pid_t pid = server_start("upload = true\n");
+    // An upload whose body stops after its first bytes
+    int upload = client();
+    send_str(upload, "PUT /up.txt HTTP/1.1\r\nHost: a\r\n"
+                     "Content-Length: 10\r\n\r\nhel");
+
+    for (int i = 0; i < 3; i++)
+    {
+        int small = client();
+        send_str(small, "GET /small.txt HTTP/1.1\r\nHost: a\r\n\r\n");
+        char head[256];
+        receive(small, head, sizeof(head));
+        cr_assert_not_null(strstr(head, "\r\n\r\nsmall"));
+        close(small);
+    }
+
+    send_str(upload, "lo body");
+    char head[256];
+    receive(upload, head, sizeof(head));
+    cr_assert_eq(strncmp(head, "HTTP/1.1 201 ", 13), 0);
+    close(upload);
+    char path[256];
+    sprintf(path, "%s/up.txt", dir);
+    FILE *file = fopen(path, "r");
+    cr_assert_not_null(file);
+    char content[16] = { 0 };
+    cr_assert_eq(fread(content, 1, sizeof(content) - 1, file), 10);
+    fclose(file);
+    cr_assert_str_eq(content, "hello body");
+    server_stop(pid);
+}
+
+/*
+ * Listen on a Unix socket standing for an upstream
+ */
+static int upstream_listen(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, path);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    cr_assert(sock >= 0);
+    cr_assert_eq(bind(sock, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    cr_assert_eq(listen(sock, 8), 0);
+    return sock;
+}
+
+/*
+ * Accept a connection of the proxy and read the request head it forwards,
+ * giving up after two seconds
+ */
+static int upstream_accept(int sock)
+{
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    cr_assert_eq(poll(&pfd, 1, 2000), 1, "the request was not forwarded");
+    int fd = accept(sock, NULL, NULL);
+    cr_assert(fd >= 0);
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char head[1024];
+    size_t len = 0;
+    while (!memmem(head, len, "\r\n\r\n", 4))
+    {
+        ssize_t n = recv(fd, head + len, sizeof(head) - len, 0);
+        cr_assert_gt(n, 0, "the request head did not come");
+        len += n;
+    }
+    return fd;
+}
+
+Test(server, small_while_upstream_stalls)
+{
+    char updir[] = "/tmp/server_test_upstreamXXXXXX";
+    cr_assert_not_null(mkdtemp(updir));
+    char path[64];
+    sprintf(path, "%s/s", updir);
+    int sock = upstream_listen(path);
+    char extra[128];
+    sprintf(extra, "proxy_pass = unix:%s\n", path);
+    pid_t pid = server_start(extra);
+    // A request the upstream does not answer yet
+    int stalled = client();
+    send_str(stalled, "GET /slow HTTP/1.1\r\nHost: a\r\n\r\n");
+    int slow = upstream_accept(sock);
+
+    for (int i = 0; i < 3; i++)
+    {
+        int small = client();
+        send_str(small, "GET /fast HTTP/1.1\r\nHost: a\r\n\r\n");
+        int fast = upstream_accept(sock);
+        send_str(fast, "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n"
+                       "Connection: close\r\n\r\nfast");
+        char head[256];
+        receive(small, head, sizeof(head));
+        cr_assert_not_null(strstr(head, "\r\n\r\nfast"));
+        close(small);
+        close(fast);
+    }
+
+    send_str(slow, "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nslow");
+    char head[256];
+    receive(stalled, head, sizeof(head));
+    cr_assert_not_null(strstr(head, "\r\n\r\nslow"));
+    close(stalled);
+    close(slow);
+    close(sock);
+    server_stop(pid);
+    unlink(path);
+    rmdir(updir);
+}
+
+Test(server, long_cache_control)
+{
+    static char extra[10100];
+    size_t len = sprintf(extra, "[[vhosts.locations]]\npath = /\n"
+                                "cache_control = ");
+    memset(extra + len, 'c', 10000);
+    strcpy(extra + len + 10000, "\n");
+    pid_t pid = server_start(extra);
+
+    int fd = client();
+    send_str(fd, "GET /small.txt HTTP/1.1\r\nHost: a\r\n\r\n");
+    static char head[12000];
+    receive(fd, head, sizeof(head));
+    char *field = strstr(head, "Cache-Control: ");
+    cr_assert_not_null(field);
+    field += 15;
+    cr_assert_eq(strspn(field, "c"), 10000);
+    cr_assert_not_null(strstr(field, "\r\n\r\nsmall"));
+    close(fd);
+    server_stop(pid);
+}
+
+/*
+ * @return the resident kilobytes of a process
+ */
+static long rss_kb(pid_t pid)
+{
+    char path[64];
+    sprintf(path, "/proc/%d/status", pid);
+    FILE *file = fopen(path, "r");
+    cr_assert_not_null(file);
+    char line[256];
+    long rss = -1;
+    while (rss < 0 && fgets(line, sizeof(line), file))
+        sscanf(line, "VmRSS: %ld", &rss);
+    fclose(file);
+    cr_assert_geq(rss, 0);
+    return rss;
+}
+
+/*
+ * Wait for the server to have gone through what the clients connected so
+ * far sent, a request being answered after them
+ */
+static void serve_small(void)
+{
+    int fd = client();
+    send_str(fd, "GET /small.txt HTTP/1.1\r\nHost: a\r\n\r\n");
+    char head[256];
+    receive(fd, head, sizeof(head));
+    cr_assert_eq(strncmp(head, "HTTP/1.1 200 ", 13), 0);
+    close(fd);
+}
+
+Test(server, idle_rss)
+{
+    pid_t pid = server_start("");
+    serve_small();
+    long base = rss_kb(pid);
+    static int fds[SOAK_CLIENTS];
+    for (size_t i = 0; i < SOAK_CLIENTS; i++)
+        fds[i] = client();
+    serve_small();
+    long silent = (rss_kb(pid) - base) * 1024 / SOAK_CLIENTS;
+    for (size_t i = 0; i < SOAK_CLIENTS; i++)
+        send_str(fds[i], "GET /small.txt HTTP/1.1\r\n");
+    serve_small();
+    long pending = (rss_kb(pid) - base) * 1024 / SOAK_CLIENTS;
+    cr_log_info("RSS per idle connection: %ld bytes silent, %ld bytes "
+                "holding a pooled buffer",
+                silent, pending);
+
+    // A silent client holds its reception alone, one midway through its
+    // head a buffer of the pool more
+    cr_assert_lt(silent, 1024);
+    cr_assert_lt(pending, 1024 + (long)sizeof(struct pool_buffer));
+    server_stop(pid);
+    for (size_t i = 0; i < SOAK_CLIENTS; i++)
+        close(fds[i]);
+}
@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <criterion/criterion.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <openssl/ssl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../utils/io/connection.h"
+#include "../tls.h"
+
+TestSuite(tls);
+
+#define FILE_SIZE (1UL << 20)
+#define HEAD "HTTP/1.1 200 OK\r\n\r\n"
+
+static char dir[] = "/tmp/tls_testXXXXXX";
+static char cert[sizeof(dir) + 8];
+static char key[sizeof(dir) + 8];
+static char file[sizeof(dir) + 8];
+
+static char pattern(size_t i)
+{
+    return 'a' + i * 7 % 26;
+}
+
+/*
+ * Create a self-signed certificate and a file to serve
+ */
+static void setup(void)
+{
+    cr_assert_not_null(mkdtemp(dir));
+    sprintf(cert, "%s/crt", dir);
+    sprintf(key, "%s/key", dir);
+    sprintf(file, "%s/file", dir);
+    char command[512];
+    sprintf(command,
+            "openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 "
+            "-nodes -subj /CN=a -days 1 -keyout %s -out %s 2>/dev/null",
+            key, cert);
+    cr_assert_eq(system(command), 0);
+    FILE *out = fopen(file, "w");
+    cr_assert_not_null(out);
+    for (size_t i = 0; i < FILE_SIZE; i++)
+        fputc(pattern(i), out);
+    fclose(out);
+}
+
+static void teardown(void)
+{
+    char command[128];
+    sprintf(command, "rm -rf %s", dir);
+    cr_assert_eq(system(command), 0);
+}
+
+/*
+ * @return whether the kernel can take over the encryption of a socket
+ */
+static bool ktls_available(void)
+{
+#ifdef OPENSSL_NO_KTLS
+    return false;
+#else
+    FILE *ulp = fopen("/proc/sys/net/ipv4/tcp_available_ulp", "r");
+    if (!ulp)
+        return false;
+    char line[256] = "";
+    char *read = fgets(line, sizeof(line), ulp);
+    fclose(ulp);
+    return read && strstr(line, "tls");
+#endif
+}
+
+/*
+ * Connect to port from a child process that sends ping, then checks it
+ * receives HEAD and the file, limited to TLS 1.2 with a cipher the kernel
+ * cannot run when cbc is set
+ */
+static pid_t client_start(unsigned short port, bool cbc)
+{
+    pid_t pid = fork();
+    cr_assert_geq(pid, 0);
+    if (pid)
+        return pid;
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    if (cbc)
+    {
+        SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+        SSL_CTX_set_cipher_list(ctx, "ECDHE-ECDSA-AES128-SHA256");
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET,
+                                .sin_port = htons(port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    SSL *ssl = SSL_new(ctx);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))
+        || !SSL_set_fd(ssl, fd) || SSL_connect(ssl) != 1
+        || SSL_write(ssl, "ping", 4) != 4)
+        _exit(1);
+    static char buf[sizeof(HEAD) - 1 + FILE_SIZE + 1];
+    size_t total = 0;
+    int n;
+    while (total < sizeof(buf)
+           && (n = SSL_read(ssl, buf + total, sizeof(buf) - total)) > 0)
+        total += n;
+    if (total != sizeof(buf) - 1 || memcmp(buf, HEAD, sizeof(HEAD) - 1))
+        _exit(2);
+    for (size_t i = 0; i < FILE_SIZE; i++)
+    {
+        if (buf[sizeof(HEAD) - 1 + i] != pattern(i))
+            _exit(3);
+    }
+    _exit(0);
+}
+
+/*
+ * Serve the file to a client over TLS, as the server does once the head is
+ * received, with the context of a listener
+ *
+ * @return whether the kernel encrypted the response
+ */
+static bool serve(bool cbc)
+{
+    struct server_config vhost = { .tls_cert = cert, .tls_key = key };
+    struct server_config *vhosts[] = { &vhost };
+    struct listener listener = { .vhosts = vhosts, .nb_vhosts = 1 };
+    cr_assert_eq(tls_listener_init(&listener), 0);
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    cr_assert_eq(bind(sock, (struct sockaddr *)&addr, len), 0);
+    cr_assert_eq(listen(sock, 1), 0);
+    cr_assert_eq(getsockname(sock, (struct sockaddr *)&addr, &len), 0);
+    pid_t pid = client_start(ntohs(addr.sin_port), cbc);
+
+    struct connection conn;
+    int fd = accept(sock, NULL, NULL);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(connection_start_tls(&conn, fd, listener.tls[0]), 0);
+    // The socket blocks, so the handshake is done in a single call
+    cr_assert_eq(connection_handshake(&conn), 0);
+    bool ktls = conn.ktls_send;
+    char ping[4];
+    cr_assert_eq(connection_recv(&conn, ping, sizeof(ping)), 4);
+    cr_assert_arr_eq(ping, "ping", 4);
+    int in = open(file, O_RDONLY);
+    cr_assert_geq(in, 0);
+    off_t offset = 0;
+    cr_assert_eq(connection_sendfile(&conn, HEAD, sizeof(HEAD) - 1, in,
+                                     &offset, FILE_SIZE),
+                 0);
+    cr_assert_eq(offset, (off_t)FILE_SIZE);
+    close(in);
+    connection_close(&conn);
+
+    int status;
+    cr_assert_eq(waitpid(pid, &status, 0), pid);
+    cr_assert(WIFEXITED(status) && !WEXITSTATUS(status));
+    close(sock);
+    tls_listener_destroy(&listener);
+    return ktls;
+}
+
+Test(tls, sendfile_ktls)
+{
+    setup();
+    // Taken over by the kernel wherever it can be
+    cr_assert_eq(serve(false), ktls_available());
+    teardown();
+}
+
+Test(tls, sendfile_user_space)
+{
+    setup();
+    // A CBC cipher cannot be moved into the kernel, SSL_write() encrypts
+    cr_assert_not(serve(true));
+    teardown();
+}
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+
+#include <criterion/criterion.h>
+#include <errno.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../utils/capture/capture.h"
+#include "../server.h"
+#include "../worker.h"
+
+TestSuite(worker);
+
+/*
+ * Make set_mempolicy() fail with EPERM in the calling process, as the
+ * default seccomp profile of the containers does
+ */
+static void deny_mempolicy(void)
+{
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_set_mempolicy, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | EPERM),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(*code), code };
+    cr_assert_eq(prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0), 0);
+    cr_assert_eq(prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog), 0);
+}
+
+Test(worker, pin_without_mempolicy)
+{
+    cpu_set_t set;
+    cr_assert_eq(sched_getaffinity(0, sizeof(set), &set), 0);
+    int cpu = 0;
+    while (!CPU_ISSET(cpu, &set))
+        cpu++;
+    pid_t pid = fork();
+    if (!pid)
+    {
+        deny_mempolicy();
+        int err = worker_pin(cpu);
+        cpu_set_t pinned;
+        sched_getaffinity(0, sizeof(pinned), &pinned);
+        _exit(err || CPU_COUNT(&pinned) != 1 || !CPU_ISSET(cpu, &pinned));
+    }
+    int status;
+    cr_assert_eq(waitpid(pid, &status, 0), pid);
+    cr_assert(WIFEXITED(status));
+    cr_assert_eq(WEXITSTATUS(status), 0);
+}
+
+Test(worker, cpus_in_turn)
+{
+    cpu_set_t set;
+    cr_assert_eq(sched_getaffinity(0, sizeof(set), &set), 0);
+    int allowed[CPU_SETSIZE];
+    size_t nb_allowed = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &set))
+            allowed[nb_allowed++] = cpu;
+    }
+    // Every allowed CPU gets a worker before any gets a second one
+    size_t nb_workers = 2 * nb_allowed + 1;
+    int *cpus = calloc(nb_workers, sizeof(int));
+    cr_assert_eq(worker_cpus(cpus, nb_workers), 0);
+    for (size_t i = 0; i < nb_workers; i++)
+        cr_assert_eq(cpus[i], allowed[i % nb_allowed]);
+    free(cpus);
+}
+
+static char dir[] = "/tmp/worker_testXXXXXX";
+static int port;
+
+/*
+ * Serve a directory holding small.txt on a free loopback port with two
+ * workers, from a child process, the reads of every connection being
+ * captured
+ */
+static pid_t server_start(bool cpu_affinity, bool denied)
+{
+    strcpy(dir, "/tmp/worker_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    char path[256];
+    sprintf(path, "%s/small.txt", dir);
+    FILE *file = fopen(path, "w");
+    cr_assert_not_null(file);
+    fputs("small", file);
+    fclose(file);
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    cr_assert_eq(bind(sock, (struct sockaddr *)&addr, len), 0);
+    cr_assert_eq(getsockname(sock, (struct sockaddr *)&addr, &len), 0);
+    port = ntohs(addr.sin_port);
+    close(sock);
+
+    sprintf(path, "%s/httpd.cfg", dir);
+    file = fopen(path, "w");
+    cr_assert_not_null(file);
+    fprintf(file,
+            "[global]\npid_file = %s/pid\nworkers = 2\ncpu_affinity = %s\n"
+            "capture_file = %s/capture\ncapture_sample = 1\n[[vhosts]]\n"
+            "server_name = a\nport = %d\nip = 127.0.0.1\nroot_dir = %s\n",
+            dir, cpu_affinity ? "true" : "false", dir, port, dir);
+    fclose(file);
+    pid_t pid = fork();
+    if (!pid)
+    {
+        // A failed test leaves no server behind
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (denied)
+            deny_mempolicy();
+        struct config *config = parse_configuration(path);
+        int err = config ? basic_launch(config) : -1;
+        config_destroy(config);
+        _exit(err ? 1 : 0);
+    }
+    return pid;
+}
+
+static void server_stop(pid_t pid)
+{
+    kill(pid, SIGINT);
+    int status;
+    cr_assert_eq(waitpid(pid, &status, 0), pid);
+    cr_assert(WIFEXITED(status));
+}
+
+/*
+ * Get small.txt on a new connection, its reads giving up after two seconds
+ */
+static void get_small(void)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    for (int i = 0; connect(fd, (struct sockaddr *)&addr, sizeof(addr)); i++)
+    {
+        cr_assert_lt(i, 100, "the server does not listen");
+        usleep(20000);
+        close(fd);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+    }
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    const char *request = "GET /small.txt HTTP/1.1\r\nHost: a\r\n\r\n";
+    cr_assert_eq(send(fd, request, strlen(request), MSG_NOSIGNAL),
+                 (ssize_t)strlen(request));
+    char buf[512];
+    size_t len = 0;
+    ssize_t n;
+    while ((n = recv(fd, buf + len, sizeof(buf) - 1 - len, 0)) > 0)
+        len += n;
+    buf[len] = '\0';
+    cr_assert_eq(n, 0, "the response did not end in time");
+    cr_assert_not_null(strstr(buf, "HTTP/1.1 200"));
+    cr_assert_not_null(strstr(buf, "\r\n\r\nsmall"));
+    close(fd);
+}
+
+/*
+ * @return the number of processes which captured a connection
+ */
+static size_t capturing_processes(void)
+{
+    char path[256];
+    sprintf(path, "%s/capture", dir);
+    FILE *file = fopen(path, "r");
+    cr_assert_not_null(file);
+    uint32_t pids[2];
+    size_t nb_pids = 0;
+    struct capture_record record;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        cr_assert_eq(record.magic, CAPTURE_MAGIC);
+        fseek(file, record.len, SEEK_CUR);
+        uint32_t pid = record.connection >> 32;
+        if (!(nb_pids && pids[0] == pid) && !(nb_pids > 1 && pids[1] == pid))
+        {
+            cr_assert_lt(nb_pids, 2);
+            pids[nb_pids++] = pid;
+        }
+    }
+    fclose(file);
+    return nb_pids;
+}
+
+static void cleanup(void)
+{
+    char command[128];
+    sprintf(command, "rm -rf %s", dir);
+    cr_assert_eq(system(command), 0);
+}
+
+Test(worker, both_accept)
+{
+    pid_t pid = server_start(false, false);
+    // The reuseport group spreads the connections by their addresses
+    for (int i = 0; i < 64; i++)
+        get_small();
+    server_stop(pid);
+    cr_assert_eq(capturing_processes(), 2);
+    cleanup();
+}
+
+Test(worker, pinned_without_mempolicy)
+{
+    pid_t pid = server_start(true, true);
+    for (int i = 0; i < 8; i++)
+        get_small();
+    server_stop(pid);
+    cleanup();
+}
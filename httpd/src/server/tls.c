@@ -0,0 +1,114 @@
+#include "tls.h"
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/*
+ * @brief: switch to the context of the vhost named by the SNI of the
+ * client, keeping the default one if none matches
+ */
+static int select_certificate(SSL *ssl, int *alert, void *arg)
+{
+    (void)alert;
+    struct listener *listener = arg;
+    const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    size_t len = name ? strlen(name) : 0;
+    for (size_t i = 1; name && i < listener->nb_vhosts; i++)
+    {
+        struct string *server_name = &listener->vhosts[i]->server_name;
+        if (server_name->size == len
+            && !strncasecmp(server_name->data, name, len))
+        {
+            SSL_set_SSL_CTX(ssl, listener->tls[i]);
+            break;
+        }
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static int select_protocol(SSL *ssl, const unsigned char **out,
+                           unsigned char *outlen, const unsigned char *in,
+                           unsigned int inlen, void *arg)
+{
+    (void)ssl;
+    struct listener *listener = arg;
+    const char *protocols = TLS_ALPN;
+    for (size_t i = 0; i < listener->nb_vhosts; i++)
+    {
+        if (listener->vhosts[i]->proxy_pass || listener->vhosts[i]->upload)
+            protocols = TLS_ALPN_HTTP1;
+    }
+    if (SSL_select_next_proto((unsigned char **)out, outlen,
+                              (const unsigned char *)protocols,
+                              strlen(protocols), in, inlen)
+        != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static SSL_CTX *create_context(struct listener *listener,
+                               const struct server_config *vhost)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+        return NULL;
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    SSL_CTX_set_tlsext_servername_callback(ctx, select_certificate);
+    SSL_CTX_set_tlsext_servername_arg(ctx, listener);
+    SSL_CTX_set_alpn_select_cb(ctx, select_protocol, listener);
+    if (SSL_CTX_use_certificate_chain_file(ctx, vhost->tls_cert) != 1
+        || SSL_CTX_use_PrivateKey_file(ctx, vhost->tls_key, SSL_FILETYPE_PEM)
+            != 1
+        || SSL_CTX_check_private_key(ctx) != 1)
+    {
+        fprintf(stderr, "%s: could not load the certificate\n",
+                vhost->tls_cert);
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+int tls_listener_init(struct listener *listener)
+{
+    size_t nb_tls = 0;
+    for (size_t i = 0; i < listener->nb_vhosts; i++)
+        nb_tls += listener->vhosts[i]->tls_cert != NULL;
+    if (!nb_tls)
+        return 0;
+    if (nb_tls != listener->nb_vhosts)
+    {
+        const struct server_config *first = listener->vhosts[0];
+        if (first->unix_socket)
+            fprintf(stderr, "%s: vhosts with and without tls_cert\n",
+                    first->unix_socket);
+        else
+            fprintf(stderr, "%s:%s: vhosts with and without tls_cert\n",
+                    first->ip, first->port);
+        return -1;
+    }
+    listener->tls = calloc(listener->nb_vhosts, sizeof(SSL_CTX *));
+    if (!listener->tls)
+        return -1;
+    for (size_t i = 0; i < listener->nb_vhosts; i++)
+    {
+        listener->tls[i] = create_context(listener, listener->vhosts[i]);
+        if (!listener->tls[i])
+            return -1;
+    }
+    return 0;
+}
+
+void tls_listener_destroy(struct listener *listener)
+{
+    for (size_t i = 0; listener->tls && i < listener->nb_vhosts; i++)
+        SSL_CTX_free(listener->tls[i]);
+    free(listener->tls);
+    listener->tls = NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include "server.h"
+
+/*
+ * Protocols offered with ALPN, in order of preference. HTTP/2 is left out
+ * when a vhost of the listener uploads or proxies, which only HTTP/1.1
+ * serves.
+ */
+#define TLS_ALPN "\x02h2\x08http/1.1"
+#define TLS_ALPN_HTTP1 "\x08http/1.1"
+
+/*
+ * @brief: create the TLS context of each vhost of the listener, with its
+ * certificate, kernel TLS offload enabled, and the certificate picked
+ * from the SNI of the client. The listener stays in plaintext if its vhosts
+ * have no certificate.
+ *
+ * @return 0 on success, -1 if a certificate cannot be loaded or if vhosts
+ * with and without one share the listener
+ */
+int tls_listener_init(struct listener *listener);
+
+/*
+ * @brief: free the TLS contexts of the listener
+ */
+void tls_listener_destroy(struct listener *listener);
+
+#endif /*!TLS_H*/
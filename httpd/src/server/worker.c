@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+
+#include "worker.h"
+
+#include <linux/filter.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int worker_cpus(int *cpus, size_t nb_workers)
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) < 0 || !CPU_COUNT(&set))
+    {
+        perror("sched_getaffinity");
+        return -1;
+    }
+    int cpu = -1;
+    for (size_t i = 0; i < nb_workers; i++)
+    {
+        do
+            cpu = (cpu + 1) % CPU_SETSIZE;
+        while (!CPU_ISSET(cpu, &set));
+        cpus[i] = cpu;
+    }
+    return 0;
+}
+
+int worker_pin(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+    {
+        perror("sched_setaffinity");
+        return -1;
+    }
+    // Allocate on the node of the CPU running the process, the one pinned.
+    // Only a hint: container seccomp profiles commonly deny the call.
+    if (syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0) < 0)
+        perror("set_mempolicy, memory policy left as it was");
+    return 0;
+}
+
+int worker_incoming_cpu(int sock, int cpu)
+{
+    if (setsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0)
+    {
+        perror("SO_INCOMING_CPU");
+        return -1;
+    }
+    return 0;
+}
+
+int worker_steer(int sock, const int *cpus, size_t nb_workers)
+{
+    // Load the CPU, return the index of its worker, else spread by CPU
+    size_t len = 2 * nb_workers + 3;
+    if (len > BPF_MAXINSNS) // Left to the hash of the reuseport group
+        return 0;
+    struct sock_filter *code = calloc(len, sizeof(struct sock_filter));
+    if (!code)
+        return -1;
+    size_t n = 0;
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                             SKF_AD_OFF + SKF_AD_CPU);
+    for (size_t i = 0; i < nb_workers; i++)
+    {
+        code[n++] =
+            (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpus[i],
+                                         0, 1);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+    }
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,
+                                             nb_workers);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+    struct sock_fprog prog = { .len = n, .filter = code };
+    int err = setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                         sizeof(prog));
+    free(code);
+    if (err < 0)
+        perror("SO_ATTACH_REUSEPORT_CBPF");
+    return err;
+}
@@ -0,0 +1,43 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <stddef.h>
+
+/*
+ * @brief: pick the CPU of each worker among those the server may run on,
+ * in turn, so that the workers spread over every core before sharing one
+ *
+ * @param cpus: filled with the CPU of each worker
+ *
+ * @return 0 on success, -1 on error
+ */
+int worker_cpus(int *cpus, size_t nb_workers);
+
+/*
+ * @brief: pin the calling process to a CPU, its memory being allocated from
+ * then on from the node of the CPU whatever policy it was started with. The
+ * memory policy is best effort, its failure being only reported.
+ *
+ * @return 0 on success, -1 if the process could not be pinned
+ */
+int worker_pin(int cpu);
+
+/*
+ * @brief: mark a listening socket as the one of the worker of a CPU, for
+ * the reuseport lookup to prefer it for the connections received there
+ *
+ * @return 0 on success, -1 on error
+ */
+int worker_incoming_cpu(int sock, int cpu);
+
+/*
+ * @brief: attach to the reuseport group of sock a program choosing, for
+ * each connection, the socket of the worker pinned to the CPU which
+ * received its packets. The sockets of the group must have been bound in
+ * the order of the workers.
+ *
+ * @return 0 on success, -1 on error
+ */
+int worker_steer(int sock, const int *cpus, size_t nb_workers);
+
+#endif /*!WORKER_H*/
@@ -1,5 +1,6 @@
 #include "arguments.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -14,6 +15,8 @@ static struct args *args_init(void)
     if (args)
     {
         args->dry = -1;
+        args->pack = -1;
+        args->replay = -1;
         args->daemon = -1;
         args->option = DEFAULT;
         args->config = NULL;
@@ -51,22 +54,40 @@ static int is_option(char *str)
 static void __parse_arguments(char *argv[], int *i, struct args **args)
 {
     int dry = (*args)->dry;
+    int pack = (*args)->pack;
+    int replay = (*args)->replay;
     int daemon = (*args)->daemon;
     enum my_options option = (*args)->option;
     char *config = (*args)->config;
 
     int isopt = is_option(argv[*i]);
 
+    bool mode = dry > 0 || pack > 0 || replay > 0;
     if (!strcmp(argv[*i], "--dry-run"))
     {
-        if (dry > 0 || daemon > 0 || option != DEFAULT || config)
+        if (mode || daemon > 0 || option != DEFAULT || config)
             *i = -1;
         else
             (*args)->dry = 1;
     }
+    else if (!strcmp(argv[*i], "--pack"))
+    {
+        if (mode || daemon > 0 || option != DEFAULT || config)
+            *i = -1;
+        else
+            (*args)->pack = 1;
+    }
+    else if (!strcmp(argv[*i], "--replay"))
+    {
+        if (mode || daemon > 0 || option != DEFAULT || config)
+            *i = -1;
+        else
+            (*args)->replay = 1;
+    }
     else if (!strcmp(argv[*i], "-a"))
     {
-        if (daemon > 0 || option != DEFAULT || config)
+        if (daemon > 0 || pack > 0 || replay > 0 || option != DEFAULT
+            || config)
             *i = -1;
         else
             (*args)->daemon = 1;
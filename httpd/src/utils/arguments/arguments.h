@@ -11,9 +11,17 @@ enum my_options
     RESTART
 };
 
+/*
+ * @param pack: pack the root_dir of the vhosts having a bundle instead of
+ * serving them
+ * @param replay: send the capture_file of the configuration to the server
+ * instead of serving it
+ */
 struct args
 {
     int dry;
+    int pack;
+    int replay;
     int daemon;
     enum my_options option;
     char *config;
@@ -0,0 +1,120 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+static int capture_fd = -1;
+static size_t sample = CAPTURE_DEFAULT_SAMPLE;
+
+static uint32_t count = 0;
+static struct capture_state current = { 0, false, 0 };
+
+static char buffer[CAPTURE_BUFFER];
+static size_t used = 0;
+static time_t first_held = 0;
+
+int capture_init(const char *path, size_t capture_sample)
+{
+    sample = capture_sample ? capture_sample : CAPTURE_DEFAULT_SAMPLE;
+    if (!path)
+        return 0;
+    capture_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (capture_fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+void capture_connection(uint16_t port)
+{
+    current.number = ++count;
+    current.sampled = capture_fd >= 0 && count % sample == 0;
+    current.port = port;
+}
+
+/*
+ * @brief: write the buffers at once, for the records of the processes not
+ * to be interleaved
+ */
+static void write_records(struct iovec *iov, int iovcnt, size_t len)
+{
+    ssize_t n;
+    do
+        n = writev(capture_fd, iov, iovcnt);
+    while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)len)
+    {
+        perror("capture file, capture stopped");
+        close(capture_fd);
+        capture_fd = -1;
+        current.sampled = false;
+    }
+}
+
+static void flush(void)
+{
+    struct iovec iov = { .iov_base = buffer, .iov_len = used };
+    if (used && capture_fd >= 0)
+        write_records(&iov, 1, used);
+    used = 0;
+}
+
+void capture_data(const void *data, size_t len)
+{
+    if (!current.sampled || capture_fd < 0)
+        return;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    struct capture_record record = { 0 };
+    record.magic = CAPTURE_MAGIC;
+    record.len = len;
+    record.port = current.port;
+    record.connection = (uint64_t)getpid() << 32 | current.number;
+    record.time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    if (used && (used + sizeof(record) + len > sizeof(buffer)
+                 || ts.tv_sec - first_held >= CAPTURE_FLUSH))
+        flush();
+    if (sizeof(record) + len > sizeof(buffer))
+    {
+        struct iovec iov[2] = { { .iov_base = &record,
+                                  .iov_len = sizeof(record) },
+                                { .iov_base = (void *)data, .iov_len = len } };
+        write_records(iov, 2, sizeof(record) + len);
+        return;
+    }
+    if (!used)
+        first_held = ts.tv_sec;
+    memcpy(buffer + used, &record, sizeof(record));
+    memcpy(buffer + used + sizeof(record), data, len);
+    used += sizeof(record) + len;
+}
+
+void capture_suspend(struct capture_state *state)
+{
+    *state = current;
+    current.sampled = false;
+}
+
+void capture_resume(const struct capture_state *state)
+{
+    current = *state;
+}
+
+void capture_destroy(void)
+{
+    flush();
+    if (capture_fd >= 0)
+        close(capture_fd);
+    capture_fd = -1;
+    current.sampled = false;
+}
@@ -0,0 +1,110 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * One connection of CAPTURE_DEFAULT_SAMPLE is recorded when the
+ * configuration sets no capture_sample
+ */
+#define CAPTURE_DEFAULT_SAMPLE 1
+
+/*
+ * First field of each record, "HTCP" in the byte order of the server
+ */
+#define CAPTURE_MAGIC 0x48544350
+
+/*
+ * Bytes of records a process holds before writing them, and seconds it
+ * holds the first of them at most
+ */
+#define CAPTURE_BUFFER (64UL << 10)
+#define CAPTURE_FLUSH 1
+
+/*
+ * @brief: the bytes of one read from a client, as written to the capture
+ * file, followed by them
+ *
+ * @param len: the number of bytes following the record
+ * @param port: the local port of the listener the client connected to
+ * @param connection: the pid of the process then the number of the
+ * connection in it, in the high and low 32 bits
+ * @param time: CLOCK_REALTIME of the read, in nanoseconds
+ */
+struct capture_record
+{
+    uint32_t magic;
+    uint32_t len;
+    uint16_t port;
+    uint16_t reserved[3];
+    uint64_t connection;
+    uint64_t time;
+};
+
+/*
+ * @brief: the connection whose reads are being captured
+ *
+ * @param number: the number of the connection in its process
+ * @param port: the local port of the listener it connected to
+ */
+struct capture_state
+{
+    uint32_t number;
+    bool sampled;
+    uint16_t port;
+};
+
+/*
+ * @brief: open the capture file, to which what is read from one connection
+ * out of sample is appended. The processes forked afterwards share it,
+ * each writing whole records.
+ *
+ * @param path: the capture file, NULL to capture nothing
+ * @param sample: 0 for CAPTURE_DEFAULT_SAMPLE
+ *
+ * @return 0 on success, -1 on error
+ */
+int capture_init(const char *path, size_t sample);
+
+/*
+ * @brief: start a connection accepted on a listener, deciding whether it is
+ * sampled
+ */
+void capture_connection(uint16_t port);
+
+/*
+ * @brief: record bytes read from the current connection if it is sampled
+ */
+void capture_data(const void *data, size_t len);
+
+/*
+ * @brief: set the current connection aside while it waits, for the reads of
+ * another one to be captured meanwhile
+ */
+void capture_suspend(struct capture_state *state);
+
+/*
+ * @brief: make a connection set aside the current one again
+ */
+void capture_resume(const struct capture_state *state);
+
+/*
+ * @brief: write the records held and close the capture file
+ */
+void capture_destroy(void);
+
+/*
+ * @brief: connect to 127.0.0.1 on the port of each captured connection and
+ * send what it sent, each read at the time it was recorded, keeping the
+ * connections open until the server closes them
+ *
+ * @param speed: how many times faster than recorded, 0 for the recorded
+ * speed
+ *
+ * @return 0 on success, -1 if the capture could not be read
+ */
+int capture_replay(const char *path, size_t speed);
+
+#endif /*!CAPTURE_H*/
@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+/*
+ * Seconds without news from the server after the last read was sent, after
+ * which the connections still open are cut
+ */
+#define REPLAY_IDLE 5
+
+#define NONE ((size_t)-1)
+
+/*
+ * @brief: a recorded read, in the order of the capture
+ *
+ * @param data: the bytes read, in the mapped capture
+ * @param client: the index of its connection
+ * @param next: the next read of the same connection, NONE for the last
+ */
+struct event
+{
+    uint64_t time;
+    uint64_t connection;
+    uint16_t port;
+    const char *data;
+    size_t len;
+    size_t order;
+    size_t client;
+    size_t next;
+};
+
+/*
+ * @brief: a captured connection being replayed
+ *
+ * @param fd: the socket, -1 before it is connected and once it is closed
+ * @param current: the read being sent, NONE once every read was
+ * @param sent: the bytes of the current read already sent
+ * @param released: the reads whose time came, sent or not
+ * @param done: the reads sent
+ */
+struct client
+{
+    uint64_t connection;
+    uint16_t port;
+    int fd;
+    bool started;
+    size_t current;
+    size_t last;
+    size_t sent;
+    size_t released;
+    size_t done;
+};
+
+struct replay
+{
+    struct event *events;
+    size_t nb_events;
+    struct client *clients;
+    size_t nb_clients;
+    size_t open;
+    size_t failed;
+    size_t cut;
+    size_t bytes_sent;
+    size_t bytes_received;
+};
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int earlier(const void *a, const void *b)
+{
+    const struct event *x = a;
+    const struct event *y = b;
+    if (x->time != y->time)
+        return (x->time > y->time) - (x->time < y->time);
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+/*
+ * @brief: read the records of the mapped capture into events sorted by time
+ *
+ * @return 0 on success, -1 if the capture is corrupted
+ */
+static int load(struct replay *replay, const char *data, size_t size)
+{
+    size_t capacity = 0;
+    size_t offset = 0;
+    while (offset < size)
+    {
+        struct capture_record record;
+        if (size - offset < sizeof(record))
+            break;
+        memcpy(&record, data + offset, sizeof(record));
+        offset += sizeof(record);
+        if (record.magic != CAPTURE_MAGIC || record.len > size - offset)
+        {
+            fprintf(stderr, "capture corrupted at byte %zu\n",
+                    offset - sizeof(record));
+            return -1;
+        }
+        if (replay->nb_events == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 1024;
+            struct event *events =
+                realloc(replay->events, capacity * sizeof(struct event));
+            if (!events)
+                return -1;
+            replay->events = events;
+        }
+        struct event *event = &replay->events[replay->nb_events];
+        event->time = record.time;
+        event->connection = record.connection;
+        event->port = record.port;
+        event->data = data + offset;
+        event->len = record.len;
+        event->order = replay->nb_events++;
+        event->next = NONE;
+        offset += record.len;
+    }
+    if (offset != size)
+    {
+        fprintf(stderr, "capture cut at byte %zu\n", offset);
+        return -1;
+    }
+    qsort(replay->events, replay->nb_events, sizeof(struct event), earlier);
+    return 0;
+}
+
+/*
+ * @brief: gather the events of each connection into a client, chaining
+ * them in their order
+ *
+ * @return 0 on success, -1 on error
+ */
+static int link_clients(struct replay *replay)
+{
+    size_t nb_slots = 1;
+    while (nb_slots < 2 * replay->nb_events)
+        nb_slots <<= 1;
+    size_t *slots = malloc(nb_slots * sizeof(size_t));
+    replay->clients = malloc(replay->nb_events * sizeof(struct client));
+    if (!slots || !replay->clients)
+    {
+        free(slots);
+        return -1;
+    }
+    memset(slots, 0xff, nb_slots * sizeof(size_t));
+    for (size_t i = 0; i < replay->nb_events; i++)
+    {
+        struct event *event = &replay->events[i];
+        size_t slot =
+            (event->connection * 0x9e3779b97f4a7c15) & (nb_slots - 1);
+        while (slots[slot] != NONE
+               && replay->clients[slots[slot]].connection != event->connection)
+            slot = (slot + 1) & (nb_slots - 1);
+        if (slots[slot] == NONE)
+        {
+            slots[slot] = replay->nb_clients;
+            struct client *client = &replay->clients[replay->nb_clients++];
+            memset(client, 0, sizeof(*client));
+            client->connection = event->connection;
+            client->port = event->port;
+            client->fd = -1;
+            client->current = i;
+            client->last = i;
+        }
+        else
+            replay->events[replay->clients[slots[slot]].last].next = i;
+        event->client = slots[slot];
+        replay->clients[slots[slot]].last = i;
+    }
+    free(slots);
+    return 0;
+}
+
+static void start(struct replay *replay, struct client *client)
+{
+    client->started = true;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(client->port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        replay->failed++;
+        client->current = NONE;
+        return;
+    }
+    client->fd = fd;
+    replay->open++;
+}
+
+static void stop(struct replay *replay, struct client *client)
+{
+    if (client->current != NONE)
+        replay->cut++;
+    close(client->fd);
+    client->fd = -1;
+    client->current = NONE;
+    replay->open--;
+}
+
+/*
+ * @brief: send what the socket takes of the released reads of a client
+ */
+static void send_released(struct replay *replay, struct client *client)
+{
+    while (client->current != NONE && client->done < client->released)
+    {
+        const struct event *event = &replay->events[client->current];
+        ssize_t n = send(client->fd, event->data + client->sent,
+                         event->len - client->sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            return;
+        if (n < 0)
+        {
+            stop(replay, client);
+            return;
+        }
+        replay->bytes_sent += n;
+        client->sent += n;
+        if (client->sent == event->len)
+        {
+            client->current = event->next;
+            client->sent = 0;
+            client->done++;
+        }
+    }
+}
+
+static void receive(struct replay *replay, struct client *client)
+{
+    char discard[16384];
+    ssize_t n;
+    while ((n = recv(client->fd, discard, sizeof(discard), 0)) > 0)
+        replay->bytes_received += n;
+    if (!n || (errno != EAGAIN && errno != EINTR))
+        stop(replay, client);
+}
+
+/*
+ * @brief: release the reads as their time comes, and move the bytes of the
+ * connections until the server closed them all
+ */
+static int run(struct replay *replay, size_t speed)
+{
+    struct pollfd *fds = malloc(replay->nb_clients * sizeof(struct pollfd));
+    size_t *polled = malloc(replay->nb_clients * sizeof(size_t));
+    if (!fds || !polled)
+    {
+        free(fds);
+        free(polled);
+        return -1;
+    }
+    uint64_t first = replay->events[0].time;
+    uint64_t begin = now();
+    size_t cursor = 0;
+    while (cursor < replay->nb_events || replay->open)
+    {
+        uint64_t elapsed = (now() - begin) * speed;
+        for (; cursor < replay->nb_events
+             && replay->events[cursor].time - first <= elapsed;
+             cursor++)
+        {
+            struct client *client =
+                &replay->clients[replay->events[cursor].client];
+            if (!client->started)
+                start(replay, client);
+            client->released++;
+            if (client->fd >= 0)
+                send_released(replay, client);
+        }
+        size_t nb = 0;
+        for (size_t i = 0; i < replay->nb_clients; i++)
+        {
+            struct client *client = &replay->clients[i];
+            if (client->fd < 0)
+                continue;
+            fds[nb].fd = client->fd;
+            fds[nb].events = POLLIN;
+            if (client->current != NONE && client->done < client->released)
+                fds[nb].events |= POLLOUT;
+            polled[nb++] = i;
+        }
+        int timeout = REPLAY_IDLE * 1000;
+        if (cursor < replay->nb_events)
+        {
+            uint64_t due = replay->events[cursor].time - first;
+            elapsed = (now() - begin) * speed;
+            timeout = due > elapsed ? (due - elapsed) / speed / 1000000 : 0;
+        }
+        int ready = poll(fds, nb, timeout);
+        if (!ready && cursor == replay->nb_events)
+        {
+            for (size_t i = 0; i < nb; i++)
+                stop(replay, &replay->clients[polled[i]]);
+            break;
+        }
+        for (size_t i = 0; ready > 0 && i < nb; i++)
+        {
+            struct client *client = &replay->clients[polled[i]];
+            if (fds[i].revents & POLLOUT)
+                send_released(replay, client);
+            if (client->fd >= 0
+                && fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                receive(replay, client);
+        }
+    }
+    free(fds);
+    free(polled);
+    return 0;
+}
+
+int capture_replay(const char *path, size_t speed)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat statbuf;
+    if (fd < 0 || fstat(fd, &statbuf) < 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    size_t size = statbuf.st_size;
+    const char *data = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                            : NULL;
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    struct replay replay;
+    memset(&replay, 0, sizeof(replay));
+    int err = load(&replay, data, size);
+    if (!err && replay.nb_events)
+        err = link_clients(&replay);
+    uint64_t begin = now();
+    if (!err && replay.nb_events)
+        err = run(&replay, speed ? speed : 1);
+    if (!err)
+        printf("%zu connections, %zu reads replayed in %.3f s: %zu bytes "
+               "sent, %zu received, %zu connections failed, %zu cut\n",
+               replay.nb_clients, replay.nb_events,
+               (now() - begin) / 1e9, replay.bytes_sent,
+               replay.bytes_received, replay.failed, replay.cut);
+    free(replay.events);
+    free(replay.clients);
+    if (data)
+        munmap((void *)data, size);
+    return err;
+}
@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <criterion/criterion.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../../server/server.h"
+#include "../capture.h"
+
+TestSuite(capture);
+
+static const char *requests[] = { "GET /a HTTP/1.1\r\nHost: x\r\n\r\n",
+                                  "GET /b HTTP/1.1\r\nHost: x\r\n\r\n" };
+
+/*
+ * Accept the replayed connections on a loopback listener, writing the
+ * request each of them sent to out
+ */
+static pid_t listener_start(uint16_t *port, int out)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    cr_assert(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    cr_assert(listen(sock, 8) == 0);
+    cr_assert(getsockname(sock, (struct sockaddr *)&addr, &len) == 0);
+    *port = ntohs(addr.sin_port);
+    pid_t pid = fork();
+    if (!pid)
+    {
+        for (size_t i = 0; i < 2; i++)
+        {
+            int fd = accept(sock, NULL, NULL);
+            char buf[256];
+            size_t n = 0;
+            ssize_t r;
+            while (!memmem(buf, n, "\r\n\r\n", 4)
+                   && (r = recv(fd, buf + n, sizeof(buf) - n, 0)) > 0)
+                n += r;
+            if (write(out, buf, n) != (ssize_t)n)
+                _exit(1);
+            close(fd);
+        }
+        _exit(0);
+    }
+    close(sock);
+    return pid;
+}
+
+Test(capture, replay_on_loopback)
+{
+    int out[2];
+    cr_assert(pipe(out) == 0);
+    uint16_t port;
+    pid_t pid = listener_start(&port, out[1]);
+    close(out[1]);
+
+    char capture[] = "/tmp/capture_testXXXXXX";
+    int fd = mkstemp(capture);
+    cr_assert(fd >= 0);
+    close(fd);
+    cr_assert_eq(capture_init(capture, 1), 0);
+    for (size_t i = 0; i < 2; i++)
+    {
+        capture_connection(port);
+        // Split as read, the second read of the connection replayed after
+        capture_data(requests[i], 10);
+        capture_data(requests[i] + 10, strlen(requests[i]) - 10);
+    }
+    capture_destroy();
+
+    char path[] = "/tmp/capture_cfgXXXXXX";
+    fd = mkstemp(path);
+    cr_assert(fd >= 0);
+    dprintf(fd, "[global]\npid_file = p\ncapture_file = %s\n"
+                "replay_speed = 100\n[[vhosts]]\nserver_name = a\n"
+                "port = %u\nip = 127.0.0.1\nroot_dir = /tmp\n",
+            capture, port);
+    close(fd);
+    struct config *config = parse_configuration(path);
+    cr_assert_not_null(config);
+    char *argv[] = { "httpd", "--replay", path };
+    struct args *args = parse_arguments(3, argv);
+    cr_assert(args->valid);
+    cr_assert_eq(tool_launch(args, config), 0);
+    args_destroy(args);
+    config_destroy(config);
+
+    int status;
+    cr_assert_eq(waitpid(pid, &status, 0), pid);
+    cr_assert(WIFEXITED(status) && !WEXITSTATUS(status));
+    char received[512] = { 0 };
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(out[0], received + len, sizeof(received) - 1 - len)) > 0)
+        len += n;
+    close(out[0]);
+    cr_assert_eq(len, strlen(requests[0]) + strlen(requests[1]));
+    cr_assert_not_null(strstr(received, requests[0]));
+    cr_assert_not_null(strstr(received, requests[1]));
+    unlink(capture);
+    unlink(path);
+}
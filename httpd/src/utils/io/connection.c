@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+
+#include "connection.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "io.h"
+
+void connection_init(struct connection *conn, int fd)
+{
+    conn->fd = fd;
+    conn->ssl = NULL;
+    conn->ktls_send = false;
+    conn->ktls_recv = false;
+    conn->peer.ss_family = AF_UNSPEC;
+}
+
+int connection_start_tls(struct connection *conn, int fd, SSL_CTX *ctx)
+{
+    connection_init(conn, fd);
+    conn->ssl = SSL_new(ctx);
+    if (!conn->ssl)
+        return -1;
+    if (!SSL_set_fd(conn->ssl, fd))
+    {
+        SSL_free(conn->ssl);
+        conn->ssl = NULL;
+        return -1;
+    }
+    SSL_set_accept_state(conn->ssl);
+    return 0;
+}
+
+int connection_handshake(struct connection *conn)
+{
+    int ret = SSL_do_handshake(conn->ssl);
+    if (ret != 1)
+    {
+        int err = SSL_get_error(conn->ssl, ret);
+        if (err == SSL_ERROR_WANT_READ)
+            return POLLIN;
+        if (err == SSL_ERROR_WANT_WRITE)
+            return POLLOUT;
+        return -1;
+    }
+    conn->ktls_send = BIO_get_ktls_send(SSL_get_wbio(conn->ssl));
+    conn->ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(conn->ssl));
+    return 0;
+}
+
+ssize_t connection_recv(struct connection *conn, void *buf, size_t len)
+{
+    if (!conn->ssl)
+        return recv(conn->fd, buf, len, 0);
+    int n = SSL_read(conn->ssl, buf, len > INT_MAX ? INT_MAX : len);
+    if (n > 0)
+        return n;
+    int err = SSL_get_error(conn->ssl, n);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+        errno = EAGAIN;
+    return err == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+}
+
+int connection_pending(struct connection *conn)
+{
+    return conn->ssl && SSL_has_pending(conn->ssl);
+}
+
+/*
+ * @brief: encrypt and send the whole buffer, SSL_write() only returning
+ * once all of its input is written
+ */
+static int ssl_send_all(SSL *ssl, const char *buf, size_t len)
+{
+    while (len)
+    {
+        int n = SSL_write(ssl, buf, len > INT_MAX ? INT_MAX : len);
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int connection_send(struct connection *conn, const void *buf, size_t len)
+{
+    if (!conn->ssl || conn->ktls_send)
+        return send_all(conn->fd, buf, len);
+    return ssl_send_all(conn->ssl, buf, len);
+}
+
+ssize_t connection_send_some(struct connection *conn, const void *buf,
+                             size_t len)
+{
+    if (!conn->ssl || conn->ktls_send)
+    {
+        ssize_t n;
+        do
+            n = send(conn->fd, buf, len, MSG_NOSIGNAL);
+        while (n < 0 && errno == EINTR);
+        return n < 0 && errno == EAGAIN ? 0 : n;
+    }
+    int n = SSL_write(conn->ssl, buf, len > INT_MAX ? INT_MAX : len);
+    if (n > 0)
+        return n;
+    int err = SSL_get_error(conn->ssl, n);
+    return err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ ? 0 : -1;
+}
+
+int connection_sendv(struct connection *conn, struct iovec *iov, int iovcnt)
+{
+    if (!conn->ssl || conn->ktls_send)
+        return sendv_all(conn->fd, iov, iovcnt);
+    char record[CONNECTION_RECORD_SIZE];
+    size_t used = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        const char *data = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        if (!used && len >= sizeof(record))
+        {
+            if (ssl_send_all(conn->ssl, data, len) < 0)
+                return -1;
+            continue;
+        }
+        while (len)
+        {
+            size_t n = sizeof(record) - used;
+            n = len < n ? len : n;
+            memcpy(record + used, data, n);
+            used += n;
+            data += n;
+            len -= n;
+            if (used == sizeof(record))
+            {
+                if (ssl_send_all(conn->ssl, record, used) < 0)
+                    return -1;
+                used = 0;
+            }
+        }
+    }
+    return ssl_send_all(conn->ssl, record, used);
+}
+
+static int send_file(int sock, const void *head, size_t head_len, int fd,
+                     off_t *offset, size_t len)
+{
+    const char *data = head;
+    while (head_len)
+    {
+        ssize_t n = send(sock, data, head_len, MSG_MORE | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        head_len -= n;
+    }
+    while (len)
+    {
+        ssize_t n = sendfile(sock, fd, offset, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+int connection_sendfile(struct connection *conn, const void *head,
+                        size_t head_len, int fd, off_t *offset, size_t len)
+{
+    if (!conn->ssl || conn->ktls_send)
+        return send_file(conn->fd, head, head_len, fd, offset, len);
+    char record[CONNECTION_RECORD_SIZE];
+    size_t used = 0;
+    if (head_len >= sizeof(record))
+    {
+        if (ssl_send_all(conn->ssl, head, head_len) < 0)
+            return -1;
+    }
+    else if (head_len)
+    {
+        memcpy(record, head, head_len);
+        used = head_len;
+    }
+    while (len)
+    {
+        size_t want = sizeof(record) - used;
+        ssize_t n = pread(fd, record + used, len < want ? len : want, *offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0 || ssl_send_all(conn->ssl, record, used + n) < 0)
+            return -1;
+        *offset += n;
+        len -= n;
+        used = 0;
+    }
+    return used ? ssl_send_all(conn->ssl, record, used) : 0;
+}
+
+ssize_t connection_sendfile_some(struct connection *conn, const void *head,
+                                 size_t head_len, int fd, off_t *offset,
+                                 size_t len)
+{
+    const char *data = head;
+    size_t sent = 0;
+    while (sent < head_len)
+    {
+        ssize_t n = send(conn->fd, data + sent, head_len - sent,
+                         MSG_MORE | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            return sent;
+        if (n <= 0)
+            return -1;
+        sent += n;
+    }
+    while (len)
+    {
+        ssize_t n = sendfile(conn->fd, fd, offset, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            break;
+        if (n <= 0)
+            return -1;
+        sent += n;
+        len -= n;
+    }
+    return sent;
+}
+
+ssize_t connection_splice_in(struct connection *conn, int out,
+                             int pipefd[2], size_t len)
+{
+    if (!conn->ssl || conn->ktls_recv)
+        return splice_all(conn->fd, out, pipefd, len);
+    char record[CONNECTION_RECORD_SIZE];
+    size_t total = 0;
+    while (total < len)
+    {
+        size_t want = len - total;
+        ssize_t n = connection_recv(conn, record,
+                                    want < sizeof(record) ? want
+                                                          : sizeof(record));
+        if (n < 0)
+            return -1;
+        if (!n)
+            break;
+        if (write_all(out, record, n) < 0)
+            return -1;
+        total += n;
+    }
+    return total;
+}
+
+ssize_t connection_splice_in_some(struct connection *conn, int out,
+                                  int pipefd[2], size_t len)
+{
+    if (!conn->ssl || conn->ktls_recv)
+        return splice_some(conn->fd, out, pipefd, len);
+    char record[CONNECTION_RECORD_SIZE];
+    ssize_t n = connection_recv(conn, record,
+                                len < sizeof(record) ? len : sizeof(record));
+    if (n > 0 && write_all(out, record, n) < 0)
+        return -1;
+    return n;
+}
+
+ssize_t connection_splice_out(struct connection *conn, int in, int pipefd[2],
+                              size_t len)
+{
+    if (!conn->ssl || conn->ktls_send)
+        return splice_all(in, conn->fd, pipefd, len);
+    char record[CONNECTION_RECORD_SIZE];
+    size_t total = 0;
+    while (total < len)
+    {
+        size_t want = len - total;
+        ssize_t n = read(in, record, want < sizeof(record) ? want
+                                                           : sizeof(record));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (!n)
+            break;
+        if (ssl_send_all(conn->ssl, record, n) < 0)
+            return -1;
+        total += n;
+    }
+    return total;
+}
+
+void connection_close(struct connection *conn)
+{
+    if (conn->ssl)
+    {
+        SSL_shutdown(conn->ssl);
+        SSL_free(conn->ssl);
+        conn->ssl = NULL;
+    }
+    close(conn->fd);
+}
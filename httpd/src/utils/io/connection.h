@@ -0,0 +1,155 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <openssl/ssl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Largest TLS record payload, the size of the buffers the user-space
+ * encryption path goes through
+ */
+#define CONNECTION_RECORD_SIZE 16384
+
+/*
+ * @brief: a client connection, in plaintext or over TLS
+ *
+ * @param fd: the client socket
+ * @param ssl: the TLS session, NULL in plaintext
+ * @param ktls_send: the kernel encrypts what is written to the socket, so
+ * send() and sendfile() work on it as in plaintext
+ * @param ktls_recv: the kernel decrypts what is read from the socket, so
+ * splice() works on it as in plaintext
+ * @param peer: the address of the client, AF_UNSPEC when unknown
+ */
+struct connection
+{
+    int fd;
+    SSL *ssl;
+    bool ktls_send;
+    bool ktls_recv;
+    struct sockaddr_storage peer;
+};
+
+/*
+ * @brief: set up a plaintext connection on a socket
+ */
+void connection_init(struct connection *conn, int fd);
+
+/*
+ * @brief: set up a TLS connection on a socket, its handshake being run by
+ * connection_handshake()
+ *
+ * @return 0 on success, -1 on error, the socket being left open
+ */
+int connection_start_tls(struct connection *conn, int fd, SSL_CTX *ctx);
+
+/*
+ * @brief: go on with the server side of the TLS handshake as far as the
+ * socket allows, then let the kernel take over the encryption if the
+ * session keys could be moved into kernel TLS
+ *
+ * @return 0 once it is done, POLLIN or POLLOUT if it waits for the socket
+ * to be readable or writable, -1 on error
+ */
+int connection_handshake(struct connection *conn);
+
+/*
+ * @brief: read up to len bytes, like recv(), errno being EAGAIN when a
+ * non-blocking socket has nothing to give
+ */
+ssize_t connection_recv(struct connection *conn, void *buf, size_t len);
+
+/*
+ * @brief: return 1 if bytes were received and decrypted but not read yet,
+ * poll() not seeing them on the socket
+ */
+int connection_pending(struct connection *conn);
+
+/*
+ * @brief: send the whole buffer
+ *
+ * @return 0 on success, -1 on error
+ */
+int connection_send(struct connection *conn, const void *buf, size_t len);
+
+/*
+ * @brief: send what a non-blocking socket takes of the buffer, without
+ * waiting for it to drain. Over TLS, a buffer not taken must be given again
+ * at the same address, and may only have grown.
+ *
+ * @return the number of bytes sent, 0 if the socket is full, -1 on error
+ */
+ssize_t connection_send_some(struct connection *conn, const void *buf,
+                             size_t len);
+
+/*
+ * @brief: send the buffers of iov in a single gathered write, or in as few
+ * TLS records as possible. The iov array is consumed.
+ *
+ * @return 0 on success, -1 on error
+ */
+int connection_sendv(struct connection *conn, struct iovec *iov, int iovcnt);
+
+/*
+ * @brief: send head then len bytes of a file from offset, advancing offset.
+ * The file goes to the socket with sendfile() in plaintext and with kernel
+ * TLS, through a buffer and SSL_write() otherwise, head sharing the first
+ * record.
+ *
+ * @return 0 on success, -1 on error
+ */
+int connection_sendfile(struct connection *conn, const void *head,
+                        size_t head_len, int fd, off_t *offset, size_t len);
+
+/*
+ * @brief: send what the socket takes of head then of len bytes of a file
+ * from offset, advancing offset, without waiting for it to drain. Only for
+ * a non-blocking socket the kernel sees the plaintext of.
+ *
+ * @return the number of bytes sent, 0 if the socket is full, -1 on error
+ */
+ssize_t connection_sendfile_some(struct connection *conn, const void *head,
+                                 size_t head_len, int fd, off_t *offset,
+                                 size_t len);
+
+/*
+ * @brief: move up to len bytes received on the connection to out, with
+ * splice() when the kernel sees the plaintext
+ *
+ * @return the number of bytes moved, less than len if the client closed the
+ * connection, -1 on error
+ */
+ssize_t connection_splice_in(struct connection *conn, int out,
+                             int pipefd[2], size_t len);
+
+/*
+ * @brief: move what a non-blocking socket has of up to len bytes received
+ * on the connection to out, with splice() when the kernel sees the
+ * plaintext, a TLS record at most otherwise
+ *
+ * @return the number of bytes moved, 0 if the client closed the connection,
+ * -1 on error, errno being EAGAIN when nothing was received
+ */
+ssize_t connection_splice_in_some(struct connection *conn, int out,
+                                  int pipefd[2], size_t len);
+
+/*
+ * @brief: send up to len bytes read from in on the connection, with
+ * splice() when the kernel sees the plaintext
+ *
+ * @return the number of bytes moved, less than len if in reached its end,
+ * -1 on error
+ */
+ssize_t connection_splice_out(struct connection *conn, int in, int pipefd[2],
+                              size_t len);
+
+/*
+ * @brief: end the TLS session if any and close the socket
+ */
+void connection_close(struct connection *conn);
+
+#endif /*!CONNECTION_H*/
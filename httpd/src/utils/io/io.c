@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+
+#include "io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int write_all(int fd, const void *buf, size_t len)
+{
+    const char *data = buf;
+    while (len)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int send_all(int fd, const void *buf, size_t len)
+{
+    const char *data = buf;
+    while (len)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int sendv_all(int fd, struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+    while (msg.msg_iovlen)
+    {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        while (msg.msg_iovlen && (size_t)n >= msg.msg_iov->iov_len)
+        {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen)
+        {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int io_pipe(int pipefd[2])
+{
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+        return -1;
+    fcntl(pipefd[1], F_SETPIPE_SZ, IO_PIPE_SIZE);
+    return 0;
+}
+
+/*
+ * @brief: move n bytes from the pipe to out
+ */
+static int drain_pipe(int pipe_out, int out, size_t n)
+{
+    while (n)
+    {
+        ssize_t moved =
+            splice(pipe_out, NULL, out, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (moved < 0 && errno == EINTR)
+            continue;
+        if (moved <= 0)
+            return -1;
+        n -= moved;
+    }
+    return 0;
+}
+
+ssize_t splice_all(int in, int out, int pipefd[2], size_t len)
+{
+    size_t total = 0;
+    while (total < len)
+    {
+        size_t chunk = len - total;
+        if (chunk > IO_PIPE_SIZE)
+            chunk = IO_PIPE_SIZE;
+        ssize_t n = splice(in, NULL, pipefd[1], NULL, chunk,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (!n)
+            break;
+        if (drain_pipe(pipefd[0], out, n) < 0)
+            return -1;
+        total += n;
+    }
+    return total;
+}
+
+ssize_t splice_some(int in, int out, int pipefd[2], size_t len)
+{
+    if (len > IO_PIPE_SIZE)
+        len = IO_PIPE_SIZE;
+    ssize_t n;
+    do
+        n = splice(in, NULL, pipefd[1], NULL, len,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    while (n < 0 && errno == EINTR);
+    if (n > 0 && drain_pipe(pipefd[0], out, n) < 0)
+        return -1;
+    return n;
+}
@@ -0,0 +1,64 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Size requested for the pipes used to splice() data between descriptors
+ */
+#define IO_PIPE_SIZE (1 << 20)
+
+/*
+ * @brief: write the whole buffer to fd, retrying on short writes
+ *
+ * @return 0 on success, -1 on error
+ */
+int write_all(int fd, const void *buf, size_t len);
+
+/*
+ * @brief: send the whole buffer on a socket, without raising SIGPIPE
+ *
+ * @return 0 on success, -1 on error
+ */
+int send_all(int fd, const void *buf, size_t len);
+
+/*
+ * @brief: send the buffers of iov on a socket in a single gathered write,
+ * retrying on short writes, without raising SIGPIPE. The iov array is
+ * consumed and must not be reused.
+ *
+ * @return 0 on success, -1 on error
+ */
+int sendv_all(int fd, struct iovec *iov, int iovcnt);
+
+/*
+ * @brief: create a pipe for splice_all(), as large as IO_PIPE_SIZE if the
+ * system allows it
+ *
+ * @return 0 on success, -1 on error
+ */
+int io_pipe(int pipefd[2]);
+
+/*
+ * @brief: move up to len bytes from in to out through the pipe, without
+ * copying them in user space. The pipe is empty again when this returns
+ * anything but -1.
+ *
+ * @return the number of bytes moved, less than len if in reached its end,
+ * -1 on error
+ */
+ssize_t splice_all(int in, int out, int pipefd[2], size_t len);
+
+/*
+ * @brief: move what a non-blocking in has of up to len bytes to out through
+ * the empty pipe, without waiting for more. The pipe is empty again when
+ * this returns anything but -1.
+ *
+ * @return the number of bytes moved, 0 if in reached its end, -1 on error,
+ * errno being EAGAIN when in has nothing to give
+ */
+ssize_t splice_some(int in, int out, int pipefd[2], size_t len);
+
+#endif /*!IO_H*/
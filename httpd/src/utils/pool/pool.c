@@ -0,0 +1,52 @@
+#include "pool.h"
+
+#include <stdlib.h>
+
+static struct pool_buffer *free_buffers = NULL;
+static size_t nb_free = 0;
+
+struct pool_buffer *pool_take(void)
+{
+    struct pool_buffer *buffer = free_buffers;
+    if (buffer)
+    {
+        free_buffers = buffer->next;
+        nb_free--;
+    }
+    else
+        buffer = malloc(sizeof(struct pool_buffer));
+    if (buffer)
+    {
+        buffer->next = NULL;
+        buffer->len = 0;
+    }
+    return buffer;
+}
+
+void pool_give(struct pool_buffer *chain)
+{
+    while (chain)
+    {
+        struct pool_buffer *next = chain->next;
+        if (nb_free < POOL_KEEP)
+        {
+            chain->next = free_buffers;
+            free_buffers = chain;
+            nb_free++;
+        }
+        else
+            free(chain);
+        chain = next;
+    }
+}
+
+void pool_destroy(void)
+{
+    while (free_buffers)
+    {
+        struct pool_buffer *next = free_buffers->next;
+        free(free_buffers);
+        free_buffers = next;
+    }
+    nb_free = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+ * Bytes of a buffer, a request head not fitting in one being received in a
+ * chain of them
+ */
+#define POOL_BUFFER_SIZE 4096
+
+/*
+ * Buffers a request head may take, beyond which it is cut
+ */
+#define POOL_CHAIN_MAX 16
+
+/*
+ * Free buffers kept for the next requests, the others being freed
+ */
+#define POOL_KEEP 64
+
+/*
+ * @brief: a buffer of the pool, chained to the next one of a request
+ *
+ * @param len: the bytes of data in use
+ */
+struct pool_buffer
+{
+    struct pool_buffer *next;
+    size_t len;
+    char data[POOL_BUFFER_SIZE];
+};
+
+/*
+ * @brief: take a free buffer, allocating one if there is none left
+ *
+ * @return the empty buffer, NULL on error
+ */
+struct pool_buffer *pool_take(void);
+
+/*
+ * @brief: give a chain of buffers back to the pool
+ */
+void pool_give(struct pool_buffer *chain);
+
+/*
+ * @brief: free the buffers kept by the pool
+ */
+void pool_destroy(void);
+
+#endif /*!POOL_H*/
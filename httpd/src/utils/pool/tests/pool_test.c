@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+
+#include <criterion/criterion.h>
+#include <malloc.h>
+#include <string.h>
+
+#include "../pool.h"
+
+TestSuite(pool);
+
+/*
+ * @return the bytes of the heap in use
+ */
+static size_t heap_used(void)
+{
+    return mallinfo2().uordblks;
+}
+
+Test(pool, given_back_then_taken)
+{
+    struct pool_buffer *first = pool_take();
+    cr_assert_not_null(first);
+    struct pool_buffer *second = pool_take();
+    cr_assert_not_null(second);
+    cr_assert_neq(first, second);
+    first->len = POOL_BUFFER_SIZE;
+    first->next = second;
+    second->len = 12;
+    pool_give(first);
+
+    // The free buffers come back last given first, emptied and unchained
+    struct pool_buffer *again = pool_take();
+    cr_assert_eq(again, second);
+    cr_assert_eq(again->len, 0);
+    cr_assert_null(again->next);
+    again->next = pool_take();
+    cr_assert_eq(again->next, first);
+    cr_assert_eq(again->next->len, 0);
+    pool_give(again);
+    pool_destroy();
+}
+
+Test(pool, taken_when_none_left)
+{
+    // Buffers are allocated once the free ones run out, with no limit
+    static struct pool_buffer *taken[2 * POOL_KEEP];
+    for (size_t i = 0; i < 2 * POOL_KEEP; i++)
+    {
+        taken[i] = pool_take();
+        cr_assert_not_null(taken[i]);
+        memset(taken[i]->data, 'a', POOL_BUFFER_SIZE);
+        for (size_t j = 0; j < i; j++)
+            cr_assert_neq(taken[i], taken[j]);
+    }
+    for (size_t i = 0; i < 2 * POOL_KEEP; i++)
+        pool_give(taken[i]);
+    pool_destroy();
+}
+
+Test(pool, keeps_at_most_pool_keep)
+{
+    size_t before = heap_used();
+    struct pool_buffer *chain = NULL;
+    for (size_t i = 0; i < POOL_KEEP + 8; i++)
+    {
+        struct pool_buffer *buffer = pool_take();
+        cr_assert_not_null(buffer);
+        buffer->next = chain;
+        chain = buffer;
+    }
+    pool_give(chain);
+
+    // The buffers beyond POOL_KEEP were freed, the others are kept
+    size_t kept = heap_used() - before;
+    cr_assert_geq(kept, POOL_KEEP * sizeof(struct pool_buffer));
+    cr_assert_lt(kept, (POOL_KEEP + 1) * sizeof(struct pool_buffer));
+    pool_destroy();
+    cr_assert_eq(heap_used(), before);
+}
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+
+#include "profile.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Innermost frames of each stack, which belong to the sampling: the handler
+ * and the signal trampoline
+ */
+#define PROFILE_SKIP 2
+
+/*
+ * Longest line written, the innermost frames of the deeper stacks being cut
+ */
+#define PROFILE_LINE 4096
+
+/*
+ * @param frames: the return addresses, innermost first, as backtrace()
+ * fills them
+ */
+struct sample
+{
+    size_t depth;
+    void *frames[PROFILE_DEPTH];
+};
+
+static int profile_fd = -1;
+static size_t frequency = PROFILE_DEFAULT_FREQUENCY;
+
+static bool running = false;
+static timer_t timer;
+static struct sigaction previous;
+
+/*
+ * Filled by the handler only, the other threads blocking every signal
+ */
+static struct sample *samples = NULL;
+static volatile size_t nb_samples = 0;
+
+int profile_init(const char *path, size_t profile_frequency)
+{
+    frequency = profile_frequency ? profile_frequency
+                                  : PROFILE_DEFAULT_FREQUENCY;
+    if (!path)
+        return 0;
+    profile_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (profile_fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static void take_sample(int signum)
+{
+    (void)signum;
+    int saved = errno;
+    size_t index = nb_samples++;
+    if (index < PROFILE_SAMPLES)
+        samples[index].depth = backtrace(samples[index].frames, PROFILE_DEPTH);
+    errno = saved;
+}
+
+static void start(void)
+{
+    samples = mmap(NULL, PROFILE_SAMPLES * sizeof(struct sample),
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (samples == MAP_FAILED)
+    {
+        samples = NULL;
+        perror("profile");
+        return;
+    }
+    // The first backtrace() loads the unwinder, which the handler must not
+    void *frame;
+    backtrace(&frame, 1);
+    nb_samples = 0;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = take_sample;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    long period = 1000000000L / frequency;
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = period / 1000000000L;
+    spec.it_interval.tv_nsec = period ? period % 1000000000L : 1;
+    spec.it_value = spec.it_interval;
+    // The CPU time of this thread only, the offload pool not being sampled
+    if (sigaction(SIGPROF, &sa, &previous) < 0
+        || timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) < 0)
+    {
+        perror("profile");
+        sigaction(SIGPROF, &previous, NULL);
+        munmap(samples, PROFILE_SAMPLES * sizeof(struct sample));
+        samples = NULL;
+        return;
+    }
+    if (timer_settime(timer, 0, &spec, NULL) < 0)
+    {
+        perror("profile");
+        timer_delete(timer);
+        sigaction(SIGPROF, &previous, NULL);
+        munmap(samples, PROFILE_SAMPLES * sizeof(struct sample));
+        samples = NULL;
+        return;
+    }
+    running = true;
+    fprintf(stderr, "profiling started\n");
+}
+
+static int same_stack(const void *a, const void *b)
+{
+    const struct sample *x = a;
+    const struct sample *y = b;
+    if (x->depth != y->depth)
+        return (x->depth > y->depth) - (x->depth < y->depth);
+    return memcmp(x->frames, y->frames, x->depth * sizeof(void *));
+}
+
+/*
+ * @brief: name a frame after its function, or after its object and offset
+ * in it for addr2line when the symbol is not exported
+ *
+ * @param returns: frame is a return address, which may be past the end of
+ * its function when a call ends it
+ */
+static void frame_name(void *frame, bool returns, char *name, size_t size)
+{
+    uintptr_t address = (uintptr_t)frame - returns;
+    Dl_info info;
+    if (!dladdr((void *)address, &info) || !info.dli_fname)
+        snprintf(name, size, "[unknown]");
+    else if (info.dli_sname)
+        snprintf(name, size, "%s", info.dli_sname);
+    else
+    {
+        const char *file = strrchr(info.dli_fname, '/');
+        snprintf(name, size, "%s+0x%" PRIxPTR,
+                 file ? file + 1 : info.dli_fname,
+                 address - (uintptr_t)info.dli_fbase);
+    }
+}
+
+/*
+ * @brief: append the line of a stack sampled count times to the profile
+ */
+static void write_stack(const struct sample *sample, size_t count)
+{
+    char line[PROFILE_LINE];
+    size_t len = 0;
+    for (size_t i = sample->depth; i-- > PROFILE_SKIP;)
+    {
+        char name[256];
+        frame_name(sample->frames[i], i > PROFILE_SKIP, name, sizeof(name));
+        size_t name_len = strlen(name);
+        // Room for the separator and the count
+        if (len + name_len + 32 > sizeof(line))
+            break;
+        if (len)
+            line[len++] = ';';
+        memcpy(line + len, name, name_len);
+        len += name_len;
+    }
+    if (!len)
+        return;
+    len += snprintf(line + len, sizeof(line) - len, " %zu\n", count);
+    ssize_t n;
+    do
+        n = write(profile_fd, line, len);
+    while (n < 0 && errno == EINTR);
+    if (n < 0)
+        perror("profile file");
+}
+
+static void stop(void)
+{
+    timer_delete(timer);
+    // Ignoring the signal discards the one which may still be pending
+    signal(SIGPROF, SIG_IGN);
+    sigaction(SIGPROF, &previous, NULL);
+    running = false;
+    size_t nb = nb_samples < PROFILE_SAMPLES ? nb_samples : PROFILE_SAMPLES;
+    qsort(samples, nb, sizeof(struct sample), same_stack);
+    for (size_t i = 0; i < nb;)
+    {
+        size_t j = i + 1;
+        while (j < nb && !same_stack(&samples[i], &samples[j]))
+            j++;
+        write_stack(&samples[i], j - i);
+        i = j;
+    }
+    fprintf(stderr, "profile of %zu samples written, %zu dropped\n", nb,
+            nb_samples - nb);
+    munmap(samples, PROFILE_SAMPLES * sizeof(struct sample));
+    samples = NULL;
+}
+
+void profile_toggle(void)
+{
+    if (profile_fd < 0)
+        fprintf(stderr, "no profile_file to write a profile to\n");
+    else if (running)
+        stop();
+    else
+        start();
+}
+
+void profile_destroy(void)
+{
+    if (running)
+        stop();
+    if (profile_fd >= 0)
+        close(profile_fd);
+    profile_fd = -1;
+}
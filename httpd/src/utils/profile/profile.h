@@ -0,0 +1,44 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+
+/*
+ * Samples taken per second of CPU time when the configuration sets no
+ * profile_frequency, off the multiples of 10 to stay clear of the timers of
+ * the server
+ */
+#define PROFILE_DEFAULT_FREQUENCY 99
+
+/*
+ * Samples a process holds per profile, the later ones being counted as
+ * dropped, and frames kept of each stack
+ */
+#define PROFILE_SAMPLES 16384
+#define PROFILE_DEPTH 32
+
+/*
+ * @brief: open the file the profiles are appended to. The processes forked
+ * afterwards share it, each writing whole lines.
+ *
+ * @param path: the profile file, NULL to leave the profiler off
+ * @param frequency: 0 for PROFILE_DEFAULT_FREQUENCY
+ *
+ * @return 0 on success, -1 on error
+ */
+int profile_init(const char *path, size_t frequency);
+
+/*
+ * @brief: start sampling the stack of the calling thread on SIGPROF, as it
+ * spends CPU time, or stop and append the stacks sampled to the profile
+ * file, one "outermost;...;innermost count" line per distinct stack, as
+ * flamegraph.pl reads them
+ */
+void profile_toggle(void);
+
+/*
+ * @brief: write the profile in progress, if any, and close the profile file
+ */
+void profile_destroy(void);
+
+#endif /*!PROFILE_H*/
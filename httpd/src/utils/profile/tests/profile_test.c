@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+
+#include <criterion/criterion.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../variables/variables.h"
+#include "../profile.h"
+
+TestSuite(profile);
+
+static char path[] = "/tmp/profile_testXXXXXX";
+
+static void handler(int signum)
+{
+    (void)signum;
+    ask_profile();
+}
+
+/*
+ * Spend about the given milliseconds of CPU time
+ */
+static void burn(long ms)
+{
+    volatile unsigned long sink = 0;
+    clock_t end = clock() + ms * (CLOCKS_PER_SEC / 1000);
+    while (clock() < end)
+        sink++;
+}
+
+/*
+ * Toggle the profiler as the event loop does after a SIGUSR1
+ */
+static void signal_toggle(void)
+{
+    cr_assert_eq(raise(SIGUSR1), 0);
+    cr_assert(take_profile());
+    profile_toggle();
+    cr_assert_not(take_profile());
+}
+
+static off_t file_size(void)
+{
+    struct stat st;
+    cr_assert_eq(stat(path, &st), 0);
+    return st.st_size;
+}
+
+Test(profile, asked_once)
+{
+    cr_assert_not(take_profile());
+    ask_profile();
+    ask_profile();
+    cr_assert(take_profile());
+    cr_assert_not(take_profile());
+}
+
+Test(profile, toggled_by_signal)
+{
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0);
+    close(fd);
+    signal(SIGUSR1, handler);
+    cr_assert_eq(profile_init(path, 999), 0);
+
+    signal_toggle();
+    burn(300);
+    // Nothing is written until the profiler is stopped
+    cr_assert_eq(file_size(), 0);
+    signal_toggle();
+    off_t size = file_size();
+    cr_assert_gt(size, 0);
+
+    // One "outermost;...;innermost count" line per stack
+    FILE *file = fopen(path, "r");
+    cr_assert_not_null(file);
+    char line[4096];
+    size_t total = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        cr_assert_eq(line[strlen(line) - 1], '\n');
+        char *count = strrchr(line, ' ');
+        cr_assert_not_null(count);
+        cr_assert_gt(count, line);
+        total += strtoul(count + 1, NULL, 10);
+    }
+    fclose(file);
+    cr_assert_gt(total, 0);
+
+    // Stopped, no more samples are taken
+    burn(100);
+    cr_assert_eq(file_size(), size);
+    profile_destroy();
+    cr_assert_eq(file_size(), size);
+    unlink(path);
+}
+
+Test(profile, no_profile_file)
+{
+    cr_assert_eq(profile_init(NULL, 0), 0);
+    profile_toggle();
+    burn(50);
+    profile_toggle();
+    profile_destroy();
+}
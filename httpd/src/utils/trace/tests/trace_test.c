@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+
+#include <criterion/criterion.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../../server/server.h"
+#include "../trace.h"
+
+TestSuite(trace);
+
+static char dir[] = "/tmp/trace_testXXXXXX";
+static char trace_path[sizeof(dir) + 8];
+
+static void setup(void)
+{
+    strcpy(dir, "/tmp/trace_testXXXXXX");
+    cr_assert_not_null(mkdtemp(dir));
+    sprintf(trace_path, "%s/trace", dir);
+}
+
+static void teardown(void)
+{
+    char command[128];
+    sprintf(command, "rm -rf %s", dir);
+    cr_assert_eq(system(command), 0);
+}
+
+/*
+ * Read the records of the trace file, waiting up to two seconds for nb of
+ * them to be written
+ */
+static void read_records(struct trace_record *records, size_t nb)
+{
+    struct stat st;
+    for (int i = 0; stat(trace_path, &st) || (size_t)st.st_size
+                                                 < nb * sizeof(*records);
+         i++)
+    {
+        cr_assert_lt(i, 100, "the records were not written");
+        usleep(20000);
+    }
+    cr_assert_eq((size_t)st.st_size, nb * sizeof(*records));
+    int fd = open(trace_path, O_RDONLY);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(read(fd, records, nb * sizeof(*records)),
+                 (ssize_t)(nb * sizeof(*records)));
+    close(fd);
+    for (size_t i = 0; i < nb; i++)
+    {
+        cr_assert_eq(records[i].magic, TRACE_MAGIC);
+        cr_assert_eq(records[i].version, TRACE_VERSION);
+        cr_assert_eq(records[i].nb_phases, TRACE_PHASES);
+    }
+}
+
+Test(trace, request_phases_in_order)
+{
+    setup();
+    char socket_path[sizeof(dir) + 2];
+    sprintf(socket_path, "%s/s", dir);
+    char path[256];
+    sprintf(path, "%s/index.html", dir);
+    FILE *file = fopen(path, "w");
+    cr_assert_not_null(file);
+    fputs("index", file);
+    fclose(file);
+    sprintf(path, "%s/httpd.cfg", dir);
+    file = fopen(path, "w");
+    cr_assert_not_null(file);
+    fprintf(file, "[global]\npid_file = %s/pid\ntrace_file = %s\n"
+                  "trace_sample = 1\n[[vhosts]]\nserver_name = a\n"
+                  "unix_socket = %s\nroot_dir = %s\n",
+            dir, trace_path, socket_path, dir);
+    fclose(file);
+    pid_t pid = fork();
+    if (!pid)
+    {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        struct config *config = parse_configuration(path);
+        int err = config ? basic_launch(config) : -1;
+        config_destroy(config);
+        _exit(err ? 1 : 0);
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    for (int i = 0; connect(fd, (struct sockaddr *)&addr, sizeof(addr)); i++)
+    {
+        cr_assert_lt(i, 100, "the server does not listen");
+        usleep(20000);
+    }
+    const char *request = "GET /index.html HTTP/1.1\r\nHost: a\r\n\r\n";
+    cr_assert_eq(send(fd, request, strlen(request), 0),
+                 (ssize_t)strlen(request));
+    char buf[512];
+    while (recv(fd, buf, sizeof(buf), 0) > 0)
+        continue;
+    close(fd);
+
+    struct trace_record record;
+    read_records(&record, 1);
+    kill(pid, SIGINT);
+    int status;
+    cr_assert_eq(waitpid(pid, &status, 0), pid);
+
+    // Every phase was reached, each one after the previous
+    cr_assert_eq(record.pid, (uint32_t)pid);
+    cr_assert_eq(record.reached, (1u << TRACE_PHASES) - 1);
+    for (size_t phase = 1; phase < TRACE_PHASES; phase++)
+        cr_assert_geq(record.offsets[phase], record.offsets[phase - 1]);
+    cr_assert_eq(record.values[TRACE_FIRST_BYTE], (int64_t)strlen(request));
+    cr_assert_eq(record.values[TRACE_RESOLVED], 200);
+    cr_assert_eq(record.values[TRACE_HEADERS_SENT], 200);
+    cr_assert_eq(record.values[TRACE_BODY_SENT], 200);
+    teardown();
+}
+
+Test(trace, one_of_sample)
+{
+    setup();
+    cr_assert_eq(trace_init(trace_path, 3), 0);
+    for (int64_t i = 1; i <= 6; i++)
+    {
+        trace_phase(TRACE_ACCEPT, i);
+        trace_phase(TRACE_PARSED, i);
+        // Only the first time a phase is reached is noted
+        trace_phase(TRACE_PARSED, -i);
+        trace_end();
+    }
+    trace_destroy();
+
+    struct trace_record records[2];
+    read_records(records, 2);
+    cr_assert_eq(records[0].id, 3);
+    cr_assert_eq(records[1].id, 6);
+    for (size_t i = 0; i < 2; i++)
+    {
+        cr_assert_eq(records[i].reached,
+                     1u << TRACE_ACCEPT | 1u << TRACE_PARSED);
+        cr_assert_eq(records[i].values[TRACE_PARSED], (int64_t)(3 + 3 * i));
+    }
+    teardown();
+}
+
+Test(trace, suspended_while_another_is_traced)
+{
+    setup();
+    cr_assert_eq(trace_init(trace_path, 1), 0);
+    struct trace_timeline waiting;
+    trace_phase(TRACE_ACCEPT, 1);
+    trace_phase(TRACE_FIRST_BYTE, 10);
+    trace_suspend(&waiting);
+    trace_phase(TRACE_ACCEPT, 2);
+    trace_phase(TRACE_FIRST_BYTE, 20);
+    trace_end();
+    trace_resume(&waiting);
+    trace_phase(TRACE_PARSED, 1);
+    trace_end();
+    trace_destroy();
+
+    // The second request ended first, the first one kept its phases
+    struct trace_record records[2];
+    read_records(records, 2);
+    cr_assert_eq(records[0].id, 2);
+    cr_assert_eq(records[0].values[TRACE_FIRST_BYTE], 20);
+    cr_assert_eq(records[1].id, 1);
+    cr_assert_eq(records[1].reached, 1u << TRACE_ACCEPT
+                                         | 1u << TRACE_FIRST_BYTE
+                                         | 1u << TRACE_PARSED);
+    cr_assert_eq(records[1].values[TRACE_FIRST_BYTE], 10);
+    cr_assert_geq(records[1].offsets[TRACE_PARSED],
+                  records[1].offsets[TRACE_FIRST_BYTE]);
+    teardown();
+}
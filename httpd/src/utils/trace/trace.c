@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The probes are nops in the binary, until bpftrace or perf attach to them
+#if defined(__has_include)
+#    if __has_include(<sys/sdt.h>)
+#        include <sys/sdt.h>
+#        define TRACE_PROBE(name, id, value)                                   \
+            DTRACE_PROBE2(httpd, name, id, value)
+#    endif
+#endif
+#ifndef TRACE_PROBE
+#    define TRACE_PROBE(name, id, value) ((void)(id), (void)(value))
+#endif
+
+static int trace_fd = -1;
+static size_t sample = TRACE_DEFAULT_SAMPLE;
+
+static uint64_t count = 0;
+static struct trace_timeline current;
+
+static uint64_t now(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int trace_init(const char *path, size_t trace_sample)
+{
+    sample = trace_sample ? trace_sample : TRACE_DEFAULT_SAMPLE;
+    if (!path)
+        return 0;
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (trace_fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * @brief: fire the probe of a phase, their names having to be spelled out
+ */
+static void probe(enum trace_phase phase, uint64_t id, int64_t value)
+{
+    switch (phase)
+    {
+    case TRACE_ACCEPT:
+        TRACE_PROBE(accept, id, value);
+        break;
+    case TRACE_FIRST_BYTE:
+        TRACE_PROBE(first_byte, id, value);
+        break;
+    case TRACE_PARSED:
+        TRACE_PROBE(parsed, id, value);
+        break;
+    case TRACE_RESOLVED:
+        TRACE_PROBE(resolved, id, value);
+        break;
+    case TRACE_HEADERS_SENT:
+        TRACE_PROBE(headers_sent, id, value);
+        break;
+    case TRACE_BODY_SENT:
+        TRACE_PROBE(body_sent, id, value);
+        break;
+    default:
+        break;
+    }
+}
+
+void trace_phase(enum trace_phase phase, int64_t value)
+{
+    if (phase == TRACE_ACCEPT)
+    {
+        current.id = ++count;
+        current.sampled = trace_fd >= 0 && count % sample == 0;
+        if (current.sampled)
+        {
+            struct trace_record *record = &current.record;
+            memset(record, 0, sizeof(*record));
+            record->magic = TRACE_MAGIC;
+            record->version = TRACE_VERSION;
+            record->nb_phases = TRACE_PHASES;
+            record->pid = getpid();
+            record->id = count;
+            record->start = now(CLOCK_REALTIME);
+            current.accepted = now(CLOCK_MONOTONIC);
+        }
+    }
+    probe(phase, current.id, value);
+    struct trace_record *record = &current.record;
+    if (!current.sampled || phase >= TRACE_PHASES
+        || record->reached & (1u << phase))
+        return;
+    record->reached |= 1u << phase;
+    record->offsets[phase] = now(CLOCK_MONOTONIC) - current.accepted;
+    record->values[phase] = value;
+}
+
+void trace_end(void)
+{
+    if (!current.sampled)
+        return;
+    current.sampled = false;
+    ssize_t n;
+    do
+        n = write(trace_fd, &current.record, sizeof(current.record));
+    while (n < 0 && errno == EINTR);
+    if (n != sizeof(current.record))
+    {
+        perror("trace file, tracing stopped");
+        trace_destroy();
+    }
+}
+
+void trace_suspend(struct trace_timeline *timeline)
+{
+    *timeline = current;
+    current.sampled = false;
+}
+
+void trace_resume(const struct trace_timeline *timeline)
+{
+    current = *timeline;
+}
+
+void trace_destroy(void)
+{
+    if (trace_fd >= 0)
+        close(trace_fd);
+    trace_fd = -1;
+    current.sampled = false;
+}
@@ -0,0 +1,115 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * One request of TRACE_DEFAULT_SAMPLE is written to the trace file when the
+ * configuration sets no trace_sample
+ */
+#define TRACE_DEFAULT_SAMPLE 100
+
+/*
+ * First field of each record, "HTTR" in the byte order of the server
+ */
+#define TRACE_MAGIC 0x48545452
+#define TRACE_VERSION 1
+
+/*
+ * The phases of a request, each one a USDT probe of the httpd provider with
+ * the id of the request and the value given to trace_phase() as arguments:
+ * - accept: the client socket
+ * - first_byte: the bytes of the first read
+ * - parsed: the method, at the end of parse_request()
+ * - resolved: the status, once create_response() looked the file up
+ * - headers_sent: the status, the head being handed to the connection, with
+ *   the start of the body when both leave in one call
+ * - body_sent: the status, once respond() sent the whole response
+ */
+enum trace_phase
+{
+    TRACE_ACCEPT = 0,
+    TRACE_FIRST_BYTE,
+    TRACE_PARSED,
+    TRACE_RESOLVED,
+    TRACE_HEADERS_SENT,
+    TRACE_BODY_SENT,
+    TRACE_PHASES
+};
+
+/*
+ * @brief: timeline of a sampled request, as written to the trace file
+ *
+ * @param reached: bit (1 << phase) of each phase the request went through
+ * @param id: number of the request in its process, as given to the probes
+ * @param start: CLOCK_REALTIME of the accept, in nanoseconds
+ * @param offsets: nanoseconds from the accept to each phase reached
+ * @param values: value of each phase reached
+ */
+struct trace_record
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t nb_phases;
+    uint32_t pid;
+    uint32_t reached;
+    uint64_t id;
+    uint64_t start;
+    uint64_t offsets[TRACE_PHASES];
+    int64_t values[TRACE_PHASES];
+};
+
+/*
+ * @brief: the state of a request being traced
+ */
+struct trace_timeline
+{
+    bool sampled;
+    uint64_t id;
+    uint64_t accepted;
+    struct trace_record record;
+};
+
+/*
+ * @brief: open the trace file, to which the timeline of one request out of
+ * sample is appended. The processes forked afterwards share it, each record
+ * being written at once.
+ *
+ * @param path: the trace file, NULL to only fire the probes
+ * @param sample: 0 for TRACE_DEFAULT_SAMPLE
+ *
+ * @return 0 on success, -1 on error
+ */
+int trace_init(const char *path, size_t sample);
+
+/*
+ * @brief: fire the probe of a phase of the current request, and note when
+ * it was reached if the request is sampled. TRACE_ACCEPT starts a request,
+ * only the first time each other phase is reached being noted.
+ */
+void trace_phase(enum trace_phase phase, int64_t value);
+
+/*
+ * @brief: end the current request, writing its timeline if it is sampled
+ */
+void trace_end(void);
+
+/*
+ * @brief: set the current request aside while it waits, for another one to
+ * be traced meanwhile
+ */
+void trace_suspend(struct trace_timeline *timeline);
+
+/*
+ * @brief: make a request set aside the current one again
+ */
+void trace_resume(const struct trace_timeline *timeline);
+
+/*
+ * @brief: close the trace file
+ */
+void trace_destroy(void);
+
+#endif /*!TRACE_H*/
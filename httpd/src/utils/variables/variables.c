@@ -1,6 +1,10 @@
 #include "variables.h"
 
+#include <signal.h>
+
 int run = 1;
+static volatile sig_atomic_t reload = 0;
+static volatile sig_atomic_t profile = 0;
 
 void unset(void)
 {
@@ -16,3 +20,27 @@ int return_run(void)
 {
     return run;
 }
+
+void ask_reload(void)
+{
+    reload = 1;
+}
+
+int take_reload(void)
+{
+    int asked = reload;
+    reload = 0;
+    return asked;
+}
+
+void ask_profile(void)
+{
+    profile = 1;
+}
+
+int take_profile(void)
+{
+    int asked = profile;
+    profile = 0;
+    return asked;
+}
@@ -9,4 +9,26 @@ void unset(void);
 
 int return_run(void);
 
+/*
+ * @brief: ask the server to read its error pages and the locations of its
+ * vhosts again, from a signal handler, the file cache being flushed when
+ * the locations changed
+ */
+void ask_reload(void);
+
+/*
+ * @brief: return 1 once after a reload was asked, 0 otherwise
+ */
+int take_reload(void);
+
+/*
+ * @brief: ask the server to start or stop profiling, from a signal handler
+ */
+void ask_profile(void);
+
+/*
+ * @brief: return 1 once after profiling was toggled, 0 otherwise
+ */
+int take_profile(void);
+
 #endif /*!VARIABLES_H*/